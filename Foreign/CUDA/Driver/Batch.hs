@@ -0,0 +1,319 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Batch
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Dynamic batching of small, repeated kernel invocations.
+--
+-- When the same small kernel is executed once for every incoming request
+-- (for example, a sparse-matrix vector multiply per query), the cost of the
+-- launch and its memory transfers dominates. A 'Batcher' instead collects
+-- requests until either a size limit is reached or the oldest request has
+-- waited for the configured delay, packs the inputs of all requests
+-- contiguously, and executes a single launch over the whole batch. The
+-- results are then scattered back to a 'Future' for each request.
+--
+-- The kernel is given the packed input and output arrays, together with the
+-- offset of each request's segment within them (see 'Batch'). It must
+-- therefore be written to process a variable number of independent
+-- segments, in the same manner as a segmented fold or scan.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Batch (
+
+  -- * Batching
+  Batcher, Config(..), Batch(..), Stats(..),
+  defaultConfig,
+  new, submit, stats, shutdown,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Context.Base                 ( Context )
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.Future                       ( Future )
+import Foreign.CUDA.Driver.Stream                       ( Stream )
+import Foreign.CUDA.Internal.Clock
+import qualified Foreign.CUDA.Driver.Context.Base       as Context
+import qualified Foreign.CUDA.Driver.Future             as Future
+import qualified Foreign.CUDA.Driver.Marshal            as Marshal
+import qualified Foreign.CUDA.Driver.Stream             as Stream
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.Foldable                                    ( toList )
+import Data.IORef
+import Data.Int
+import Data.Sequence                                    ( Seq, ViewL(..), (|>) )
+import Data.Word
+import Foreign                                          ( Storable, advancePtr, peekArray, pokeArray )
+import System.Timeout
+import Prelude
+import qualified Data.Sequence                          as Seq
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- Batching limits
+--
+data Config = Config
+  { configMaxRequests   :: !Int         -- ^ maximum number of requests in a batch
+  , configMaxInput      :: !Int         -- ^ maximum number of input elements in a batch
+  , configMaxOutput     :: !Int         -- ^ maximum number of output elements in a batch
+  , configMaxDelay      :: !Int         -- ^ maximum time (microseconds) a request waits for others to join its batch
+  }
+  deriving Show
+
+-- |
+-- Batches of up to 256 requests and 1M input and output elements, waiting
+-- at most 200 microseconds.
+--
+defaultConfig :: Config
+defaultConfig = Config 256 1048576 1048576 200
+
+
+-- |
+-- The arguments to a batched launch. The input (output) of request @i@
+-- occupies the elements @[off!!i, off!!(i+1))@ of the packed input (output)
+-- array, where the offset arrays have 'batchCount' + 1 entries.
+--
+data Batch a b = Batch
+  { batchCount          :: !Int
+  , batchInput          :: !(DevicePtr a)
+  , batchInputOffsets   :: !(DevicePtr Int32)
+  , batchOutput         :: !(DevicePtr b)
+  , batchOutputOffsets  :: !(DevicePtr Int32)
+  }
+
+-- |
+-- Batching statistics since the batcher was created
+--
+data Stats = Stats
+  { statsBatches        :: !Int         -- ^ number of launches issued
+  , statsRequests       :: !Int         -- ^ number of requests completed
+  , statsBatchFactor    :: !Double      -- ^ average number of requests per launch
+  , statsMeanLatency    :: !Double      -- ^ average time (seconds) a request waited in the queue
+  , statsMaxLatency     :: !Double      -- ^ longest time (seconds) a request waited in the queue
+  }
+  deriving Show
+
+-- |
+-- A batching front-end to a single kernel
+--
+data Batcher a b = Batcher
+  { batcherConfig       :: !Config
+  , batcherQueue        :: !(MVar (Seq (Request a b)))
+  , batcherSignal       :: !(MVar ())
+  , batcherClosed       :: !(IORef Bool)
+  , batcherDone         :: !(MVar ())
+  , batcherStats        :: !(IORef Counters)
+  }
+
+data Request a b = Request
+  { requestInput        :: [a]
+  , requestInputLen     :: !Int
+  , requestOutputLen    :: !Int
+  , requestArrival      :: !Word64
+  , requestResult       :: !(Future [b])
+  }
+
+data Counters = Counters !Int !Int !Double !Double
+
+
+--------------------------------------------------------------------------------
+-- Batching
+--------------------------------------------------------------------------------
+
+-- |
+-- Create a new batcher executing in the given context. The function is
+-- called with the packed arguments of each batch, and should launch the
+-- kernel into the given stream.
+--
+-- The batch is executed by a bound worker thread, so the program must be
+-- linked with the threaded runtime.
+--
+{-# INLINEABLE new #-}
+new :: (Storable a, Storable b) => Context -> Config -> (Batch a b -> Stream -> IO ()) -> IO (Batcher a b)
+new !ctx !config launch = do
+  queue  <- newMVar Seq.empty
+  signal <- newEmptyMVar
+  closed <- newIORef False
+  done   <- newEmptyMVar
+  counts <- newIORef (Counters 0 0 0 0)
+  let b = Batcher config queue signal closed done counts
+  _      <- forkOS $ do
+    r <- try (Context.push ctx >> worker b launch)
+    abandon b (either id (const closedError) r) `finally` putMVar done ()
+  return b
+
+
+-- |
+-- Submit a request with the given input, whose result has the given number
+-- of elements. If the worker thread has died, the future fails with the
+-- exception which killed it.
+--
+{-# INLINEABLE submit #-}
+submit :: Batcher a b -> [a] -> Int -> IO (Future [b])
+submit !b !xs !m = do
+  let !n = length xs
+  when (n > configMaxInput (batcherConfig b) || m > configMaxOutput (batcherConfig b)) $
+    cudaError "Batch.submit: request exceeds the batch size limit"
+  --
+  f  <- Future.new
+  t0 <- getTime
+  modifyMVar_ (batcherQueue b) $ \q -> do
+    closed <- readIORef (batcherClosed b)
+    when closed $ throwIO closedError
+    return (q |> Request xs n m t0 f)
+  _  <- tryPutMVar (batcherSignal b) ()
+  return f
+
+
+-- |
+-- The batching factor and queueing latency observed so far
+--
+{-# INLINEABLE stats #-}
+stats :: Batcher a b -> IO Stats
+stats !b = do
+  Counters batches requests total worst <- readIORef (batcherStats b)
+  return $ Stats
+    { statsBatches      = batches
+    , statsRequests     = requests
+    , statsBatchFactor  = if batches  == 0 then 0 else fromIntegral requests / fromIntegral batches
+    , statsMeanLatency  = if requests == 0 then 0 else total / fromIntegral requests
+    , statsMaxLatency   = worst
+    }
+
+
+-- |
+-- Execute all outstanding requests and stop the worker thread. Further
+-- requests are rejected.
+--
+{-# INLINEABLE shutdown #-}
+shutdown :: Batcher a b -> IO ()
+shutdown !b = do
+  withMVar (batcherQueue b) $ \_ -> writeIORef (batcherClosed b) True
+  _ <- tryPutMVar (batcherSignal b) ()
+  readMVar (batcherDone b)
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Once the worker thread has stopped, for whatever reason, fail the requests
+-- still in the queue and reject any submitted later. The closed flag is only
+-- changed while holding the queue, so no request can slip in afterwards.
+--
+abandon :: Batcher a b -> SomeException -> IO ()
+abandon !b !e = do
+  rs <- modifyMVar (batcherQueue b) $ \q -> do
+    writeIORef (batcherClosed b) True
+    return (Seq.empty, q)
+  forM_ (toList rs) $ \r -> Future.putException (requestResult r) e
+
+closedError :: SomeException
+closedError = toException (UserError "Batch.submit: batcher has been shut down")
+
+
+-- The worker thread. Device and page-locked staging buffers are allocated
+-- once, at the maximum batch size, and reused for every batch.
+--
+worker :: (Storable a, Storable b) => Batcher a b -> (Batch a b -> Stream -> IO ()) -> IO ()
+worker !b launch =
+  bracket (Stream.create [])                          Stream.destroy   $ \st    ->
+  bracket (Marshal.mallocArray maxIn)                 Marshal.free     $ \dIn   ->
+  bracket (Marshal.mallocArray maxOut)                Marshal.free     $ \dOut  ->
+  bracket (Marshal.mallocArray (2 * (maxReq+1)))      Marshal.free     $ \dOffs ->
+  bracket (Marshal.mallocHostArray [] maxIn)          Marshal.freeHost $ \hIn   ->
+  bracket (Marshal.mallocHostArray [] maxOut)         Marshal.freeHost $ \hOut  ->
+  bracket (Marshal.mallocHostArray [] (2*(maxReq+1))) Marshal.freeHost $ \hOffs ->
+    let
+        go = do
+          batch <- collect
+          unless (null batch) $ do
+            execute st dIn dOut dOffs hIn hOut hOffs batch
+            go
+    in go
+  where
+    config = batcherConfig b
+    maxReq = configMaxRequests config
+    maxIn  = configMaxInput config
+    maxOut = configMaxOutput config
+    delay  = fromIntegral (configMaxDelay config) * 1000
+
+    -- Wait for the first request, then for the batch to fill up or the
+    -- first request's deadline to pass. Returns an empty batch once the
+    -- batcher has been shut down and the queue drained.
+    collect = do
+      takeMVar (batcherSignal b)
+      (q, closed) <- snapshot
+      case Seq.viewl q of
+        EmptyL | closed    -> return []
+               | otherwise -> collect
+        r :< _             -> fill (requestArrival r + delay)
+
+    fill deadline = do
+      (q, closed) <- snapshot
+      now         <- getTime
+      let (batch, rest) = split q
+      if closed || not (Seq.null rest) || Seq.length batch >= maxReq || now >= deadline
+        then do
+          modifyMVar_ (batcherQueue b) (return . Seq.drop (Seq.length batch))
+          when (closed || not (Seq.null rest)) $ void (tryPutMVar (batcherSignal b) ())
+          return (toList batch)
+        else do
+          _ <- timeout (fromIntegral ((deadline - now) `div` 1000) + 1) (takeMVar (batcherSignal b))
+          fill deadline
+
+    -- The queue, and whether the batcher has been shut down, read together
+    snapshot = withMVar (batcherQueue b) $ \q -> do
+      closed <- readIORef (batcherClosed b)
+      return (q, closed)
+
+    -- The longest prefix of the queue which fits within the limits
+    split q = go 0 0 0 Seq.empty q
+      where
+        go !k !i !o !acc rs =
+          case Seq.viewl rs of
+            r :< rs' | k < maxReq
+                     , i + requestInputLen r  <= maxIn
+                     , o + requestOutputLen r <= maxOut
+                     -> go (k+1) (i + requestInputLen r) (o + requestOutputLen r) (acc |> r) rs'
+            _        -> (acc, rs)
+
+    execute st dIn dOut dOffs hIn hOut hOffs rs = do
+      let !n       = length rs
+          inOffs   = scanl (+) 0 (map requestInputLen rs)
+          outOffs  = scanl (+) 0 (map requestOutputLen rs)
+          !nIn     = last inOffs
+          !nOut    = last outOffs
+          dInOffs  = dOffs
+          dOutOffs = dOffs `advanceDevPtr` (n+1)
+      --
+      t <- getTime
+      modifyIORef' (batcherStats b) $ \(Counters batches requests total worst) ->
+        let ls = [ elapsed (requestArrival r) t | r <- rs ]
+        in  Counters (batches+1) (requests+n) (total + sum ls) (maximum (worst:ls))
+      --
+      r <- try $ do
+        pokeArray (useHostPtr hIn) (concatMap requestInput rs)
+        pokeArray (useHostPtr hOffs) (map fromIntegral (inOffs ++ outOffs) :: [Int32])
+        Marshal.pokeArrayAsync nIn hIn dIn (Just st)
+        Marshal.pokeArrayAsync (2*(n+1)) hOffs dOffs (Just st)
+        launch (Batch n dIn dInOffs dOut dOutOffs) st
+        Marshal.peekArrayAsync nOut dOut hOut (Just st)
+        Stream.block st
+      case r of
+        Left e   -> forM_ rs $ \x -> Future.putException (requestResult x) (e :: SomeException)
+        Right () -> forM_ (zip rs outOffs) $ \(x, o) ->
+          Future.put (requestResult x) =<< peekArray (requestOutputLen x) (useHostPtr hOut `advancePtr` o)
@@ -0,0 +1,219 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Counters
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Process-wide counters of driver activity, which are always on.
+--
+-- Every completed memory transfer, allocation, kernel launch,
+-- synchronisation, and stream, event and module operation made through these
+-- bindings is counted, together with the number of bytes it transferred or
+-- allocated. Transfers are counted separately for each direction, and for
+-- synchronous and asynchronous calls (for example 'MemcpyHtoD' and
+-- 'MemcpyHtoDAsync'). The number of bytes of live device, page-locked host
+-- and managed memory are tracked together with their high-water marks, as
+-- are the launches of each kernel.
+--
+-- Counters are cumulative; take the 'delta' between two snapshots to find
+-- the activity over an interval, and divide by 'elapsed' for a rate.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Counters (
+
+  -- * Counters
+  Counters(..), Usage(..), Memory(..), API(..), Kind(..),
+  snapshot, delta, elapsed, calls, bytes,
+
+  -- * Export
+  prometheus, dump,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Internal.Clock                      ( getTime )
+import Foreign.CUDA.Internal.Counters
+import Foreign.CUDA.Internal.Histogram                  ( kernelName )
+import Foreign.CUDA.Internal.Trace                      ( API(..), apiName )
+
+-- System
+import Control.Concurrent
+import Control.Monad
+import Data.Map                                         ( Map )
+import Data.Word
+import Foreign.Marshal                                  ( allocaArray, peekArray )
+import Foreign.Ptr
+import System.Directory                                 ( renameFile )
+import Text.Printf
+import Prelude
+import qualified Data.Map                               as Map
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- A snapshot of the counters
+--
+data Counters = Counters
+  { countersTime        :: !Word64                      -- ^ when the snapshot was taken (nanoseconds, monotonic)
+  , countersAPI         :: Map API Usage                -- ^ calls made to each driver operation
+  , countersMemory      :: Map Kind Memory              -- ^ live memory of each kind
+  , countersLaunches    :: Map String Word64            -- ^ launches of each kernel
+  }
+  deriving Show
+
+-- |
+-- The number of completed calls to a driver operation, and the bytes they
+-- transferred or allocated
+--
+data Usage = Usage
+  { usageCalls          :: !Word64
+  , usageBytes          :: !Word64
+  }
+  deriving (Eq, Show)
+
+-- |
+-- Live bytes of a kind of memory, and the most there have ever been
+--
+data Memory = Memory
+  { memoryLive          :: !Word64
+  , memoryPeak          :: !Word64
+  }
+  deriving (Eq, Show)
+
+
+--------------------------------------------------------------------------------
+-- Counters
+--------------------------------------------------------------------------------
+
+-- |
+-- Read the current value of every counter. Kernels are identified by the
+-- name they were looked up with ('Foreign.CUDA.Driver.Module.getFun'), or
+-- otherwise by their address; launches of kernels beyond the number which
+-- are counted individually are counted together under the name @\<other\>@.
+--
+{-# INLINEABLE snapshot #-}
+snapshot :: IO Counters
+snapshot = do
+  t  <- getTime
+  ws <- allocaArray (2 * apis + 2 * kinds) $ \p -> do
+          hs_counters_read p
+          peekArray (2 * apis + 2 * kinds) p
+  ks <- allocaArray (2 * (maxKernels + 1)) $ \p -> do
+          n <- fromIntegral `fmap` hs_counters_launches p
+          peekArray (2 * n) p
+  ls <- forM (pairs ks) $ \(fn, c) -> do
+          name <- kernel fn
+          return (name, c)
+  let
+      (us, ms) = splitAt apis (pairs ws)
+      api      = Map.fromList [ (a, uncurry Usage u) | (a, u) <- zip [minBound .. maxBound] us ]
+      memory   = Map.fromList [ (k, uncurry Memory m) | (k, m) <- zip [minBound .. maxBound] ms ]
+  --
+  return $! Counters t api memory (Map.fromListWith (+) ls)
+  where
+    apis  = maxAPIs
+    kinds = memoryKinds
+
+    pairs (x:y:zs) = (x,y) : pairs zs
+    pairs _        = []
+
+    kernel 0  = return "<other>"
+    kernel fn = do
+      let p = wordPtrToPtr (fromIntegral fn)
+      k <- kernelName p
+      return (maybe (printf "<%s>" (show p)) id k)
+
+
+-- |
+-- The activity between two snapshots, the earlier given first. Live memory
+-- and high-water marks are those of the later snapshot.
+--
+delta :: Counters -> Counters -> Counters
+delta old new =
+  Counters { countersTime     = countersTime new - countersTime old
+           , countersAPI      = Map.mapWithKey (\k u -> maybe u (minus u) (Map.lookup k (countersAPI old))) (countersAPI new)
+           , countersMemory   = countersMemory new
+           , countersLaunches = Map.mapWithKey (\k n -> maybe n (n -) (Map.lookup k (countersLaunches old))) (countersLaunches new)
+           }
+  where
+    minus (Usage c1 b1) (Usage c0 b0) = Usage (c1 - c0) (b1 - b0)
+
+-- |
+-- The time (seconds) covered by the 'delta' of two snapshots
+--
+elapsed :: Counters -> Double
+elapsed c = fromIntegral (countersTime c) * 1.0e-9
+
+-- |
+-- The number of calls made to the given driver operation
+--
+calls :: API -> Counters -> Word64
+calls api c = maybe 0 usageCalls (Map.lookup api (countersAPI c))
+
+-- |
+-- The number of bytes transferred or allocated by the given driver operation
+--
+bytes :: API -> Counters -> Word64
+bytes api c = maybe 0 usageBytes (Map.lookup api (countersAPI c))
+
+
+--------------------------------------------------------------------------------
+-- Export
+--------------------------------------------------------------------------------
+
+-- |
+-- Render a snapshot in the Prometheus text exposition format
+--
+prometheus :: Counters -> String
+prometheus c = unlines $ concat
+  [ metric "cuda_api_calls_total" "counter" "Completed driver calls"
+      [ (label "api" (apiName a), usageCalls u) | (a, u) <- Map.toList (countersAPI c) ]
+  , metric "cuda_api_bytes_total" "counter" "Bytes transferred or allocated by driver calls"
+      [ (label "api" (apiName a), usageBytes u) | (a, u) <- Map.toList (countersAPI c) ]
+  , metric "cuda_memory_live_bytes" "gauge" "Bytes of live memory allocations"
+      [ (label "kind" (kind k), memoryLive m) | (k, m) <- Map.toList (countersMemory c) ]
+  , metric "cuda_memory_peak_bytes" "gauge" "Largest number of bytes of live memory allocations"
+      [ (label "kind" (kind k), memoryPeak m) | (k, m) <- Map.toList (countersMemory c) ]
+  , metric "cuda_kernel_launches_total" "counter" "Kernel launches"
+      [ (label "kernel" k, n) | (k, n) <- Map.toList (countersLaunches c) ]
+  ]
+  where
+    metric name typ help samples =
+        printf "# HELP %s %s" name help
+      : printf "# TYPE %s %s" name typ
+      : [ printf "%s{%s} %d" name l v | (l, v) <- samples ]
+
+    label :: String -> String -> String
+    label k v = k ++ "=\"" ++ concatMap escape v ++ "\""
+
+    escape '"'  = "\\\""
+    escape '\\' = "\\\\"
+    escape '\n' = "\\n"
+    escape x    = [x]
+
+    kind DeviceMemory  = "device"
+    kind HostMemory    = "host"
+    kind ManagedMemory = "managed"
+
+
+-- |
+-- Write a snapshot to the given file in the Prometheus text format every
+-- given number of microseconds, for collection by the node exporter's
+-- textfile collector. The file is replaced atomically. Kill the returned
+-- thread to stop.
+--
+{-# INLINEABLE dump #-}
+dump :: Int -> FilePath -> IO ThreadId
+dump !interval !path =
+  forkIO . forever $ do
+    c <- snapshot
+    writeFile tmp (prometheus c)
+    renameFile tmp path
+    threadDelay interval
+  where
+    tmp = path ++ ".tmp"
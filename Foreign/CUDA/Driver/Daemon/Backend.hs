@@ -0,0 +1,236 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Daemon.Backend
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Execution backends for the GPU owning daemon.
+--
+-- A backend implements the small subset of the driver API which the daemon
+-- forwards on behalf of its clients. Device pointers, modules, and functions
+-- are passed as opaque machine words, so that they can be sent over the
+-- wire unchanged. Every client is given its own stream, and the daemon only
+-- waits on streams after issuing a whole batch of commands.
+--
+-- Three backends are provided: 'driverBackend' executes commands in a CUDA
+-- context, while 'hostBackend' executes them in host memory, using kernels
+-- implemented in Haskell. The latter allows the daemon and its clients to be
+-- exercised on machines without a GPU. Finally, 'nullBackend' executes
+-- nothing at all, which measures the cost of issuing the commands (see
+-- "Foreign.CUDA.Driver.Replay").
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Daemon.Backend (
+
+  -- * Backends
+  Backend(..), HostKernel,
+  driverBackend, hostBackend, nullBackend,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Context.Base                 ( Context )
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.Exec                         ( Fun(..), FunParam(..) )
+import Foreign.CUDA.Driver.Module.Base                  ( Module(..) )
+import Foreign.CUDA.Driver.Stream                       ( Stream(..) )
+import qualified Foreign.CUDA.Driver.Context.Base       as Context
+import qualified Foreign.CUDA.Driver.Exec               as Exec
+import qualified Foreign.CUDA.Driver.Marshal            as Marshal
+import qualified Foreign.CUDA.Driver.Module.Base        as Module
+import qualified Foreign.CUDA.Driver.Module.Query       as Module
+import qualified Foreign.CUDA.Driver.Stream             as Stream
+
+-- System
+import Control.Monad
+import Data.IORef
+import Data.List                                        ( findIndex )
+import Foreign
+import Prelude
+
+
+-- |
+-- The operations the daemon requires of an execution engine. All operations
+-- are executed on a single, bound, thread, after 'backendInit'.
+--
+-- Operations taking a 'Stream' may complete asynchronously; host memory
+-- passed to them remains valid until 'backendBlock' has been called on that
+-- stream.
+--
+data Backend = Backend
+  { backendInit         :: IO ()
+  , backendNewStream    :: IO Stream
+  , backendFreeStream   :: Stream -> IO ()
+  , backendRegister     :: Ptr Word8 -> Int -> IO ()
+  , backendUnregister   :: Ptr Word8 -> IO ()
+  , backendMalloc       :: Int -> IO WordPtr
+  , backendFree         :: WordPtr -> IO ()
+  , backendPoke         :: Int -> Ptr Word8 -> WordPtr -> Stream -> IO ()
+  , backendPeek         :: Int -> WordPtr -> Ptr Word8 -> Stream -> IO ()
+  , backendCopy         :: Int -> WordPtr -> WordPtr -> Stream -> IO ()
+  , backendMemset       :: WordPtr -> Int -> Int -> Word32 -> Stream -> IO ()
+  , backendLoad         :: FilePath -> IO WordPtr
+  , backendGetFun       :: WordPtr -> String -> IO WordPtr
+  , backendLaunch       :: WordPtr -> (Int,Int,Int) -> (Int,Int,Int) -> Int -> Stream -> [(Int, Ptr ())] -> IO ()
+  , backendBlock        :: Stream -> IO ()
+  }
+
+
+-- |
+-- A kernel executed by the host backend. It is given the grid and thread
+-- block dimensions, and a pointer to each of the kernel parameters, in the
+-- same manner as @cuLaunchKernel@. Device pointers are ordinary host
+-- addresses.
+--
+type HostKernel = (Int,Int,Int) -> (Int,Int,Int) -> [Ptr ()] -> IO ()
+
+
+--------------------------------------------------------------------------------
+-- Driver backend
+--------------------------------------------------------------------------------
+
+-- |
+-- Execute commands in the given context. The context is made current on the
+-- executing thread by 'backendInit'.
+--
+{-# INLINEABLE driverBackend #-}
+driverBackend :: Context -> Backend
+driverBackend !ctx = Backend
+  { backendInit         = Context.push ctx
+  , backendNewStream    = Stream.create []
+  , backendFreeStream   = Stream.destroy
+  , backendRegister     = \p n -> void (Marshal.registerArray [] n p)
+  , backendUnregister   = \p   -> void (Marshal.unregisterArray (HostPtr p))
+  , backendMalloc       = \n   -> devPtrToWordPtr `fmap` (Marshal.mallocArray n :: IO (DevicePtr Word8))
+  , backendFree         = \d   -> Marshal.free (wordPtrToDevPtr d :: DevicePtr Word8)
+  , backendPoke         = \n p d st -> Marshal.pokeArrayAsync n (HostPtr p) (wordPtrToDevPtr d) (Just st)
+  , backendPeek         = \n d p st -> Marshal.peekArrayAsync n (wordPtrToDevPtr d) (HostPtr p) (Just st)
+  , backendCopy         = \n s d st -> Marshal.copyArrayAsync n (wordPtrToDevPtr s :: DevicePtr Word8) (wordPtrToDevPtr d) (Just st)
+  , backendMemset       = memsetD
+  , backendLoad         = \f   -> (ptrToWordPtr . useModule) `fmap` Module.loadFile f
+  , backendGetFun       = \m s -> (ptrToWordPtr . useFun) `fmap` Module.getFun (Module (wordPtrToPtr m)) s
+  , backendLaunch       = \f g b sm st args ->
+      Exec.launchKernel (Fun (wordPtrToPtr f)) g b sm (Just st) [ VArg (RawArg n p) | (n,p) <- args ]
+  , backendBlock        = Stream.block
+  }
+  where
+    memsetD :: WordPtr -> Int -> Int -> Word32 -> Stream -> IO ()
+    memsetD !d !n !width !v !st =
+      case width of
+        1 -> Marshal.memsetAsync (wordPtrToDevPtr d) n (fromIntegral v :: Word8)  (Just st)
+        2 -> Marshal.memsetAsync (wordPtrToDevPtr d) n (fromIntegral v :: Word16) (Just st)
+        4 -> Marshal.memsetAsync (wordPtrToDevPtr d) n v                          (Just st)
+        _ -> cudaError "Daemon.memset: can only memset 8-, 16-, and 32-bit values"
+
+
+-- A kernel parameter given as uninterpreted bytes
+--
+data RawArg = RawArg !Int !(Ptr ())
+
+instance Storable RawArg where
+  sizeOf    (RawArg n _)   = n
+  alignment (RawArg n _)   = min 8 n
+  poke p    (RawArg n src) = copyBytes (castPtr p) src n
+  peek _                   = error "Can not peek Foreign.CUDA.Driver.Daemon.RawArg"
+
+
+--------------------------------------------------------------------------------
+-- Host backend
+--------------------------------------------------------------------------------
+
+-- |
+-- Execute commands in host memory. Modules are looked up by file name in
+-- the given table, and their functions by name. Each function is given one
+-- handle, however many times it is looked up. All operations complete
+-- synchronously.
+--
+{-# INLINEABLE hostBackend #-}
+hostBackend :: [(FilePath, [(String, HostKernel)])] -> IO Backend
+hostBackend !modules = do
+  kernels <- newIORef []
+  let
+      load !f =
+        case lookup f (zip (map fst modules) [1..]) of
+          Just i  -> return i
+          Nothing -> cudaError "Daemon.loadFile: no such module"
+
+      getFun !m !s = do
+        let i = fromIntegral m - 1
+        when (i < 0 || i >= length modules) $ cudaError "Daemon.getFun: invalid module"
+        case lookup s (snd (modules !! i)) of
+          Nothing -> cudaError "Daemon.getFun: no such function"
+          Just k  -> atomicModifyIORef kernels $ \ks ->
+            case findIndex ((== (i,s)) . fst) ks of
+              Just j  -> (ks, fromIntegral (j + 1))
+              Nothing -> (ks ++ [((i,s), k)], fromIntegral (length ks + 1))
+
+      launch !f !g !b _ _ !args = do
+        ks <- readIORef kernels
+        let i = fromIntegral f - 1
+        when (i < 0 || i >= length ks) $ cudaError "Daemon.launchKernel: invalid function"
+        snd (ks !! i) g b (map snd args)
+
+      memsetH !d !n !width !v _ =
+        let p = wordPtrToPtr d
+        in case width of
+             1 -> forM_ [0 .. n-1] $ \i -> pokeElemOff (castPtr p) i (fromIntegral v :: Word8)
+             2 -> forM_ [0 .. n-1] $ \i -> pokeElemOff (castPtr p) i (fromIntegral v :: Word16)
+             4 -> forM_ [0 .. n-1] $ \i -> pokeElemOff (castPtr p) i v
+             _ -> cudaError "Daemon.memset: can only memset 8-, 16-, and 32-bit values"
+  --
+  return Backend
+    { backendInit       = return ()
+    , backendNewStream  = return (Stream nullPtr)
+    , backendFreeStream = \_ -> return ()
+    , backendRegister   = \_ _ -> return ()
+    , backendUnregister = \_ -> return ()
+    , backendMalloc     = \n -> ptrToWordPtr `fmap` mallocBytes (max 1 n)
+    , backendFree       = \d -> free (wordPtrToPtr d)
+    , backendPoke       = \n p d _ -> copyBytes (wordPtrToPtr d) p n
+    , backendPeek       = \n d p _ -> copyBytes p (wordPtrToPtr d) n
+    , backendCopy       = \n s d _ -> moveBytes (wordPtrToPtr d :: Ptr Word8) (wordPtrToPtr s) n
+    , backendMemset     = memsetH
+    , backendLoad       = load
+    , backendGetFun     = getFun
+    , backendLaunch     = launch
+    , backendBlock      = \_ -> return ()
+    }
+
+
+--------------------------------------------------------------------------------
+-- Null backend
+--------------------------------------------------------------------------------
+
+-- |
+-- Execute nothing. Allocations, modules and functions are given distinct
+-- addresses which must not be dereferenced, and every other command
+-- succeeds immediately. Memory transfers do not touch host memory.
+--
+{-# INLINEABLE nullBackend #-}
+nullBackend :: IO Backend
+nullBackend = do
+  next <- newIORef 0x100000
+  let
+      fresh :: Int -> IO WordPtr
+      fresh !n = atomicModifyIORef' next $ \p -> (p + fromIntegral ((max 1 n + 255) `div` 256 * 256), p)
+  --
+  return Backend
+    { backendInit       = return ()
+    , backendNewStream  = return (Stream nullPtr)
+    , backendFreeStream = \_ -> return ()
+    , backendRegister   = \_ _ -> return ()
+    , backendUnregister = \_ -> return ()
+    , backendMalloc     = fresh
+    , backendFree       = \_ -> return ()
+    , backendPoke       = \_ _ _ _ -> return ()
+    , backendPeek       = \_ _ _ _ -> return ()
+    , backendCopy       = \_ _ _ _ -> return ()
+    , backendMemset     = \_ _ _ _ _ -> return ()
+    , backendLoad       = \_ -> fresh 1
+    , backendGetFun     = \_ _ -> fresh 1
+    , backendLaunch     = \_ _ _ _ _ _ -> return ()
+    , backendBlock      = \_ -> return ()
+    }
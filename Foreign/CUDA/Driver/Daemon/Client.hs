@@ -0,0 +1,362 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Daemon.Client
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Client side of the GPU owning daemon (see
+-- "Foreign.CUDA.Driver.Daemon.Server").
+--
+-- The operations exported from this module have the same names and types as
+-- their counterparts in "Foreign.CUDA.Driver", so that a program can switch
+-- to using the daemon by changing its imports and calling 'connect' in
+-- place of creating a context. Device pointers, modules, and functions
+-- refer to objects owned by the daemon, and are only meaningful to it.
+--
+-- All commands of a client are executed in order on a single stream owned
+-- by the daemon, so the stream argument to 'launchKernel' is ignored.
+-- Memory transfers are synchronous with respect to the host, as in the
+-- driver API.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Daemon.Client (
+
+  -- * Connection
+  connect, disconnect,
+
+  -- * Memory management
+  mallocArray, allocaArray, free,
+  peekArray, peekListArray,
+  pokeArray, pokeListArray,
+  copyArray,
+  newListArray, withListArray,
+  memset,
+
+  -- * Modules and execution
+  Module, Fun, FunParam(..),
+  loadFile, getFun,
+  launchKernel, sync,
+
+  module Foreign.CUDA.Ptr,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Daemon.Protocol
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.Exec                         ( Fun(..), FunParam(..) )
+import Foreign.CUDA.Driver.Module.Base                  ( Module(..) )
+import Foreign.CUDA.Driver.Stream                       ( Stream )
+import qualified Foreign.CUDA.Internal.SharedMemory     as SHM
+
+-- System
+import Control.Concurrent.MVar
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Foreign                                          hiding ( mallocArray, allocaArray, free, peekArray, pokeArray, copyArray )
+import Foreign.C
+import Network.Socket                                   ( Socket, Family(..), SockAddr(..), defaultProtocol, socket )
+import Prelude
+import System.IO.Unsafe
+import qualified Foreign.Marshal                        as F
+import qualified Network.Socket                         as N
+
+
+-- An open connection to the daemon, together with the shared memory segment
+-- used to exchange bulk data. Only one request may be outstanding at once.
+--
+data Connection = Connection
+  { connSocket          :: !Socket
+  , connSegment         :: !SHM.Segment
+  , connLock            :: !(MVar ())
+  }
+
+{-# NOINLINE theConnection #-}
+theConnection :: IORef (Maybe Connection)
+theConnection = unsafePerformIO (newIORef Nothing)
+
+{-# NOINLINE theSegmentCount #-}
+theSegmentCount :: IORef Int
+theSegmentCount = unsafePerformIO (newIORef 0)
+
+
+--------------------------------------------------------------------------------
+-- Connection
+--------------------------------------------------------------------------------
+
+-- |
+-- Connect to the daemon listening on the given socket. The second argument
+-- is the size in bytes of the segment used to exchange data with the
+-- daemon; larger transfers are split into several requests.
+--
+{-# INLINEABLE connect #-}
+connect :: FilePath -> Int -> IO ()
+connect !path !bytes = do
+  disconnect
+  pid  <- c_getpid
+  n    <- atomicModifyIORef theSegmentCount (\i -> (i+1, i))
+  let name = "/cuda-daemon-" ++ show pid ++ "-" ++ show n
+  seg  <- SHM.create name (max 4096 bytes)
+  sock <- socket AF_UNIX N.Stream defaultProtocol
+  (do N.connect sock (SockAddrUnix path)
+      withCStringLen name $ \(p, len) -> do
+        sendRequest sock OpHello [fromIntegral len]
+        sendBytes sock (castPtr p) len
+      _ <- reply =<< recvReply sock
+      return ())
+    `finally` SHM.unlink seg
+    `onException` (N.close sock >> SHM.detach seg)
+  lock <- newMVar ()
+  writeIORef theConnection (Just (Connection sock seg lock))
+
+
+-- |
+-- Close the connection to the daemon, if any. Objects allocated by this
+-- process are not released.
+--
+{-# INLINEABLE disconnect #-}
+disconnect :: IO ()
+disconnect = do
+  mc <- atomicModifyIORef theConnection (\c -> (Nothing, c))
+  case mc of
+    Nothing -> return ()
+    Just c  -> withMVar (connLock c) $ \_ -> do
+      sendRequest (connSocket c) OpBye [] `catch` \e -> const (return ()) (e :: IOException)
+      N.close (connSocket c)
+      SHM.detach (connSegment c)
+
+
+--------------------------------------------------------------------------------
+-- Memory management
+--------------------------------------------------------------------------------
+
+-- |
+-- Allocate a section of linear memory on the device
+--
+{-# INLINEABLE mallocArray #-}
+mallocArray :: Storable a => Int -> IO (DevicePtr a)
+mallocArray = doMalloc undefined
+  where
+    doMalloc :: Storable a' => a' -> Int -> IO (DevicePtr a')
+    doMalloc x !n = (wordPtrToDevPtr . fromIntegral) `fmap` request OpMalloc [fromIntegral (n * sizeOf x)]
+
+-- |
+-- Execute a computation with a temporary device allocation
+--
+{-# INLINEABLE allocaArray #-}
+allocaArray :: Storable a => Int -> (DevicePtr a -> IO b) -> IO b
+allocaArray !n = bracket (mallocArray n) free
+
+-- |
+-- Release a section of device memory
+--
+{-# INLINEABLE free #-}
+free :: DevicePtr a -> IO ()
+free !dp = void $ request OpFree [fromIntegral (devPtrToWordPtr dp)]
+
+
+-- |
+-- Copy a number of elements from the device to host memory
+--
+{-# INLINEABLE peekArray #-}
+peekArray :: Storable a => Int -> DevicePtr a -> Ptr a -> IO ()
+peekArray !n !dptr !hptr = doPeek undefined dptr
+  where
+    doPeek :: Storable a' => a' -> DevicePtr a' -> IO ()
+    doPeek x _ = chunked (n * sizeOf x) $ \c payload o m -> do
+      _ <- call' c OpPeek [fromIntegral (devPtrToWordPtr dptr) + fromIntegral o, fromIntegral m, 0]
+      copyBytes (castPtr hptr `plusPtr` o) payload m
+
+-- |
+-- Copy a number of elements from the device into a new list
+--
+{-# INLINEABLE peekListArray #-}
+peekListArray :: Storable a => Int -> DevicePtr a -> IO [a]
+peekListArray !n !dptr =
+  F.allocaArray n $ \p -> do
+    peekArray n dptr p
+    F.peekArray n p
+
+-- |
+-- Copy a number of elements onto the device
+--
+{-# INLINEABLE pokeArray #-}
+pokeArray :: Storable a => Int -> Ptr a -> DevicePtr a -> IO ()
+pokeArray !n !hptr !dptr = doPoke undefined dptr
+  where
+    doPoke :: Storable a' => a' -> DevicePtr a' -> IO ()
+    doPoke x _ = chunked (n * sizeOf x) $ \c payload o m -> do
+      copyBytes payload (castPtr hptr `plusPtr` o) m
+      void $ call' c OpPoke [0, fromIntegral m, fromIntegral (devPtrToWordPtr dptr) + fromIntegral o]
+
+-- |
+-- Write a list of elements into a device array
+--
+{-# INLINEABLE pokeListArray #-}
+pokeListArray :: Storable a => [a] -> DevicePtr a -> IO ()
+pokeListArray !xs !dptr = F.withArrayLen xs $ \n p -> pokeArray n p dptr
+
+-- |
+-- Copy the given number of elements from the first device array (source) to
+-- the second (destination)
+--
+{-# INLINEABLE copyArray #-}
+copyArray :: Storable a => Int -> DevicePtr a -> DevicePtr a -> IO ()
+copyArray !n = docopy undefined
+  where
+    docopy :: Storable a' => a' -> DevicePtr a' -> DevicePtr a' -> IO ()
+    docopy x !src !dst = void $ request OpCopy [ fromIntegral (devPtrToWordPtr src)
+                                               , fromIntegral (devPtrToWordPtr dst)
+                                               , fromIntegral (n * sizeOf x) ]
+
+-- |
+-- Allocate a new device array and initialise it with the given list
+--
+{-# INLINEABLE newListArray #-}
+newListArray :: Storable a => [a] -> IO (DevicePtr a)
+newListArray !xs = do
+  dptr <- mallocArray (length xs)
+  pokeListArray xs dptr `onException` free dptr
+  return dptr
+
+-- |
+-- Temporarily store a list of elements on the device
+--
+{-# INLINEABLE withListArray #-}
+withListArray :: Storable a => [a] -> (DevicePtr a -> IO b) -> IO b
+withListArray !xs = bracket (newListArray xs) free
+
+-- |
+-- Set a number of data elements to the specified value, which may be either
+-- 8-, 16-, or 32-bits wide
+--
+{-# INLINEABLE memset #-}
+memset :: Storable a => DevicePtr a -> Int -> a -> IO ()
+memset !dptr !n !val = do
+  let width = sizeOf val
+  v <- with val $ \p -> case width of
+         1 -> fromIntegral `fmap` peek (castPtr p :: Ptr Word8)
+         2 -> fromIntegral `fmap` peek (castPtr p :: Ptr Word16)
+         4 -> fromIntegral `fmap` peek (castPtr p :: Ptr Word32)
+         _ -> cudaError "can only memset 8-, 16-, and 32-bit values"
+  void $ request OpMemset [fromIntegral (devPtrToWordPtr dptr), fromIntegral n, v, fromIntegral width]
+
+
+--------------------------------------------------------------------------------
+-- Modules and execution
+--------------------------------------------------------------------------------
+
+-- |
+-- Load the contents of the given file onto the daemon's context. The file
+-- is read by the daemon, so the path should be absolute.
+--
+{-# INLINEABLE loadFile #-}
+loadFile :: FilePath -> IO Module
+loadFile !path =
+  withConnection $ \c ->
+  withCStringLen path $ \(p, n) -> do
+    payload <- inPayload c 0 n
+    copyBytes payload (castPtr p) n
+    (Module . wordPtrToPtr . fromIntegral) `fmap` call' c OpLoad [0, fromIntegral n]
+
+-- |
+-- Returns a function handle
+--
+{-# INLINEABLE getFun #-}
+getFun :: Module -> String -> IO Fun
+getFun !mdl !name =
+  withConnection $ \c ->
+  withCStringLen name $ \(p, n) -> do
+    payload <- inPayload c 0 n
+    copyBytes payload (castPtr p) n
+    (Fun . wordPtrToPtr . fromIntegral) `fmap` call' c OpGetFun [fromIntegral (ptrToWordPtr (useModule mdl)), 0, fromIntegral n]
+
+-- |
+-- Invoke a kernel on a @(gx * gy * gz)@ grid of blocks, where each block
+-- contains @(tx * ty * tz)@ threads and has access to a given number of
+-- bytes of shared memory. The launch is asynchronous; the stream argument
+-- is ignored, as all commands of this client execute on the same stream.
+--
+{-# INLINEABLE launchKernel #-}
+launchKernel
+    :: Fun                      -- ^ function to execute
+    -> (Int, Int, Int)          -- ^ block grid dimension
+    -> (Int, Int, Int)          -- ^ thread block shape
+    -> Int                      -- ^ shared memory (bytes)
+    -> Maybe Stream             -- ^ (optional) stream to execute in
+    -> [FunParam]               -- ^ list of function parameters
+    -> IO ()
+launchKernel !fn (!gx,!gy,!gz) (!tx,!ty,!tz) !sm _ !args =
+  withConnection $ \c -> do
+    let n     = length args
+        sizes = map sizeOf args
+        offs  = scanl (\o s -> o + align8 s) (n * 8) sizes
+    payload <- inPayload c 0 (last offs)
+    F.pokeArray (castPtr payload) (map fromIntegral sizes :: [Word64])
+    zipWithM_ (\o a -> poke (payload `plusPtr` o) a) offs args
+    void $ call' c OpLaunch [ fromIntegral (ptrToWordPtr (useFun fn))
+                            , fromIntegral gx, fromIntegral gy, fromIntegral gz
+                            , fromIntegral tx, fromIntegral ty, fromIntegral tz
+                            , fromIntegral sm, 0, fromIntegral n ]
+  where
+    align8 x = (x + 7) `div` 8 * 8
+
+-- |
+-- Block until all commands issued by this client have completed
+--
+{-# INLINEABLE sync #-}
+sync :: IO ()
+sync = void $ request OpSync []
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+withConnection :: (Connection -> IO a) -> IO a
+withConnection action = do
+  mc <- readIORef theConnection
+  case mc of
+    Nothing -> cudaError "Daemon: not connected"
+    Just c  -> withMVar (connLock c) (const (action c))
+
+-- Make a request which does not use the shared segment
+--
+request :: Op -> [Word64] -> IO Word64
+request !op !args = withConnection $ \c -> call' c op args
+
+-- Make a request on a connection which has already been locked
+--
+call' :: Connection -> Op -> [Word64] -> IO Word64
+call' !c !op !args = do
+  sendRequest (connSocket c) op args
+  reply =<< recvReply (connSocket c)
+
+reply :: Reply -> IO Word64
+reply (ReplyOk v)     = return v
+reply (ReplyStatus s) = throwIO (ExitCode (toEnum s))
+reply ReplyError      = cudaError "Daemon: request failed"
+
+-- Transfer the given number of bytes through the segment in pieces. The
+-- action is given the locked connection, the segment, and the offset and
+-- size of the piece.
+--
+chunked :: Int -> (Connection -> Ptr Word8 -> Int -> Int -> IO ()) -> IO ()
+chunked !bytes action =
+  withConnection $ \c -> do
+    let payload = castPtr (SHM.segmentPtr (connSegment c))
+        step    = SHM.segmentBytes (connSegment c)
+    forM_ [0, step .. bytes-1] $ \o ->
+      action c payload o (min step (bytes - o))
+
+inPayload :: Connection -> Int -> Int -> IO (Ptr Word8)
+inPayload !c !o !n
+  | o + n <= SHM.segmentBytes (connSegment c) = return (castPtr (SHM.segmentPtr (connSegment c)) `plusPtr` o)
+  | otherwise = cudaError "Daemon: request exceeds the shared memory segment"
+
+foreign import ccall unsafe "unistd.h getpid" c_getpid :: IO CInt
@@ -0,0 +1,156 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Daemon.Protocol
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Wire protocol between daemon clients and the GPU owning daemon.
+--
+-- Every request is a fixed size header of machine words: an opcode followed
+-- by its arguments. Bulk data (arrays, strings, and kernel parameters) is
+-- not sent over the socket, but exchanged through a shared memory segment
+-- owned by the client; the header arguments give offsets into that segment.
+-- Each request is answered with a status word and a result word.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Daemon.Protocol (
+
+  Op(..), Reply(..),
+  requestArgs,
+  sendRequest, recvRequest,
+  sendReply, recvReply,
+  sendBytes, recvBytes,
+
+) where
+
+-- System
+import Control.Exception
+import Control.Monad
+import Foreign
+import Network.Socket                                   ( Socket, sendBuf, recvBuf )
+import Prelude
+
+
+-- |
+-- Request operations. See "Foreign.CUDA.Driver.Daemon.Server" for the
+-- arguments of each.
+--
+data Op
+  = OpHello
+  | OpBye
+  | OpMalloc
+  | OpFree
+  | OpPoke
+  | OpPeek
+  | OpCopy
+  | OpMemset
+  | OpLoad
+  | OpGetFun
+  | OpLaunch
+  | OpSync
+  deriving (Eq, Show, Enum, Bounded)
+
+-- |
+-- The result of a request: success with a result word, a failing driver
+-- status (as given by 'fromEnum'), or some other error.
+--
+data Reply
+  = ReplyOk     !Word64
+  | ReplyStatus !Int
+  | ReplyError
+  deriving (Eq, Show)
+
+
+-- |
+-- Number of argument words following the opcode in each request
+--
+requestArgs :: Int
+requestArgs = 11
+
+headerBytes :: Int
+headerBytes = (1 + requestArgs) * sizeOf (undefined :: Word64)
+
+
+-- |
+-- Send a request. Missing arguments are padded with zero.
+--
+sendRequest :: Socket -> Op -> [Word64] -> IO ()
+sendRequest !sock !op !args =
+  allocaArray (1 + requestArgs) $ \p -> do
+    pokeArray p (take (1 + requestArgs) (fromIntegral (fromEnum op) : args ++ repeat 0))
+    sendBytes sock (castPtr p) headerBytes
+
+-- |
+-- Receive a request, or 'Nothing' if the peer has closed the connection.
+--
+recvRequest :: Socket -> IO (Maybe (Op, [Word64]))
+recvRequest !sock =
+  allocaArray (1 + requestArgs) $ \p -> do
+    ok <- recvBytes sock (castPtr p) headerBytes
+    if not ok
+      then return Nothing
+      else do
+        op:args <- peekArray (1 + requestArgs) p
+        when (op > fromIntegral (fromEnum (maxBound :: Op))) $
+          throwIO (userError "Foreign.CUDA.Driver.Daemon: invalid request")
+        return (Just (toEnum (fromIntegral op), args))
+
+
+-- |
+-- Send the reply to a request
+--
+sendReply :: Socket -> Reply -> IO ()
+sendReply !sock !reply =
+  allocaArray 2 $ \p -> do
+    case reply of
+      ReplyOk v     -> pokeArray p [0, v]
+      ReplyStatus s -> pokeArray p [1, fromIntegral s]
+      ReplyError    -> pokeArray p [2, 0]
+    sendBytes sock (castPtr p) (2 * sizeOf (undefined :: Word64))
+
+-- |
+-- Receive the reply to a request
+--
+recvReply :: Socket -> IO Reply
+recvReply !sock =
+  allocaArray 2 $ \p -> do
+    ok <- recvBytes sock (castPtr p) (2 * sizeOf (undefined :: Word64))
+    unless ok $ throwIO (userError "Foreign.CUDA.Driver.Daemon: connection closed")
+    [tag, v] <- peekArray 2 (p :: Ptr Word64)
+    return $ case tag of
+      0 -> ReplyOk v
+      1 -> ReplyStatus (fromIntegral v)
+      _ -> ReplyError
+
+
+-- |
+-- Send the given number of bytes from the buffer
+--
+sendBytes :: Socket -> Ptr Word8 -> Int -> IO ()
+sendBytes !sock = go
+  where
+    go !p !n
+      | n <= 0    = return ()
+      | otherwise = do
+          m <- sendBuf sock p n
+          go (p `plusPtr` m) (n - m)
+
+-- |
+-- Fill the buffer with the given number of bytes. Returns 'False' if the
+-- connection was closed before any data was received.
+--
+recvBytes :: Socket -> Ptr Word8 -> Int -> IO Bool
+recvBytes !sock !p0 !n0 = go p0 n0
+  where
+    go !p !n
+      | n <= 0    = return True
+      | otherwise = do
+          -- depending on the version of the network library, end of file
+          -- is either reported as zero bytes read or as an exception
+          m <- recvBuf sock p n `catch` \e -> const (return 0) (e :: IOException)
+          case m of
+            0 | n == n0   -> return False
+              | otherwise -> throwIO (userError "Foreign.CUDA.Driver.Daemon: truncated message")
+            _             -> go (p `plusPtr` m) (n - m)
@@ -0,0 +1,295 @@
+{-# LANGUAGE BangPatterns        #-}
+{-# LANGUAGE ScopedTypeVariables #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Daemon.Server
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A daemon which owns the GPU on behalf of several client processes.
+--
+-- Each client process would otherwise create its own context, and pay the
+-- cost of driver initialisation and context creation, as well as holding
+-- device memory for its own context. Instead, clients connect to the daemon
+-- over a local socket using "Foreign.CUDA.Driver.Daemon.Client", and the
+-- daemon executes their commands in its single context. The daemon and its
+-- client are only built with the @daemon@ package flag.
+--
+-- Requests from all clients are collected into a single queue, which is
+-- drained in batches by one bound executor thread. Each client has its own
+-- stream, so commands from different clients may overlap on the device. The
+-- executor does not wait for any stream until the entire batch has been
+-- issued, and then waits only on those streams which have a command whose
+-- reply depends on its completion (memory transfers and 'OpSync').
+--
+-- Bulk data is exchanged through a shared memory segment owned by each
+-- client, which the daemon page-locks (where the backend supports it) so
+-- that transfers to and from it are asynchronous. The request arguments are:
+--
+--   * 'OpHello'  [segment name length]; the name follows on the socket
+--   * 'OpMalloc' [bytes]
+--   * 'OpFree'   [device pointer]
+--   * 'OpPoke'   [segment offset, bytes, device pointer]
+--   * 'OpPeek'   [device pointer, bytes, segment offset]
+--   * 'OpCopy'   [source, destination, bytes]
+--   * 'OpMemset' [device pointer, count, value, element width]
+--   * 'OpLoad'   [segment offset, path length]
+--   * 'OpGetFun' [module, segment offset, name length]
+--   * 'OpLaunch' [function, grid x y z, block x y z, shared memory bytes,
+--                 segment offset, parameter count]; the parameters are
+--                 stored as a table of sizes followed by their values, each
+--                 aligned to 8 bytes
+--   * 'OpSync'   []
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Daemon.Server (
+
+  -- * Daemon
+  Config(..), defaultConfig,
+  serve,
+
+  module Foreign.CUDA.Driver.Daemon.Backend,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Driver.Daemon.Backend
+import Foreign.CUDA.Driver.Daemon.Protocol
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.Stream                       ( Stream(..) )
+import qualified Foreign.CUDA.Internal.SharedMemory     as SHM
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.Foldable                                    ( toList )
+import Data.List                                        ( nubBy )
+import Data.Maybe                                       ( catMaybes )
+import Data.Sequence                                    ( Seq, (|>) )
+import Foreign
+import Foreign.C
+import Network.Socket                                   ( Socket, Family(..), SockAddr(..), defaultProtocol, socket, bind, listen, accept )
+import Prelude
+import System.Directory                                 ( removeFile, doesFileExist )
+import qualified Data.Sequence                          as Seq
+import qualified Network.Socket                         as N
+
+
+-- |
+-- Daemon configuration
+--
+data Config = Config
+  { configSocket        :: FilePath     -- ^ path of the listening socket
+  , configBatchLimit    :: !Int         -- ^ maximum number of commands executed per batch
+  }
+
+-- |
+-- Listen on @\/tmp\/cuda-daemon.sock@, with batches of up to 256 commands
+--
+defaultConfig :: Config
+defaultConfig = Config "/tmp/cuda-daemon.sock" 256
+
+
+-- A connected client
+--
+data Session = Session
+  { sessionStream       :: !Stream
+  , sessionPayload      :: {-# UNPACK #-} !(Ptr Word8)
+  , sessionBytes        :: {-# UNPACK #-} !Int
+  }
+
+-- A request waiting to be executed, and where to put its reply
+--
+data Command = Command !Session !Op ![Word64] !(MVar Reply)
+
+data Queue = Queue
+  { queueCommands       :: !(MVar (Seq Command))
+  , queueSignal         :: !(MVar ())
+  }
+
+
+-- |
+-- Run the daemon with the given backend. This function does not return.
+--
+-- The executor runs in a bound thread, so the program must be linked with
+-- the threaded runtime. If the backend fails to initialise, every request is
+-- answered with that failure.
+--
+{-# INLINEABLE serve #-}
+serve :: Config -> Backend -> IO ()
+serve !config !backend = do
+  commands <- newMVar Seq.empty
+  signal   <- newEmptyMVar
+  let queue = Queue commands signal
+  _        <- forkOS $ do
+    r <- try (backendInit backend)
+    case r of
+      Right () -> executor config backend queue
+      Left e   -> reject queue (initFailed e)
+  --
+  exists <- doesFileExist (configSocket config)
+  when exists $ removeFile (configSocket config)
+  bracket (socket AF_UNIX N.Stream defaultProtocol) N.close $ \sock -> do
+    bind sock (SockAddrUnix (configSocket config))
+    listen sock 64
+    forever $ do
+      (conn, _) <- accept sock
+      forkIO $ session queue conn `finally` N.close conn
+
+
+-- Serve a single client connection. Requests are forwarded to the executor
+-- one at a time, and the reply sent back once it is available.
+--
+session :: Queue -> Socket -> IO ()
+session !queue !conn = do
+  hello <- recvRequest conn
+  case hello of
+    Just (OpHello, n:_) -> do
+      name <- allocaBytes (fromIntegral n) $ \p -> do
+        ok <- recvBytes conn p (fromIntegral n)
+        unless ok $ throwIO (userError "Foreign.CUDA.Driver.Daemon: connection closed")
+        peekCStringLen (castPtr p, fromIntegral n)
+      bracket (SHM.attach name) SHM.detach $ \seg -> do
+        let payload = castPtr (SHM.segmentPtr seg)
+            bytes   = SHM.segmentBytes seg
+        stream <- submit queue (Session (Stream nullPtr) payload bytes) OpHello []
+        case stream of
+          ReplyOk st -> do
+            let s = Session (Stream (wordPtrToPtr (fromIntegral st))) payload bytes
+            sendReply conn stream
+            loop s `finally` submit queue s OpBye []
+          _          -> sendReply conn stream
+    _ -> sendReply conn ReplyError
+  where
+    loop !s = do
+      req <- recvRequest conn
+      case req of
+        Nothing         -> return ()
+        Just (OpBye, _) -> return ()
+        Just (op, args) -> submit queue s op args >>= sendReply conn >> loop s
+
+
+-- Queue a command for the executor and wait for its reply
+--
+submit :: Queue -> Session -> Op -> [Word64] -> IO Reply
+submit !queue !s !op !args = do
+  reply <- newEmptyMVar
+  modifyMVar_ (queueCommands queue) (return . (|> Command s op args reply))
+  _ <- tryPutMVar (queueSignal queue) ()
+  takeMVar reply
+
+
+-- If the backend could not be initialised, fail every command, both those
+-- already waiting and any submitted later, rather than leaving the clients
+-- waiting for replies which will never come.
+--
+reject :: Queue -> Reply -> IO ()
+reject !queue !reply = forever $ do
+  takeMVar (queueSignal queue)
+  batch <- modifyMVar (queueCommands queue) $ \q -> return (Seq.empty, q)
+  forM_ (toList batch) $ \(Command _ _ _ r) -> putMVar r reply
+
+initFailed :: SomeException -> Reply
+initFailed e = maybe ReplyError toReply (fromException e)
+
+
+-- The executor thread. Takes whatever commands are waiting (up to the batch
+-- limit), issues them all, then waits on the streams of those commands whose
+-- replies depend on completion.
+--
+executor :: Config -> Backend -> Queue -> IO ()
+executor !config !backend !queue = forever $ do
+  takeMVar (queueSignal queue)
+  batch <- modifyMVar (queueCommands queue) $ \q -> do
+    let (now, later) = Seq.splitAt (configBatchLimit config) q
+    unless (Seq.null later) $ void (tryPutMVar (queueSignal queue) ())
+    return (later, now)
+  --
+  results  <- mapM issue (toList batch)
+  let deferred = [ (s, r, v) | (Command s _ _ r, Left v) <- zip (toList batch) results ]
+      streams  = nubBy (\a b -> useStream a == useStream b) [ sessionStream s | (s,_,_) <- deferred ]
+  --
+  failed <- catMaybes `fmap` forM streams (\st ->
+    (backendBlock backend st >> return Nothing) `catch` \(e :: CUDAException) -> return (Just (useStream st, e)))
+  --
+  forM_ (zip (toList batch) results) $ \(Command _ _ _ r, res) ->
+    either (const (return ())) (putMVar r) res
+  forM_ deferred $ \(s, r, v) ->
+    case lookup (useStream (sessionStream s)) failed of
+      Just e  -> putMVar r (toReply e)
+      Nothing -> putMVar r (ReplyOk v)
+  where
+    -- Issue a single command. Returns either the reply, or the result value
+    -- to reply with once the command's stream has completed.
+    issue :: Command -> IO (Either Word64 Reply)
+    issue (Command s op args _) =
+      execute s op args `catches`
+        [ Handler $ \(e :: CUDAException) -> return (Right (toReply e))
+        , Handler $ \(_ :: IOException)   -> return (Right ReplyError) ]
+
+    execute :: Session -> Op -> [Word64] -> IO (Either Word64 Reply)
+    execute !s !op !args =
+      let st      = sessionStream s
+          arg i   = args !! i
+          int i   = fromIntegral (arg i) :: Int
+          wptr i  = fromIntegral (arg i) :: WordPtr
+          payload = sessionPayload s
+          ok v    = return (Right (ReplyOk v))
+          later v = return (Left v)
+          inPayload o n
+            | o >= 0 && n >= 0 && o + n <= sessionBytes s = return (payload `plusPtr` o)
+            | otherwise = cudaError "Daemon: request exceeds the shared memory segment"
+      in
+      case op of
+        OpHello  -> do
+          st' <- backendNewStream backend
+          backendRegister backend payload (sessionBytes s) `catch` \(_ :: CUDAException) -> return ()
+          ok (fromIntegral (ptrToWordPtr (useStream st')))
+        OpBye    -> do
+          backendBlock backend st
+          backendUnregister backend payload `catch` \(_ :: CUDAException) -> return ()
+          backendFreeStream backend st
+          ok 0
+        OpMalloc -> backendMalloc backend (int 0) >>= ok . fromIntegral
+        OpFree   -> backendFree backend (wptr 0) >> ok 0
+        OpPoke   -> do
+          p <- inPayload (int 0) (int 1)
+          backendPoke backend (int 1) p (wptr 2) st
+          later 0
+        OpPeek   -> do
+          p <- inPayload (int 2) (int 1)
+          backendPeek backend (int 1) (wptr 0) p st
+          later 0
+        OpCopy   -> backendCopy backend (int 2) (wptr 0) (wptr 1) st >> ok 0
+        OpMemset -> backendMemset backend (wptr 0) (int 1) (int 3) (fromIntegral (arg 2)) st >> ok 0
+        OpLoad   -> do
+          p    <- inPayload (int 0) (int 1)
+          path <- peekCStringLen (castPtr p, int 1)
+          backendLoad backend path >>= ok . fromIntegral
+        OpGetFun -> do
+          p    <- inPayload (int 1) (int 2)
+          name <- peekCStringLen (castPtr p, int 2)
+          backendGetFun backend (wptr 0) name >>= ok . fromIntegral
+        OpLaunch -> do
+          let n = int 9
+          sizes <- inPayload (int 8) (n * 8)
+          ws    <- peekArray n (castPtr sizes :: Ptr Word64)
+          let offs = scanl (\o w -> o + align8 (fromIntegral w)) (int 8 + n * 8) ws
+          params <- forM (zip ws offs) $ \(w, o) -> do
+            p <- inPayload o (fromIntegral w)
+            return (fromIntegral w, castPtr p)
+          -- the parameter values are copied by the launch itself, so the
+          -- client may reuse the segment as soon as we reply
+          backendLaunch backend (wptr 0) (int 1, int 2, int 3) (int 4, int 5, int 6) (int 7) st params
+          ok 0
+        OpSync   -> later 0
+
+    align8 :: Int -> Int
+    align8 x = (x + 7) `div` 8 * 8
+
+
+toReply :: CUDAException -> Reply
+toReply (ExitCode status) = ReplyStatus (fromEnum status)
+toReply (UserError _)     = ReplyError
@@ -0,0 +1,80 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Future
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Write-once results of operations completed by another thread.
+--
+-- Operations submitted to a worker thread, such as a batched launch, return
+-- a future which is filled in exactly once when the operation completes. If
+-- the operation failed, waiting on the future re-throws the exception in the
+-- waiting thread.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Future (
+
+  Future,
+  await, poll,
+
+  -- Internal
+  new, put, putException,
+
+) where
+
+-- System
+import Control.Concurrent.MVar
+import Control.Exception
+import Prelude
+
+
+-- |
+-- The eventual result of an operation
+--
+newtype Future a = Future (MVar (Either SomeException a))
+
+
+-- |
+-- Create a new, empty future
+--
+{-# INLINEABLE new #-}
+new :: IO (Future a)
+new = Future `fmap` newEmptyMVar
+
+-- |
+-- Complete the future with a value. Completing a future a second time has no
+-- effect.
+--
+{-# INLINEABLE put #-}
+put :: Future a -> a -> IO ()
+put (Future !var) !x = tryPutMVar var (Right x) >> return ()
+
+-- |
+-- Complete the future with an exception
+--
+{-# INLINEABLE putException #-}
+putException :: Exception e => Future a -> e -> IO ()
+putException (Future !var) !e = tryPutMVar var (Left (toException e)) >> return ()
+
+
+-- |
+-- Block until the future has been completed and return its value, or
+-- re-throw the exception the operation failed with.
+--
+{-# INLINEABLE await #-}
+await :: Future a -> IO a
+await (Future !var) = either throwIO return =<< readMVar var
+
+-- |
+-- Return the value of the future if it has been completed, without
+-- blocking.
+--
+{-# INLINEABLE poll #-}
+poll :: Future a -> IO (Maybe a)
+poll (Future !var) = do
+  mr <- tryReadMVar var
+  case mr of
+    Nothing -> return Nothing
+    Just r  -> either throwIO (return . Just) r
@@ -0,0 +1,199 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Histogram
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Distributions of kernel execution times, suitable for leaving enabled in
+-- production.
+--
+-- When enabled, a sample of kernel launches (and every launch of the
+-- selected kernels) is bracketed by a pair of events recorded into its
+-- stream. The launching thread never waits for the kernel to complete;
+-- elapsed times are collected in the background and added to a histogram
+-- for each kernel. The histograms have a relative error of about 3%, and
+-- their 'percentile's can be read at any time with 'snapshot'.
+--
+-- Kernels are identified by the name they were looked up with
+-- ('Foreign.CUDA.Driver.Module.getFun'). When timing is disabled, the cost
+-- to each launch is a single test of a flag.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Histogram (
+
+  -- * Sampling
+  Config(..),
+  defaultConfig,
+  enable, disable, reset, skipped,
+
+  -- * Histograms
+  Histogram(..), Summary(..),
+  snapshot, percentile, summary,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Internal.Histogram
+
+-- System
+import Data.Word
+import Foreign.Marshal                                  ( allocaArray, peekArray )
+import Foreign.Ptr
+import Text.Printf
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- Sampling options
+--
+data Config = Config
+  { configPeriod        :: !Int         -- ^ time one in every this many launches on each thread (none if zero)
+  , configSelect        :: [String]     -- ^ kernels to time on every launch
+  , configMaxPending    :: !Int         -- ^ maximum number of launches awaiting completion
+  }
+  deriving Show
+
+-- |
+-- Time one launch in every hundred, with at most 4096 outstanding
+--
+defaultConfig :: Config
+defaultConfig = Config 100 [] 4096
+
+
+-- |
+-- The distribution of execution times (nanoseconds) of a kernel. Each
+-- bucket is given as the largest time which falls into it, and the number
+-- of launches which did; empty buckets are omitted.
+--
+data Histogram = Histogram
+  { histCount           :: !Word64
+  , histMin             :: !Word64
+  , histMax             :: !Word64
+  , histSum             :: !Word64
+  , histBuckets         :: [(Word64, Word64)]
+  }
+  deriving Show
+
+-- |
+-- The usual summary statistics of a histogram (nanoseconds)
+--
+data Summary = Summary
+  { summaryCount        :: !Word64
+  , summaryMean         :: !Double
+  , summaryP50          :: !Word64
+  , summaryP90          :: !Word64
+  , summaryP99          :: !Word64
+  , summaryMax          :: !Word64
+  }
+  deriving Show
+
+
+--------------------------------------------------------------------------------
+-- Sampling
+--------------------------------------------------------------------------------
+
+-- |
+-- Start timing kernel launches
+--
+{-# INLINEABLE enable #-}
+enable :: Config -> IO ()
+enable !config = do
+  hs_hist_configure (fromIntegral (max 0 (configPeriod config))) (fromIntegral (configMaxPending config))
+  setSelection (configSelect config)
+  setEnabled True
+
+-- |
+-- Stop timing kernel launches. Launches already timed are still added to
+-- the histograms.
+--
+{-# INLINEABLE disable #-}
+disable :: IO ()
+disable = setEnabled False
+
+-- |
+-- Empty every histogram
+--
+{-# INLINEABLE reset #-}
+reset :: IO ()
+reset = hs_hist_reset
+
+-- |
+-- The number of launches which were not timed because too many were
+-- awaiting completion
+--
+{-# INLINEABLE skipped #-}
+skipped :: IO Int
+skipped = fromIntegral `fmap` hs_hist_skipped
+
+
+--------------------------------------------------------------------------------
+-- Histograms
+--------------------------------------------------------------------------------
+
+-- |
+-- The histogram of each kernel which has been timed, including every launch
+-- which has completed on the device. Kernels which were not looked up by
+-- name are identified by their address.
+--
+{-# INLINEABLE snapshot #-}
+snapshot :: IO [(String, Histogram)]
+snapshot = go 4096
+  where
+    go !n = do
+      r <- allocaArray n $ \p -> do
+             m <- fromIntegral `fmap` hs_hist_snapshot p (fromIntegral n)
+             if m > n
+               then return (Left m)
+               else Right `fmap` peekArray m p
+      case r of
+        Left m   -> go m
+        Right ws -> mapM name (decode ws)
+
+    decode (fn:count:lo:hi:total:n:rest) =
+      let (bs, rest') = splitAt (2 * fromIntegral n) rest
+          pairs (x:y:zs) = (x,y) : pairs zs
+          pairs _        = []
+      in
+      (fn, Histogram count lo hi total (pairs bs)) : decode rest'
+    decode _ = []
+
+    name (fn, h) = do
+      let p = wordPtrToPtr (fromIntegral fn)
+      k <- kernelName p
+      return (maybe (printf "<%s>" (show p)) id k, h)
+
+
+-- |
+-- The smallest time (nanoseconds) which at least the given percentage of
+-- launches completed within, to the precision of the histogram
+--
+percentile :: Double -> Histogram -> Word64
+percentile !p !h
+  | histCount h == 0 = 0
+  | otherwise        = go 0 (histBuckets h)
+  where
+    target = max 1 (ceiling (p / 100 * fromIntegral (histCount h)))
+
+    go _ []             = histMax h
+    go !acc ((v,c):bs)
+      | acc + c >= target = min v (histMax h)
+      | otherwise         = go (acc + c) bs
+
+-- |
+-- Summarise a histogram
+--
+summary :: Histogram -> Summary
+summary !h =
+  Summary { summaryCount = histCount h
+          , summaryMean  = if histCount h == 0 then 0 else fromIntegral (histSum h) / fromIntegral (histCount h)
+          , summaryP50   = percentile 50 h
+          , summaryP90   = percentile 90 h
+          , summaryP99   = percentile 99 h
+          , summaryMax   = histMax h
+          }
@@ -0,0 +1,192 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.IPC.Cache
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A reference counted cache of inter-process memory handles.
+--
+-- Opening an inter-process memory handle with
+-- 'Foreign.CUDA.Driver.IPC.Marshal.open' is expensive, and a handle may only
+-- be opened once per context in each importing process. The cache maps each
+-- exported handle to the device pointer it was opened at, so that repeated
+-- requests for the same allocation share a single mapping. Mappings are
+-- closed lazily: once the last reference is released the mapping is kept
+-- open, and only closed once the number of idle mappings exceeds the limit
+-- given to 'new', or when the cache is 'flush'ed.
+--
+-- Device pointers returned from the cache are only valid in the context
+-- which was current when the handle was opened, so a separate cache should
+-- be used for each context.
+--
+-- Since CUDA-4.0.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.IPC.Cache (
+
+  -- * IPC handle cache
+  Cache,
+  new, open, close, with, flush, destroy,
+  size,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.IPC.Marshal                  ( IPCDevicePtr, IPCFlag, ipcDevicePtrKey )
+import qualified Foreign.CUDA.Driver.IPC.Marshal        as IPC
+
+-- System
+import Control.Exception                                ( bracket )
+import Control.Monad
+import Control.Concurrent.MVar
+import Data.ByteString                                  ( ByteString )
+import Data.List                                        ( sortBy )
+import Data.Ord                                         ( comparing )
+import Data.Map                                         ( Map )
+import qualified Data.Map                               as Map
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- A cache of opened inter-process memory handles
+--
+data Cache = Cache
+  { cacheIdleLimit      :: {-# UNPACK #-} !Int
+  , cacheEntries        :: {-# UNPACK #-} !(MVar CacheState)
+  }
+
+data CacheState = CacheState
+  { stateClock          :: {-# UNPACK #-} !Int
+  , stateMappings       :: !(Map ByteString Mapping)
+  }
+
+-- An opened mapping. Idle mappings have a reference count of zero, and are
+-- evicted oldest first according to the time at which they were last
+-- released.
+--
+data Mapping = Mapping
+  { mappingPtr          :: {-# UNPACK #-} !(DevicePtr ())
+  , mappingRefs         :: {-# UNPACK #-} !Int
+  , mappingReleased     :: {-# UNPACK #-} !Int
+  }
+
+
+--------------------------------------------------------------------------------
+-- IPC handle cache
+--------------------------------------------------------------------------------
+
+-- |
+-- Create a new, empty cache, which will keep at most the given number of
+-- unreferenced mappings open.
+--
+{-# INLINEABLE new #-}
+new :: Int -> IO Cache
+new !limit = Cache (max 0 limit) `fmap` newMVar (CacheState 0 Map.empty)
+
+
+-- |
+-- Return the device pointer at which the given handle is mapped into the
+-- current process, opening the handle if necessary. Each call to 'open'
+-- must be matched by a call to 'close'.
+--
+-- The flags are only used when the handle is not already mapped.
+--
+{-# INLINEABLE open #-}
+open :: Cache -> IPCDevicePtr a -> [IPCFlag] -> IO (DevicePtr a)
+open !cache !hdl !flags = do
+  key <- ipcDevicePtrKey hdl
+  modifyMVar (cacheEntries cache) $ \st ->
+    case Map.lookup key (stateMappings st) of
+      Just m  -> do
+        let m' = m { mappingRefs = mappingRefs m + 1 }
+        return ( st { stateMappings = Map.insert key m' (stateMappings st) }
+               , castDevPtr (mappingPtr m) )
+      Nothing -> do
+        dptr <- IPC.open hdl flags
+        let m = Mapping (castDevPtr dptr) 1 0
+        return ( st { stateMappings = Map.insert key m (stateMappings st) }
+               , dptr )
+
+
+-- |
+-- Release a reference to the mapping of the given handle. The mapping is
+-- not closed immediately; it remains available to subsequent calls to
+-- 'open' until it is evicted.
+--
+{-# INLINEABLE close #-}
+close :: Cache -> IPCDevicePtr a -> IO ()
+close !cache !hdl = do
+  key <- ipcDevicePtrKey hdl
+  modifyMVar_ (cacheEntries cache) $ \st ->
+    case Map.lookup key (stateMappings st) of
+      Just m | mappingRefs m > 0 ->
+        let !now = stateClock st + 1
+            m'   = m { mappingRefs = mappingRefs m - 1, mappingReleased = now }
+        in
+        evict (cacheIdleLimit cache) st { stateClock    = now
+                                        , stateMappings = Map.insert key m' (stateMappings st) }
+      _ -> cudaError "IPC.Cache.close: handle is not open"
+
+
+-- |
+-- Execute an action with the device pointer of the given handle, releasing
+-- the reference once the action completes (normally or via an exception).
+--
+{-# INLINEABLE with #-}
+with :: Cache -> IPCDevicePtr a -> [IPCFlag] -> (DevicePtr a -> IO b) -> IO b
+with !cache !hdl !flags = bracket (open cache hdl flags) (const (close cache hdl))
+
+
+-- |
+-- Close all mappings which are no longer referenced.
+--
+{-# INLINEABLE flush #-}
+flush :: Cache -> IO ()
+flush !cache = modifyMVar_ (cacheEntries cache) (evict 0)
+
+
+-- |
+-- Close every mapping held by the cache, regardless of whether it is still
+-- referenced. The cache must not be used afterwards.
+--
+{-# INLINEABLE destroy #-}
+destroy :: Cache -> IO ()
+destroy !cache = modifyMVar_ (cacheEntries cache) $ \st -> do
+  mapM_ (IPC.close . mappingPtr) (Map.elems (stateMappings st))
+  return st { stateMappings = Map.empty }
+
+
+-- |
+-- The number of mappings currently held open by the cache, both referenced
+-- and idle.
+--
+{-# INLINEABLE size #-}
+size :: Cache -> IO Int
+size !cache = (Map.size . stateMappings) `fmap` readMVar (cacheEntries cache)
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Close the least recently released idle mappings until at most the given
+-- number remain.
+--
+evict :: Int -> CacheState -> IO CacheState
+evict !limit !st
+  | excess <= 0 = return st
+  | otherwise   = do
+      let victims = take excess $ sortBy (comparing (mappingReleased . snd)) idle
+      forM_ victims $ \(_,m) -> IPC.close (mappingPtr m)
+      return st { stateMappings = foldr (Map.delete . fst) (stateMappings st) victims }
+  where
+    idle   = filter ((== 0) . mappingRefs . snd) (Map.toList (stateMappings st))
+    excess = length idle - limit
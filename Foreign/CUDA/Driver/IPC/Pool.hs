@@ -0,0 +1,222 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.IPC.Pool
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A pool of fixed size device memory blocks shared between processes.
+--
+-- A single exporting process allocates one large region of device memory
+-- and carves it into equally sized blocks. The region is exported once, and
+-- importing processes 'attach' to it through an IPC handle
+-- 'Foreign.CUDA.Driver.IPC.Cache.Cache', so that the handle is opened at
+-- most once per importing context. Afterwards, blocks are addressed purely
+-- by their byte offset into the region, and no further calls to
+-- 'Foreign.CUDA.Driver.IPC.Marshal.open' are required.
+--
+-- Block allocation is managed by the exporting process, which hands out
+-- offsets to importers by whatever means the application uses to
+-- communicate. Synchronising access to the contents of a block is the
+-- responsibility of the application; see "Foreign.CUDA.Driver.IPC.Event".
+--
+-- Since CUDA-4.0.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.IPC.Pool (
+
+  -- * Shared block pool
+  Pool, Offset,
+  create, destroy,
+  attach, detach,
+  alloc, free,
+  handle, blockSize, blockCount, blockPtr,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.IPC.Cache                    ( Cache )
+import Foreign.CUDA.Driver.IPC.Marshal                  ( IPCDevicePtr, IPCFlag )
+import qualified Foreign.CUDA.Driver.IPC.Cache          as Cache
+import qualified Foreign.CUDA.Driver.IPC.Marshal        as IPC
+import qualified Foreign.CUDA.Driver.Marshal            as Marshal
+
+-- System
+import Control.Exception                                ( onException )
+import Control.Concurrent.MVar
+import Data.IntSet                                      ( IntSet )
+import Data.Word
+import qualified Data.IntSet                            as IntSet
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- A region of device memory divided into equally sized blocks, either owned
+-- by this process or imported from another.
+--
+data Pool = Pool
+  { poolBase            :: {-# UNPACK #-} !(DevicePtr Word8)
+  , poolHandle          :: !(IPCDevicePtr Word8)
+  , poolBlockSize       :: {-# UNPACK #-} !Int
+  , poolBlockCount      :: {-# UNPACK #-} !Int
+  , poolOwner           :: !Owner
+  }
+
+data Owner
+  = Exporter !(MVar Blocks)
+  | Importer !Cache
+
+-- The offsets of the free blocks, and of the blocks currently handed out
+--
+data Blocks = Blocks [Offset] !IntSet
+
+-- |
+-- The offset of a block from the start of the pool, in bytes.
+--
+type Offset = Int
+
+
+--------------------------------------------------------------------------------
+-- Exporting process
+--------------------------------------------------------------------------------
+
+-- |
+-- Allocate a new pool of the given number of blocks of (at least) the given
+-- number of bytes each, and export it for use by other processes. Block
+-- sizes are rounded up so that every block is suitably aligned for any
+-- type.
+--
+{-# INLINEABLE create #-}
+create :: Int -> Int -> IO Pool
+create !bytes !count = do
+  let !bs = align bytes
+  base <- Marshal.mallocArray (bs * count)
+  hdl  <- IPC.export base `onException` Marshal.free base
+  fl   <- newMVar (Blocks [ i * bs | i <- [0 .. count-1] ] IntSet.empty)
+  return $! Pool base hdl bs count (Exporter fl)
+
+
+-- |
+-- Release the memory backing a pool created with 'create'. Any importing
+-- processes must have detached from the pool before it is destroyed.
+--
+{-# INLINEABLE destroy #-}
+destroy :: Pool -> IO ()
+destroy !pool =
+  case poolOwner pool of
+    Exporter _ -> Marshal.free (poolBase pool)
+    Importer _ -> cudaError "IPC.Pool.destroy: pool was not created by this process"
+
+
+-- |
+-- Reserve a free block from the pool, returning its offset, or 'Nothing'
+-- if all blocks are in use. Only the exporting process may allocate blocks.
+--
+{-# INLINEABLE alloc #-}
+alloc :: Pool -> IO (Maybe Offset)
+alloc !pool =
+  case poolOwner pool of
+    Importer _  -> cudaError "IPC.Pool.alloc: pool was not created by this process"
+    Exporter fl -> modifyMVar fl $ \blocks@(Blocks offs used) ->
+      case offs of
+        []   -> return (blocks, Nothing)
+        o:os -> return (Blocks os (IntSet.insert o used), Just o)
+
+
+-- |
+-- Return a block to the pool. It is an error to free a block which is not
+-- currently allocated, such as one which has already been freed, as it would
+-- otherwise be handed out twice.
+--
+{-# INLINEABLE free #-}
+free :: Pool -> Offset -> IO ()
+free !pool !off =
+  case poolOwner pool of
+    Importer _  -> cudaError "IPC.Pool.free: pool was not created by this process"
+    Exporter fl
+      | off < 0 || off >= poolBlockSize pool * poolBlockCount pool || off `rem` poolBlockSize pool /= 0
+      -> cudaError "IPC.Pool.free: invalid block offset"
+      | otherwise
+      -> modifyMVar_ fl $ \(Blocks offs used) ->
+           if IntSet.member off used
+             then return (Blocks (off:offs) (IntSet.delete off used))
+             else cudaError "IPC.Pool.free: block is not allocated"
+
+
+--------------------------------------------------------------------------------
+-- Importing process
+--------------------------------------------------------------------------------
+
+-- |
+-- Attach to a pool exported by another process, given its handle and
+-- geometry as returned by 'handle', 'blockSize' and 'blockCount' in the
+-- exporting process. The handle is opened through the given cache.
+--
+{-# INLINEABLE attach #-}
+attach :: Cache -> IPCDevicePtr Word8 -> Int -> Int -> [IPCFlag] -> IO Pool
+attach !cache !hdl !bytes !count !flags = do
+  base <- Cache.open cache hdl flags
+  return $! Pool base hdl bytes count (Importer cache)
+
+
+-- |
+-- Release this process' reference to an imported pool. The underlying
+-- mapping is closed lazily by the cache.
+--
+{-# INLINEABLE detach #-}
+detach :: Pool -> IO ()
+detach !pool =
+  case poolOwner pool of
+    Importer c -> Cache.close c (poolHandle pool)
+    Exporter _ -> cudaError "IPC.Pool.detach: pool was created by this process"
+
+
+--------------------------------------------------------------------------------
+-- Queries
+--------------------------------------------------------------------------------
+
+-- |
+-- The inter-process handle to the memory backing the pool
+--
+{-# INLINE handle #-}
+handle :: Pool -> IPCDevicePtr Word8
+handle = poolHandle
+
+-- |
+-- The size of each block in the pool, in bytes
+--
+{-# INLINE blockSize #-}
+blockSize :: Pool -> Int
+blockSize = poolBlockSize
+
+-- |
+-- The number of blocks in the pool
+--
+{-# INLINE blockCount #-}
+blockCount :: Pool -> Int
+blockCount = poolBlockCount
+
+-- |
+-- The device pointer, valid in the current process, to the block at the
+-- given offset.
+--
+{-# INLINE blockPtr #-}
+blockPtr :: Pool -> Offset -> DevicePtr a
+blockPtr !pool !off = castDevPtr (poolBase pool `plusDevPtr` off)
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Round up to the alignment guaranteed by 'Marshal.mallocArray'
+--
+align :: Int -> Int
+align !n = ((max 1 n + 255) `div` 256) * 256
@@ -0,0 +1,393 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.IPC.Ring
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A single-producer, single-consumer ring buffer for passing device
+-- resident data between processes without copying.
+--
+-- The slots of the ring live in an exported device allocation (see
+-- "Foreign.CUDA.Driver.IPC.Pool"). The producer fills a slot with work
+-- submitted to a stream and then 'commit's it, which records an
+-- inter-process event for that slot in the stream. The consumer
+-- 'acquire's the slot by making its own stream wait on that event, so
+-- neither process blocks on the host while data is in flight.
+--
+-- The head and tail indices, together with the IPC handles of the slot
+-- memory and events, are stored in a named POSIX shared memory segment.
+-- The consumer needs only the name of the segment to 'open' the ring.
+--
+-- For testing, the ring may instead be backed by host memory stored in the
+-- shared memory segment itself. The control logic is identical, but no
+-- device memory or events are used.
+--
+-- Since CUDA-4.0. Not available on Windows.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.IPC.Ring (
+
+  -- * Ring buffer
+  Ring, Slot(..), Backing(..),
+  create, open, close,
+
+  -- * Producer
+  reserve, tryReserve, commit,
+
+  -- * Consumer
+  acquire, tryAcquire, release,
+
+  -- * Queries
+  capacity, slotSize, pending,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+import Foreign.CUDA.Driver.Error
+import Foreign.CUDA.Driver.IPC.Cache                    ( Cache )
+import Foreign.CUDA.Driver.IPC.Pool                     ( Pool )
+import Foreign.CUDA.Internal.SharedMemory               ( Segment(..), loadAcquire, storeRelease )
+import qualified Foreign.CUDA.Driver.Event              as Event
+import qualified Foreign.CUDA.Driver.IPC.Event          as IPCEvent
+import qualified Foreign.CUDA.Driver.IPC.Marshal        as IPC
+import qualified Foreign.CUDA.Driver.IPC.Pool           as Pool
+import qualified Foreign.CUDA.Internal.SharedMemory     as SHM
+
+-- System
+import Control.Concurrent                               ( yield, threadDelay )
+import Control.Exception                                ( onException )
+import Control.Monad
+import Data.Foldable                                    ( toList )
+import Data.Sequence                                    ( Seq )
+import qualified Data.Sequence                          as Seq
+import Foreign.Ptr
+import Foreign.Storable
+import Data.Word
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- One end of a ring buffer
+--
+data Ring = Ring
+  { ringSegment         :: !Segment
+  , ringRole            :: !Role
+  , ringCapacity        :: {-# UNPACK #-} !Int
+  , ringSlotBytes       :: {-# UNPACK #-} !Int
+  , ringMemory          :: !Memory
+  }
+
+data Role = Producer | Consumer
+  deriving Eq
+
+data Memory
+  = HostMemory   {-# UNPACK #-} !(Ptr Word8)
+  | DeviceMemory !Pool !(Seq Event)
+
+-- |
+-- Where the slots of the ring are stored
+--
+data Backing = Host | Device
+  deriving (Eq, Show, Enum, Bounded)
+
+-- |
+-- A slot of the ring. The sequence number identifies the slot to 'commit'
+-- or 'release', and the pointer is valid in the current process. For rings
+-- backed by host memory, the pointer refers to host memory.
+--
+data Slot = Slot
+  { slotSequence        :: {-# UNPACK #-} !Word64
+  , slotPtr             :: {-# UNPACK #-} !(DevicePtr Word8)
+  }
+  deriving (Eq, Show)
+
+
+--------------------------------------------------------------------------------
+-- Ring management
+--------------------------------------------------------------------------------
+
+-- |
+-- Create the producer end of a new ring with the given number of slots,
+-- each of at least the given number of bytes. The ring is made available
+-- to other processes under the given shared memory name, which must begin
+-- with a slash and not already exist.
+--
+-- A ring with 'Device' backing requires a current context on a device
+-- which supports inter-process communication.
+--
+{-# INLINEABLE create #-}
+create :: Backing -> String -> Int -> Int -> IO Ring
+create !backing !name !slots !bytes = do
+  when (slots <= 0 || bytes <= 0) $
+    cudaError "IPC.Ring.create: number of slots and slot size must be positive"
+  case backing of
+    Host   -> do
+      let !sb = roundUp 64 bytes
+      seg <- SHM.create name (dataOffset slots + slots * sb)
+      writeHeader seg Host slots sb
+      return $! Ring seg Producer slots sb (HostMemory (segmentPtr seg `plusPtr` dataOffset slots))
+
+    Device -> do
+      pool <- Pool.create bytes slots
+      evs  <- replicateM slots (Event.create [Event.DisableTiming, Event.Interprocess])
+      seg  <- SHM.create name (dataOffset slots)
+                `onException` (mapM_ Event.destroy evs >> Pool.destroy pool)
+      let !sb = Pool.blockSize pool
+          !p  = segmentPtr seg
+      IPC.pokeIPCDevicePtr (p `plusPtr` offMemHandle) (Pool.handle pool)
+      forM_ (zip [0..] evs) $ \(i,ev) ->
+        IPCEvent.pokeIPCEvent (p `plusPtr` eventOffset i) =<< IPCEvent.export ev
+      writeHeader seg Device slots sb
+      return $! Ring seg Producer slots sb (DeviceMemory pool (Seq.fromList evs))
+
+
+-- |
+-- Open the consumer end of the ring with the given shared memory name. The
+-- slot memory of a 'Device' backed ring is mapped through the given cache.
+--
+{-# INLINEABLE open #-}
+open :: Cache -> String -> IO Ring
+open !cache !name = do
+  seg   <- SHM.attach name
+  let !p = segmentPtr seg
+  magic <- loadAcquire (p `plusPtr` offMagic)
+  when (magic /= ringMagic) $ do
+    SHM.detach seg
+    cudaError "IPC.Ring.open: shared memory segment does not contain a ring"
+  kind  <- peekWord p offKind
+  slots <- fromIntegral `fmap` peekWord p offCapacity
+  sb    <- fromIntegral `fmap` peekWord p offSlotBytes
+  mem   <- case toEnum (fromIntegral kind) of
+    Host   -> return (HostMemory (p `plusPtr` dataOffset slots))
+    Device -> do
+      hdl  <- IPC.peekIPCDevicePtr (p `plusPtr` offMemHandle)
+      pool <- Pool.attach cache hdl sb slots []
+      evs  <- forM [0 .. slots-1] $ \i ->
+                IPCEvent.open =<< IPCEvent.peekIPCEvent (p `plusPtr` eventOffset i)
+      return (DeviceMemory pool (Seq.fromList evs))
+  return $! Ring seg Consumer slots sb mem
+
+
+-- |
+-- Release the resources held by this end of the ring. Closing the producer
+-- end also removes the name of the shared memory segment, and frees the
+-- slot memory; the consumer must have closed its end before this happens.
+--
+{-# INLINEABLE close #-}
+close :: Ring -> IO ()
+close !ring = do
+  case ringMemory ring of
+    HostMemory _          -> return ()
+    DeviceMemory pool evs -> do
+      mapM_ Event.destroy (toList evs)
+      case ringRole ring of
+        Producer -> Pool.destroy pool
+        Consumer -> Pool.detach pool
+  SHM.detach (ringSegment ring)
+  when (ringRole ring == Producer) $ SHM.unlink (ringSegment ring)
+
+
+--------------------------------------------------------------------------------
+-- Producer
+--------------------------------------------------------------------------------
+
+-- |
+-- Wait until a slot is free, and return it to be filled.
+--
+{-# INLINEABLE reserve #-}
+reserve :: Ring -> IO Slot
+reserve !ring = spin (tryReserve ring)
+
+-- |
+-- Return the next free slot, or 'Nothing' if all slots are occupied.
+--
+{-# INLINEABLE tryReserve #-}
+tryReserve :: Ring -> IO (Maybe Slot)
+tryReserve !ring = do
+  requireRole Producer "tryReserve" ring
+  h <- peek (headPtr ring)
+  t <- loadAcquire (tailPtr ring)
+  return $ if h - t >= fromIntegral (ringCapacity ring)
+             then Nothing
+             else Just (slot ring h)
+
+-- |
+-- Publish the most recently reserved slot to the consumer. The slot is
+-- marked ready once all work currently submitted to the (optional) stream
+-- has completed, so the producer may 'commit' immediately after enqueuing
+-- the kernels or copies that fill the slot.
+--
+{-# INLINEABLE commit #-}
+commit :: Ring -> Slot -> Maybe Stream -> IO ()
+commit !ring !s !mst = do
+  requireRole Producer "commit" ring
+  h <- peek (headPtr ring)
+  when (slotSequence s /= h) $ cudaError "IPC.Ring.commit: slot is not the most recently reserved"
+  case ringMemory ring of
+    HostMemory _         -> return ()
+    DeviceMemory _ evs   -> Event.record (Seq.index evs (index ring h)) mst
+  storeRelease (headPtr ring) (h+1)
+
+
+--------------------------------------------------------------------------------
+-- Consumer
+--------------------------------------------------------------------------------
+
+-- |
+-- Wait until a slot has been committed by the producer, and return it.
+-- All work subsequently submitted to the (optional) stream will wait until
+-- the producer's work filling the slot has completed. This does not block
+-- the calling thread on the device.
+--
+{-# INLINEABLE acquire #-}
+acquire :: Ring -> Maybe Stream -> IO Slot
+acquire !ring !mst = spin (tryAcquire ring mst)
+
+-- |
+-- As 'acquire', but return 'Nothing' if no slot has been committed.
+--
+{-# INLINEABLE tryAcquire #-}
+tryAcquire :: Ring -> Maybe Stream -> IO (Maybe Slot)
+tryAcquire !ring !mst = do
+  requireRole Consumer "tryAcquire" ring
+  t <- peek (tailPtr ring)
+  h <- loadAcquire (headPtr ring)
+  if h == t
+    then return Nothing
+    else do
+      case ringMemory ring of
+        HostMemory _       -> return ()
+        DeviceMemory _ evs -> Event.wait (Seq.index evs (index ring t)) mst []
+      return (Just (slot ring t))
+
+-- |
+-- Return the oldest acquired slot to the producer, which may immediately
+-- overwrite it. Any work reading from the slot must have completed before
+-- it is released, for example by blocking on the stream that was passed
+-- to 'acquire'.
+--
+{-# INLINEABLE release #-}
+release :: Ring -> Slot -> IO ()
+release !ring !s = do
+  requireRole Consumer "release" ring
+  t <- peek (tailPtr ring)
+  when (slotSequence s /= t) $ cudaError "IPC.Ring.release: slot is not the oldest acquired"
+  storeRelease (tailPtr ring) (t+1)
+
+
+--------------------------------------------------------------------------------
+-- Queries
+--------------------------------------------------------------------------------
+
+-- |
+-- The number of slots in the ring
+--
+{-# INLINE capacity #-}
+capacity :: Ring -> Int
+capacity = ringCapacity
+
+-- |
+-- The size of each slot in bytes
+--
+{-# INLINE slotSize #-}
+slotSize :: Ring -> Int
+slotSize = ringSlotBytes
+
+-- |
+-- The number of slots which have been committed but not yet released
+--
+{-# INLINEABLE pending #-}
+pending :: Ring -> IO Int
+pending !ring = do
+  h <- loadAcquire (headPtr ring)
+  t <- loadAcquire (tailPtr ring)
+  return (fromIntegral (h - t))
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Layout of the shared memory segment. The head and tail indices are
+-- written by different processes, so are placed on separate cache lines.
+--
+-- > 0    magic, backing, capacity, slot size
+-- > 64   head (written by producer)
+-- > 128  tail (written by consumer)
+-- > 192  IPC memory handle
+-- > ...  IPC event handle for each slot
+-- > ...  slot data (host backing only)
+--
+offMagic, offKind, offCapacity, offSlotBytes, offHead, offTail, offMemHandle :: Int
+offMagic     = 0
+offKind      = 8
+offCapacity  = 16
+offSlotBytes = 24
+offHead      = 64
+offTail      = 128
+offMemHandle = 192
+
+eventOffset :: Int -> Int
+eventOffset !i = roundUp 64 (offMemHandle + IPC.ipcDevicePtrSize) + i * roundUp 64 IPCEvent.ipcEventSize
+
+dataOffset :: Int -> Int
+dataOffset !slots = roundUp 256 (eventOffset slots)
+
+ringMagic :: Word64
+ringMagic = 0x43554441524e4731      -- "CUDARNG1"
+
+roundUp :: Int -> Int -> Int
+roundUp !a !n = ((n + a - 1) `div` a) * a
+
+writeHeader :: Segment -> Backing -> Int -> Int -> IO ()
+writeHeader !seg !backing !slots !bytes = do
+  let !p = segmentPtr seg
+  pokeWord p offKind      (fromIntegral (fromEnum backing))
+  pokeWord p offCapacity  (fromIntegral slots)
+  pokeWord p offSlotBytes (fromIntegral bytes)
+  storeRelease (p `plusPtr` offMagic) ringMagic
+
+peekWord :: Ptr () -> Int -> IO Word64
+peekWord !p !off = peek (p `plusPtr` off)
+
+pokeWord :: Ptr () -> Int -> Word64 -> IO ()
+pokeWord !p !off = poke (p `plusPtr` off)
+
+headPtr, tailPtr :: Ring -> Ptr Word64
+headPtr r = segmentPtr (ringSegment r) `plusPtr` offHead
+tailPtr r = segmentPtr (ringSegment r) `plusPtr` offTail
+
+index :: Ring -> Word64 -> Int
+index !r !n = fromIntegral (n `rem` fromIntegral (ringCapacity r))
+
+slot :: Ring -> Word64 -> Slot
+slot !r !n =
+  let !off = index r n * ringSlotBytes r
+  in  Slot n $ case ringMemory r of
+                 HostMemory p        -> DevicePtr (p `plusPtr` off)
+                 DeviceMemory pool _ -> Pool.blockPtr pool off
+
+requireRole :: Role -> String -> Ring -> IO ()
+requireRole !role !fn !r =
+  when (ringRole r /= role) $ cudaError ("IPC.Ring." ++ fn ++ ": operation not valid at this end of the ring")
+
+-- Poll an operation until it succeeds, yielding and then sleeping briefly
+-- between attempts.
+--
+spin :: IO (Maybe a) -> IO a
+spin action = go (0 :: Int)
+  where
+    go !n = do
+      r <- action
+      case r of
+        Just x  -> return x
+        Nothing -> do
+          if n < 64 then yield else threadDelay 50
+          go (n+1)
@@ -0,0 +1,141 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Record
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Recording of driver calls, for reproducing performance problems away from
+-- the program which exhibited them.
+--
+-- While recording, every allocation, memory transfer, memset, kernel
+-- launch, and stream, event and module operation made through these
+-- bindings is appended to a compact binary file, together with its sizes,
+-- launch shape, the identities of the streams and events involved, and
+-- when it began and ended on the host. Optionally, the data of host to
+-- device transfers is recorded as well. The recording can be re-issued
+-- against a real or stub driver with "Foreign.CUDA.Driver.Replay".
+--
+-- Two-dimensional copies are recorded as one-dimensional copies of the same
+-- number of bytes, without their data. Page-locked host memory released by
+-- the finaliser of 'Foreign.CUDA.Driver.Marshal.mallocHostForeignPtr' is
+-- not recorded as freed.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Record (
+
+  -- * Recording
+  Config(..), Call(..), Entry(..), Kind(..),
+  defaultConfig,
+  start, stop, withRecording,
+
+  -- * Reading
+  readEntries,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Internal.Record                     ( Call(..), Entry(..), decode, magic, version )
+import Foreign.CUDA.Internal.Tracker                    ( Kind(..) )
+import qualified Foreign.CUDA.Internal.Record           as Internal
+
+-- System
+import Control.Exception
+import Data.Word
+import Foreign.Ptr
+import Foreign.Storable
+import Prelude
+import qualified Data.ByteString                        as B
+import qualified Data.ByteString.Unsafe                 as B
+
+
+--------------------------------------------------------------------------------
+-- Recording
+--------------------------------------------------------------------------------
+
+-- |
+-- Recording options
+--
+data Config = Config
+  { configPayloads      :: !Bool        -- ^ record the data of host to device transfers
+  }
+  deriving Show
+
+-- |
+-- Record calls but not their data
+--
+defaultConfig :: Config
+defaultConfig = Config False
+
+
+-- |
+-- Start recording driver calls to the given file, replacing any recording
+-- in progress
+--
+{-# INLINEABLE start #-}
+start :: Config -> FilePath -> IO ()
+start !config !path = Internal.start path (configPayloads config)
+
+-- |
+-- Stop recording, and close the file
+--
+{-# INLINEABLE stop #-}
+stop :: IO ()
+stop = Internal.stop
+
+-- |
+-- Record the driver calls made while executing the action
+--
+{-# INLINEABLE withRecording #-}
+withRecording :: Config -> FilePath -> IO a -> IO a
+withRecording !config !path = bracket_ (start config path) stop
+
+
+--------------------------------------------------------------------------------
+-- Reading
+--------------------------------------------------------------------------------
+
+-- |
+-- Read the entries of a recording, in the order they were written (that
+-- is, the order in which the calls completed)
+--
+readEntries :: FilePath -> IO [Entry]
+readEntries !path = do
+  bs <- B.readFile path
+  let header = B.length magic + 8
+  if B.take (B.length magic) bs /= magic || B.length bs < header
+    then failure "not a recording"
+    else do
+      v <- word bs (B.length magic)
+      if v /= version
+        then failure ("unsupported version " ++ show v)
+        else entries bs header []
+  where
+    failure msg = throwIO (userError ("Foreign.CUDA.Driver.Record.readEntries: " ++ path ++ ": " ++ msg))
+
+    -- the words are in the byte order of the recording machine
+    word :: B.ByteString -> Int -> IO Word64
+    word !bs !i
+      | i + 8 > B.length bs = failure "truncated entry"
+      | otherwise           = B.unsafeUseAsCString bs $ \p -> peekByteOff (castPtr p) i
+
+    words' !bs !i !n = mapM (\k -> word bs (i + 8*k)) [0 .. n-1]
+
+    entries !bs !i acc
+      | i >= B.length bs = return (reverse acc)
+      | otherwise        = do
+          [op, thr, t0, t1, nargs, nblobs] <- words' bs i 6
+          args  <- words' bs (i + 48) (fromIntegral nargs)
+          lens  <- words' bs (i + 48 + 8 * fromIntegral nargs) (fromIntegral nblobs)
+          let start' = i + 8 * (6 + fromIntegral nargs + fromIntegral nblobs)
+              sizes  = map fromIntegral lens
+              offs   = scanl (\o n -> o + (n + 7) `div` 8 * 8) start' sizes
+              next   = last offs
+          if next > B.length bs
+            then failure "truncated entry"
+            else do
+              let blobs = [ B.take n (B.drop o bs) | (o, n) <- zip offs sizes ]
+              case decode op args blobs of
+                Nothing   -> failure ("invalid entry at offset " ++ show i)
+                Just call -> entries bs next (Entry call (fromIntegral thr) t0 t1 : acc)
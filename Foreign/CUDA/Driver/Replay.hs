@@ -0,0 +1,443 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Replay
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Replay of recorded driver calls (see "Foreign.CUDA.Driver.Record").
+--
+-- The calls are re-issued in the order they began in the recording, through
+-- one of the execution backends of "Foreign.CUDA.Driver.Daemon.Backend":
+-- 'Foreign.CUDA.Driver.Daemon.Backend.driverBackend' to reproduce the
+-- recording on a real device, or
+-- 'Foreign.CUDA.Driver.Daemon.Backend.nullBackend' to measure the cost of
+-- the calls themselves. The time each call takes is measured, and can be
+-- compared against the recording to bisect a performance regression
+-- without the data path of the original program.
+--
+-- Allocations, streams, modules and functions are created afresh, and the
+-- addresses in the recording are translated to those of the replay. This
+-- includes kernel parameters of pointer size which fall inside a recorded
+-- device allocation; other parameters are passed unchanged. Memory must
+-- therefore have been allocated while recording.
+--
+-- Transfers use a ring of page-locked staging memory on the host, filled
+-- with the recorded data if there is any. The backends do not support
+-- waiting on events on the device, so a stream waiting on an event instead
+-- blocks the host until the stream the event was recorded in has completed.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Replay (
+
+  -- * Replay
+  Config(..), Timing(..),
+  defaultConfig,
+  replay, replayFile,
+
+  -- * Report
+  Summary(..),
+  summarise, render,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Driver.Daemon.Backend
+import Foreign.CUDA.Driver.Error                        ( cudaError )
+import Foreign.CUDA.Driver.Record                       ( Kind(..), Call(..), Entry(..), readEntries )
+import Foreign.CUDA.Driver.Stream                       ( Stream(..) )
+import Foreign.CUDA.Internal.Clock
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.List                                        ( sortBy, foldl' )
+import Data.Map                                         ( Map )
+import Data.Ord                                         ( comparing )
+import Data.Word
+import Foreign.Marshal
+import Foreign.Ptr
+import Foreign.Storable
+import System.Directory                                 ( getTemporaryDirectory, removeFile )
+import System.IO
+import Text.Printf
+import Prelude
+import qualified Data.ByteString                        as B
+import qualified Data.ByteString.Unsafe                 as B
+import qualified Data.Map                               as Map
+
+
+--------------------------------------------------------------------------------
+-- Replay
+--------------------------------------------------------------------------------
+
+-- |
+-- Replay options
+--
+data Config = Config
+  { configPaced         :: !Bool        -- ^ wait between calls as long as the recording did
+  , configStaging       :: !Int         -- ^ initial bytes of host staging memory
+  }
+  deriving Show
+
+-- |
+-- Replay calls as fast as possible, with 64MB of staging memory
+--
+defaultConfig :: Config
+defaultConfig = Config False (64 * 1024 * 1024)
+
+
+-- |
+-- A replayed call, and how long it took on the host (nanoseconds)
+--
+data Timing = Timing
+  { timingEntry         :: !Entry
+  , timingReplayed      :: !Word64
+  }
+  deriving Show
+
+
+-- The objects created by the replay, keyed by their identity in the
+-- recording
+--
+data State = State
+  { stateMemory         :: !(Map WordPtr (WordPtr, Int, Kind))  -- recorded base -> (replayed base, bytes, kind)
+  , stateStreams        :: !(Map WordPtr Stream)
+  , stateEvents         :: !(Map WordPtr Stream)                -- the stream each event was last recorded in
+  , stateModules        :: !(Map WordPtr WordPtr)
+  , stateFunctions      :: !(Map WordPtr WordPtr)
+  , stateStaging        :: !(Ptr Word8, Int, Int)               -- host staging memory, its size, and the next free byte
+  }
+
+
+-- |
+-- Read a recording and replay it
+--
+replayFile :: Config -> Backend -> FilePath -> IO [Timing]
+replayFile !config !backend !path = replay config backend =<< readEntries path
+
+-- |
+-- Replay the recorded calls in the order in which they began. The calls are
+-- issued from a single bound thread, after initialising the backend, and
+-- everything the replay created is released once it is finished.
+--
+replay :: Config -> Backend -> [Entry] -> IO [Timing]
+replay !config !backend !entries = runInBoundThread $ do
+  backendInit backend
+  staging <- mallocBytes (max 1 (configStaging config))
+  backendRegister backend staging (configStaging config)
+  ref     <- newIORef (State Map.empty Map.empty Map.empty Map.empty Map.empty (staging, configStaging config, 0))
+  t0      <- getTime
+  let es  = sortBy (comparing entryBegin) entries
+      r0  = case es of
+              []  -> 0
+              e:_ -> entryBegin e
+      --
+      go !e = do
+        when (configPaced config) $ do
+          now <- getTime
+          let due = t0 + (entryBegin e - r0)
+          when (due > now) $ threadDelay (fromIntegral ((due - now) `div` 1000))
+        s0 <- getTime
+        issue backend ref (entryCall e)
+        s1 <- getTime
+        return (Timing e (s1 - s0))
+  --
+  mapM go es `finally` release backend ref
+
+
+-- Issue a single call
+--
+issue :: Backend -> IORef State -> Call -> IO ()
+issue !backend !ref !call =
+  case call of
+    Malloc k n p -> do
+      p' <- case k of
+              HostMemory -> do
+                h <- mallocBytes (max 1 n)
+                backendRegister backend h n
+                return (ptrToWordPtr h)
+              _          -> backendMalloc backend n
+      modify $ \s -> s { stateMemory = Map.insert p (p', n, k) (stateMemory s) }
+
+    Free _ p -> do
+      s <- readIORef ref
+      case Map.lookup p (stateMemory s) of
+        Nothing            -> unknown "memory" p
+        Just (p', _, k)    -> do
+          case k of
+            HostMemory -> do
+              backendUnregister backend (wordPtrToPtr p')
+              free (wordPtrToPtr p')
+            _          -> backendFree backend p'
+          modify $ \s' -> s' { stateMemory = Map.delete p (stateMemory s') }
+
+    Poke n d mst mb -> do
+      d' <- address d
+      st <- stream mst
+      h  <- stage n
+      case mb of
+        Nothing -> return ()
+        Just b  -> B.unsafeUseAsCString b $ \p -> copyBytes h (castPtr p) (min n (B.length b))
+      backendPoke backend n h d' st
+      synchronous mst st
+
+    Peek n d mst -> do
+      d' <- address d
+      st <- stream mst
+      h  <- stage n
+      backendPeek backend n d' h st
+      synchronous mst st
+
+    Copy n src dst mst -> do
+      src' <- address src
+      dst' <- address dst
+      st   <- stream mst
+      backendCopy backend n src' dst' st
+      synchronous mst st
+
+    Set d n w v mst -> do
+      d' <- address d
+      st <- stream mst
+      backendMemset backend d' n w v st
+      synchronous mst st
+
+    Launch f grid block sm st ps -> do
+      s   <- readIORef ref
+      f'  <- maybe (unknown "function" f) return (Map.lookup f (stateFunctions s))
+      st' <- stream (Just st)
+      ps' <- mapM (parameter s) ps
+      withParams ps' $ backendLaunch backend f' grid block sm st'
+
+    NewStream st -> do
+      st' <- backendNewStream backend
+      modify $ \s -> s { stateStreams = Map.insert st st' (stateStreams s) }
+
+    FreeStream st -> do
+      st' <- stream (Just st)
+      backendFreeStream backend st'
+      modify $ \s -> s { stateStreams = Map.delete st (stateStreams s) }
+
+    BlockStream st      -> backendBlock backend =<< stream (Just st)
+    WaitStream _ ev     -> event ev
+    BlockEvent ev       -> event ev
+    NewEvent _          -> return ()
+    FreeEvent ev        -> modify $ \s -> s { stateEvents = Map.delete ev (stateEvents s) }
+    RecordEvent ev st   -> do
+      st' <- stream (Just st)
+      modify $ \s -> s { stateEvents = Map.insert ev st' (stateEvents s) }
+
+    LoadFile path m     -> load m (backendLoad backend path)
+    LoadData img m      -> load m $ do
+      dir         <- getTemporaryDirectory
+      (path, h)   <- openBinaryTempFile dir "replay.img"
+      B.hPut h img
+      hClose h
+      backendLoad backend path `finally` removeFile path
+
+    Unload m            -> modify $ \s -> s { stateModules = Map.delete m (stateModules s) }
+    GetFun m name f     -> do
+      s  <- readIORef ref
+      m' <- maybe (unknown "module" m) return (Map.lookup m (stateModules s))
+      f' <- backendGetFun backend m' name
+      modify $ \s' -> s' { stateFunctions = Map.insert f f' (stateFunctions s') }
+
+    Sync                -> blockAll backend ref
+  where
+    modify :: (State -> State) -> IO ()
+    modify f = modifyIORef' ref f
+
+    unknown :: String -> WordPtr -> IO a
+    unknown what p = cudaError (printf "Replay: %s 0x%x was not created in the recording" what (fromIntegral p :: Word64))
+
+    -- The replayed address of a recorded device address
+    address :: WordPtr -> IO WordPtr
+    address !p = do
+      s <- readIORef ref
+      maybe (unknown "memory" p) return (translate s p)
+
+    -- The default stream is not recorded as created. Streams created before
+    -- recording started are created when first used.
+    stream :: Maybe WordPtr -> IO Stream
+    stream Nothing   = return (Stream nullPtr)
+    stream (Just 0)  = return (Stream nullPtr)
+    stream (Just st) = do
+      s <- readIORef ref
+      case Map.lookup st (stateStreams s) of
+        Just st' -> return st'
+        Nothing  -> do
+          st' <- backendNewStream backend
+          modify $ \s' -> s' { stateStreams = Map.insert st st' (stateStreams s') }
+          return st'
+
+    synchronous :: Maybe WordPtr -> Stream -> IO ()
+    synchronous Nothing st = backendBlock backend st
+    synchronous _       _  = return ()
+
+    event :: WordPtr -> IO ()
+    event !ev = do
+      s <- readIORef ref
+      maybe (return ()) (backendBlock backend) (Map.lookup ev (stateEvents s))
+
+    load :: WordPtr -> IO WordPtr -> IO ()
+    load !m action = do
+      m' <- action
+      modify $ \s -> s { stateModules = Map.insert m m' (stateModules s) }
+
+    -- The next region of staging memory. When the ring wraps around, the
+    -- transfers using it must first have completed.
+    stage :: Int -> IO (Ptr Word8)
+    stage !n = do
+      s <- readIORef ref
+      let (base, size, next) = stateStaging s
+          bytes              = (n + 255) `div` 256 * 256
+      if next + bytes <= size
+        then do
+          modify $ \s' -> s' { stateStaging = (base, size, next + bytes) }
+          return (base `plusPtr` next)
+        else do
+          blockAll backend ref
+          if bytes <= size
+            then do
+              modify $ \s' -> s' { stateStaging = (base, size, bytes) }
+              return base
+            else do
+              backendUnregister backend base
+              free base
+              base' <- mallocBytes bytes
+              backendRegister backend base' bytes
+              modify $ \s' -> s' { stateStaging = (base', bytes, bytes) }
+              return base'
+
+    -- Kernel parameters of pointer size which point into a recorded
+    -- allocation are translated
+    parameter :: State -> B.ByteString -> IO B.ByteString
+    parameter !s !b
+      | B.length b /= sizeOf (undefined :: Word64) = return b
+      | otherwise                                   = do
+          w <- B.unsafeUseAsCString b $ \p -> peek (castPtr p) :: IO Word64
+          case translate s (fromIntegral w) of
+            Nothing -> return b
+            Just p' -> with (fromIntegral p' :: Word64) $ \p -> B.packCStringLen (castPtr p, 8)
+
+    withParams :: [B.ByteString] -> ([(Int, Ptr ())] -> IO a) -> IO a
+    withParams []     k = k []
+    withParams (b:bs) k =
+      B.unsafeUseAsCStringLen b $ \(p, n) ->
+        withParams bs (\ps -> k ((n, castPtr p) : ps))
+
+
+-- The replayed address of a recorded address inside an allocation
+--
+translate :: State -> WordPtr -> Maybe WordPtr
+translate !s !p =
+  case Map.lookupLE p (stateMemory s) of
+    Just (base, (base', n, _))
+      | p < base + fromIntegral (max 1 n) -> Just (base' + (p - base))
+    _                                      -> Nothing
+
+-- Wait for every stream, including the default stream
+--
+blockAll :: Backend -> IORef State -> IO ()
+blockAll !backend !ref = do
+  s <- readIORef ref
+  mapM_ (backendBlock backend) (Map.elems (stateStreams s))
+  backendBlock backend (Stream nullPtr)
+
+-- Release everything created by the replay
+--
+release :: Backend -> IORef State -> IO ()
+release !backend !ref = do
+  blockAll backend ref
+  s <- readIORef ref
+  forM_ (Map.elems (stateMemory s)) $ \(p, _, k) ->
+    case k of
+      HostMemory -> backendUnregister backend (wordPtrToPtr p) >> free (wordPtrToPtr p)
+      _          -> backendFree backend p
+  mapM_ (backendFreeStream backend) (Map.elems (stateStreams s))
+  let (base, _, _) = stateStaging s
+  backendUnregister backend base
+  free base
+
+
+--------------------------------------------------------------------------------
+-- Report
+--------------------------------------------------------------------------------
+
+-- |
+-- The replayed calls of one kind. Kernel launches are distinguished by the
+-- name of the kernel, where it was loaded during the recording.
+--
+data Summary = Summary
+  { summaryName         :: String
+  , summaryCalls        :: !Int
+  , summaryRecorded     :: !Word64      -- ^ total host time in the recording (nanoseconds)
+  , summaryReplayed     :: !Word64      -- ^ total host time in the replay (nanoseconds)
+  }
+  deriving Show
+
+-- |
+-- Summarise replayed calls by kind, in decreasing order of replayed time
+--
+summarise :: [Timing] -> [Summary]
+summarise ts =
+  sortBy (flip (comparing summaryReplayed))
+    [ Summary k c r p | (k, (c, r, p)) <- Map.toList byName ]
+  where
+    names  = Map.fromList [ (f, n) | Timing (Entry (GetFun _ n f) _ _ _) _ <- ts ]
+    byName = foldl' add Map.empty ts
+
+    add m (Timing e t) =
+      let r = entryEnd e - entryBegin e
+      in Map.insertWith plus (name (entryCall e)) (1, r, t) m
+
+    plus (a,b,c) (x,y,z) = (a+x, b+y, c+z)
+
+    name call =
+      case call of
+        Malloc k _ _                    -> "malloc " ++ kind k
+        Free k _                        -> "free " ++ kind k
+        Poke _ _ Nothing _              -> "poke"
+        Poke _ _ _ _                    -> "poke async"
+        Peek _ _ Nothing                -> "peek"
+        Peek _ _ _                      -> "peek async"
+        Copy _ _ _ Nothing              -> "copy"
+        Copy _ _ _ _                    -> "copy async"
+        Set _ _ _ _ Nothing             -> "memset"
+        Set _ _ _ _ _                   -> "memset async"
+        Launch f _ _ _ _ _              -> "launch " ++ Map.findWithDefault "<unknown>" f names
+        NewStream _                     -> "stream create"
+        FreeStream _                    -> "stream destroy"
+        BlockStream _                   -> "stream block"
+        WaitStream _ _                  -> "stream wait"
+        NewEvent _                      -> "event create"
+        FreeEvent _                     -> "event destroy"
+        RecordEvent _ _                 -> "event record"
+        BlockEvent _                    -> "event block"
+        LoadFile _ _                    -> "module load"
+        LoadData _ _                    -> "module load"
+        Unload _                        -> "module unload"
+        GetFun _ _ _                    -> "module function"
+        Sync                            -> "context sync"
+
+    kind DeviceMemory  = "device"
+    kind HostMemory    = "host"
+    kind ManagedMemory = "managed"
+
+-- |
+-- A readable table comparing the recorded and replayed time of each kind of
+-- call
+--
+render :: [Summary] -> String
+render ss = unlines $
+  printf "%-40s %10s %14s %14s %8s" "call" "count" "recorded (ms)" "replayed (ms)" "ratio"
+  : [ printf "%-40s %10d %14.3f %14.3f %8.2f"
+        (summaryName s) (summaryCalls s) (ms (summaryRecorded s)) (ms (summaryReplayed s))
+        (if summaryRecorded s == 0 then 0 else fromIntegral (summaryReplayed s) / fromIntegral (summaryRecorded s) :: Double)
+    | s <- ss ]
+  where
+    ms :: Word64 -> Double
+    ms t = fromIntegral t * 1.0e-6
@@ -0,0 +1,255 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Submission
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Submission of driver operations through a dedicated driver thread.
+--
+-- When many Haskell threads call into the driver concurrently, each must
+-- make its context current on whichever OS thread it happens to be running
+-- on, and the calls contend on locks inside the driver. As an alternative, a
+-- 'Submitter' owns a single bound OS thread on which the context is always
+-- current. Producer threads enqueue operations without blocking, and the
+-- driver thread drains the queue in batches, issuing the operations in the
+-- order they were submitted. The completion of each operation is delivered
+-- through a 'Future'.
+--
+-- The queue is a lock-free multi-producer, single-consumer stack: producers
+-- push with a single compare-and-swap, and the driver thread takes the
+-- entire contents at once. The driver thread only blocks when the queue is
+-- empty, and is woken by the first producer to push after it has gone to
+-- sleep.
+--
+-- A future is completed when the corresponding driver call returns. For
+-- asynchronous operations this means the operation has been enqueued in its
+-- stream, not that it has completed on the device.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Submission (
+
+  -- * Driver thread
+  Submitter,
+  new, destroy,
+
+  -- * Operations
+  submit,
+  launchKernel,
+  peekArrayAsync, pokeArrayAsync, copyArrayAsync, memsetAsync,
+  record, wait,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Context.Base                 ( Context )
+import Foreign.CUDA.Driver.Error                        ( CUDAException(..) )
+import Foreign.CUDA.Driver.Event                        ( Event, WaitFlag )
+import Foreign.CUDA.Driver.Exec                         ( Fun, FunParam )
+import Foreign.CUDA.Driver.Future                       ( Future )
+import Foreign.CUDA.Driver.Stream                       ( Stream )
+import qualified Foreign.CUDA.Driver.Context.Base       as Context
+import qualified Foreign.CUDA.Driver.Event              as Event
+import qualified Foreign.CUDA.Driver.Exec               as Exec
+import qualified Foreign.CUDA.Driver.Future             as Future
+import qualified Foreign.CUDA.Driver.Marshal            as Marshal
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.Maybe                                       ( isNothing )
+import Foreign.Storable
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- A driver thread, together with its queue of pending operations
+--
+data Submitter = Submitter
+  { submitQueue         :: {-# UNPACK #-} !(IORef Queue)
+  , submitWakeup        :: {-# UNPACK #-} !(MVar ())
+  , submitDone          :: {-# UNPACK #-} !(MVar ())
+  }
+
+-- Pending operations, most recently submitted first, whether the driver
+-- thread is (about to go to) sleep, and whether the queue has been closed.
+-- Closing the queue is signalled to the driver thread by 'Nothing' in the
+-- operation list; no operations are accepted after that.
+--
+data Queue = Queue ![Maybe Op] !Bool !Bool
+
+-- An operation, and how to fail it if it will never be executed
+--
+data Op = Op (IO ()) (SomeException -> IO ())
+
+
+--------------------------------------------------------------------------------
+-- Driver thread
+--------------------------------------------------------------------------------
+
+-- |
+-- Start a new driver thread for the given context. The program must be
+-- linked with the threaded runtime.
+--
+{-# INLINEABLE new #-}
+new :: Context -> IO Submitter
+new !ctx = do
+  queue  <- newIORef (Queue [] False False)
+  wakeup <- newEmptyMVar
+  done   <- newEmptyMVar
+  let s = Submitter queue wakeup done
+  _      <- forkOS $ do
+    r <- try (Context.push ctx >> drain s)
+    abandon s (either id (const closedError) r) `finally` putMVar done ()
+  return s
+
+
+-- |
+-- Wait for all submitted operations to be issued, then stop the driver
+-- thread. Operations submitted afterwards fail immediately.
+--
+{-# INLINEABLE destroy #-}
+destroy :: Submitter -> IO ()
+destroy !s = do
+  _ <- push s Nothing
+  readMVar (submitDone s)
+
+
+--------------------------------------------------------------------------------
+-- Operations
+--------------------------------------------------------------------------------
+
+-- |
+-- Execute an arbitrary action on the driver thread, where the context is
+-- current, and return its result through a future. If the submitter has been
+-- destroyed, or its driver thread has died, the future has already failed.
+--
+{-# INLINEABLE submit #-}
+submit :: Submitter -> IO a -> IO (Future a)
+submit !s action = do
+  f  <- Future.new
+  let run = do
+        r <- try action
+        case r of
+          Left e  -> Future.putException f (e :: SomeException)
+          Right x -> Future.put f x
+  ok <- push s (Just (Op run (Future.putException f)))
+  unless ok $ Future.putException f closedError
+  return f
+
+-- |
+-- Launch a kernel; see 'Foreign.CUDA.Driver.Exec.launchKernel'
+--
+{-# INLINEABLE launchKernel #-}
+launchKernel :: Submitter -> Fun -> (Int,Int,Int) -> (Int,Int,Int) -> Int -> Maybe Stream -> [FunParam] -> IO (Future ())
+launchKernel !s !fn !grid !block !sm !mst !args =
+  submit s (Exec.launchKernel fn grid block sm mst args)
+
+-- |
+-- Copy from the device to page-locked host memory; see
+-- 'Foreign.CUDA.Driver.Marshal.peekArrayAsync'
+--
+{-# INLINEABLE peekArrayAsync #-}
+peekArrayAsync :: Storable a => Submitter -> Int -> DevicePtr a -> HostPtr a -> Maybe Stream -> IO (Future ())
+peekArrayAsync !s !n !dptr !hptr !mst =
+  submit s (Marshal.peekArrayAsync n dptr hptr mst)
+
+-- |
+-- Copy from page-locked host memory to the device; see
+-- 'Foreign.CUDA.Driver.Marshal.pokeArrayAsync'
+--
+{-# INLINEABLE pokeArrayAsync #-}
+pokeArrayAsync :: Storable a => Submitter -> Int -> HostPtr a -> DevicePtr a -> Maybe Stream -> IO (Future ())
+pokeArrayAsync !s !n !hptr !dptr !mst =
+  submit s (Marshal.pokeArrayAsync n hptr dptr mst)
+
+-- |
+-- Copy between two device arrays; see
+-- 'Foreign.CUDA.Driver.Marshal.copyArrayAsync'
+--
+{-# INLINEABLE copyArrayAsync #-}
+copyArrayAsync :: Storable a => Submitter -> Int -> DevicePtr a -> DevicePtr a -> Maybe Stream -> IO (Future ())
+copyArrayAsync !s !n !src !dst !mst =
+  submit s (Marshal.copyArrayAsync n src dst mst)
+
+-- |
+-- Set device memory; see 'Foreign.CUDA.Driver.Marshal.memsetAsync'
+--
+{-# INLINEABLE memsetAsync #-}
+memsetAsync :: Storable a => Submitter -> DevicePtr a -> Int -> a -> Maybe Stream -> IO (Future ())
+memsetAsync !s !dptr !n !val !mst =
+  submit s (Marshal.memsetAsync dptr n val mst)
+
+-- |
+-- Record an event; see 'Foreign.CUDA.Driver.Event.record'
+--
+{-# INLINEABLE record #-}
+record :: Submitter -> Event -> Maybe Stream -> IO (Future ())
+record !s !ev !mst =
+  submit s (Event.record ev mst)
+
+-- |
+-- Make a stream wait on an event; see 'Foreign.CUDA.Driver.Event.wait'
+--
+{-# INLINEABLE wait #-}
+wait :: Submitter -> Event -> Maybe Stream -> [WaitFlag] -> IO (Future ())
+wait !s !ev !mst !flags =
+  submit s (Event.wait ev mst flags)
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Push an operation onto the queue, waking the driver thread if it was
+-- sleeping, or return False if the queue has been closed. Only the producer
+-- which observes the sleeping flag wakes it, so the wakeup variable is filled
+-- at most once per sleep.
+--
+push :: Submitter -> Maybe Op -> IO Bool
+push !s !op = do
+  r <- atomicModifyIORef' (submitQueue s) $ \q@(Queue ops z closed) ->
+    if closed
+      then (q, Nothing)
+      else (Queue (op:ops) False (isNothing op), Just z)
+  case r of
+    Nothing       -> return False
+    Just sleeping -> do
+      when sleeping $ putMVar (submitWakeup s) ()
+      return True
+
+-- Once the driver thread has stopped, for whatever reason, close the queue
+-- and fail the operations which remain in it.
+--
+abandon :: Submitter -> SomeException -> IO ()
+abandon !s !e = do
+  ops <- atomicModifyIORef' (submitQueue s) $ \(Queue ops _ _) -> (Queue [] False True, ops)
+  forM_ (reverse ops) $ \op ->
+    case op of
+      Just (Op _ failed) -> failed e
+      Nothing            -> return ()
+
+closedError :: SomeException
+closedError = toException (UserError "Submission.submit: submitter has been destroyed")
+
+-- The driver thread. Takes all pending operations at once and executes them
+-- in submission order, sleeping when there is nothing to do.
+--
+drain :: Submitter -> IO ()
+drain !s = do
+  ops <- atomicModifyIORef' (submitQueue s) $ \(Queue ops _ closed) -> (Queue [] (null ops) closed, ops)
+  case ops of
+    [] -> takeMVar (submitWakeup s) >> drain s
+    _  -> go (reverse ops)
+  where
+    go []                     = drain s
+    go (Nothing : _)          = return ()
+    go (Just (Op op _) : xs)  = op >> go xs
@@ -0,0 +1,132 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Texture.Cache
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A cache of texture objects.
+--
+-- Kernels which read the same arrays on every launch, such as the @x@ vector
+-- of a sparse-matrix vector multiply, would otherwise create and destroy a
+-- texture object around each launch. The cache keeps one object for each
+-- distinct resource and descriptor, so that it is created only on first use.
+-- Objects over an array must be 'evict'ed before the array is freed.
+--
+-- Texture objects are only valid in the context in which they were created,
+-- so a separate cache should be used for each context.
+--
+-- Requires CUDA-5.0.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Texture.Cache (
+
+  -- * Texture object cache
+  Cache,
+  new, lookup, evict, flush,
+  size,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Texture.Object               ( TexObject, Resource(..), Descriptor(..) )
+import qualified Foreign.CUDA.Driver.Texture.Object     as Object
+
+-- System
+import Control.Concurrent.MVar
+import Data.Map                                         ( Map )
+import Prelude                                          hiding ( lookup )
+import qualified Data.Map                               as Map
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- A cache of texture objects, keyed by the resource they read and how it is
+-- interpreted
+--
+newtype Cache = Cache (MVar (Map Key TexObject))
+
+-- The descriptor's enumerations are only Eq, so they are keyed by their
+-- numeric representation.
+--
+type Key = (Resource, (Int, Int, Int, Int, [Int]))
+
+key :: Resource -> Descriptor -> Key
+key !res !desc =
+  ( res
+  , ( fromEnum (descFormat desc)
+    , descChannels desc
+    , fromEnum (descAddressMode desc)
+    , fromEnum (descFilterMode desc)
+    , map fromEnum (descReadMode desc)
+    )
+  )
+
+
+--------------------------------------------------------------------------------
+-- Cache operations
+--------------------------------------------------------------------------------
+
+-- |
+-- Create a new, empty cache
+--
+{-# INLINEABLE new #-}
+new :: IO Cache
+new = Cache `fmap` newMVar Map.empty
+
+
+-- |
+-- Return the texture object reading the given resource with the given
+-- descriptor, creating it in the current context if it is not already in
+-- the cache.
+--
+{-# INLINEABLE lookup #-}
+lookup :: Cache -> Resource -> Descriptor -> IO TexObject
+lookup (Cache !var) !res !desc =
+  modifyMVar var $ \m ->
+    let k = key res desc
+    in case Map.lookup k m of
+         Just tex -> return (m, tex)
+         Nothing  -> do
+           tex <- Object.create res desc
+           return (Map.insert k tex m, tex)
+
+
+-- |
+-- Destroy all texture objects reading from the array starting at the given
+-- address. This must be done before the array is freed.
+--
+{-# INLINEABLE evict #-}
+evict :: Cache -> DevicePtr a -> IO ()
+evict (Cache !var) !dptr =
+  modifyMVar_ var $ \m -> do
+    let (gone, keep) = Map.partitionWithKey (\(res,_) _ -> base res == castDevPtr dptr) m
+    mapM_ Object.destroy (Map.elems gone)
+    return keep
+  where
+    base (ResourceLinear  p _)   = p
+    base (ResourcePitch2D p _ _) = p
+
+
+-- |
+-- Destroy all texture objects in the cache
+--
+{-# INLINEABLE flush #-}
+flush :: Cache -> IO ()
+flush (Cache !var) =
+  modifyMVar_ var $ \m -> do
+    mapM_ Object.destroy (Map.elems m)
+    return Map.empty
+
+
+-- |
+-- The number of texture objects in the cache
+--
+{-# INLINEABLE size #-}
+size :: Cache -> IO Int
+size (Cache !var) = Map.size `fmap` readMVar var
@@ -0,0 +1,250 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Trace
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A timeline of driver calls.
+--
+-- When enabled, every memory transfer, allocation, kernel launch, and stream,
+-- event and module operation made through these bindings is recorded
+-- together with the Haskell thread which made it, the stream it was issued
+-- to, the number of bytes involved, and when it started and finished on the
+-- host. Optionally, operations which are ordered in a stream are also given
+-- device timestamps, showing when they actually executed. The records can
+-- be written as a Chrome trace (viewable at @chrome:\/\/tracing@), and
+-- matching markers can be emitted to the GHC eventlog (when the program is
+-- run with @+RTS -l@).
+--
+-- Records are kept in a fixed-size buffer for each OS thread, and are
+-- dropped when the buffer is full; 'collect' the records regularly to avoid
+-- this. When tracing is disabled, the cost to each driver call is a single
+-- test of a flag.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Trace (
+
+  -- * Tracing
+  Config(..), API(..), Record(..),
+  defaultConfig,
+  enable, disable, collect, dropped,
+
+  -- * Export
+  chromeTrace, writeChromeTrace,
+  writeRecords, readRecords,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+import Foreign.CUDA.Internal.Trace
+
+-- System
+import Control.Concurrent.MVar
+import Data.List                                        ( intercalate, nub )
+import Data.Maybe                                       ( fromMaybe )
+import Data.Word
+import Foreign.Marshal                                  ( allocaArray, peekArray )
+import Foreign.Ptr
+import System.IO.Unsafe
+import Text.Printf
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- Tracing options
+--
+data Config = Config
+  { configBufferSize    :: !Int         -- ^ number of records buffered for each OS thread
+  , configDeviceTimes   :: !Bool        -- ^ record device timestamps of stream operations
+  , configEventlog      :: !Bool        -- ^ emit markers to the GHC eventlog
+  }
+  deriving Show
+
+-- |
+-- Buffer 64K records per thread, and record host timestamps only
+--
+defaultConfig :: Config
+defaultConfig = Config 65536 False False
+
+
+-- |
+-- A single traced driver call. Times are in nanoseconds on a monotonic
+-- clock.
+--
+data Record = Record
+  { recordAPI           :: !API
+  , recordThread        :: !Int                         -- ^ Haskell thread which made the call
+  , recordOSThread      :: !Int                         -- ^ OS thread which made the call
+  , recordStream        :: !Stream
+  , recordBytes         :: !Int
+  , recordBegin         :: !Word64
+  , recordEnd           :: !Word64
+  , recordDevice        :: !(Maybe (Word64, Word64))     -- ^ when the operation executed on the device
+  }
+  deriving Show
+
+
+--------------------------------------------------------------------------------
+-- Tracing
+--------------------------------------------------------------------------------
+
+-- |
+-- Start recording driver calls. The buffer size applies to threads which
+-- have not yet recorded anything.
+--
+{-# INLINEABLE enable #-}
+enable :: Config -> IO ()
+enable !config = do
+  hs_trace_configure (fromIntegral (configBufferSize config)) (if configDeviceTimes config then 1 else 0)
+  setEventlog (configEventlog config)
+  setEnabled True
+
+-- |
+-- Stop recording driver calls. Records already made can still be
+-- 'collect'ed.
+--
+{-# INLINEABLE disable #-}
+disable :: IO ()
+disable = setEnabled False
+
+
+-- |
+-- Remove all records from the buffers, oldest first for each OS thread. If
+-- device timestamps are enabled, this blocks until the device has executed
+-- every recorded operation.
+--
+{-# INLINEABLE collect #-}
+collect :: IO [Record]
+collect =
+  withMVar reader $ \_ ->
+  allocaArray (chunk * entryWords) $ \p ->
+    let go acc = do
+          n  <- fromIntegral `fmap` hs_trace_drain p (fromIntegral chunk)
+          ws <- peekArray (n * entryWords) p
+          let acc' = decode ws : acc
+          if n < chunk
+            then return (concat (reverse acc'))
+            else go acc'
+    in go []
+  where
+    chunk      = 4096
+    entryWords = 9
+
+    decode (api:thr:os:st:bytes:t0:t1:d0:d1:rest) =
+      Record { recordAPI      = toEnum (fromIntegral api)
+             , recordThread   = fromIntegral thr
+             , recordOSThread = fromIntegral os
+             , recordStream   = Stream (wordPtrToPtr (fromIntegral st))
+             , recordBytes    = fromIntegral bytes
+             , recordBegin    = t0
+             , recordEnd      = t1
+             , recordDevice   = if d0 == 0 || d1 == 0 then Nothing else Just (d0, d1)
+             }
+      : decode rest
+    decode _ = []
+
+-- Only one thread may drain the buffers at once
+--
+{-# NOINLINE reader #-}
+reader :: MVar ()
+reader = unsafePerformIO (newMVar ())
+
+
+-- |
+-- The number of records which have been dropped because a buffer was full
+--
+{-# INLINEABLE dropped #-}
+dropped :: IO Int
+dropped = fromIntegral `fmap` hs_trace_dropped
+
+
+--------------------------------------------------------------------------------
+-- Export
+--------------------------------------------------------------------------------
+
+-- |
+-- Render records in the Chrome trace event format. Host calls are shown for
+-- each Haskell thread, and device execution for each stream.
+--
+chromeTrace :: [Record] -> String
+chromeTrace rs =
+  "{\"traceEvents\":[\n" ++ intercalate ",\n" (meta ++ concatMap events rs) ++ "\n]}\n"
+  where
+    origin  = minimum (maxBound : map recordBegin rs)
+    us t    = fromIntegral (t - min t origin) / 1000 :: Double
+    streams = nub (map recordStream rs)
+
+    streamId st = length (takeWhile (/= st) streams)
+
+    meta =
+      [ "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"host\"}}"
+      , "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"device\"}}"
+      ] ++
+      [ printf "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":%d,\"args\":{\"name\":\"stream %s\"}}"
+          (streamId st) (show (useStream st))
+      | st <- streams ]
+
+    events r =
+      let name = apiName (recordAPI r)
+          args = printf "{\"stream\":\"%s\",\"bytes\":%d,\"os_thread\":%d}"
+                   (show (useStream (recordStream r))) (recordBytes r) (recordOSThread r) :: String
+          host = printf "{\"name\":\"%s\",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":%s}"
+                   name (recordThread r) (us (recordBegin r)) (us (recordEnd r) - us (recordBegin r)) args
+          dev  = case recordDevice r of
+                   Nothing       -> []
+                   Just (d0, d1) ->
+                     [ printf "{\"name\":\"%s\",\"cat\":\"device\",\"ph\":\"X\",\"pid\":2,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":%s}"
+                         name (streamId (recordStream r)) (us d0) (us d1 - us d0) args ]
+      in
+      host : dev
+
+
+-- |
+-- Write records to the given file as a Chrome trace
+--
+writeChromeTrace :: FilePath -> [Record] -> IO ()
+writeChromeTrace path rs = writeFile path (chromeTrace rs)
+
+
+-- |
+-- Write records to the given file, one per line, so that they can be read
+-- back with 'readRecords' for offline analysis (see
+-- "Foreign.CUDA.Driver.Trace.Overlap")
+--
+writeRecords :: FilePath -> [Record] -> IO ()
+writeRecords path rs = writeFile path (unlines (map line rs))
+  where
+    line r =
+      let (d0, d1) = fromMaybe (0,0) (recordDevice r)
+      in unwords $ show (recordAPI r)
+                 : map show [ fromIntegral (recordThread r), fromIntegral (recordOSThread r)
+                            , fromIntegral (ptrToWordPtr (useStream (recordStream r)))
+                            , fromIntegral (recordBytes r)
+                            , recordBegin r, recordEnd r, d0, d1 :: Word64 ]
+
+-- |
+-- Read records written by 'writeRecords'
+--
+readRecords :: FilePath -> IO [Record]
+readRecords path = (map record . filter (not . null) . map words . lines) `fmap` readFile path
+  where
+    record ws =
+      case ws of
+        api : [thr, os, st, bytes, t0, t1, d0, d1] ->
+          Record { recordAPI      = read api
+                 , recordThread   = read thr
+                 , recordOSThread = read os
+                 , recordStream   = Stream (wordPtrToPtr (fromIntegral (read st :: Word64)))
+                 , recordBytes    = read bytes
+                 , recordBegin    = read t0
+                 , recordEnd      = read t1
+                 , recordDevice   = if d0 == "0" || d1 == "0" then Nothing else Just (read d0, read d1)
+                 }
+        _ -> error ("readRecords: malformed record: " ++ unwords ws)
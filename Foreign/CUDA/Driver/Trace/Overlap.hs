@@ -0,0 +1,253 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Trace.Overlap
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Offline analysis of the overlap of copies and kernels in a recorded trace
+-- (see "Foreign.CUDA.Driver.Trace").
+--
+-- A device executes kernels on its compute engine, and copies on one or two
+-- copy engines (see 'Foreign.CUDA.Analysis.Device.asyncEngineCount'), all
+-- of which can be busy at once. The trace is divided into a timeline for
+-- each engine, from which are reported:
+--
+--   * the time each engine was busy, and the gaps in which it was idle;
+--
+--   * operations issued to the default stream, which (with the legacy
+--     default stream) do not overlap with work in any other stream;
+--
+--   * synchronous copies and memsets. Asynchronous copies in these bindings
+--     require page-locked memory, so transfers from pageable memory are
+--     always among the synchronous copies. These block the host thread
+--     until they complete, so it cannot issue further work in the meantime;
+--
+--   * time the host spent waiting in synchronisation calls; and
+--
+--   * an estimate of the speedup which could be achieved if the work were
+--     perfectly overlapped. Operations in the same stream must still run in
+--     order, so the trace can be no shorter than the busiest engine or the
+--     longest stream.
+--
+-- Asynchronous operations are placed on the timeline only if the trace was
+-- recorded with 'Foreign.CUDA.Driver.Trace.configDeviceTimes'; synchronous
+-- copies use their host times.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Trace.Overlap (
+
+  -- * Analysis
+  Engine(..), Usage(..), Serialisation(..), Analysis(..),
+  analyse, engine,
+
+  -- * Report
+  render,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+import Foreign.CUDA.Driver.Trace
+
+-- System
+import Data.List                                        ( sortBy, foldl' )
+import Data.Maybe
+import Data.Ord                                         ( comparing )
+import Data.Word
+import Foreign.Ptr
+import Text.Printf
+import Prelude
+import qualified Data.Map                               as Map
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- An engine of the device
+--
+data Engine
+  = ComputeEngine
+  | CopyEngine !Int
+  deriving (Eq, Ord, Show)
+
+-- |
+-- The timeline of a single engine. Times are in nanoseconds.
+--
+data Usage = Usage
+  { usageEngine         :: !Engine
+  , usageOperations     :: !Int
+  , usageBusy           :: !Word64
+  , usageGaps           :: [(Word64, Word64)]   -- ^ idle periods at least as long as the threshold
+  }
+  deriving Show
+
+-- |
+-- Operations of one kind which prevented overlap, and the time they took
+--
+data Serialisation = Serialisation
+  { serialCount         :: !Int
+  , serialTime          :: !Word64
+  }
+  deriving Show
+
+-- |
+-- The result of analysing a trace
+--
+data Analysis = Analysis
+  { analysisStart       :: !Word64              -- ^ when the first device operation began
+  , analysisSpan        :: !Word64              -- ^ from the first device operation to the end of the last
+  , analysisEngines     :: [Usage]
+  , analysisDefault     :: !Serialisation       -- ^ device operations in the default stream
+  , analysisSynchronous :: !Serialisation       -- ^ synchronous copies and memsets
+  , analysisWaiting     :: !Serialisation       -- ^ host synchronisation calls
+  , analysisUnmeasured  :: !Int                 -- ^ asynchronous operations without device times
+  , analysisIdeal       :: !Word64              -- ^ lower bound on the span with perfect overlap
+  , analysisSpeedup     :: !Double              -- ^ span relative to the ideal
+  }
+  deriving Show
+
+
+--------------------------------------------------------------------------------
+-- Analysis
+--------------------------------------------------------------------------------
+
+-- |
+-- The engine which executes an operation on a device with the given number
+-- of copy engines, if the operation executes on the device at all.
+-- Device-to-device and peer copies are placed on the first copy engine.
+--
+engine :: Int -> API -> Maybe Engine
+engine !copies !api =
+  case api of
+    LaunchKernel    -> Just ComputeEngine
+    Memset          -> Just ComputeEngine
+    MemsetAsync     -> Just ComputeEngine
+    MemcpyHtoD      -> copy 0
+    MemcpyHtoDAsync -> copy 0
+    MemcpyDtoH      -> copy 1
+    MemcpyDtoHAsync -> copy 1
+    MemcpyDtoD      -> copy 0
+    MemcpyDtoDAsync -> copy 0
+    MemcpyPeer      -> copy 0
+    MemcpyPeerAsync -> copy 0
+    _               -> Nothing
+  where
+    copy n
+      | copies <= 0 = Just ComputeEngine
+      | otherwise   = Just (CopyEngine (min n (copies - 1)))
+
+
+-- |
+-- Analyse a trace of a device with the given number of copy engines,
+-- reporting idle gaps at least as long as the given threshold
+-- (nanoseconds)
+--
+analyse :: Int -> Word64 -> [Record] -> Analysis
+analyse !copies !threshold rs =
+  Analysis { analysisStart       = start
+           , analysisSpan        = end - start
+           , analysisEngines     = [ usage e is | (e, is) <- Map.toList byEngine ]
+           , analysisDefault     = serial [ (b,e) | (r,_,b,e) <- ops, isDefault r ]
+           , analysisSynchronous = serial [ (b,e) | (r,_,b,e) <- ops, recordAPI r `elem` synchronous ]
+           , analysisWaiting     = serial [ (recordBegin r, recordEnd r) | r <- rs, recordAPI r `elem` waiting ]
+           , analysisUnmeasured  = length [ () | r <- rs, isJust (engine copies (recordAPI r))
+                                               , isNothing (interval r) ]
+           , analysisIdeal       = ideal
+           , analysisSpeedup     = if ideal == 0 then 1 else fromIntegral (end - start) / fromIntegral ideal
+           }
+  where
+    -- device operations placed on the timeline
+    ops       = [ (r, e, b, t) | r <- rs
+                               , Just e     <- [engine copies (recordAPI r)]
+                               , Just (b,t) <- [interval r] ]
+
+    interval r =
+      case recordDevice r of
+        Just d                                  -> Just d
+        Nothing
+          | recordAPI r `elem` synchronous      -> Just (recordBegin r, recordEnd r)
+          | otherwise                           -> Nothing
+
+    start     = if null ops then 0 else minimum [ b | (_,_,b,_) <- ops ]
+    end       = if null ops then 0 else maximum [ t | (_,_,_,t) <- ops ]
+
+    byEngine  = Map.fromListWith (++) [ (e, [(b,t)]) | (_,e,b,t) <- ops ]
+    byStream  = Map.fromListWith (+)  [ (ptrToWordPtr (useStream (recordStream r)), t - b) | (r,_,b,t) <- ops ]
+
+    ideal     = maximum (0 : map usageBusy (map (uncurry usage) (Map.toList byEngine)) ++ Map.elems byStream)
+
+    isDefault r = useStream (recordStream r) == nullPtr
+
+    synchronous = [ MemcpyHtoD, MemcpyDtoH, MemcpyDtoD, MemcpyPeer, Memset ]
+    waiting     = [ StreamSynchronize, EventSynchronize, CtxSynchronize ]
+
+    serial is = Serialisation (length is) (sum [ t - b | (b,t) <- is ])
+
+    usage e is =
+      let merged = merge (sortBy (comparing fst) is)
+          edges  = start : concat [ [b,t] | (b,t) <- merged ] ++ [end]
+          gaps   = [ (b,t) | (b,t) <- pairs edges, t > b, t - b >= threshold ]
+      in
+      Usage e (length is) (sum [ t - b | (b,t) <- merged ]) gaps
+
+    pairs (x:y:zs) = (x,y) : pairs zs
+    pairs _        = []
+
+    -- union of intervals sorted by their start
+    merge = reverse . foldl' step []
+      where
+        step ((b0,t0):acc) (b,t)
+          | b <= t0   = (b0, max t0 t) : acc
+        step acc i    = i : acc
+
+
+--------------------------------------------------------------------------------
+-- Report
+--------------------------------------------------------------------------------
+
+-- |
+-- A readable report of the analysis, listing at most the given number of
+-- the longest idle gaps of each engine
+--
+render :: Int -> Analysis -> String
+render !n a = unlines $
+  [ printf "span:              %s" (time (analysisSpan a))
+  , printf "ideal:             %s (speedup %.2fx if perfectly overlapped)" (time (analysisIdeal a)) (analysisSpeedup a)
+  , ""
+  ] ++
+  concat
+  [ printf "%-18s %s busy (%.1f%%), %d operations, %d gaps idle for %s"
+      (name (usageEngine u) ++ ":") (time (usageBusy u)) (percent (usageBusy u))
+      (usageOperations u) (length (usageGaps u)) (time (sum [ t - b | (b,t) <- usageGaps u ]))
+    : [ printf "    idle %s from +%s" (time (t - b)) (time (b - analysisStart a))
+      | (b,t) <- take n (sortBy (flip (comparing (\(b,t) -> t - b))) (usageGaps u)) ]
+  | u <- analysisEngines a ] ++
+  [ ""
+  , serial "default stream:"     "device operations which could not overlap other streams" (analysisDefault a)
+  , serial "synchronous copies:" "copies and memsets blocking the host, including all pageable transfers" (analysisSynchronous a)
+  , serial "host waiting:"       "synchronisation calls" (analysisWaiting a)
+  ] ++
+  [ printf "warning: %d asynchronous operations have no device times; record with configDeviceTimes" (analysisUnmeasured a)
+  | analysisUnmeasured a > 0 ]
+  where
+    name ComputeEngine  = "compute"
+    name (CopyEngine i) = "copy " ++ show i
+
+    percent :: Word64 -> Double
+    percent t
+      | analysisSpan a == 0 = 0
+      | otherwise           = 100 * fromIntegral t / fromIntegral (analysisSpan a)
+
+    serial :: String -> String -> Serialisation -> String
+    serial label what s =
+      printf "%-20s %6d %s, %s" label (serialCount s) what (time (serialTime s))
+
+    time :: Word64 -> String
+    time t
+      | t >= 1000000000 = printf "%.3f s"  (fromIntegral t * 1.0e-9 :: Double)
+      | t >= 1000000    = printf "%.3f ms" (fromIntegral t * 1.0e-6 :: Double)
+      | otherwise       = printf "%.3f us" (fromIntegral t * 1.0e-3 :: Double)
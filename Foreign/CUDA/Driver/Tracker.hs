@@ -0,0 +1,189 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Tracker
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Tracking of live memory allocations, for finding leaks.
+--
+-- While enabled, every allocation made with
+-- 'Foreign.CUDA.Driver.Marshal.mallocArray',
+-- 'Foreign.CUDA.Driver.Marshal.mallocHostArray' or
+-- 'Foreign.CUDA.Driver.Marshal.mallocManagedArray' (and the functions built
+-- on them) is recorded with its size, the time it was made, and a tag
+-- naming the code which made it (see 'withTag'), until it is freed. Reports
+-- list the tags holding the most memory, the oldest live allocations, and
+-- how fragmented device memory is.
+--
+-- The cost to each allocation and free is an update of a map, so tracking
+-- can be left enabled in long-running programs.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Tracker (
+
+  -- * Tracking
+  Kind(..), Block(..),
+  enable, disable, withTag, live,
+
+  -- * Reports
+  Allocator(..), Fragmentation(..),
+  topAllocators, oldest, fragmentation, report,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Driver.Marshal                      ( getMemInfo )
+import Foreign.CUDA.Internal.Clock
+import Foreign.CUDA.Internal.Tracker
+
+-- System
+import Data.Int
+import Data.List                                        ( sortBy )
+import Data.Ord                                         ( comparing )
+import Data.Word
+import Text.Printf
+import Prelude
+import qualified Data.Map                               as Map
+
+
+--------------------------------------------------------------------------------
+-- Tracking
+--------------------------------------------------------------------------------
+
+-- |
+-- Start tracking allocations. Allocations made before this are not known.
+--
+{-# INLINEABLE enable #-}
+enable :: IO ()
+enable = setTracking True
+
+-- |
+-- Stop tracking allocations, and forget those being tracked
+--
+{-# INLINEABLE disable #-}
+disable :: IO ()
+disable = setTracking False
+
+-- |
+-- The live allocations, in address order
+--
+{-# INLINEABLE live #-}
+live :: IO [Block]
+live = Map.elems `fmap` blocks
+
+
+--------------------------------------------------------------------------------
+-- Reports
+--------------------------------------------------------------------------------
+
+-- |
+-- The live allocations made under a single tag
+--
+data Allocator = Allocator
+  { allocatorTag        :: String
+  , allocatorBlocks     :: !Int
+  , allocatorBytes      :: !Int
+  }
+  deriving Show
+
+-- |
+-- The layout of device memory. Holes are the gaps between live device
+-- allocations; a large amount of memory in holes, but a small largest
+-- hole, means that a large allocation may fail even though there is enough
+-- free memory in total.
+--
+data Fragmentation = Fragmentation
+  { fragFree            :: !Int64       -- ^ free memory reported by the driver
+  , fragTotal           :: !Int64       -- ^ total memory reported by the driver
+  , fragLive            :: !Int         -- ^ bytes in live tracked allocations
+  , fragSpan            :: !Int         -- ^ bytes from the lowest to the highest allocated address
+  , fragHoles           :: !Int         -- ^ number of holes between allocations
+  , fragHoleBytes       :: !Int         -- ^ bytes in holes
+  , fragLargestHole     :: !Int         -- ^ bytes in the largest hole
+  }
+  deriving Show
+
+
+-- |
+-- The given number of tags holding the most live memory, largest first
+--
+{-# INLINEABLE topAllocators #-}
+topAllocators :: Int -> IO [Allocator]
+topAllocators !n = do
+  bs <- live
+  let m = Map.fromListWith plus [ (blockTag b, (1, blockSize b)) | b <- bs ]
+      plus (a,x) (b,y) = (a+b, x+y)
+  return . take n
+         . sortBy (flip (comparing allocatorBytes))
+         $ [ Allocator t c s | (t, (c, s)) <- Map.toList m ]
+
+-- |
+-- The given number of oldest live allocations, oldest first, together with
+-- their age (seconds)
+--
+{-# INLINEABLE oldest #-}
+oldest :: Int -> IO [(Block, Double)]
+oldest !n = do
+  bs  <- live
+  now <- getTime
+  return [ (b, elapsed (blockTime b) now) | b <- take n (sortBy (comparing blockTime) bs) ]
+
+-- |
+-- The fragmentation of device memory. The free and total memory are those
+-- of the device of the current context, so this is meaningful only if the
+-- tracked device allocations were all made on that device.
+--
+{-# INLINEABLE fragmentation #-}
+fragmentation :: IO Fragmentation
+fragmentation = do
+  (free, total) <- getMemInfo
+  bs            <- filter ((== DeviceMemory) . blockKind) `fmap` live
+  let
+      extent b  = (fromIntegral (blockAddress b), fromIntegral (blockAddress b) + blockSize b)
+      es        = map extent bs
+      holes     = [ lo' - hi | ((_, hi), (lo', _)) <- zip es (drop 1 es), lo' > hi ]
+      span'     = case es of
+                    [] -> 0
+                    _  -> snd (last es) - fst (head es)
+  --
+  return $ Fragmentation
+    { fragFree        = free
+    , fragTotal       = total
+    , fragLive        = sum (map blockSize bs)
+    , fragSpan        = span'
+    , fragHoles       = length holes
+    , fragHoleBytes   = sum holes
+    , fragLargestHole = maximum (0 : holes)
+    }
+
+
+-- |
+-- A readable report of the given number of top allocators and oldest
+-- allocations, and the fragmentation of device memory
+--
+{-# INLINEABLE report #-}
+report :: Int -> IO String
+report !n = do
+  as <- topAllocators n
+  os <- oldest n
+  f  <- fragmentation
+  return . unlines $
+    [ "top allocators:" ] ++
+    [ printf "  %12d bytes %8d blocks  %s" (allocatorBytes a) (allocatorBlocks a) (allocatorTag a) | a <- as ] ++
+    [ "oldest allocations:" ] ++
+    [ printf "  %12d bytes  %-7s 0x%016x  %10.1f s  %s" (blockSize b) (kind (blockKind b)) (word (blockAddress b)) age (blockTag b) | (b, age) <- os ] ++
+    [ "device memory:"
+    , printf "  %d of %d bytes free" (fragFree f) (fragTotal f)
+    , printf "  %d bytes live in a span of %d bytes" (fragLive f) (fragSpan f)
+    , printf "  %d holes of %d bytes, the largest %d bytes" (fragHoles f) (fragHoleBytes f) (fragLargestHole f)
+    ]
+  where
+    word :: Integral a => a -> Word64
+    word = fromIntegral
+
+    kind :: Kind -> String
+    kind DeviceMemory  = "device"
+    kind HostMemory    = "host"
+    kind ManagedMemory = "managed"
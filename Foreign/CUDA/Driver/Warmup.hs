@@ -0,0 +1,252 @@
+{-# LANGUAGE BangPatterns #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Driver.Warmup
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Background initialisation of devices at program start.
+--
+-- The first use of a device pays for several expensive, one-off operations:
+-- initialising the driver, creating or retaining a context, loading (and
+-- possibly JIT compiling) modules, and the first allocations of device
+-- memory. Rather than paying these costs on the first request, a program can
+-- describe the resources it needs up front and 'start' creating them on
+-- background threads, continuing with its own initialisation in the
+-- meantime. The returned 'Future' is completed once every device is ready,
+-- together with the time each phase took.
+--
+-- Devices are initialised concurrently, and the modules of each device are
+-- loaded concurrently with one another. The program must be linked with the
+-- threaded runtime.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Driver.Warmup (
+
+  -- * Warm-up
+  Spec(..), ContextMode(..), Warm(..), Resources(..), Timings(..),
+  spec, start, release,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Ptr
+import Foreign.CUDA.Driver.Context.Base                 ( Context, ContextFlag )
+import Foreign.CUDA.Driver.Device                       ( Device )
+import Foreign.CUDA.Driver.Future                       ( Future )
+import Foreign.CUDA.Driver.Module.Base                  ( Module )
+import Foreign.CUDA.Driver.Stream                       ( Stream )
+import Foreign.CUDA.Internal.Clock
+import qualified Foreign.CUDA.Driver.Context.Base       as Context
+import qualified Foreign.CUDA.Driver.Context.Primary    as Primary
+import qualified Foreign.CUDA.Driver.Device             as Device
+import qualified Foreign.CUDA.Driver.Future             as Future
+import qualified Foreign.CUDA.Driver.Marshal            as Marshal
+import qualified Foreign.CUDA.Driver.Module.Base        as Module
+import qualified Foreign.CUDA.Driver.Stream             as Stream
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.Either
+import Data.Word
+import Prelude
+
+
+--------------------------------------------------------------------------------
+-- Data Types
+--------------------------------------------------------------------------------
+
+-- |
+-- The resources to prepare on a single device
+--
+data Spec = Spec
+  { specDevice          :: !Int                 -- ^ device ordinal
+  , specContext         :: !ContextMode         -- ^ how to obtain the context
+  , specModules         :: [FilePath]           -- ^ modules to load into the context
+  , specStreams         :: !Int                 -- ^ number of streams to create
+  , specPools           :: [Int]                -- ^ size (bytes) of each device memory region to allocate
+  }
+  deriving Show
+
+-- |
+-- Whether to create a new context or to retain the device's primary context
+-- (requires CUDA-7.0).
+--
+data ContextMode
+  = NewContext [ContextFlag]
+  | PrimaryContext
+  deriving Show
+
+-- |
+-- A new context on the given device, and nothing else
+--
+spec :: Int -> Spec
+spec !dev = Spec dev (NewContext []) [] 0 []
+
+
+-- |
+-- The resources prepared on each device, in the order they were specified
+--
+data Warm = Warm
+  { warmResources       :: [Resources]
+  , warmInitialise      :: !Double              -- ^ time (seconds) to initialise the driver
+  , warmTotal           :: !Double              -- ^ time (seconds) until every device was ready
+  }
+
+-- |
+-- The resources prepared on a single device. The context is not current on
+-- any thread once warm-up has completed.
+--
+data Resources = Resources
+  { resourceSpec        :: !Spec
+  , resourceDevice      :: !Device
+  , resourceContext     :: !Context
+  , resourceModules     :: [(FilePath, Module)]
+  , resourceStreams     :: [Stream]
+  , resourcePools       :: [DevicePtr Word8]
+  , resourceTimings     :: !Timings
+  }
+
+-- |
+-- Time (seconds) spent in each phase of preparing a device
+--
+data Timings = Timings
+  { timeContext         :: !Double
+  , timeModules         :: !Double
+  , timeStreams         :: !Double
+  , timePools           :: !Double
+  }
+  deriving Show
+
+
+--------------------------------------------------------------------------------
+-- Warm-up
+--------------------------------------------------------------------------------
+
+-- |
+-- Initialise the driver and prepare the resources of each device on
+-- background threads, returning immediately. The future is completed once
+-- all devices are ready. If preparing any device fails, the resources of
+-- all devices are released and the future holds the first exception.
+--
+{-# INLINEABLE start #-}
+start :: [Spec] -> IO (Future Warm)
+start !specs = do
+  f  <- Future.new
+  t0 <- getTime
+  _  <- forkIO $ do
+    r <- try $ do
+      Device.initialise []
+      t1 <- getTime
+      rs <- concurrently (map prepare specs)
+      case partitionEithers rs of
+        ([], ok) -> do
+          t2 <- getTime
+          return $ Warm ok (elapsed t0 t1) (elapsed t0 t2)
+        (e:_, ok) -> do
+          mapM_ releaseResources ok
+          throwIO e
+    case r of
+      Left e  -> Future.putException f (e :: SomeException)
+      Right w -> Future.put f w
+  return f
+
+
+-- |
+-- Release all of the resources which were prepared
+--
+{-# INLINEABLE release #-}
+release :: Warm -> IO ()
+release !w = mapM_ releaseResources (warmResources w)
+
+
+--------------------------------------------------------------------------------
+-- Internal
+--------------------------------------------------------------------------------
+
+-- Prepare a single device. This runs on its own bound thread, on which the
+-- context is current for the duration. On failure, anything already created
+-- is released before the exception is re-thrown.
+--
+prepare :: Spec -> IO Resources
+prepare !s = do
+  dev        <- Device.device (specDevice s)
+  (ctx, tc)  <- timed $ case specContext s of
+                  NewContext flags -> Context.create dev flags
+                  PrimaryContext   -> do ctx <- Primary.retain dev
+                                         Context.push ctx `onException` Primary.release dev
+                                         return ctx
+  let
+      releaseContext = case specContext s of
+                         NewContext _   -> Context.destroy ctx
+                         PrimaryContext -> Context.pop >> Primary.release dev
+  --
+  flip onException releaseContext $ do
+    (mdls, tm) <- timed $ loadModules ctx (specModules s)
+    (sts,  ts) <- timed $ allocateAll (replicate (specStreams s) (Stream.create [])) Stream.destroy
+                            `onException` mapM_ (Module.unload . snd) mdls
+    (ps,   tp) <- timed $ allocateAll (map Marshal.mallocArray (specPools s)) Marshal.free
+                            `onException` (mapM_ Stream.destroy sts >> mapM_ (Module.unload . snd) mdls)
+    _          <- Context.pop
+    return $ Resources s dev ctx mdls sts ps (Timings tc tm ts tp)
+
+
+-- Release the resources of a single device, on a bound thread so that the
+-- context remains current throughout.
+--
+releaseResources :: Resources -> IO ()
+releaseResources !r = runInBoundThread $ do
+  Context.push (resourceContext r)
+  mapM_ Marshal.free (resourcePools r)
+  mapM_ Stream.destroy (resourceStreams r)
+  mapM_ (Module.unload . snd) (resourceModules r)
+  case specContext (resourceSpec r) of
+    NewContext _   -> Context.destroy (resourceContext r)
+    PrimaryContext -> Context.pop >> Primary.release (resourceDevice r)
+
+
+-- Load each module concurrently, on a separate bound thread with the context
+-- current. If any fails, those which succeeded are unloaded again.
+--
+loadModules :: Context -> [FilePath] -> IO [(FilePath, Module)]
+loadModules !ctx !paths = do
+  rs <- concurrently [ bracket_ (Context.push ctx) Context.pop (Module.loadFile p) | p <- paths ]
+  case partitionEithers rs of
+    ([], ok) -> return (zip paths ok)
+    (e:_, _) -> do
+      sequence_ [ Module.unload m | Right m <- rs ]
+      throwIO e
+
+
+-- Run each action on its own bound thread and wait for all of them
+--
+concurrently :: [IO a] -> IO [Either SomeException a]
+concurrently actions = do
+  vars <- forM actions $ \action -> do
+    var <- newEmptyMVar
+    _   <- forkOS (putMVar var =<< try action)
+    return var
+  mapM takeMVar vars
+
+
+-- Run each action in turn. If one fails, release the results of those which
+-- came before it.
+--
+allocateAll :: [IO a] -> (a -> IO ()) -> IO [a]
+allocateAll actions free = go [] actions
+  where
+    go acc []     = return (reverse acc)
+    go acc (a:as) = do
+      x <- a `onException` mapM_ free acc
+      go (x:acc) as
+
+
+timed :: IO a -> IO (a, Double)
+timed action = do
+  t0 <- getTime
+  r  <- action
+  t1 <- getTime
+  return (r, elapsed t0 t1)
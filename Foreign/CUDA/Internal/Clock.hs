@@ -0,0 +1,37 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Clock
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- A monotonic wall clock, for measuring latencies on the host
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Clock (
+
+  getTime, elapsed,
+
+) where
+
+-- System
+import Data.Word
+
+
+-- |
+-- Current value of the clock, in nanoseconds since some unspecified point
+--
+{-# INLINE getTime #-}
+getTime :: IO Word64
+getTime = hs_clock_monotonic_ns
+
+-- |
+-- Seconds elapsed between two clock readings
+--
+{-# INLINE elapsed #-}
+elapsed :: Word64 -> Word64 -> Double
+elapsed t0 t1 = fromIntegral (t1 - t0) * 1.0e-9
+
+
+foreign import ccall unsafe "cbits/clock.h hs_clock_monotonic_ns" hs_clock_monotonic_ns :: IO Word64
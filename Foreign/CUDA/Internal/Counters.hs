@@ -0,0 +1,100 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Counters
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Always-on counters of driver calls, live memory and kernel launches. See
+-- "Foreign.CUDA.Driver.Counters" for the user interface.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Counters (
+
+  Kind(..),
+  launched, allocated, released,
+  maxAPIs, memoryKinds, maxKernels,
+
+  hs_counters_api, hs_counters_read, hs_counters_launches,
+  finalizerFreeHost,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Internal.Tracker                    ( Kind(..), track, untrack )
+
+-- System
+import Data.Word
+import Foreign.C
+import Foreign.ForeignPtr
+import Foreign.Ptr
+import Foreign.Storable
+import System.IO.Unsafe
+import Prelude
+
+
+-- |
+-- Execute a kernel launch, counting it once it has been issued
+--
+{-# INLINE launched #-}
+launched :: Ptr () -> IO a -> IO a
+launched !fn action = do
+  r <- action
+  hs_counters_launch fn
+  return r
+
+-- |
+-- Record an allocation of the given size (bytes)
+--
+{-# INLINE allocated #-}
+allocated :: Kind -> Ptr a -> Int -> IO ()
+allocated !kind !p !bytes = do
+  hs_counters_alloc (fromIntegral (fromEnum kind)) (castPtr p) (fromIntegral bytes)
+  track kind (castPtr p) bytes
+
+-- |
+-- Record that an allocation was freed. Call this before the driver frees
+-- the memory, so that the record can not be confused with that of a later
+-- allocation at the same address (see 'untrack').
+--
+{-# INLINE released #-}
+released :: Ptr a -> IO ()
+released !p = do
+  hs_counters_free (castPtr p)
+  untrack (castPtr p)
+
+
+-- |
+-- The number of driver calls, kinds of memory and kernels counted, as
+-- defined in counters.h
+--
+{-# NOINLINE maxAPIs #-}
+maxAPIs :: Int
+maxAPIs = unsafePerformIO $ fromIntegral `fmap` peek hs_counters_api_size
+
+{-# NOINLINE memoryKinds #-}
+memoryKinds :: Int
+memoryKinds = unsafePerformIO $ fromIntegral `fmap` peek hs_counters_kinds_size
+
+{-# NOINLINE maxKernels #-}
+maxKernels :: Int
+maxKernels = unsafePerformIO $ fromIntegral `fmap` peek hs_counters_kernels_size
+
+
+foreign import ccall unsafe "cbits/counters.h hs_counters_api"       hs_counters_api       :: Word32 -> Word64 -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_launch"    hs_counters_launch    :: Ptr () -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_alloc"     hs_counters_alloc     :: Word32 -> Ptr () -> Word64 -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_free"      hs_counters_free      :: Ptr () -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_read"      hs_counters_read      :: Ptr Word64 -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_launches"  hs_counters_launches  :: Ptr Word64 -> IO CSize
+
+foreign import ccall "cbits/counters.h &hs_counters_api_size"     hs_counters_api_size     :: Ptr Word32
+foreign import ccall "cbits/counters.h &hs_counters_kinds_size"   hs_counters_kinds_size   :: Ptr Word32
+foreign import ccall "cbits/counters.h &hs_counters_kernels_size" hs_counters_kernels_size :: Ptr Word32
+
+-- Release page-locked host memory and record that it was freed, for use as
+-- a finaliser
+--
+foreign import ccall "cbits/counters.h &hs_counters_free_host" finalizerFreeHost :: FinalizerPtr a
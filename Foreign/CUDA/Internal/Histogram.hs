@@ -0,0 +1,144 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE EmptyDataDecls           #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Histogram
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Instrumentation of kernel launches. Launches are wrapped with 'measured',
+-- which costs a single test of a flag when timing is disabled, and kernel
+-- functions are given names with 'register' as they are looked up. See
+-- "Foreign.CUDA.Driver.Histogram" for the user interface.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Histogram (
+
+  measured, register,
+  setEnabled, setSelection, kernelName,
+
+  Sample,
+  hs_hist_configure, hs_hist_snapshot, hs_hist_reset, hs_hist_skipped,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+
+-- System
+import Control.Concurrent.MVar
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.Map                                         ( Map )
+import Data.Set                                         ( Set )
+import Data.Word
+import Foreign.C
+import Foreign.Marshal                                  ( withArrayLen )
+import Foreign.Ptr
+import System.IO.Unsafe
+import Prelude
+import qualified Data.Map                               as Map
+import qualified Data.Set                               as Set
+
+
+-- Global state: whether launches are timed, the names of the kernels which
+-- are timed on every launch, and the names of every kernel looked up so far
+--
+{-# NOINLINE enabled #-}
+enabled :: IORef Bool
+enabled = unsafePerformIO (newIORef False)
+
+{-# NOINLINE selection #-}
+selection :: IORef (Set String)
+selection = unsafePerformIO (newIORef Set.empty)
+
+{-# NOINLINE names #-}
+names :: IORef (Map (Ptr ()) String)
+names = unsafePerformIO (newIORef Map.empty)
+
+-- Only one thread may replace the set of selected kernels at once
+--
+{-# NOINLINE selecting #-}
+selecting :: MVar ()
+selecting = unsafePerformIO (newMVar ())
+
+setEnabled :: Bool -> IO ()
+setEnabled = atomicWriteIORef enabled
+
+
+-- |
+-- Execute a kernel launch, timing it if it is selected or sampled. The
+-- arguments are the kernel function and the stream it is launched into.
+--
+{-# INLINE measured #-}
+measured :: Ptr () -> Stream -> IO a -> IO a
+measured !fn !st action = do
+  on <- readIORef enabled
+  if on
+    then sample fn st action
+    else action
+
+{-# NOINLINE sample #-}
+sample :: Ptr () -> Stream -> IO a -> IO a
+sample !fn !st action = do
+  s <- hs_hist_begin fn (useStream st)
+  if s == nullPtr
+    then action
+    else do
+      r <- action `onException` hs_hist_cancel s
+      hs_hist_end s (useStream st)
+      return r
+
+
+-- |
+-- Record the name of a kernel function, and time every launch of it if that
+-- name is selected
+--
+{-# INLINEABLE register #-}
+register :: Ptr () -> String -> IO ()
+register !fn !name = do
+  atomicModifyIORef' names (\m -> (Map.insert fn name m, ()))
+  sel <- readIORef selection
+  when (name `Set.member` sel) $ select sel
+
+-- |
+-- Time every launch of the kernels with the given names
+--
+{-# INLINEABLE setSelection #-}
+setSelection :: [String] -> IO ()
+setSelection ks = do
+  let sel = Set.fromList ks
+  atomicWriteIORef selection sel
+  select sel
+
+-- Pass the set of kernel functions with the selected names to the C side in
+-- a single call, which replaces the previous set
+--
+select :: Set String -> IO ()
+select sel =
+  withMVar selecting $ \_ -> do
+    fns <- readIORef names
+    withArrayLen [ fn | (fn, name) <- Map.toList fns, name `Set.member` sel ] $ \n p ->
+      hs_hist_select p (fromIntegral n)
+
+-- |
+-- The name of a kernel function, if it was looked up by name
+--
+{-# INLINEABLE kernelName #-}
+kernelName :: Ptr () -> IO (Maybe String)
+kernelName !fn = Map.lookup fn `fmap` readIORef names
+
+
+data Sample
+
+foreign import ccall unsafe "cbits/histogram.h hs_hist_configure" hs_hist_configure :: Word32 -> CSize -> IO ()
+foreign import ccall unsafe "cbits/histogram.h hs_hist_select"    hs_hist_select    :: Ptr (Ptr ()) -> CSize -> IO ()
+foreign import ccall unsafe "cbits/histogram.h hs_hist_begin"     hs_hist_begin     :: Ptr () -> Ptr () -> IO (Ptr Sample)
+foreign import ccall safe   "cbits/histogram.h hs_hist_end"       hs_hist_end       :: Ptr Sample -> Ptr () -> IO ()
+foreign import ccall unsafe "cbits/histogram.h hs_hist_cancel"    hs_hist_cancel    :: Ptr Sample -> IO ()
+foreign import ccall safe   "cbits/histogram.h hs_hist_snapshot"  hs_hist_snapshot  :: Ptr Word64 -> CSize -> IO CSize
+foreign import ccall safe   "cbits/histogram.h hs_hist_reset"     hs_hist_reset     :: IO ()
+foreign import ccall unsafe "cbits/histogram.h hs_hist_skipped"   hs_hist_skipped   :: IO Word64
@@ -0,0 +1,350 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Record
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Recording of driver calls to a file. The bindings wrap each call of
+-- interest with 'recorded', which costs a single test of a flag when
+-- recording is disabled. See "Foreign.CUDA.Driver.Record" for the user
+-- interface.
+--
+-- The file begins with a magic number and version, followed by one entry
+-- for each call. An entry is a header of machine words: the operation, the
+-- Haskell thread which made the call, when it began and ended on the host,
+-- the number of argument words and of data blocks, and then the arguments
+-- and the length of each data block. The data blocks follow, each padded to
+-- a multiple of 8 bytes.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Record (
+
+  Call(..), Entry(..),
+  recorded, recordedWith, payload, imageSize, streamWord,
+  start, stop,
+  encode, decode, magic, version,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+import Foreign.CUDA.Internal.Clock
+import Foreign.CUDA.Internal.Trace                      ( currentThreadId )
+import Foreign.CUDA.Internal.Tracker                    ( Kind(..) )
+
+-- System
+import Control.Concurrent.MVar
+import Control.Monad
+import Data.ByteString                                  ( ByteString )
+import Data.IORef
+import Data.Word
+import Foreign.C
+import Foreign.Marshal                                  ( allocaArray, pokeArray, with )
+import Foreign.Ptr
+import Foreign.Storable
+import System.IO
+import System.IO.Unsafe
+import Prelude
+import qualified Data.ByteString                        as B
+
+
+-- |
+-- A recorded driver call. Device pointers, streams, events, modules and
+-- functions are identified by their address in the recording process;
+-- operations which may be asynchronous give the stream they were issued to,
+-- or 'Nothing' if they were synchronous.
+--
+data Call
+  = Malloc        !Kind !Int !WordPtr                   -- ^ kind, bytes, address
+  | Free          !Kind !WordPtr                        -- ^ kind, address
+  | Poke          !Int !WordPtr !(Maybe WordPtr) !(Maybe ByteString)
+                                                        -- ^ bytes, destination, stream, and the data if recorded
+  | Peek          !Int !WordPtr !(Maybe WordPtr)        -- ^ bytes, source, stream
+  | Copy          !Int !WordPtr !WordPtr !(Maybe WordPtr)
+                                                        -- ^ bytes, source, destination, stream
+  | Set           !WordPtr !Int !Int !Word32 !(Maybe WordPtr)
+                                                        -- ^ destination, count, element width (bytes), value, stream
+  | Launch        !WordPtr !(Int,Int,Int) !(Int,Int,Int) !Int !WordPtr [ByteString]
+                                                        -- ^ function, grid, thread block, shared memory, stream, parameters
+  | NewStream     !WordPtr
+  | FreeStream    !WordPtr
+  | BlockStream   !WordPtr
+  | WaitStream    !WordPtr !WordPtr                     -- ^ stream, event
+  | NewEvent      !WordPtr
+  | FreeEvent     !WordPtr
+  | RecordEvent   !WordPtr !WordPtr                     -- ^ event, stream
+  | BlockEvent    !WordPtr
+  | LoadFile      FilePath !WordPtr                     -- ^ file, module
+  | LoadData      ByteString !WordPtr                   -- ^ image, module
+  | Unload        !WordPtr
+  | GetFun        !WordPtr String !WordPtr              -- ^ module, name, function
+  | Sync
+  deriving (Eq, Show)
+
+-- |
+-- A call together with the Haskell thread which made it, and when it began
+-- and ended on the host (nanoseconds, monotonic)
+--
+data Entry = Entry
+  { entryCall           :: !Call
+  , entryThread         :: !Int
+  , entryBegin          :: !Word64
+  , entryEnd            :: !Word64
+  }
+  deriving Show
+
+
+-- Global state: whether calls are recorded, whether transferred data is
+-- recorded with them, and the file they are written to
+--
+{-# NOINLINE enabled #-}
+enabled :: IORef Bool
+enabled = unsafePerformIO (newIORef False)
+
+{-# NOINLINE payloads #-}
+payloads :: IORef Bool
+payloads = unsafePerformIO (newIORef False)
+
+{-# NOINLINE output #-}
+output :: MVar (Maybe Handle)
+output = unsafePerformIO (newMVar Nothing)
+
+
+-- |
+-- Execute a driver operation, recording the given call once it completes if
+-- recording is enabled
+--
+{-# INLINE recorded #-}
+recorded :: Call -> IO a -> IO a
+recorded call = recordedWith (\_ -> return call)
+
+-- |
+-- As 'recorded', but the call is made from the result of the operation
+--
+{-# INLINE recordedWith #-}
+recordedWith :: (a -> IO Call) -> IO a -> IO a
+recordedWith mk action = do
+  on <- readIORef enabled
+  if on
+    then record mk action
+    else action
+
+{-# NOINLINE record #-}
+record :: (a -> IO Call) -> IO a -> IO a
+record mk action = do
+  t0   <- getTime
+  r    <- action
+  t1   <- getTime
+  call <- mk r
+  tid  <- currentThreadId
+  withMVar output $ maybe (return ()) (\h -> write h (Entry call (fromIntegral tid) t0 t1))
+  return r
+
+
+-- |
+-- The given number of bytes at the address, if data is being recorded
+--
+{-# INLINEABLE payload #-}
+payload :: Ptr a -> Int -> IO (Maybe ByteString)
+payload !p !n = do
+  on <- readIORef payloads
+  if on
+    then Just `fmap` B.packCStringLen (castPtr p, n)
+    else return Nothing
+
+-- |
+-- The size in bytes of a module image: an ELF object (cubin), a fat binary,
+-- or otherwise a NUL-terminated string (PTX)
+--
+imageSize :: Ptr Word8 -> IO Int
+imageSize !img = do
+  hdr <- forM [0..3] (peekByteOff img) :: IO [Word8]
+  fat <- peekByteOff img 0             :: IO Word32
+  case hdr of
+    [0x7f, 0x45, 0x4c, 0x46] -> do
+      cls <- peekByteOff img 4 :: IO Word8
+      if cls == 2
+        then elf (peekByteOff img 0x20 :: IO Word64) 0x36 0x38 (peekByteOff img 0x28 :: IO Word64) 0x3a 0x3c
+        else elf (peekByteOff img 0x1c :: IO Word32) 0x2a 0x2c (peekByteOff img 0x20 :: IO Word32) 0x2e 0x30
+    _ | fat == 0xba55ed50    -> do
+          hsize <- peekByteOff img 6 :: IO Word16
+          fsize <- peekByteOff img 8 :: IO Word64
+          return (fromIntegral hsize + fromIntegral fsize)
+      | otherwise            -> fromIntegral `fmap` c_strlen (castPtr img)
+  where
+    -- the program and section header tables are at the end of the image
+    elf :: Integral i => IO i -> Int -> Int -> IO i -> Int -> Int -> IO Int
+    elf phoff phentsize phnum shoff shentsize shnum = do
+      ph  <- fromIntegral `fmap` phoff
+      phs <- (peekByteOff img phentsize :: IO Word16)
+      phn <- (peekByteOff img phnum     :: IO Word16)
+      sh  <- fromIntegral `fmap` shoff
+      shs <- (peekByteOff img shentsize :: IO Word16)
+      shn <- (peekByteOff img shnum     :: IO Word16)
+      return $ max (ph + fromIntegral phs * fromIntegral phn)
+                   (sh + fromIntegral shs * fromIntegral shn)
+
+-- |
+-- The identity of the stream an asynchronous operation is issued to
+--
+{-# INLINE streamWord #-}
+streamWord :: Maybe Stream -> WordPtr
+streamWord = maybe 0 (ptrToWordPtr . useStream)
+
+
+-- |
+-- Start recording calls to the given file, replacing any recording in
+-- progress. If the flag is set, the data of host to device transfers is
+-- also recorded.
+--
+start :: FilePath -> Bool -> IO ()
+start path withData =
+  modifyMVar_ output $ \old -> do
+    maybe (return ()) hClose old
+    h <- openBinaryFile path WriteMode
+    B.hPut h magic
+    with version $ \p -> hPutBuf h p 8
+    atomicWriteIORef payloads withData
+    atomicWriteIORef enabled True
+    return (Just h)
+
+-- |
+-- Stop recording, and close the file
+--
+stop :: IO ()
+stop =
+  modifyMVar_ output $ \old -> do
+    atomicWriteIORef enabled False
+    maybe (return ()) hClose old
+    return Nothing
+
+
+-- |
+-- The magic number at the start of a recording
+--
+magic :: ByteString
+magic = B.pack (map (fromIntegral . fromEnum) "HSCUREC\0")
+
+-- |
+-- The version of the file format
+--
+version :: Word64
+version = 1
+
+-- Append an entry to the file
+--
+write :: Handle -> Entry -> IO ()
+write !h !e = do
+  let (op, args, blobs) = encode (entryCall e)
+      ws                = [ op, fromIntegral (entryThread e), entryBegin e, entryEnd e
+                          , fromIntegral (length args), fromIntegral (length blobs) ]
+                          ++ args
+                          ++ map (fromIntegral . B.length) blobs
+      n                 = length ws
+  allocaArray n $ \p -> do
+    pokeArray p ws
+    hPutBuf h p (n * 8)
+  forM_ blobs $ \b -> do
+    B.hPut h b
+    B.hPut h (B.replicate (negate (B.length b) `mod` 8) 0)
+
+
+-- |
+-- The operation, argument words, and data blocks of a call
+--
+encode :: Call -> (Word64, [Word64], [ByteString])
+encode call =
+  case call of
+    Malloc k n p              -> ( 0, [kind k, int n, ptr p], [])
+    Free k p                  -> ( 1, [kind k, ptr p], [])
+    Poke n d s b              -> ( 2, [int n, ptr d, stream s], maybe [] return b)
+    Peek n d s                -> ( 3, [int n, ptr d, stream s], [])
+    Copy n s d st             -> ( 4, [int n, ptr s, ptr d, stream st], [])
+    Set d n w v s             -> ( 5, [ptr d, int n, int w, fromIntegral v, stream s], [])
+    Launch f (gx,gy,gz) (tx,ty,tz) sm s ps
+                              -> ( 6, [ptr f, int gx, int gy, int gz, int tx, int ty, int tz, int sm, ptr s], ps)
+    NewStream s               -> ( 7, [ptr s], [])
+    FreeStream s              -> ( 8, [ptr s], [])
+    BlockStream s             -> ( 9, [ptr s], [])
+    WaitStream s ev           -> (10, [ptr s, ptr ev], [])
+    NewEvent ev               -> (11, [ptr ev], [])
+    FreeEvent ev              -> (12, [ptr ev], [])
+    RecordEvent ev s          -> (13, [ptr ev, ptr s], [])
+    BlockEvent ev             -> (14, [ptr ev], [])
+    LoadFile f m              -> (15, [ptr m], [string f])
+    LoadData img m            -> (16, [ptr m], [img])
+    Unload m                  -> (17, [ptr m], [])
+    GetFun m s f              -> (18, [ptr m, ptr f], [string s])
+    Sync                      -> (19, [], [])
+  where
+    int :: Int -> Word64
+    int = fromIntegral
+
+    ptr :: WordPtr -> Word64
+    ptr = fromIntegral
+
+    kind :: Kind -> Word64
+    kind = fromIntegral . fromEnum
+
+    -- stream handles are never all ones
+    stream :: Maybe WordPtr -> Word64
+    stream = maybe maxBound fromIntegral
+
+    string :: String -> ByteString
+    string = B.pack . map (fromIntegral . fromEnum)
+
+-- |
+-- The call given by an operation, argument words and data blocks, if they
+-- are valid
+--
+decode :: Word64 -> [Word64] -> [ByteString] -> Maybe Call
+decode op args blobs =
+  case (op, args, blobs) of
+    ( 0, [k, n, p], [])                         -> kind k >>= \k' -> Just (Malloc k' (int n) (ptr p))
+    ( 1, [k, p], [])                            -> kind k >>= \k' -> Just (Free k' (ptr p))
+    ( 2, [n, d, s], [])                         -> Just (Poke (int n) (ptr d) (stream s) Nothing)
+    ( 2, [n, d, s], [b])                        -> Just (Poke (int n) (ptr d) (stream s) (Just b))
+    ( 3, [n, d, s], [])                         -> Just (Peek (int n) (ptr d) (stream s))
+    ( 4, [n, s, d, st], [])                     -> Just (Copy (int n) (ptr s) (ptr d) (stream st))
+    ( 5, [d, n, w, v, s], [])                   -> Just (Set (ptr d) (int n) (int w) (fromIntegral v) (stream s))
+    ( 6, [f, gx, gy, gz, tx, ty, tz, sm, s], ps)
+                                                -> Just (Launch (ptr f) (int gx, int gy, int gz) (int tx, int ty, int tz) (int sm) (ptr s) ps)
+    ( 7, [s], [])                               -> Just (NewStream (ptr s))
+    ( 8, [s], [])                               -> Just (FreeStream (ptr s))
+    ( 9, [s], [])                               -> Just (BlockStream (ptr s))
+    (10, [s, ev], [])                           -> Just (WaitStream (ptr s) (ptr ev))
+    (11, [ev], [])                              -> Just (NewEvent (ptr ev))
+    (12, [ev], [])                              -> Just (FreeEvent (ptr ev))
+    (13, [ev, s], [])                           -> Just (RecordEvent (ptr ev) (ptr s))
+    (14, [ev], [])                              -> Just (BlockEvent (ptr ev))
+    (15, [m], [f])                              -> Just (LoadFile (string f) (ptr m))
+    (16, [m], [img])                            -> Just (LoadData img (ptr m))
+    (17, [m], [])                               -> Just (Unload (ptr m))
+    (18, [m, f], [s])                           -> Just (GetFun (ptr m) (string s) (ptr f))
+    (19, [], [])                                -> Just Sync
+    _                                           -> Nothing
+  where
+    int :: Word64 -> Int
+    int = fromIntegral
+
+    ptr :: Word64 -> WordPtr
+    ptr = fromIntegral
+
+    kind :: Word64 -> Maybe Kind
+    kind k
+      | k <= fromIntegral (fromEnum (maxBound :: Kind)) = Just (toEnum (fromIntegral k))
+      | otherwise                                       = Nothing
+
+    stream :: Word64 -> Maybe WordPtr
+    stream s
+      | s == maxBound = Nothing
+      | otherwise     = Just (fromIntegral s)
+
+    string :: ByteString -> String
+    string = map (toEnum . fromIntegral) . B.unpack
+
+
+foreign import ccall unsafe "string.h strlen" c_strlen :: CString -> IO CSize
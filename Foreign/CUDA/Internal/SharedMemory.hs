@@ -0,0 +1,103 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.SharedMemory
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- POSIX shared memory segments and atomic access to words stored within
+-- them, used to exchange control information between processes.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.SharedMemory (
+
+  Segment(..),
+  create, attach, detach, unlink,
+  loadAcquire, storeRelease, fetchAdd,
+
+) where
+
+-- System
+import Foreign
+import Foreign.C
+
+
+-- |
+-- A shared memory segment mapped into the address space of this process
+--
+data Segment = Segment
+  { segmentName         :: !String
+  , segmentPtr          :: {-# UNPACK #-} !(Ptr ())
+  , segmentBytes        :: {-# UNPACK #-} !Int
+  }
+
+-- |
+-- Create a new, zero-filled segment of the given name and size. Fails if
+-- a segment with the same name already exists.
+--
+create :: String -> Int -> IO Segment
+create !name !bytes =
+  withCString name $ \cname -> do
+    p <- throwErrnoIfNull "shm_open" (hs_shm_create cname (fromIntegral bytes))
+    return $! Segment name p bytes
+
+-- |
+-- Map an existing segment into this process.
+--
+attach :: String -> IO Segment
+attach !name =
+  withCString name $ \cname ->
+  alloca           $ \pbytes -> do
+    p <- throwErrnoIfNull "shm_open" (hs_shm_attach cname pbytes)
+    n <- peek pbytes
+    return $! Segment name p (fromIntegral n)
+
+-- |
+-- Unmap the segment from this process.
+--
+detach :: Segment -> IO ()
+detach !seg =
+  throwErrnoIfMinus1_ "munmap" (hs_shm_detach (segmentPtr seg) (fromIntegral (segmentBytes seg)))
+
+-- |
+-- Remove the name of the segment. The memory is released once every
+-- process has detached from it.
+--
+unlink :: Segment -> IO ()
+unlink !seg =
+  withCString (segmentName seg) $ \cname ->
+    throwErrnoIfMinus1_ "shm_unlink" (hs_shm_unlink cname)
+
+
+-- |
+-- Atomically read a word, ordering all subsequent memory accesses after it
+--
+{-# INLINE loadAcquire #-}
+loadAcquire :: Ptr Word64 -> IO Word64
+loadAcquire = hs_atomic_load_acquire_u64
+
+-- |
+-- Atomically write a word, ordering all preceding memory accesses before it
+--
+{-# INLINE storeRelease #-}
+storeRelease :: Ptr Word64 -> Word64 -> IO ()
+storeRelease = hs_atomic_store_release_u64
+
+-- |
+-- Atomically add to a word, returning its previous value
+--
+{-# INLINE fetchAdd #-}
+fetchAdd :: Ptr Word64 -> Word64 -> IO Word64
+fetchAdd = hs_atomic_fetch_add_u64
+
+
+foreign import ccall unsafe "cbits/shm.h hs_shm_create"  hs_shm_create  :: CString -> CSize -> IO (Ptr ())
+foreign import ccall unsafe "cbits/shm.h hs_shm_attach"  hs_shm_attach  :: CString -> Ptr CSize -> IO (Ptr ())
+foreign import ccall unsafe "cbits/shm.h hs_shm_detach"  hs_shm_detach  :: Ptr () -> CSize -> IO CInt
+foreign import ccall unsafe "cbits/shm.h hs_shm_unlink"  hs_shm_unlink  :: CString -> IO CInt
+
+foreign import ccall unsafe "cbits/shm.h hs_atomic_load_acquire_u64"  hs_atomic_load_acquire_u64  :: Ptr Word64 -> IO Word64
+foreign import ccall unsafe "cbits/shm.h hs_atomic_store_release_u64" hs_atomic_store_release_u64 :: Ptr Word64 -> Word64 -> IO ()
+foreign import ccall unsafe "cbits/shm.h hs_atomic_fetch_add_u64"     hs_atomic_fetch_add_u64     :: Ptr Word64 -> Word64 -> IO Word64
@@ -0,0 +1,174 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE EmptyDataDecls           #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+{-# LANGUAGE MagicHash                #-}
+{-# LANGUAGE UnliftedFFITypes         #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Trace
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- Instrumentation of driver calls. The bindings wrap each call of interest
+-- with 'traced', which counts every completed call (see
+-- "Foreign.CUDA.Driver.Counters"), and otherwise costs a single test of a
+-- flag when tracing is disabled. See "Foreign.CUDA.Driver.Trace" for the
+-- user interface.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Trace (
+
+  API(..), apiName,
+  traced,
+  setEnabled, setEventlog,
+  currentThreadId,
+
+  Marker,
+  hs_trace_configure, hs_trace_drain, hs_trace_dropped,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Types
+import Foreign.CUDA.Internal.Clock
+import Foreign.CUDA.Internal.Counters
+
+-- System
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.Word
+import Debug.Trace                                      ( traceEventIO )
+import Foreign.C
+import Foreign.Ptr
+import GHC.Conc                                         ( ThreadId(..), myThreadId )
+import GHC.Exts                                         ( ThreadId# )
+import System.IO.Unsafe
+import Prelude
+
+
+-- |
+-- The driver operations which are traced
+--
+data API
+  = MemAlloc
+  | MemFree
+  | MemAllocHost
+  | MemFreeHost
+  | MemAllocManaged
+  | MemcpyHtoD
+  | MemcpyHtoDAsync
+  | MemcpyDtoH
+  | MemcpyDtoHAsync
+  | MemcpyDtoD
+  | MemcpyDtoDAsync
+  | MemcpyPeer
+  | MemcpyPeerAsync
+  | Memset
+  | MemsetAsync
+  | LaunchKernel
+  | StreamCreate
+  | StreamDestroy
+  | StreamQuery
+  | StreamSynchronize
+  | StreamWaitEvent
+  | EventRecord
+  | EventQuery
+  | EventSynchronize
+  | ModuleLoad
+  | ModuleUnload
+  | CtxSynchronize
+  deriving (Eq, Ord, Show, Read, Enum, Bounded)
+
+-- |
+-- The name of the driver function
+--
+apiName :: API -> String
+apiName api = "cu" ++ show api
+
+-- Operations which are ordered in a stream, and so may be given device
+-- timestamps
+--
+streamOrdered :: API -> Bool
+streamOrdered api =
+  case api of
+    MemcpyHtoDAsync -> True
+    MemcpyDtoHAsync -> True
+    MemcpyDtoDAsync -> True
+    MemcpyPeerAsync -> True
+    MemsetAsync     -> True
+    LaunchKernel    -> True
+    _               -> False
+
+
+-- Global switches
+--
+{-# NOINLINE enabled #-}
+enabled :: IORef Bool
+enabled = unsafePerformIO (newIORef False)
+
+{-# NOINLINE eventlog #-}
+eventlog :: IORef Bool
+eventlog = unsafePerformIO (newIORef False)
+
+setEnabled :: Bool -> IO ()
+setEnabled = atomicWriteIORef enabled
+
+setEventlog :: Bool -> IO ()
+setEventlog = atomicWriteIORef eventlog
+
+
+-- |
+-- Execute a driver operation, counting it once it completes and recording
+-- it if tracing is enabled. The arguments are the operation, the stream it
+-- is associated with, and the number of bytes it transfers or allocates.
+--
+{-# INLINE traced #-}
+traced :: API -> Maybe Stream -> Int -> IO a -> IO a
+traced !api !mst !bytes action = do
+  on <- readIORef enabled
+  r  <- if on
+          then record api mst bytes action
+          else action
+  hs_counters_api (fromIntegral (fromEnum api)) (fromIntegral bytes)
+  return r
+
+{-# NOINLINE record #-}
+record :: API -> Maybe Stream -> Int -> IO a -> IO a
+record !api !mst !bytes action = do
+  el  <- readIORef eventlog
+  let marker s = when el $ traceEventIO (s ++ apiName api)
+      st       = maybe nullPtr useStream mst
+      dev      = streamOrdered api
+  bracket_ (marker "START ") (marker "STOP ") $ do
+    m0  <- if dev then hs_trace_marker_record st else return nullPtr
+    t0  <- getTime
+    r   <- action `onException` hs_trace_marker_release m0
+    t1  <- getTime
+    m1  <- if dev then hs_trace_marker_record st else return nullPtr
+    tid <- currentThreadId
+    hs_trace_record (fromIntegral (fromEnum api)) tid st (fromIntegral bytes) t0 t1 m0 m1
+    return r
+
+
+-- |
+-- The number of the current Haskell thread, as shown by 'show' on its
+-- 'ThreadId'
+--
+currentThreadId :: IO Word32
+currentThreadId = do
+  ThreadId t <- myThreadId
+  return $! fromIntegral (getThreadId t)
+
+foreign import ccall unsafe "rts_getThreadId" getThreadId :: ThreadId# -> CInt
+
+
+data Marker
+
+foreign import ccall unsafe "cbits/trace.h hs_trace_configure"      hs_trace_configure      :: CSize -> CInt -> IO ()
+foreign import ccall safe   "cbits/trace.h hs_trace_marker_record"  hs_trace_marker_record  :: Ptr () -> IO (Ptr Marker)
+foreign import ccall unsafe "cbits/trace.h hs_trace_marker_release" hs_trace_marker_release :: Ptr Marker -> IO ()
+foreign import ccall unsafe "cbits/trace.h hs_trace_record"         hs_trace_record         :: Word32 -> Word32 -> Ptr () -> Word64 -> Word64 -> Word64 -> Ptr Marker -> Ptr Marker -> IO ()
+foreign import ccall safe   "cbits/trace.h hs_trace_drain"          hs_trace_drain          :: Ptr Word64 -> CSize -> IO CSize
+foreign import ccall unsafe "cbits/trace.h hs_trace_dropped"        hs_trace_dropped        :: IO Word64
@@ -0,0 +1,149 @@
+{-# LANGUAGE BangPatterns             #-}
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+-- |
+-- Module    : Foreign.CUDA.Internal.Tracker
+-- Copyright : [2009..2015] Trevor L. McDonell
+-- License   : BSD
+--
+-- The table of live allocations, maintained while tracking is enabled. See
+-- "Foreign.CUDA.Driver.Tracker" for the user interface.
+--
+--------------------------------------------------------------------------------
+
+module Foreign.CUDA.Internal.Tracker (
+
+  Kind(..), Block(..),
+  track, untrack,
+  setTracking, withTag, blocks,
+
+) where
+
+-- Friends
+import Foreign.CUDA.Internal.Clock
+
+-- System
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.IORef
+import Data.Map                                         ( Map )
+import Data.Word
+import Foreign.C
+import Foreign.Marshal                                  ( allocaArray, peekArray )
+import Foreign.Ptr
+import System.IO.Unsafe
+import Prelude
+import qualified Data.Map                               as Map
+
+
+-- |
+-- Kinds of memory allocation
+--
+data Kind = DeviceMemory | HostMemory | ManagedMemory
+  deriving (Eq, Ord, Show, Enum, Bounded)
+
+-- |
+-- A live allocation
+--
+data Block = Block
+  { blockAddress        :: !WordPtr
+  , blockSize           :: !Int                 -- ^ bytes
+  , blockKind           :: !Kind
+  , blockTag            :: String               -- ^ innermost 'withTag' of the allocating thread
+  , blockTime           :: !Word64              -- ^ when it was allocated (nanoseconds, monotonic)
+  }
+  deriving Show
+
+
+-- Global state: whether allocations are tracked, the live allocations in
+-- address order, and the current tag of each thread
+--
+{-# NOINLINE enabled #-}
+enabled :: IORef Bool
+enabled = unsafePerformIO (newIORef False)
+
+{-# NOINLINE table #-}
+table :: MVar (Map WordPtr Block)
+table = unsafePerformIO (newMVar Map.empty)
+
+{-# NOINLINE tags #-}
+tags :: IORef (Map ThreadId String)
+tags = unsafePerformIO (newIORef Map.empty)
+
+
+-- |
+-- Record a new allocation, if tracking is enabled
+--
+{-# INLINE track #-}
+track :: Kind -> Ptr () -> Int -> IO ()
+track !kind !p !bytes = do
+  on <- readIORef enabled
+  when on $ do
+    tid <- myThreadId
+    tag <- Map.findWithDefault "<untagged>" tid `fmap` readIORef tags
+    now <- getTime
+    modifyMVar_ table $ \m -> do
+      m' <- settle m
+      return $! Map.insert (ptrToWordPtr p) (Block (ptrToWordPtr p) bytes kind tag now) m'
+
+-- |
+-- Record that an allocation was freed, if tracking is enabled. This must be
+-- called before the memory is returned to the driver: once it is, another
+-- thread may be given the same address and 'track' it, and removing the
+-- entry afterwards would forget the new allocation instead.
+--
+{-# INLINE untrack #-}
+untrack :: Ptr () -> IO ()
+untrack !p = do
+  on <- readIORef enabled
+  when on $ modifyMVar_ table (return . Map.delete (ptrToWordPtr p))
+
+
+-- |
+-- Start or stop tracking. Stopping forgets every allocation, since frees
+-- are no longer seen.
+--
+setTracking :: Bool -> IO ()
+setTracking on =
+  modifyMVar_ table $ \_ -> do
+    hs_counters_track_host_frees (if on then 1 else 0)
+    atomicWriteIORef enabled on
+    return Map.empty
+
+-- |
+-- Tag the allocations made by the current thread while executing the
+-- action
+--
+withTag :: String -> IO a -> IO a
+withTag tag action = do
+  tid <- myThreadId
+  old <- Map.lookup tid `fmap` readIORef tags
+  let set t = atomicModifyIORef' tags (\m -> (Map.alter (const t) tid m, ()))
+  bracket_ (set (Just tag)) (set old) action
+
+-- |
+-- The live allocations, in address order
+--
+blocks :: IO (Map WordPtr Block)
+blocks = modifyMVar table $ \m -> do
+  m' <- settle m
+  return (m', m')
+
+
+-- Remove the host allocations which were released by a finaliser
+--
+settle :: Map WordPtr Block -> IO (Map WordPtr Block)
+settle !m = do
+  ps <- allocaArray chunk $ \p -> do
+          n <- fromIntegral `fmap` hs_counters_host_frees p (fromIntegral chunk)
+          peekArray n p
+  let m' = foldr (Map.delete . ptrToWordPtr) m ps
+  if length ps < chunk
+    then return m'
+    else settle m'
+  where
+    chunk = 256
+
+foreign import ccall unsafe "cbits/counters.h hs_counters_track_host_frees" hs_counters_track_host_frees :: CInt -> IO ()
+foreign import ccall unsafe "cbits/counters.h hs_counters_host_frees"       hs_counters_host_frees       :: Ptr (Ptr ()) -> CSize -> IO CSize
@@ -121,11 +121,17 @@ getCudaLibraryPath (CudaPath path) (Platform arch os) = path </> libSubpath
 -- not need to set the DYLD_LIBRARY_PATH environment variable in order to
 -- compile or execute programs.
 --
+-- Elsewhere we link against the runtime library only. The driver library is
+-- part of the display driver rather than the toolkit, so it is loaded on
+-- first use (see cbits/driver.c) and a program can start, and report the
+-- error, on a machine where it is not installed.
+--
 getCudaLibraries :: Platform -> [String]
 getCudaLibraries (Platform _ os) =
   case os of
-    OSX -> []
-    _   -> ["cudart", "cuda"]
+    OSX   -> []
+    Linux -> ["cudart", "dl"]
+    _     -> ["cudart"]
 
 
 -- Slightly modified version of `words` from base - it takes predicate saying on which characters split.
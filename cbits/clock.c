@@ -0,0 +1,44 @@
+/*
+ * Monotonic wall clock, for measuring latencies
+ */
+
+#include "cbits/clock.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+/*
+ * Nanoseconds elapsed since some unspecified point in the past. The clock is
+ * not affected by changes to the system time.
+ */
+#if defined(_WIN32)
+uint64_t
+hs_clock_monotonic_ns(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER        now;
+    uint64_t             ticks, hz;
+
+    /* the frequency is fixed at boot, so racing to read it is harmless */
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    ticks = (uint64_t) now.QuadPart;
+    hz    = (uint64_t) freq.QuadPart;
+    return ticks / hz * 1000000000ull + ticks % hz * 1000000000ull / hz;
+}
+#else
+uint64_t
+hs_clock_monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+#endif
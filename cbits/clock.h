@@ -0,0 +1,19 @@
+/*
+ * Monotonic wall clock, for measuring latencies
+ */
+
+#ifndef C_CLOCK_H
+#define C_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t hs_clock_monotonic_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
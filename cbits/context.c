@@ -0,0 +1,94 @@
+/*
+ * Thread-local cache of the current driver context
+ *
+ * Each OS thread remembers which context it last made current, so that
+ * making the same context current again does not require a call into the
+ * driver. The cache of the calling thread is invalidated whenever its
+ * context stack is changed by other means (create, push, pop, set), and the
+ * caches of all threads are invalidated whenever a context is destroyed,
+ * since the handle of a destroyed context may be reused for a new one.
+ */
+
+#include "cbits/context.h"
+#include "cbits/thread.h"
+
+static HS_THREAD_LOCAL CUcontext    hs_ctx_current;
+static HS_THREAD_LOCAL int          hs_ctx_valid;
+static HS_THREAD_LOCAL unsigned int hs_ctx_generation;
+
+static unsigned int             hs_ctx_global_generation;
+
+
+static int hs_ctx_cached(void)
+{
+    return hs_ctx_valid
+        && hs_ctx_generation == __atomic_load_n(&hs_ctx_global_generation, __ATOMIC_ACQUIRE);
+}
+
+static CUresult hs_ctx_set(CUcontext ctx)
+{
+    CUresult status;
+
+    if (hs_ctx_cached() && hs_ctx_current == ctx)
+        return CUDA_SUCCESS;
+
+    hs_ctx_generation = __atomic_load_n(&hs_ctx_global_generation, __ATOMIC_ACQUIRE);
+    status            = cuCtxSetCurrent(ctx);
+    hs_ctx_current    = ctx;
+    hs_ctx_valid      = status == CUDA_SUCCESS;
+
+    return status;
+}
+
+
+/*
+ * Make the given context current to the calling thread, returning the
+ * context which was current before. The driver is only called if the
+ * context is not already known to be current.
+ */
+CUresult hs_ctx_enter(CUcontext ctx, CUcontext *prev)
+{
+    CUresult status;
+
+    if (!hs_ctx_cached()) {
+        hs_ctx_generation = __atomic_load_n(&hs_ctx_global_generation, __ATOMIC_ACQUIRE);
+        status            = cuCtxGetCurrent(&hs_ctx_current);
+        hs_ctx_valid      = status == CUDA_SUCCESS;
+
+        if (status != CUDA_SUCCESS)
+            return status;
+    }
+
+    *prev = hs_ctx_current;
+    return hs_ctx_set(ctx);
+}
+
+/*
+ * Restore the context which was current before the matching call to
+ * hs_ctx_enter. If no context was current before, the given context is left
+ * current, so that entering it again later is free.
+ */
+CUresult hs_ctx_leave(CUcontext ctx, CUcontext prev)
+{
+    if (prev == NULL || prev == ctx)
+        return CUDA_SUCCESS;
+
+    return hs_ctx_set(prev);
+}
+
+/*
+ * Forget the cached context of the calling thread
+ */
+void hs_ctx_invalidate(void)
+{
+    hs_ctx_valid = 0;
+}
+
+/*
+ * Forget the cached context of every thread
+ */
+void hs_ctx_invalidate_all(void)
+{
+    hs_ctx_valid = 0;
+    __atomic_add_fetch(&hs_ctx_global_generation, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,22 @@
+/*
+ * Thread-local cache of the current driver context
+ */
+
+#ifndef C_CONTEXT_H
+#define C_CONTEXT_H
+
+#include "cbits/stubs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CUresult hs_ctx_enter(CUcontext ctx, CUcontext *prev);
+CUresult hs_ctx_leave(CUcontext ctx, CUcontext prev);
+void hs_ctx_invalidate(void);
+void hs_ctx_invalidate_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
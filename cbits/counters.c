@@ -0,0 +1,260 @@
+/*
+ * Process-wide counters of driver calls, memory and kernel launches
+ *
+ * Counters of calls and launches are updated with relaxed atomic additions,
+ * so that counting is cheap enough to be always on. The size of each live
+ * allocation is remembered, so that the number of live bytes can be reduced
+ * when it is freed; allocations are already expensive, so this table is
+ * protected by a lock.
+ *
+ * Page-locked host memory owned by a ForeignPtr is released by a C finaliser,
+ * which cannot call back into Haskell. While allocations are being tracked
+ * (see Foreign.CUDA.Driver.Tracker), these frees are queued so that the
+ * tracker can collect them later.
+ */
+
+#include "cbits/counters.h"
+#include "cbits/thread.h"
+
+#include <stdlib.h>
+
+
+typedef struct hs_counters_block {
+    void                       *ptr;
+    uint64_t                    bytes;
+    uint32_t                    kind;
+    struct hs_counters_block   *next;
+} hs_counters_block;
+
+typedef struct hs_counters_freed {
+    void                       *ptr;
+    struct hs_counters_freed   *next;
+} hs_counters_freed;
+
+#define HS_COUNTERS_BLOCK_BUCKETS 4096
+
+const uint32_t              hs_counters_api_size     = HS_COUNTERS_API;
+const uint32_t              hs_counters_kinds_size   = HS_COUNTERS_KINDS;
+const uint32_t              hs_counters_kernels_size = HS_COUNTERS_KERNELS;
+
+static uint64_t             hs_counters_calls[HS_COUNTERS_API];
+static uint64_t             hs_counters_bytes[HS_COUNTERS_API];
+static uint64_t             hs_counters_live[HS_COUNTERS_KINDS];
+static uint64_t             hs_counters_peak[HS_COUNTERS_KINDS];
+
+static uintptr_t            hs_counters_kernel[HS_COUNTERS_KERNELS];
+static uint64_t             hs_counters_kernel_launches[HS_COUNTERS_KERNELS];
+static uint64_t             hs_counters_other_launches;
+
+static hs_mutex_t           hs_counters_block_lock = HS_MUTEX_INITIALIZER;
+static hs_counters_block   *hs_counters_blocks[HS_COUNTERS_BLOCK_BUCKETS];
+
+static int                  hs_counters_tracking;
+static hs_counters_freed   *hs_counters_freed_list;
+
+
+/*
+ * Count a completed driver call, and the bytes it transferred or allocated
+ */
+void hs_counters_api(uint32_t api, uint64_t bytes)
+{
+    if (api >= HS_COUNTERS_API)
+        return;
+
+    __atomic_add_fetch(&hs_counters_calls[api], 1, __ATOMIC_RELAXED);
+    if (bytes)
+        __atomic_add_fetch(&hs_counters_bytes[api], bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Count a launch of the given kernel. Each kernel claims a slot of the
+ * table the first time it is launched, and keeps it thereafter.
+ */
+void hs_counters_launch(CUfunction fn)
+{
+    uintptr_t key = (uintptr_t) fn;
+    uintptr_t cur;
+    size_t    i, n;
+
+    i = (key >> 4) & (HS_COUNTERS_KERNELS - 1);
+    for (n = 0; n < HS_COUNTERS_KERNELS; ++n, i = (i + 1) & (HS_COUNTERS_KERNELS - 1)) {
+        cur = __atomic_load_n(&hs_counters_kernel[i], __ATOMIC_ACQUIRE);
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&hs_counters_kernel[i], &cur, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                cur = key;
+        }
+        if (cur == key) {
+            __atomic_add_fetch(&hs_counters_kernel_launches[i], 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_add_fetch(&hs_counters_other_launches, 1, __ATOMIC_RELAXED);
+}
+
+
+static size_t hs_counters_bucket(void *ptr)
+{
+    return ((uintptr_t) ptr >> 8) & (HS_COUNTERS_BLOCK_BUCKETS - 1);
+}
+
+/*
+ * Record a new allocation of the given kind
+ */
+void hs_counters_alloc(uint32_t kind, void *ptr, uint64_t bytes)
+{
+    hs_counters_block *b;
+    uint64_t           live, peak;
+    size_t             i;
+
+    if (kind >= HS_COUNTERS_KINDS || ptr == NULL)
+        return;
+
+    b = malloc(sizeof(hs_counters_block));
+    if (b == NULL)
+        return;
+
+    b->ptr   = ptr;
+    b->bytes = bytes;
+    b->kind  = kind;
+    i        = hs_counters_bucket(ptr);
+
+    hs_mutex_lock(&hs_counters_block_lock);
+    b->next               = hs_counters_blocks[i];
+    hs_counters_blocks[i] = b;
+    hs_mutex_unlock(&hs_counters_block_lock);
+
+    live = __atomic_add_fetch(&hs_counters_live[kind], bytes, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&hs_counters_peak[kind], __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&hs_counters_peak[kind], &peak, live, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Record that an allocation was freed. Pointers which were not recorded are
+ * ignored.
+ */
+void hs_counters_free(void *ptr)
+{
+    hs_counters_block **p, *b = NULL;
+
+    hs_mutex_lock(&hs_counters_block_lock);
+    for (p = &hs_counters_blocks[hs_counters_bucket(ptr)]; *p != NULL; p = &(*p)->next) {
+        if ((*p)->ptr == ptr) {
+            b  = *p;
+            *p = b->next;
+            break;
+        }
+    }
+    hs_mutex_unlock(&hs_counters_block_lock);
+
+    if (b != NULL) {
+        __atomic_sub_fetch(&hs_counters_live[b->kind], b->bytes, __ATOMIC_RELAXED);
+        free(b);
+    }
+}
+
+/*
+ * Finaliser for page-locked host memory
+ */
+void hs_counters_free_host(void *ptr)
+{
+    hs_counters_freed *f;
+
+    /* queue before releasing, so the address can not be reused first */
+    if (__atomic_load_n(&hs_counters_tracking, __ATOMIC_RELAXED) && (f = malloc(sizeof(hs_counters_freed))) != NULL) {
+        f->ptr  = ptr;
+        f->next = __atomic_load_n(&hs_counters_freed_list, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&hs_counters_freed_list, &f->next, f, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    hs_counters_free(ptr);
+    cuMemFreeHost(ptr);
+}
+
+/*
+ * Start or stop queueing host memory released by the finaliser. Stopping
+ * discards anything queued.
+ */
+void hs_counters_track_host_frees(int enable)
+{
+    hs_counters_freed *f, *next;
+
+    __atomic_store_n(&hs_counters_tracking, enable, __ATOMIC_RELAXED);
+    if (!enable) {
+        f = __atomic_exchange_n(&hs_counters_freed_list, NULL, __ATOMIC_ACQUIRE);
+        for (; f != NULL; f = next) {
+            next = f->next;
+            free(f);
+        }
+    }
+}
+
+/*
+ * Remove up to 'max' pointers from the queue of host memory released by the
+ * finaliser, returning the number written. Only one thread may do this at
+ * a time.
+ */
+size_t hs_counters_host_frees(void **out, size_t max)
+{
+    hs_counters_freed *f;
+    size_t             n = 0;
+
+    while (n < max) {
+        f = __atomic_load_n(&hs_counters_freed_list, __ATOMIC_ACQUIRE);
+        if (f == NULL)
+            break;
+        /* finalisers only push, so the head can not be removed under us */
+        if (!__atomic_compare_exchange_n(&hs_counters_freed_list, &f, f->next, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        out[n++] = f->ptr;
+        free(f);
+    }
+    return n;
+}
+
+
+/*
+ * Write the counters of driver calls and memory, as described by
+ * HS_COUNTERS_WORDS
+ */
+void hs_counters_read(uint64_t *out)
+{
+    size_t i;
+
+    for (i = 0; i < HS_COUNTERS_API; ++i) {
+        *out++ = __atomic_load_n(&hs_counters_calls[i], __ATOMIC_RELAXED);
+        *out++ = __atomic_load_n(&hs_counters_bytes[i], __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < HS_COUNTERS_KINDS; ++i) {
+        *out++ = __atomic_load_n(&hs_counters_live[i], __ATOMIC_RELAXED);
+        *out++ = __atomic_load_n(&hs_counters_peak[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Write a (function, launches) pair for each kernel which has been launched,
+ * followed by the launches of kernels which did not fit in the table under
+ * the null function. The output must have room for 2 * (HS_COUNTERS_KERNELS
+ * + 1) words. Returns the number of pairs written.
+ */
+size_t hs_counters_launches(uint64_t *out)
+{
+    uintptr_t key;
+    size_t    i, n = 0;
+
+    for (i = 0; i < HS_COUNTERS_KERNELS; ++i) {
+        key = __atomic_load_n(&hs_counters_kernel[i], __ATOMIC_ACQUIRE);
+        if (key != 0) {
+            *out++ = key;
+            *out++ = __atomic_load_n(&hs_counters_kernel_launches[i], __ATOMIC_RELAXED);
+            n++;
+        }
+    }
+    if ((key = __atomic_load_n(&hs_counters_other_launches, __ATOMIC_RELAXED)) != 0) {
+        *out++ = 0;
+        *out++ = key;
+        n++;
+    }
+    return n;
+}
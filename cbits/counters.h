@@ -0,0 +1,62 @@
+/*
+ * Process-wide counters of driver calls, memory and kernel launches
+ */
+
+#ifndef C_COUNTERS_H
+#define C_COUNTERS_H
+
+#include "cbits/stubs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The maximum number of distinct driver calls and kernels counted. Launches
+ * of kernels beyond this are counted together, under the null function.
+ */
+#define HS_COUNTERS_API         64
+#define HS_COUNTERS_KERNELS     1024
+
+/*
+ * Kinds of memory allocation
+ */
+#define HS_COUNTERS_DEVICE      0
+#define HS_COUNTERS_HOST        1
+#define HS_COUNTERS_MANAGED     2
+#define HS_COUNTERS_KINDS       3
+
+/*
+ * The number of 64-bit words written by hs_counters_read:
+ *
+ *   (calls, bytes) for each driver call, then
+ *   (live bytes, high-water mark) for each kind of memory
+ */
+#define HS_COUNTERS_WORDS       (2 * HS_COUNTERS_API + 2 * HS_COUNTERS_KINDS)
+
+/*
+ * The sizes above, for the Haskell side, which can not see the macros
+ */
+extern const uint32_t hs_counters_api_size;
+extern const uint32_t hs_counters_kinds_size;
+extern const uint32_t hs_counters_kernels_size;
+
+void hs_counters_api(uint32_t api, uint64_t bytes);
+void hs_counters_launch(CUfunction fn);
+void hs_counters_alloc(uint32_t kind, void *ptr, uint64_t bytes);
+void hs_counters_free(void *ptr);
+void hs_counters_free_host(void *ptr);
+
+void hs_counters_track_host_frees(int enable);
+size_t hs_counters_host_frees(void **out, size_t max);
+
+void hs_counters_read(uint64_t *out);
+size_t hs_counters_launches(uint64_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
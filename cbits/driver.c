@@ -0,0 +1,250 @@
+/*
+ * Runtime loading of the CUDA driver library
+ *
+ * Rather than linking against libcuda, which is installed with the display
+ * driver rather than the toolkit, the driver library is opened on first use
+ * and the entry points listed in driver_api.h are resolved from it. This
+ * allows a program using these bindings to start on a machine without a GPU,
+ * and to report the missing driver as an ordinary error rather than failing
+ * in the dynamic linker.
+ *
+ * Each entry point is defined here with the same name and type as in cuda.h,
+ * so that stubs.c and the other C sources call these definitions directly.
+ * Where cuda.h renames a function, such as cuMemAlloc to cuMemAlloc_v2, it is
+ * defined under both names: the bindings refer to the original name (see
+ * stubs.h), while C sources compiled against cuda.h use the new one. The first
+ * call to any of them loads the library.
+ *
+ * The environment variable HS_CUDA_DRIVER names a different library to load
+ * in place of the installed driver, such as the host execution backend (see
+ * host/host.h).
+ */
+
+#include <cuda.h>
+#include <cudaProfiler.h>
+
+#include "cbits/driver.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+#define HS_STR_(x)      #x
+#define HS_STR(x)       HS_STR_(x)
+
+
+/*
+ * The resolved entry points, NULL until the library has been loaded
+ */
+#define HS_CU(name, params, args) \
+    static CUresult (CUDAAPI *hs_cu_##name) params = NULL;
+#define HS_CU_V HS_CU
+#include "cbits/driver_api.h"
+#undef HS_CU_V
+#undef HS_CU
+
+static const struct {
+    const char  *symbol;
+    void       **slot;
+} hs_cu_table[] = {
+#define HS_CU(name, params, args) \
+    { HS_STR(name), (void**) &hs_cu_##name },
+#define HS_CU_V HS_CU
+#include "cbits/driver_api.h"
+#undef HS_CU_V
+#undef HS_CU
+};
+
+static CUresult (CUDAAPI *hs_cu_cuGetErrorString)(CUresult, const char**) = NULL;
+
+static int   hs_driver_loaded = 0;
+static char  hs_driver_error[256];
+
+
+#if defined(_WIN32)
+static HMODULE hs_driver_handle;
+
+static void* hs_driver_sym(const char *symbol)
+{
+    return (void*) GetProcAddress(hs_driver_handle, symbol);
+}
+
+static int hs_driver_open(void)
+{
+    const char *name = getenv("HS_CUDA_DRIVER");
+
+    if (name == NULL || *name == '\0')
+        name = "nvcuda.dll";
+
+    hs_driver_handle = LoadLibraryA(name);
+    if (hs_driver_handle == NULL) {
+        snprintf(hs_driver_error, sizeof(hs_driver_error), "could not load %s", name);
+        return 0;
+    }
+    return 1;
+}
+#else
+static void *hs_driver_handle;
+
+static void* hs_driver_sym(const char *symbol)
+{
+    return dlsym(hs_driver_handle, symbol);
+}
+
+static int hs_driver_open(void)
+{
+#if defined(__APPLE__)
+    static const char *names[] = { "libcuda.dylib", "/usr/local/cuda/lib/libcuda.dylib", "/Library/Frameworks/CUDA.framework/CUDA", NULL };
+#else
+    static const char *names[] = { "libcuda.so.1", "libcuda.so", NULL };
+#endif
+    const char *driver = getenv("HS_CUDA_DRIVER");
+    const char *err;
+    int i;
+
+    /* an explicitly chosen driver is used without falling back to another */
+    if (driver != NULL && *driver != '\0') {
+        hs_driver_handle = dlopen(driver, RTLD_NOW | RTLD_GLOBAL);
+        if (hs_driver_handle != NULL)
+            return 1;
+
+        err = dlerror();
+        strncpy(hs_driver_error, err != NULL ? err : driver, sizeof(hs_driver_error) - 1);
+        return 0;
+    }
+
+    for (i = 0; names[i] != NULL; ++i) {
+        hs_driver_handle = dlopen(names[i], RTLD_NOW | RTLD_GLOBAL);
+        if (hs_driver_handle != NULL)
+            return 1;
+
+        /* report the reason the first (preferred) name failed */
+        err = dlerror();
+        if (i == 0 && err != NULL)
+            strncpy(hs_driver_error, err, sizeof(hs_driver_error) - 1);
+    }
+    return 0;
+}
+#endif
+
+
+/*
+ * Open the driver library and resolve every entry point. Entry points which
+ * the installed driver does not provide are left NULL, and calling them
+ * returns CUDA_ERROR_NOT_FOUND.
+ */
+static void hs_driver_init(void)
+{
+    size_t i;
+
+    if (!hs_driver_open())
+        return;
+
+    for (i = 0; i < sizeof(hs_cu_table) / sizeof(hs_cu_table[0]); ++i)
+        __atomic_store_n(hs_cu_table[i].slot, hs_driver_sym(hs_cu_table[i].symbol), __ATOMIC_RELEASE);
+
+    *(void**) &hs_cu_cuGetErrorString = hs_driver_sym("cuGetErrorString");
+    __atomic_store_n(&hs_driver_loaded, 1, __ATOMIC_RELEASE);
+}
+
+#if defined(_WIN32)
+static INIT_ONCE hs_driver_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK hs_driver_init_once(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void) once; (void) param; (void) ctx;
+    hs_driver_init();
+    return TRUE;
+}
+#else
+static pthread_once_t hs_driver_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/*
+ * Load the driver library, if that has not already been done. Returns
+ * non-zero on success. This is safe to call from several threads at once.
+ */
+int hs_cuda_driver_load(void)
+{
+#if defined(_WIN32)
+    InitOnceExecuteOnce(&hs_driver_once, hs_driver_init_once, NULL, NULL);
+#else
+    pthread_once(&hs_driver_once, hs_driver_init);
+#endif
+    return __atomic_load_n(&hs_driver_loaded, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * A description of why the driver library could not be loaded
+ */
+const char* hs_cuda_driver_error(void)
+{
+    return hs_driver_error;
+}
+
+
+/*
+ * The entry points themselves. After the library has been loaded, each call
+ * costs one additional indirect jump.
+ */
+#define HS_CU_DEFINE(name, slot, params, args)                                  \
+CUresult CUDAAPI name params                                                    \
+{                                                                               \
+    CUresult (CUDAAPI *fn) params = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);   \
+                                                                                \
+    if (fn == NULL) {                                                           \
+        if (!hs_cuda_driver_load())                                             \
+            return CUDA_ERROR_NOT_INITIALIZED;                                  \
+        if ((fn = slot) == NULL)                                                \
+            return CUDA_ERROR_NOT_FOUND;                                        \
+    }                                                                           \
+    return fn args;                                                             \
+}
+
+#define HS_CU(name, params, args)   HS_CU_DEFINE(name, hs_cu_##name, params, args)
+#define HS_CU_V HS_CU
+#include "cbits/driver_api.h"
+#undef HS_CU_V
+#undef HS_CU
+
+/*
+ * The renamed entry points again, under their original names, which stubs.h
+ * restores by removing the renaming macros
+ */
+#include "cbits/stubs.h"
+
+#define HS_CU(name, params, args)
+#define HS_CU_V(name, params, args) HS_CU_DEFINE(name, hs_cu_##name, params, args)
+#include "cbits/driver_api.h"
+#undef HS_CU_V
+#undef HS_CU
+
+
+#if CUDA_VERSION >= 6000
+/*
+ * Error descriptions are needed to report that the driver could not be
+ * loaded in the first place, so provide a fallback.
+ */
+CUresult CUDAAPI cuGetErrorString(CUresult error, const char **pStr)
+{
+    if (hs_cuda_driver_load() && hs_cu_cuGetErrorString != NULL)
+        return hs_cu_cuGetErrorString(error, pStr);
+
+    switch (error) {
+        case CUDA_SUCCESS:                  *pStr = "no error"; break;
+        case CUDA_ERROR_NOT_INITIALIZED:    *pStr = "the CUDA driver could not be loaded"; break;
+        case CUDA_ERROR_NOT_FOUND:          *pStr = "the CUDA driver does not provide this function"; break;
+        default:                            *pStr = "unknown error"; break;
+    }
+    return CUDA_SUCCESS;
+}
+#endif
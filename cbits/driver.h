@@ -0,0 +1,18 @@
+/*
+ * Runtime loading of the CUDA driver library
+ */
+
+#ifndef C_DRIVER_H
+#define C_DRIVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hs_cuda_driver_load(void);
+const char* hs_cuda_driver_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Driver API entry points which are resolved at runtime, see driver.c
+ *
+ * Each entry gives the name of the function as it is declared in cuda.h, its
+ * parameter list, and the argument list used to forward the call. This file
+ * is included several times with different definitions of HS_CU, and so has
+ * no include guard.
+ *
+ * From the version given, cuda.h renames the entries marked HS_CU_<version>,
+ * usually to a _v2 variant. The bindings (see stubs.h) still call them by
+ * their original name, so these are defined under both names, by HS_CU_V.
+ */
+#if CUDA_VERSION >= 3020
+#define HS_CU_3020 HS_CU_V
+#else
+#define HS_CU_3020 HS_CU
+#endif
+
+#if CUDA_VERSION >= 4000
+#define HS_CU_4000 HS_CU_V
+#else
+#define HS_CU_4000 HS_CU
+#endif
+
+#if CUDA_VERSION >= 6050
+#define HS_CU_6050 HS_CU_V
+#else
+#define HS_CU_6050 HS_CU
+#endif
+
+/* Initialisation and version management */
+HS_CU(cuInit,                       (unsigned int Flags), (Flags))
+HS_CU(cuDriverGetVersion,           (int *driverVersion), (driverVersion))
+
+/* Device management */
+HS_CU(cuDeviceGet,                  (CUdevice *device, int ordinal), (device, ordinal))
+HS_CU(cuDeviceGetCount,             (int *count), (count))
+HS_CU(cuDeviceGetName,              (char *name, int len, CUdevice dev), (name, len, dev))
+HS_CU_3020(cuDeviceTotalMem,        (size_t *bytes, CUdevice dev), (bytes, dev))
+HS_CU(cuDeviceGetAttribute,         (int *pi, CUdevice_attribute attrib, CUdevice dev), (pi, attrib, dev))
+#if CUDA_VERSION < 5000
+HS_CU(cuDeviceGetProperties,        (CUdevprop *prop, CUdevice dev), (prop, dev))
+HS_CU(cuDeviceComputeCapability,    (int *major, int *minor, CUdevice dev), (major, minor, dev))
+#endif
+
+/* Context management */
+HS_CU_3020(cuCtxCreate,             (CUcontext *pctx, unsigned int flags, CUdevice dev), (pctx, flags, dev))
+HS_CU_4000(cuCtxDestroy,            (CUcontext ctx), (ctx))
+HS_CU(cuCtxAttach,                  (CUcontext *pctx, unsigned int flags), (pctx, flags))
+HS_CU(cuCtxDetach,                  (CUcontext ctx), (ctx))
+HS_CU_4000(cuCtxPushCurrent,        (CUcontext ctx), (ctx))
+HS_CU_4000(cuCtxPopCurrent,         (CUcontext *pctx), (pctx))
+HS_CU(cuCtxSetCurrent,              (CUcontext ctx), (ctx))
+HS_CU(cuCtxGetCurrent,              (CUcontext *pctx), (pctx))
+HS_CU(cuCtxGetDevice,               (CUdevice *device), (device))
+HS_CU(cuCtxSynchronize,             (void), ())
+HS_CU(cuCtxSetLimit,                (CUlimit limit, size_t value), (limit, value))
+HS_CU(cuCtxGetLimit,                (size_t *pvalue, CUlimit limit), (pvalue, limit))
+HS_CU(cuCtxGetCacheConfig,          (CUfunc_cache *pconfig), (pconfig))
+HS_CU(cuCtxSetCacheConfig,          (CUfunc_cache config), (config))
+HS_CU(cuCtxEnablePeerAccess,        (CUcontext peerContext, unsigned int Flags), (peerContext, Flags))
+HS_CU(cuCtxDisablePeerAccess,       (CUcontext peerContext), (peerContext))
+HS_CU(cuDeviceCanAccessPeer,        (int *canAccessPeer, CUdevice dev, CUdevice peerDev), (canAccessPeer, dev, peerDev))
+#if CUDA_VERSION >= 4020
+HS_CU(cuCtxGetSharedMemConfig,      (CUsharedconfig *pConfig), (pConfig))
+HS_CU(cuCtxSetSharedMemConfig,      (CUsharedconfig config), (config))
+#endif
+#if CUDA_VERSION >= 5050
+HS_CU(cuCtxGetStreamPriorityRange,  (int *leastPriority, int *greatestPriority), (leastPriority, greatestPriority))
+#endif
+#if CUDA_VERSION >= 7000
+HS_CU(cuCtxGetFlags,                (unsigned int *flags), (flags))
+HS_CU(cuDevicePrimaryCtxRetain,     (CUcontext *pctx, CUdevice dev), (pctx, dev))
+HS_CU(cuDevicePrimaryCtxRelease,    (CUdevice dev), (dev))
+HS_CU(cuDevicePrimaryCtxSetFlags,   (CUdevice dev, unsigned int flags), (dev, flags))
+HS_CU(cuDevicePrimaryCtxGetState,   (CUdevice dev, unsigned int *flags, int *active), (dev, flags, active))
+HS_CU(cuDevicePrimaryCtxReset,      (CUdevice dev), (dev))
+#endif
+
+/* Module management */
+HS_CU(cuModuleLoad,                 (CUmodule *module, const char *fname), (module, fname))
+HS_CU(cuModuleLoadData,             (CUmodule *module, const void *image), (module, image))
+HS_CU(cuModuleLoadDataEx,           (CUmodule *module, const void *image, unsigned int numOptions, CUjit_option *options, void **optionValues), (module, image, numOptions, options, optionValues))
+HS_CU(cuModuleUnload,               (CUmodule hmod), (hmod))
+HS_CU(cuModuleGetFunction,          (CUfunction *hfunc, CUmodule hmod, const char *name), (hfunc, hmod, name))
+HS_CU_3020(cuModuleGetGlobal,       (CUdeviceptr *dptr, size_t *bytes, CUmodule hmod, const char *name), (dptr, bytes, hmod, name))
+HS_CU(cuModuleGetTexRef,            (CUtexref *pTexRef, CUmodule hmod, const char *name), (pTexRef, hmod, name))
+#if CUDA_VERSION >= 5050
+HS_CU_6050(cuLinkCreate,            (unsigned int numOptions, CUjit_option *options, void **optionValues, CUlinkState *stateOut), (numOptions, options, optionValues, stateOut))
+HS_CU_6050(cuLinkAddData,           (CUlinkState state, CUjitInputType type, void *data, size_t size, const char *name, unsigned int numOptions, CUjit_option *options, void **optionValues), (state, type, data, size, name, numOptions, options, optionValues))
+HS_CU_6050(cuLinkAddFile,           (CUlinkState state, CUjitInputType type, const char *path, unsigned int numOptions, CUjit_option *options, void **optionValues), (state, type, path, numOptions, options, optionValues))
+HS_CU(cuLinkComplete,               (CUlinkState state, void **cubinOut, size_t *sizeOut), (state, cubinOut, sizeOut))
+HS_CU(cuLinkDestroy,                (CUlinkState state), (state))
+#endif
+
+/* Memory management */
+HS_CU_3020(cuMemGetInfo,            (size_t *free, size_t *total), (free, total))
+HS_CU_3020(cuMemAlloc,              (CUdeviceptr *dptr, size_t bytesize), (dptr, bytesize))
+HS_CU_3020(cuMemFree,               (CUdeviceptr dptr), (dptr))
+HS_CU_3020(cuMemGetAddressRange,    (CUdeviceptr *pbase, size_t *psize, CUdeviceptr dptr), (pbase, psize, dptr))
+HS_CU(cuMemHostAlloc,               (void **pp, size_t bytesize, unsigned int Flags), (pp, bytesize, Flags))
+HS_CU(cuMemFreeHost,                (void *p), (p))
+HS_CU_3020(cuMemHostGetDevicePointer, (CUdeviceptr *pdptr, void *p, unsigned int Flags), (pdptr, p, Flags))
+#if CUDA_VERSION >= 4000
+HS_CU_6050(cuMemHostRegister,       (void *p, size_t bytesize, unsigned int Flags), (p, bytesize, Flags))
+HS_CU(cuMemHostUnregister,          (void *p), (p))
+#endif
+#if CUDA_VERSION >= 6000
+HS_CU(cuMemAllocManaged,            (CUdeviceptr *dptr, size_t bytesize, unsigned int flags), (dptr, bytesize, flags))
+#endif
+HS_CU_3020(cuMemcpyHtoD,            (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount), (dstDevice, srcHost, ByteCount))
+HS_CU_3020(cuMemcpyDtoH,            (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount), (dstHost, srcDevice, ByteCount))
+HS_CU_3020(cuMemcpyDtoD,            (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount), (dstDevice, srcDevice, ByteCount))
+HS_CU_3020(cuMemcpyHtoDAsync,       (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount, CUstream hStream), (dstDevice, srcHost, ByteCount, hStream))
+HS_CU_3020(cuMemcpyDtoHAsync,       (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream), (dstHost, srcDevice, ByteCount, hStream))
+HS_CU_3020(cuMemcpyDtoDAsync,       (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream), (dstDevice, srcDevice, ByteCount, hStream))
+HS_CU(cuMemcpy2D,                   (const CUDA_MEMCPY2D *pCopy), (pCopy))
+HS_CU(cuMemcpy2DAsync,              (const CUDA_MEMCPY2D *pCopy, CUstream hStream), (pCopy, hStream))
+HS_CU(cuMemcpyPeer,                 (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice, CUcontext srcContext, size_t ByteCount), (dstDevice, dstContext, srcDevice, srcContext, ByteCount))
+HS_CU(cuMemcpyPeerAsync,            (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice, CUcontext srcContext, size_t ByteCount, CUstream hStream), (dstDevice, dstContext, srcDevice, srcContext, ByteCount, hStream))
+HS_CU_3020(cuMemsetD8,              (CUdeviceptr dstDevice, unsigned char uc, size_t N), (dstDevice, uc, N))
+HS_CU_3020(cuMemsetD16,             (CUdeviceptr dstDevice, unsigned short us, size_t N), (dstDevice, us, N))
+HS_CU_3020(cuMemsetD32,             (CUdeviceptr dstDevice, unsigned int ui, size_t N), (dstDevice, ui, N))
+HS_CU(cuMemsetD8Async,              (CUdeviceptr dstDevice, unsigned char uc, size_t N, CUstream hStream), (dstDevice, uc, N, hStream))
+HS_CU(cuMemsetD16Async,             (CUdeviceptr dstDevice, unsigned short us, size_t N, CUstream hStream), (dstDevice, us, N, hStream))
+HS_CU(cuMemsetD32Async,             (CUdeviceptr dstDevice, unsigned int ui, size_t N, CUstream hStream), (dstDevice, ui, N, hStream))
+#if CUDA_VERSION >= 8000
+HS_CU(cuMemPrefetchAsync,           (CUdeviceptr devPtr, size_t count, CUdevice dstDevice, CUstream hStream), (devPtr, count, dstDevice, hStream))
+HS_CU(cuMemAdvise,                  (CUdeviceptr devPtr, size_t count, CUmem_advise advice, CUdevice device), (devPtr, count, advice, device))
+#endif
+#if CUDA_VERSION >= 4010
+HS_CU(cuIpcGetEventHandle,          (CUipcEventHandle *pHandle, CUevent event), (pHandle, event))
+HS_CU(cuIpcOpenEventHandle,         (CUevent *phEvent, CUipcEventHandle handle), (phEvent, handle))
+HS_CU(cuIpcGetMemHandle,            (CUipcMemHandle *pHandle, CUdeviceptr dptr), (pHandle, dptr))
+HS_CU(cuIpcOpenMemHandle,           (CUdeviceptr *pdptr, CUipcMemHandle handle, unsigned int Flags), (pdptr, handle, Flags))
+HS_CU(cuIpcCloseMemHandle,          (CUdeviceptr dptr), (dptr))
+#endif
+
+/* Stream and event management */
+HS_CU(cuStreamCreate,               (CUstream *phStream, unsigned int Flags), (phStream, Flags))
+HS_CU_4000(cuStreamDestroy,         (CUstream hStream), (hStream))
+HS_CU(cuStreamQuery,                (CUstream hStream), (hStream))
+HS_CU(cuStreamSynchronize,          (CUstream hStream), (hStream))
+HS_CU(cuStreamWaitEvent,            (CUstream hStream, CUevent hEvent, unsigned int Flags), (hStream, hEvent, Flags))
+#if CUDA_VERSION >= 5050
+HS_CU(cuStreamCreateWithPriority,   (CUstream *phStream, unsigned int flags, int priority), (phStream, flags, priority))
+HS_CU(cuStreamGetPriority,          (CUstream hStream, int *priority), (hStream, priority))
+#endif
+HS_CU(cuEventCreate,                (CUevent *phEvent, unsigned int Flags), (phEvent, Flags))
+HS_CU_4000(cuEventDestroy,          (CUevent hEvent), (hEvent))
+HS_CU(cuEventElapsedTime,           (float *pMilliseconds, CUevent hStart, CUevent hEnd), (pMilliseconds, hStart, hEnd))
+HS_CU(cuEventQuery,                 (CUevent hEvent), (hEvent))
+HS_CU(cuEventRecord,                (CUevent hEvent, CUstream hStream), (hEvent, hStream))
+HS_CU(cuEventSynchronize,           (CUevent hEvent), (hEvent))
+
+/* Execution control */
+HS_CU(cuFuncGetAttribute,           (int *pi, CUfunction_attribute attrib, CUfunction hfunc), (pi, attrib, hfunc))
+HS_CU(cuFuncSetCacheConfig,         (CUfunction hfunc, CUfunc_cache config), (hfunc, config))
+#if CUDA_VERSION >= 4020
+HS_CU(cuFuncSetSharedMemConfig,     (CUfunction hfunc, CUsharedconfig config), (hfunc, config))
+#endif
+HS_CU(cuLaunchKernel,               (CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ, unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ, unsigned int sharedMemBytes, CUstream hStream, void **kernelParams, void **extra), (f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ, sharedMemBytes, hStream, kernelParams, extra))
+HS_CU(cuFuncSetBlockShape,          (CUfunction hfunc, int x, int y, int z), (hfunc, x, y, z))
+HS_CU(cuFuncSetSharedSize,          (CUfunction hfunc, unsigned int bytes), (hfunc, bytes))
+HS_CU(cuParamSetSize,               (CUfunction hfunc, unsigned int numbytes), (hfunc, numbytes))
+HS_CU(cuParamSeti,                  (CUfunction hfunc, int offset, unsigned int value), (hfunc, offset, value))
+HS_CU(cuParamSetf,                  (CUfunction hfunc, int offset, float value), (hfunc, offset, value))
+HS_CU(cuParamSetv,                  (CUfunction hfunc, int offset, void *ptr, unsigned int numbytes), (hfunc, offset, ptr, numbytes))
+HS_CU(cuLaunchGridAsync,            (CUfunction f, int grid_width, int grid_height, CUstream hStream), (f, grid_width, grid_height, hStream))
+
+/* Texture reference management */
+HS_CU(cuTexRefCreate,               (CUtexref *pTexRef), (pTexRef))
+HS_CU(cuTexRefDestroy,              (CUtexref hTexRef), (hTexRef))
+HS_CU_3020(cuTexRefSetAddress,      (size_t *ByteOffset, CUtexref hTexRef, CUdeviceptr dptr, size_t bytes), (ByteOffset, hTexRef, dptr, bytes))
+HS_CU(cuTexRefSetAddress2D,         (CUtexref hTexRef, const CUDA_ARRAY_DESCRIPTOR *desc, CUdeviceptr dptr, size_t Pitch), (hTexRef, desc, dptr, Pitch))
+HS_CU(cuTexRefSetFormat,            (CUtexref hTexRef, CUarray_format fmt, int NumPackedComponents), (hTexRef, fmt, NumPackedComponents))
+HS_CU(cuTexRefSetAddressMode,       (CUtexref hTexRef, int dim, CUaddress_mode am), (hTexRef, dim, am))
+HS_CU(cuTexRefSetFilterMode,        (CUtexref hTexRef, CUfilter_mode fm), (hTexRef, fm))
+HS_CU(cuTexRefSetFlags,             (CUtexref hTexRef, unsigned int Flags), (hTexRef, Flags))
+HS_CU(cuTexRefGetAddressMode,       (CUaddress_mode *pam, CUtexref hTexRef, int dim), (pam, hTexRef, dim))
+HS_CU(cuTexRefGetFilterMode,        (CUfilter_mode *pfm, CUtexref hTexRef), (pfm, hTexRef))
+HS_CU(cuTexRefGetFormat,            (CUarray_format *pFormat, int *pNumChannels, CUtexref hTexRef), (pFormat, pNumChannels, hTexRef))
+
+/* Texture object management */
+#if CUDA_VERSION >= 5000
+HS_CU(cuTexObjectCreate,            (CUtexObject *pTexObject, const CUDA_RESOURCE_DESC *pResDesc, const CUDA_TEXTURE_DESC *pTexDesc, const CUDA_RESOURCE_VIEW_DESC *pResViewDesc), (pTexObject, pResDesc, pTexDesc, pResViewDesc))
+HS_CU(cuTexObjectDestroy,           (CUtexObject texObject), (texObject))
+#endif
+
+/* Profiler control */
+HS_CU(cuProfilerInitialize,         (const char *configFile, const char *outputFile, CUoutput_mode outputMode), (configFile, outputFile, outputMode))
+HS_CU(cuProfilerStart,              (void), ())
+HS_CU(cuProfilerStop,               (void), ())
+
+#undef HS_CU_3020
+#undef HS_CU_4000
+#undef HS_CU_6050
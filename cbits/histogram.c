@@ -0,0 +1,544 @@
+/*
+ * Sampled kernel execution times, aggregated into per-kernel histograms
+ *
+ * A sampled launch is bracketed by a pair of events recorded into its
+ * stream. The launching thread never waits for the device: completed
+ * samples are pushed onto a lock-free list, and are harvested (their
+ * elapsed time read and added to the histogram of the kernel) by whichever
+ * thread next finds the harvest lock free, or when a snapshot is taken.
+ * Samples whose events have not yet been reached are kept for a later
+ * harvest.
+ *
+ * Events are taken from a pool for each context, since an event can only
+ * be recorded into streams of the context it was created in. The pool is
+ * released when its context is destroyed.
+ */
+
+#include "cbits/histogram.h"
+#include "cbits/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct hs_hist_pool {
+    CUcontext               context;
+    hs_hist_sample         *free;
+    struct hs_hist_pool    *next;
+} hs_hist_pool;
+
+struct hs_hist_sample {
+    CUevent                 start;
+    CUevent                 stop;
+    CUfunction              fn;
+    hs_hist_pool           *pool;
+    hs_hist_sample         *next;
+};
+
+typedef struct {
+    CUfunction              fn;
+    uint64_t                count;
+    uint64_t                min;
+    uint64_t                max;
+    uint64_t                sum;
+    uint64_t                buckets[HS_HIST_BUCKETS];
+} hs_hist_kernel;
+
+/*
+ * The kernels which are timed on every launch. The set is replaced, never
+ * modified, so that launching threads can read it without a lock; replaced
+ * sets are not freed, since a launching thread may still be reading one, so
+ * the whole set is built at once whenever the selection changes.
+ */
+typedef struct {
+    size_t                  size;
+    CUfunction              fns[];
+} hs_hist_selection;
+
+
+static uint32_t             hs_hist_period = 100;
+static size_t               hs_hist_max_pending = 4096;
+static uint64_t             hs_hist_pending_count;
+static uint64_t             hs_hist_lost;
+static HS_THREAD_LOCAL uint32_t hs_hist_countdown;
+static HS_THREAD_LOCAL uint32_t hs_hist_harvest_countdown;
+
+static hs_hist_selection   *hs_hist_selected;
+static hs_hist_sample      *hs_hist_incoming;
+
+static hs_mutex_t           hs_hist_lock = HS_MUTEX_INITIALIZER;
+static hs_hist_sample      *hs_hist_pending;
+static hs_hist_kernel     **hs_hist_table;
+static size_t               hs_hist_table_size;
+static size_t               hs_hist_table_count;
+
+static hs_mutex_t           hs_hist_pool_lock = HS_MUTEX_INITIALIZER;
+static hs_hist_pool        *hs_hist_pools;
+
+/* harvest from a launching thread after this many samples */
+#define HS_HIST_HARVEST_INTERVAL 64
+
+
+/*
+ * Sample one in every 'period' launches on each thread (none if zero), in
+ * addition to the selected kernels, with at most 'max_pending' samples not
+ * yet harvested.
+ */
+void hs_hist_configure(uint32_t period, size_t max_pending)
+{
+    __atomic_store_n(&hs_hist_period, period, __ATOMIC_RELAXED);
+    __atomic_store_n(&hs_hist_max_pending, max_pending, __ATOMIC_RELAXED);
+}
+
+/*
+ * Replace the set of kernels timed on every launch
+ */
+void hs_hist_select(const CUfunction *fns, size_t n)
+{
+    hs_hist_selection *new = NULL;
+
+    if (n > 0) {
+        new = malloc(sizeof(hs_hist_selection) + n * sizeof(CUfunction));
+        if (new == NULL)
+            return;
+
+        memcpy(new->fns, fns, n * sizeof(CUfunction));
+        new->size = n;
+    }
+    __atomic_store_n(&hs_hist_selected, new, __ATOMIC_RELEASE);
+}
+
+static int hs_hist_is_selected(CUfunction fn)
+{
+    hs_hist_selection *s = __atomic_load_n(&hs_hist_selected, __ATOMIC_ACQUIRE);
+    size_t             i;
+
+    for (i = 0; s != NULL && i < s->size; ++i)
+        if (s->fns[i] == fn)
+            return 1;
+    return 0;
+}
+
+
+/*
+ * Take a sample from the pool of the current context, creating it if the
+ * pool is empty
+ */
+static hs_hist_sample* hs_hist_sample_new(void)
+{
+    CUcontext       ctx;
+    hs_hist_pool   *pool;
+    hs_hist_sample *s = NULL;
+
+    if (cuCtxGetCurrent(&ctx) != CUDA_SUCCESS || ctx == NULL)
+        return NULL;
+
+    hs_mutex_lock(&hs_hist_pool_lock);
+    for (pool = hs_hist_pools; pool != NULL; pool = pool->next)
+        if (pool->context == ctx)
+            break;
+
+    if (pool == NULL && (pool = calloc(1, sizeof(hs_hist_pool))) != NULL) {
+        pool->context = ctx;
+        pool->next    = hs_hist_pools;
+        hs_hist_pools = pool;
+    }
+    if (pool != NULL && (s = pool->free) != NULL)
+        pool->free = s->next;
+    hs_mutex_unlock(&hs_hist_pool_lock);
+
+    if (pool == NULL || s != NULL)
+        return s;
+
+    s = calloc(1, sizeof(hs_hist_sample));
+    if (s == NULL)
+        return NULL;
+
+    if (cuEventCreate(&s->start, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+        free(s);
+        return NULL;
+    }
+    if (cuEventCreate(&s->stop, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+        cuEventDestroy(s->start);
+        free(s);
+        return NULL;
+    }
+    s->pool = pool;
+    return s;
+}
+
+static void hs_hist_sample_release(hs_hist_sample *s)
+{
+    __atomic_sub_fetch(&hs_hist_pending_count, 1, __ATOMIC_RELAXED);
+
+    hs_mutex_lock(&hs_hist_pool_lock);
+    s->next       = s->pool->free;
+    s->pool->free = s;
+    hs_mutex_unlock(&hs_hist_pool_lock);
+}
+
+
+/*
+ * The histogram of the given kernel, created on first use. The caller must
+ * hold the harvest lock.
+ */
+static hs_hist_kernel* hs_hist_kernel_get(CUfunction fn)
+{
+    hs_hist_kernel **table;
+    hs_hist_kernel  *k;
+    size_t           i, j, size;
+
+    if (2 * (hs_hist_table_count + 1) > hs_hist_table_size) {
+        size  = hs_hist_table_size ? 2 * hs_hist_table_size : 64;
+        table = calloc(size, sizeof(hs_hist_kernel*));
+        if (table == NULL)
+            return NULL;
+
+        for (i = 0; i < hs_hist_table_size; ++i) {
+            if ((k = hs_hist_table[i]) != NULL) {
+                for (j = ((uintptr_t) k->fn >> 4) & (size - 1); table[j] != NULL; j = (j + 1) & (size - 1))
+                    ;
+                table[j] = k;
+            }
+        }
+        free(hs_hist_table);
+        hs_hist_table      = table;
+        hs_hist_table_size = size;
+    }
+
+    for (i = ((uintptr_t) fn >> 4) & (hs_hist_table_size - 1); hs_hist_table[i] != NULL; i = (i + 1) & (hs_hist_table_size - 1))
+        if (hs_hist_table[i]->fn == fn)
+            return hs_hist_table[i];
+
+    k = calloc(1, sizeof(hs_hist_kernel));
+    if (k == NULL)
+        return NULL;
+
+    k->fn    = fn;
+    k->min   = UINT64_MAX;
+    hs_hist_table[i] = k;
+    hs_hist_table_count++;
+
+    return k;
+}
+
+static unsigned hs_hist_bucket(uint64_t v)
+{
+    unsigned e, g;
+
+    if (v < (1u << HS_HIST_SUB_BITS))
+        return (unsigned) v;
+
+    e = 63 - __builtin_clzll(v);
+    g = e - HS_HIST_SUB_BITS + 1;
+    return (g << HS_HIST_SUB_BITS) + (unsigned) ((v >> (e - HS_HIST_SUB_BITS)) - (1u << HS_HIST_SUB_BITS));
+}
+
+/*
+ * The largest value which falls into the given bucket
+ */
+static uint64_t hs_hist_bucket_max(unsigned i)
+{
+    unsigned g = i >> HS_HIST_SUB_BITS;
+    uint64_t m = i & ((1u << HS_HIST_SUB_BITS) - 1);
+
+    if (g == 0)
+        return i;
+
+    return (((1ull << HS_HIST_SUB_BITS) + m) << (g - 1)) + ((1ull << (g - 1)) - 1);
+}
+
+static void hs_hist_add(CUfunction fn, uint64_t ns)
+{
+    hs_hist_kernel *k = hs_hist_kernel_get(fn);
+
+    if (k == NULL)
+        return;
+
+    k->count++;
+    k->sum += ns;
+    if (ns < k->min) k->min = ns;
+    if (ns > k->max) k->max = ns;
+    k->buckets[hs_hist_bucket(ns)]++;
+}
+
+
+/*
+ * Move the samples queued by launching threads to the pending list. The
+ * caller must hold the harvest lock.
+ */
+static void hs_hist_collect(void)
+{
+    hs_hist_sample *s, *next, *incoming;
+
+    /* samples are pushed to the front, so reverse to harvest oldest first */
+    incoming = __atomic_exchange_n(&hs_hist_incoming, NULL, __ATOMIC_ACQUIRE);
+    for (s = incoming; s != NULL; s = next) {
+        next            = s->next;
+        s->next         = hs_hist_pending;
+        hs_hist_pending = s;
+    }
+}
+
+/*
+ * Add every sample the device has completed to its histogram. The caller
+ * must hold the harvest lock.
+ */
+static void hs_hist_harvest(void)
+{
+    hs_hist_sample *s, *next, *keep = NULL;
+    CUcontext       current = NULL, ctx;
+    CUresult        status;
+    float           ms;
+
+    hs_hist_collect();
+    if (hs_hist_pending == NULL)
+        return;
+
+    cuCtxGetCurrent(&current);
+    ctx = current;
+
+    for (s = hs_hist_pending; s != NULL; s = next) {
+        next = s->next;
+
+        if (s->pool->context != ctx) {
+            if (ctx != current)
+                cuCtxPopCurrent(NULL);
+            if (s->pool->context != current && cuCtxPushCurrent(s->pool->context) != CUDA_SUCCESS) {
+                ctx = current;
+                hs_hist_sample_release(s);
+                continue;
+            }
+            ctx = s->pool->context;
+        }
+
+        status = cuEventQuery(s->stop);
+        if (status == CUDA_ERROR_NOT_READY) {
+            s->next = keep;
+            keep    = s;
+            continue;
+        }
+        if (status == CUDA_SUCCESS && cuEventElapsedTime(&ms, s->start, s->stop) == CUDA_SUCCESS)
+            hs_hist_add(s->fn, (uint64_t) ((double) ms * 1.0e6));
+
+        hs_hist_sample_release(s);
+    }
+
+    if (ctx != current)
+        cuCtxPopCurrent(NULL);
+
+    /* restore the original order of the remaining samples */
+    hs_hist_pending = NULL;
+    for (s = keep; s != NULL; s = next) {
+        next            = s->next;
+        s->next         = hs_hist_pending;
+        hs_hist_pending = s;
+    }
+}
+
+
+/*
+ * Forget the pool of a context which has been destroyed, together with its
+ * samples which have not been harvested. Their events were destroyed with
+ * the context, whose handle may be reused by a later one.
+ */
+void hs_hist_release_context(CUcontext ctx)
+{
+    hs_hist_pool   **p, *pool;
+    hs_hist_sample **q, *s, *next;
+
+    hs_mutex_lock(&hs_hist_lock);
+    hs_hist_collect();
+    for (q = &hs_hist_pending; (s = *q) != NULL; ) {
+        if (s->pool->context == ctx) {
+            *q = s->next;
+            __atomic_sub_fetch(&hs_hist_pending_count, 1, __ATOMIC_RELAXED);
+            free(s);
+        }
+        else
+            q = &s->next;
+    }
+    hs_mutex_unlock(&hs_hist_lock);
+
+    hs_mutex_lock(&hs_hist_pool_lock);
+    for (p = &hs_hist_pools; (pool = *p) != NULL; p = &pool->next) {
+        if (pool->context == ctx) {
+            *p = pool->next;
+            break;
+        }
+    }
+    hs_mutex_unlock(&hs_hist_pool_lock);
+
+    if (pool != NULL) {
+        for (s = pool->free; s != NULL; s = next) {
+            next = s->next;
+            free(s);
+        }
+        free(pool);
+    }
+}
+
+
+/*
+ * Decide whether to time this launch of the kernel, and if so record the
+ * start event into its stream. Returns NULL if the launch is not timed.
+ */
+hs_hist_sample* hs_hist_begin(CUfunction fn, CUstream stream)
+{
+    hs_hist_sample *s;
+    uint32_t        period = __atomic_load_n(&hs_hist_period, __ATOMIC_RELAXED);
+
+    if (!hs_hist_is_selected(fn)) {
+        if (period == 0)
+            return NULL;
+        if (hs_hist_countdown > 1 && hs_hist_countdown <= period) {
+            hs_hist_countdown--;
+            return NULL;
+        }
+        hs_hist_countdown = period;
+    }
+
+    if (__atomic_add_fetch(&hs_hist_pending_count, 1, __ATOMIC_RELAXED) > __atomic_load_n(&hs_hist_max_pending, __ATOMIC_RELAXED)) {
+        __atomic_sub_fetch(&hs_hist_pending_count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hs_hist_lost, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    if ((s = hs_hist_sample_new()) == NULL) {
+        __atomic_sub_fetch(&hs_hist_pending_count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hs_hist_lost, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    s->fn = fn;
+    if (cuEventRecord(s->start, stream) != CUDA_SUCCESS) {
+        hs_hist_sample_release(s);
+        return NULL;
+    }
+    return s;
+}
+
+/*
+ * Record the stop event of a timed launch, and queue it for harvesting
+ */
+void hs_hist_end(hs_hist_sample *s, CUstream stream)
+{
+    if (s == NULL)
+        return;
+
+    if (cuEventRecord(s->stop, stream) != CUDA_SUCCESS) {
+        hs_hist_sample_release(s);
+        return;
+    }
+
+    s->next = __atomic_load_n(&hs_hist_incoming, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&hs_hist_incoming, &s->next, s, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    /* harvest occasionally, but never wait for another thread to do so */
+    if (++hs_hist_harvest_countdown >= HS_HIST_HARVEST_INTERVAL) {
+        hs_hist_harvest_countdown = 0;
+        if (hs_mutex_trylock(&hs_hist_lock) == 0) {
+            hs_hist_harvest();
+            hs_mutex_unlock(&hs_hist_lock);
+        }
+    }
+}
+
+/*
+ * Abandon a timed launch which failed
+ */
+void hs_hist_cancel(hs_hist_sample *s)
+{
+    if (s != NULL)
+        hs_hist_sample_release(s);
+}
+
+
+/*
+ * Harvest completed samples, and write the histogram of every kernel into
+ * 'out' as:
+ *
+ *   function, count, min, max, sum, n, followed by n pairs of
+ *   (largest value in the bucket, count) for the non-empty buckets
+ *
+ * Returns the number of words required. If this is greater than 'max',
+ * nothing is written.
+ */
+size_t hs_hist_snapshot(uint64_t *out, size_t max)
+{
+    hs_hist_kernel *k;
+    size_t          i, n, total = 0;
+    unsigned        b;
+
+    hs_mutex_lock(&hs_hist_lock);
+    hs_hist_harvest();
+
+    for (i = 0; i < hs_hist_table_size; ++i) {
+        if ((k = hs_hist_table[i]) != NULL && k->count > 0) {
+            for (n = 0, b = 0; b < HS_HIST_BUCKETS; ++b)
+                n += k->buckets[b] != 0;
+            total += 6 + 2 * n;
+        }
+    }
+
+    if (total <= max) {
+        for (i = 0; i < hs_hist_table_size; ++i) {
+            if ((k = hs_hist_table[i]) != NULL && k->count > 0) {
+                uint64_t *hdr = out;
+
+                out[0] = (uint64_t) (uintptr_t) k->fn;
+                out[1] = k->count;
+                out[2] = k->min;
+                out[3] = k->max;
+                out[4] = k->sum;
+                out   += 6;
+
+                for (n = 0, b = 0; b < HS_HIST_BUCKETS; ++b) {
+                    if (k->buckets[b] != 0) {
+                        out[0] = hs_hist_bucket_max(b);
+                        out[1] = k->buckets[b];
+                        out   += 2;
+                        n++;
+                    }
+                }
+                hdr[5] = n;
+            }
+        }
+    }
+    hs_mutex_unlock(&hs_hist_lock);
+
+    return total;
+}
+
+/*
+ * Empty every histogram
+ */
+void hs_hist_reset(void)
+{
+    hs_hist_kernel *k;
+    size_t          i;
+
+    hs_mutex_lock(&hs_hist_lock);
+    hs_hist_harvest();
+
+    for (i = 0; i < hs_hist_table_size; ++i) {
+        if ((k = hs_hist_table[i]) != NULL) {
+            memset(k->buckets, 0, sizeof(k->buckets));
+            k->count = 0;
+            k->sum   = 0;
+            k->max   = 0;
+            k->min   = UINT64_MAX;
+        }
+    }
+    hs_mutex_unlock(&hs_hist_lock);
+}
+
+/*
+ * The number of launches which should have been timed, but were not because
+ * too many samples were waiting to be harvested
+ */
+uint64_t hs_hist_skipped(void)
+{
+    return __atomic_load_n(&hs_hist_lost, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,46 @@
+/*
+ * Sampled kernel execution times, aggregated into per-kernel histograms
+ */
+
+#ifndef C_HISTOGRAM_H
+#define C_HISTOGRAM_H
+
+#include "cbits/stubs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A launch being timed: a pair of events bracketing the kernel in its stream
+ */
+typedef struct hs_hist_sample hs_hist_sample;
+
+/*
+ * Histogram buckets are log-linear: values below 2^HS_HIST_SUB_BITS
+ * nanoseconds have a bucket each, and every power of two above that is
+ * divided into 2^HS_HIST_SUB_BITS buckets, for a relative error of at most
+ * 2^-HS_HIST_SUB_BITS.
+ */
+#define HS_HIST_SUB_BITS    5
+#define HS_HIST_BUCKETS     ((64 - HS_HIST_SUB_BITS + 1) << HS_HIST_SUB_BITS)
+
+void hs_hist_configure(uint32_t period, size_t max_pending);
+void hs_hist_select(const CUfunction *fns, size_t n);
+
+hs_hist_sample* hs_hist_begin(CUfunction fn, CUstream stream);
+void hs_hist_end(hs_hist_sample *sample, CUstream stream);
+void hs_hist_cancel(hs_hist_sample *sample);
+void hs_hist_release_context(CUcontext ctx);
+
+size_t hs_hist_snapshot(uint64_t *out, size_t max);
+void hs_hist_reset(void);
+uint64_t hs_hist_skipped(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,108 @@
+/*
+ * POSIX shared memory and atomic helpers for inter-process communication
+ */
+
+#include "cbits/shm.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * Create a new, zero-filled shared memory segment of the given size and map
+ * it into the address space of the calling process. Fails if a segment of
+ * that name already exists. Returns NULL and sets errno on failure.
+ */
+void*
+hs_shm_create(const char *name, size_t bytes)
+{
+    void *ptr;
+    int  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, (off_t) bytes) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    return ptr;
+}
+
+/*
+ * Map an existing shared memory segment into the address space of the
+ * calling process, returning the size of the segment via the second
+ * argument. Returns NULL and sets errno on failure.
+ */
+void*
+hs_shm_attach(const char *name, size_t *bytes)
+{
+    void        *ptr;
+    struct stat st;
+    int         fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    ptr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    *bytes = (size_t) st.st_size;
+    return ptr;
+}
+
+int
+hs_shm_detach(void *ptr, size_t bytes)
+{
+    return munmap(ptr, bytes);
+}
+
+int
+hs_shm_unlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+
+/*
+ * Atomic operations on words in shared memory. These are used to publish
+ * indices between processes, so must impose ordering on the surrounding
+ * memory accesses.
+ */
+uint64_t
+hs_atomic_load_acquire_u64(const uint64_t *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+void
+hs_atomic_store_release_u64(uint64_t *ptr, uint64_t val)
+{
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+uint64_t
+hs_atomic_fetch_add_u64(uint64_t *ptr, uint64_t val)
+{
+    return __atomic_fetch_add(ptr, val, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,27 @@
+/*
+ * POSIX shared memory and atomic helpers for inter-process communication
+ */
+
+#ifndef C_SHM_H
+#define C_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void*    hs_shm_create(const char *name, size_t bytes);
+void*    hs_shm_attach(const char *name, size_t *bytes);
+int      hs_shm_detach(void *ptr, size_t bytes);
+int      hs_shm_unlink(const char *name);
+
+uint64_t hs_atomic_load_acquire_u64(const uint64_t *ptr);
+void     hs_atomic_store_release_u64(uint64_t *ptr, uint64_t val);
+uint64_t hs_atomic_fetch_add_u64(uint64_t *ptr, uint64_t val);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -4,6 +4,8 @@
 
 #include "cbits/stubs.h"
 
+#include <string.h>
+
 
 cudaError_t
 cudaConfigureCallSimple
@@ -41,6 +43,59 @@ cuTexRefSetAddress2DSimple
     return cuTexRefSetAddress2D(tex, &desc, dptr, pitch);
 }
 
+#if CUDA_VERSION >= 5000
+/*
+ * Create a texture object over linear memory. If the height is zero the
+ * resource is one-dimensional and the width is its size in bytes, otherwise
+ * it is a pitched two-dimensional array of the given extent (in elements).
+ */
+CUresult
+cuTexObjectCreateSimple
+(
+    CUtexObject *pTexObject,
+    CUdeviceptr dptr,
+    CUarray_format format,
+    unsigned int numChannels,
+    size_t width,
+    size_t height,
+    size_t pitch,
+    CUaddress_mode addressMode,
+    CUfilter_mode filterMode,
+    unsigned int flags
+)
+{
+    CUDA_RESOURCE_DESC res;
+    CUDA_TEXTURE_DESC  tex;
+
+    memset(&res, 0, sizeof(res));
+    memset(&tex, 0, sizeof(tex));
+
+    if (height == 0) {
+        res.resType                     = CU_RESOURCE_TYPE_LINEAR;
+        res.res.linear.devPtr           = dptr;
+        res.res.linear.format           = format;
+        res.res.linear.numChannels      = numChannels;
+        res.res.linear.sizeInBytes      = width;
+    } else {
+        res.resType                     = CU_RESOURCE_TYPE_PITCH2D;
+        res.res.pitch2D.devPtr          = dptr;
+        res.res.pitch2D.format          = format;
+        res.res.pitch2D.numChannels     = numChannels;
+        res.res.pitch2D.width           = width;
+        res.res.pitch2D.height          = height;
+        res.res.pitch2D.pitchInBytes    = pitch;
+    }
+
+    tex.addressMode[0] = addressMode;
+    tex.addressMode[1] = addressMode;
+    tex.addressMode[2] = addressMode;
+    tex.filterMode     = filterMode;
+    tex.flags          = flags;
+
+    return cuTexObjectCreate(pTexObject, &res, &tex, NULL);
+}
+#endif
+
 CUresult
 cuMemcpy2DHtoD
 (
@@ -248,148 +303,3 @@ cuMemcpy2DDtoDAsync
     return cuMemcpy2DAsync(&desc, hStream);
 }
 
-
-#if CUDA_VERSION >= 3020
-/*
- * Extra exports for CUDA-3.2
- */
-CUresult CUDAAPI cuDeviceTotalMem(size_t *bytes, CUdevice dev)
-{
-    return cuDeviceTotalMem_v2(bytes, dev);
-}
-
-CUresult CUDAAPI cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
-{
-    return cuCtxCreate_v2(pctx, flags, dev);
-}
-
-CUresult CUDAAPI cuModuleGetGlobal(CUdeviceptr *dptr, size_t *bytes, CUmodule hmod, const char *name)
-{
-    return cuModuleGetGlobal_v2(dptr, bytes, hmod, name);
-}
-
-CUresult CUDAAPI cuMemAlloc(CUdeviceptr *dptr, size_t bytesize)
-{
-    return cuMemAlloc_v2(dptr, bytesize);
-}
-
-CUresult CUDAAPI cuMemFree(CUdeviceptr dptr)
-{
-    return cuMemFree_v2(dptr);
-}
-
-CUresult CUDAAPI cuMemGetInfo(size_t *free, size_t *total)
-{
-    return cuMemGetInfo_v2(free, total);
-}
-
-CUresult CUDAAPI cuMemGetAddressRange(CUdeviceptr *pbase, size_t *psize, CUdeviceptr dptr)
-{
-    return cuMemGetAddressRange_v2(pbase, psize, dptr);
-}
-
-CUresult CUDAAPI cuMemHostGetDevicePointer(CUdeviceptr *pdptr, void *p, unsigned int Flags)
-{
-    return cuMemHostGetDevicePointer_v2(pdptr, p, Flags);
-}
-
-CUresult CUDAAPI cuMemcpyHtoD(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount)
-{
-    return cuMemcpyHtoD_v2(dstDevice, srcHost, ByteCount);
-}
-
-CUresult CUDAAPI cuMemcpyDtoH(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount)
-{
-    return cuMemcpyDtoH_v2(dstHost, srcDevice, ByteCount);
-}
-
-CUresult CUDAAPI cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount)
-{
-    return cuMemcpyDtoD_v2(dstDevice, srcDevice, ByteCount);
-}
-
-CUresult CUDAAPI cuMemcpyDtoDAsync(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream)
-{
-    return cuMemcpyDtoDAsync_v2(dstDevice, srcDevice, ByteCount, hStream);
-}
-
-CUresult CUDAAPI cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount, CUstream hStream)
-{
-    return cuMemcpyHtoDAsync_v2(dstDevice, srcHost, ByteCount, hStream);
-}
-
-CUresult CUDAAPI cuMemcpyDtoHAsync(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream)
-{
-    return cuMemcpyDtoHAsync_v2(dstHost, srcDevice, ByteCount, hStream);
-}
-
-CUresult CUDAAPI cuMemsetD8(CUdeviceptr dstDevice, unsigned char uc, size_t N)
-{
-    return cuMemsetD8_v2(dstDevice, uc, N);
-}
-
-CUresult CUDAAPI cuMemsetD16(CUdeviceptr dstDevice, unsigned short us, size_t N)
-{
-    return cuMemsetD16_v2(dstDevice, us, N);
-}
-
-CUresult CUDAAPI cuMemsetD32(CUdeviceptr dstDevice, unsigned int ui, size_t N)
-{
-    return cuMemsetD32_v2(dstDevice, ui, N);
-}
-
-CUresult CUDAAPI cuTexRefSetAddress(size_t *ByteOffset, CUtexref hTexRef, CUdeviceptr dptr, size_t bytes)
-{
-    return cuTexRefSetAddress_v2(ByteOffset, hTexRef, dptr, bytes);
-}
-#endif
-
-#if CUDA_VERSION >= 4000
-CUresult CUDAAPI cuCtxDestroy(CUcontext ctx)
-{
-    return cuCtxDestroy_v2(ctx);
-}
-
-CUresult CUDAAPI cuCtxPopCurrent(CUcontext *pctx)
-{
-    return cuCtxPopCurrent_v2(pctx);
-}
-
-CUresult CUDAAPI cuCtxPushCurrent(CUcontext ctx)
-{
-    return cuCtxPushCurrent_v2(ctx);
-}
-
-CUresult CUDAAPI cuStreamDestroy(CUstream hStream)
-{
-    return cuStreamDestroy_v2(hStream);
-}
-
-CUresult CUDAAPI cuEventDestroy(CUevent hEvent)
-{
-    return cuEventDestroy_v2(hEvent);
-}
-#endif
-
-#if CUDA_VERSION >= 6050
-CUresult CUDAAPI cuMemHostRegister(void *p, size_t bytesize, unsigned int Flags)
-{
-    return cuMemHostRegister_v2(p, bytesize, Flags);
-}
-
-CUresult CUDAAPI cuLinkCreate(unsigned int numOptions, CUjit_option *options, void **optionValues, CUlinkState *stateOut)
-{
-    return cuLinkCreate_v2(numOptions, options, optionValues, stateOut);
-}
-
-CUresult CUDAAPI cuLinkAddData(CUlinkState state, CUjitInputType type, void *data, size_t size, const char *name, unsigned int numOptions, CUjit_option *options, void **optionValues)
-{
-    return cuLinkAddData_v2(state, type, data, size, name, numOptions, options, optionValues);
-}
-
-CUresult CUDAAPI cuLinkAddFile(CUlinkState state, CUjitInputType type, const char *path, unsigned int numOptions, CUjit_option *options, void **optionValues)
-{
-    return cuLinkAddFile_v2(state, type, path, numOptions, options, optionValues);
-}
-#endif
-
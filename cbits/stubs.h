@@ -97,10 +97,28 @@ cuMemcpy2DDtoDAsync
     CUstream hStream
 );
 
+#if CUDA_VERSION >= 5000
+CUresult
+cuTexObjectCreateSimple
+(
+    CUtexObject         *pTexObject,
+    CUdeviceptr         dptr,
+    CUarray_format      format,
+    unsigned int        numChannels,
+    size_t              width,
+    size_t              height,
+    size_t              pitch,
+    CUaddress_mode      addressMode,
+    CUfilter_mode       filterMode,
+    unsigned int        flags
+);
+#endif
+
 
 /*
  * Need to re-export some symbols as they are now generated by #defines, which
- * c2hs does not like in the function binding hooks.
+ * c2hs does not like in the function binding hooks. These are defined, along
+ * with the renamed versions, in driver.c.
  */
 #if CUDA_VERSION >= 3020
 #undef cuDeviceTotalMem
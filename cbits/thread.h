@@ -0,0 +1,42 @@
+/*
+ * Thread-local storage and mutexes, on POSIX threads or Windows
+ */
+
+#ifndef C_THREAD_H
+#define C_THREAD_H
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+ * MinGW's gcc, which GHC uses on Windows, supports __thread; only MSVC needs
+ * its own spelling
+ */
+#if defined(_MSC_VER)
+#define HS_THREAD_LOCAL         __declspec(thread)
+#else
+#define HS_THREAD_LOCAL         __thread
+#endif
+
+/*
+ * A statically initialised mutex. The trylock operation returns zero if the
+ * lock was acquired, as pthread_mutex_trylock does.
+ */
+#if defined(_WIN32)
+typedef SRWLOCK                 hs_mutex_t;
+#define HS_MUTEX_INITIALIZER    SRWLOCK_INIT
+#define hs_mutex_lock(m)        AcquireSRWLockExclusive(m)
+#define hs_mutex_trylock(m)     (TryAcquireSRWLockExclusive(m) ? 0 : 1)
+#define hs_mutex_unlock(m)      ReleaseSRWLockExclusive(m)
+#else
+typedef pthread_mutex_t         hs_mutex_t;
+#define HS_MUTEX_INITIALIZER    PTHREAD_MUTEX_INITIALIZER
+#define hs_mutex_lock(m)        pthread_mutex_lock(m)
+#define hs_mutex_trylock(m)     pthread_mutex_trylock(m)
+#define hs_mutex_unlock(m)      pthread_mutex_unlock(m)
+#endif
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Per-thread trace buffers for driver calls
+ *
+ * Each OS thread which records a trace entry is given its own ring buffer, so
+ * that recording requires no locks: the owning thread is the only writer,
+ * and the (single) thread draining the buffers is the only reader. Rings are
+ * never freed, since the reader may still be looking at a ring when its
+ * owner exits. If a ring is full the entry is dropped and counted.
+ *
+ * Device timestamps are taken by recording an event into the stream before
+ * and after the operation. Events are taken from a pool kept for each
+ * context, together with a reference event whose host time is known, so
+ * that elapsed device times can be placed on the host timeline.
+ */
+
+#include "cbits/trace.h"
+#include "cbits/thread.h"
+#include "cbits/clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct hs_trace_pool {
+    CUcontext               context;
+    CUevent                 reference;
+    uint64_t                reference_time;
+    hs_trace_marker        *free;
+    struct hs_trace_pool   *next;
+} hs_trace_pool;
+
+struct hs_trace_marker {
+    CUevent                 event;
+    hs_trace_pool          *pool;
+    hs_trace_marker        *next;
+};
+
+typedef struct {
+    uint32_t                api;
+    uint32_t                thread;
+    CUstream                stream;
+    uint64_t                bytes;
+    uint64_t                begin;
+    uint64_t                end;
+    hs_trace_marker        *dev_begin;
+    hs_trace_marker        *dev_end;
+} hs_trace_entry;
+
+typedef struct hs_trace_ring {
+    hs_trace_entry         *entries;
+    uint64_t                capacity;           /* power of two */
+    uint64_t                head;               /* written by the owner */
+    uint64_t                tail;               /* written by the reader */
+    uint64_t                id;
+    struct hs_trace_ring   *next;
+} hs_trace_ring;
+
+
+static HS_THREAD_LOCAL hs_trace_ring *hs_trace_local;
+static hs_trace_ring           *hs_trace_rings;
+static uint64_t                 hs_trace_ring_count;
+static uint64_t                 hs_trace_lost;
+
+static size_t                   hs_trace_capacity = 65536;
+static int                      hs_trace_device_times;
+
+static hs_trace_pool           *hs_trace_pools;
+static hs_mutex_t               hs_trace_pool_lock = HS_MUTEX_INITIALIZER;
+
+
+/*
+ * Set the capacity (entries) of rings created from now on, and whether
+ * device timestamps are recorded.
+ */
+void hs_trace_configure(size_t capacity, int device_times)
+{
+    size_t c = 1;
+
+    while (c < capacity)
+        c <<= 1;
+
+    __atomic_store_n(&hs_trace_capacity, c, __ATOMIC_RELAXED);
+    __atomic_store_n(&hs_trace_device_times, device_times, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * The ring of the calling thread, created on first use. Returns NULL if the
+ * ring could not be allocated.
+ */
+static hs_trace_ring* hs_trace_ring_local(void)
+{
+    hs_trace_ring *ring = hs_trace_local;
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(hs_trace_ring));
+        if (ring == NULL)
+            return NULL;
+
+        ring->capacity = __atomic_load_n(&hs_trace_capacity, __ATOMIC_RELAXED);
+        ring->entries  = calloc(ring->capacity, sizeof(hs_trace_entry));
+        if (ring->entries == NULL) {
+            free(ring);
+            return NULL;
+        }
+        ring->id = __atomic_add_fetch(&hs_trace_ring_count, 1, __ATOMIC_RELAXED);
+
+        /* publish the ring to the reader */
+        ring->next = __atomic_load_n(&hs_trace_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&hs_trace_rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+
+        hs_trace_local = ring;
+    }
+    return ring;
+}
+
+
+/*
+ * The event pool of the current context, created on first use. The caller
+ * must hold the pool lock.
+ */
+static hs_trace_pool* hs_trace_pool_current(void)
+{
+    CUcontext      ctx;
+    hs_trace_pool *pool;
+
+    if (cuCtxGetCurrent(&ctx) != CUDA_SUCCESS || ctx == NULL)
+        return NULL;
+
+    for (pool = hs_trace_pools; pool != NULL; pool = pool->next)
+        if (pool->context == ctx)
+            return pool;
+
+    pool = calloc(1, sizeof(hs_trace_pool));
+    if (pool == NULL)
+        return NULL;
+
+    if (cuEventCreate(&pool->reference, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+        free(pool);
+        return NULL;
+    }
+
+    /* align the device and host clocks */
+    cuEventRecord(pool->reference, NULL);
+    cuEventSynchronize(pool->reference);
+
+    pool->reference_time = hs_clock_monotonic_ns();
+    pool->context        = ctx;
+    pool->next           = hs_trace_pools;
+    hs_trace_pools       = pool;
+
+    return pool;
+}
+
+/*
+ * Record a device timestamp into the given stream, if device timestamps are
+ * enabled. Returns NULL otherwise or on failure.
+ */
+hs_trace_marker* hs_trace_marker_record(CUstream stream)
+{
+    hs_trace_pool   *pool;
+    hs_trace_marker *marker = NULL;
+
+    if (!__atomic_load_n(&hs_trace_device_times, __ATOMIC_RELAXED))
+        return NULL;
+
+    hs_mutex_lock(&hs_trace_pool_lock);
+    pool = hs_trace_pool_current();
+    if (pool != NULL) {
+        marker = pool->free;
+        if (marker != NULL)
+            pool->free = marker->next;
+    }
+    hs_mutex_unlock(&hs_trace_pool_lock);
+
+    if (pool == NULL)
+        return NULL;
+
+    if (marker == NULL) {
+        marker = calloc(1, sizeof(hs_trace_marker));
+        if (marker == NULL)
+            return NULL;
+
+        if (cuEventCreate(&marker->event, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+            free(marker);
+            return NULL;
+        }
+        marker->pool = pool;
+    }
+
+    if (cuEventRecord(marker->event, stream) != CUDA_SUCCESS) {
+        hs_trace_marker_release(marker);
+        return NULL;
+    }
+    return marker;
+}
+
+/*
+ * Return a marker to its pool
+ */
+void hs_trace_marker_release(hs_trace_marker *marker)
+{
+    if (marker == NULL)
+        return;
+
+    hs_mutex_lock(&hs_trace_pool_lock);
+    marker->next       = marker->pool->free;
+    marker->pool->free = marker;
+    hs_mutex_unlock(&hs_trace_pool_lock);
+}
+
+/*
+ * Wait for the marker to be reached by the device, and convert it to host
+ * time. Returns zero if the time could not be determined.
+ */
+static uint64_t hs_trace_marker_time(hs_trace_marker *marker)
+{
+    float    ms;
+    uint64_t t = 0;
+
+    if (marker == NULL)
+        return 0;
+
+    if (cuCtxPushCurrent(marker->pool->context) == CUDA_SUCCESS) {
+        if (cuEventSynchronize(marker->event) == CUDA_SUCCESS &&
+            cuEventElapsedTime(&ms, marker->pool->reference, marker->event) == CUDA_SUCCESS)
+        {
+            t = marker->pool->reference_time + (uint64_t) ((double) ms * 1.0e6);
+        }
+        cuCtxPopCurrent(NULL);
+    }
+
+    hs_trace_marker_release(marker);
+    return t;
+}
+
+
+/*
+ * Append an entry to the ring of the calling thread
+ */
+void hs_trace_record
+(
+    uint32_t api,
+    uint32_t thread,
+    CUstream stream,
+    uint64_t bytes,
+    uint64_t begin,
+    uint64_t end,
+    hs_trace_marker *dev_begin,
+    hs_trace_marker *dev_end
+)
+{
+    hs_trace_ring  *ring = hs_trace_ring_local();
+    hs_trace_entry *e;
+    uint64_t        head;
+
+    if (ring == NULL || ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->capacity) {
+        __atomic_add_fetch(&hs_trace_lost, 1, __ATOMIC_RELAXED);
+        hs_trace_marker_release(dev_begin);
+        hs_trace_marker_release(dev_end);
+        return;
+    }
+
+    head         = ring->head;
+    e            = &ring->entries[head & (ring->capacity - 1)];
+    e->api       = api;
+    e->thread    = thread;
+    e->stream    = stream;
+    e->bytes     = bytes;
+    e->begin     = begin;
+    e->end       = end;
+    e->dev_begin = dev_begin;
+    e->dev_end   = dev_end;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Remove up to 'max' entries from the rings of all threads, writing
+ * HS_TRACE_ENTRY_WORDS words for each. Returns the number of entries
+ * written. This blocks until the device has reached any recorded device
+ * timestamps. Only one thread may drain at a time.
+ */
+size_t hs_trace_drain(uint64_t *out, size_t max)
+{
+    hs_trace_ring  *ring;
+    hs_trace_entry *e;
+    uint64_t        head, tail;
+    size_t          n = 0;
+
+    for (ring = __atomic_load_n(&hs_trace_rings, __ATOMIC_ACQUIRE); ring != NULL && n < max; ring = ring->next) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+
+        for (; tail != head && n < max; ++tail, ++n) {
+            e      = &ring->entries[tail & (ring->capacity - 1)];
+            out[0] = e->api;
+            out[1] = e->thread;
+            out[2] = ring->id;
+            out[3] = (uint64_t) (uintptr_t) e->stream;
+            out[4] = e->bytes;
+            out[5] = e->begin;
+            out[6] = e->end;
+            out[7] = hs_trace_marker_time(e->dev_begin);
+            out[8] = hs_trace_marker_time(e->dev_end);
+            out   += HS_TRACE_ENTRY_WORDS;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+/*
+ * The number of entries dropped because a ring was full
+ */
+uint64_t hs_trace_dropped(void)
+{
+    return __atomic_load_n(&hs_trace_lost, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,46 @@
+/*
+ * Per-thread trace buffers for driver calls
+ */
+
+#ifndef C_TRACE_H
+#define C_TRACE_H
+
+#include "cbits/stubs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A device timestamp, taken by recording an event into a stream
+ */
+typedef struct hs_trace_marker hs_trace_marker;
+
+/*
+ * The number of 64-bit words in each entry returned by hs_trace_drain:
+ *
+ *   api, Haskell thread, OS thread, stream, bytes,
+ *   host begin, host end, device begin, device end
+ *
+ * Host times are in nanoseconds of the monotonic clock. Device times are
+ * on the same time base, or zero if not measured.
+ */
+#define HS_TRACE_ENTRY_WORDS 9
+
+void hs_trace_configure(size_t capacity, int device_times);
+
+hs_trace_marker* hs_trace_marker_record(CUstream stream);
+void hs_trace_marker_release(hs_trace_marker *marker);
+
+void hs_trace_record(uint32_t api, uint32_t thread, CUstream stream, uint64_t bytes, uint64_t begin, uint64_t end, hs_trace_marker *dev_begin, hs_trace_marker *dev_end);
+
+size_t hs_trace_drain(uint64_t *entries, size_t max);
+uint64_t hs_trace_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -16,6 +16,31 @@
 #include <limits.h>
 
 
+/*
+ * Allow the operators to be used by host code compiled without nvcc, such as
+ * the host implementations of the examples. Applied to vector types, as the
+ * host implementations do, the operations are element-wise.
+ */
+#ifndef __CUDACC__
+#ifndef __host__
+#define __host__
+#endif
+#ifndef __device__
+#define __device__
+#endif
+
+namespace host_op {
+template <typename T> inline T min(const T &a, const T &b) { return a < b ? a : b; }
+template <typename T> inline T max(const T &a, const T &b) { return a < b ? b : a; }
+}
+#define OP_MIN(a,b)     host_op::min(a,b)
+#define OP_MAX(a,b)     host_op::max(a,b)
+#else
+#define OP_MIN(a,b)     min(a,b)
+#define OP_MAX(a,b)     max(a,b)
+#endif
+
+
 /*
  * Template class for an operation that can be mapped over an array.
  */
@@ -26,14 +51,14 @@ public:
     /*
      * Apply the operation to the given operand.
      */
-    static __device__ Tb apply(const Ta &x);
+    static __host__ __device__ Tb apply(const Ta &x);
 };
 
 template <typename Ta, typename Tb>
 class fromIntegral : Functor<Ta, Tb>
 {
 public:
-    static __device__ Tb apply(const Ta &x) { return (Tb) x; }
+    static __host__ __device__ Tb apply(const Ta &x) { return (Tb) x; }
 };
 
 
@@ -51,7 +76,7 @@ public:
     /*
      * Apply the operation to the given operands.
      */
-    static __device__ Tc apply(const Ta &a, const Tb &b);
+    static __host__ __device__ Tc apply(const Ta &a, const Tb &b);
 
     /*
      * Return an identity element for the type Tc.
@@ -59,18 +84,18 @@ public:
      * This may have special meaning for a given implementation, for example a
      * `max' operation over integers may want to return INT_MIN.
      */
-    static __device__ Tc identity();
+    static __host__ __device__ Tc identity();
 };
 
 /*
  * Return the minimum or maximum value of a type
  */
-template <typename T> inline __device__ T getMin();
-template <typename T> inline __device__ T getMax();
+template <typename T> inline __host__ __device__ T getMin();
+template <typename T> inline __host__ __device__ T getMax();
 
 #define SPEC_MINMAX(type,vmin,vmax)                                            \
-    template <> inline __device__ type getMin() { return vmin; };              \
-    template <> inline __device__ type getMax() { return vmax; }               \
+    template <> inline __host__ __device__ type getMin() { return vmin; };     \
+    template <> inline __host__ __device__ type getMax() { return vmax; }      \
 
 SPEC_MINMAX(float,        -FLT_MAX,  FLT_MAX);
 SPEC_MINMAX(int,           INT_MIN,  INT_MAX);
@@ -83,32 +108,34 @@ SPEC_MINMAX(unsigned char, 0,        UCHAR_MAX);
  * Basic binary arithmetic operations. We take advantage of automatic type
  * promotion to keep the parameters general.
  */
-#define BASIC_OP(name,expr,id)                                                 \
-    template <typename Ta, typename Tb=Ta, typename Tc=Ta>                     \
-    class name : BinaryOp<Ta, Tb, Tc>                                          \
-    {                                                                          \
-    public:                                                                    \
-        static __device__ Tc apply(const Ta &a, const Tb &b) { return expr; }  \
-        static __device__ Tc identity() { return id; }                         \
+#define BASIC_OP(name,expr,id)                                                         \
+    template <typename Ta, typename Tb=Ta, typename Tc=Ta>                             \
+    class name : BinaryOp<Ta, Tb, Tc>                                                  \
+    {                                                                                  \
+    public:                                                                            \
+        static __host__ __device__ Tc apply(const Ta &a, const Tb &b) { return expr; } \
+        static __host__ __device__ Tc identity() { return id; }                        \
     }
 
-#define LOGICAL_OP(name,expr,id)                                               \
-    template <typename Ta, typename Tb=Ta>                                     \
-    class name : BinaryOp<Ta, Tb, bool>                                        \
-    {                                                                          \
-    public:                                                                    \
-        static __device__ bool apply(const Ta &a, const Tb &b) { return expr; }\
-        static __device__ bool identity() { return id; }                       \
+#define LOGICAL_OP(name,expr,id)                                                         \
+    template <typename Ta, typename Tb=Ta>                                               \
+    class name : BinaryOp<Ta, Tb, bool>                                                  \
+    {                                                                                    \
+    public:                                                                              \
+        static __host__ __device__ bool apply(const Ta &a, const Tb &b) { return expr; } \
+        static __host__ __device__ bool identity() { return id; }                        \
     }
 
 BASIC_OP(Plus,  a + b,    0);
 BASIC_OP(Times, a * b,    1);
-BASIC_OP(Min,   min(a,b), getMax<Ta>());
-BASIC_OP(Max,   max(a,b), getMin<Ta>());
+BASIC_OP(Min,   OP_MIN(a,b), getMax<Ta>());
+BASIC_OP(Max,   OP_MAX(a,b), getMin<Ta>());
 
 LOGICAL_OP(Eq,  a == b,   false);
 
 #undef SPEC_MINMAX
 #undef BASIC_OP
+#undef OP_MIN
+#undef OP_MAX
 #endif
 
@@ -0,0 +1,204 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : Parallel
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * A pool of threads for the host implementations of the examples.
+ *
+ * The pool is started on first use, with one thread for each online processor
+ * unless the environment variable HS_CUDA_HOST_THREADS (which also sizes the
+ * host execution backend) says otherwise. The calling thread takes part in
+ * the work, so it counts as one of them. Tasks are handed out one at a time in
+ * order, so that neighbouring tasks, which typically touch neighbouring
+ * memory, start at about the same time.
+ *
+ * Only one job runs at once, and a task must not itself call parallel_for.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+class ThreadPool
+{
+public:
+    typedef void (*Task)(void *arg, int task);
+
+    /*
+     * The pool shared by the whole program
+     */
+    static ThreadPool& get()
+    {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        pthread_once(&once, create);
+        return *instance();
+    }
+
+    int threads() const { return m_threads; }
+
+    /*
+     * Run the tasks [0,n), returning once they have all completed
+     */
+    void run(int n, Task fn, void *arg)
+    {
+        pthread_mutex_lock(&m_serial);
+        pthread_mutex_lock(&m_lock);
+
+        /* workers still looking at the previous job would claim from this one */
+        while (m_active > 0)
+            pthread_cond_wait(&m_finish, &m_lock);
+
+        m_fn        = fn;
+        m_arg       = arg;
+        m_tasks     = n;
+        m_next      = 0;
+        m_completed = 0;
+        ++m_generation;
+        pthread_cond_broadcast(&m_start);
+        pthread_mutex_unlock(&m_lock);
+
+        work(fn, arg, n);
+
+        pthread_mutex_lock(&m_lock);
+        while (__atomic_load_n(&m_completed, __ATOMIC_ACQUIRE) < n)
+            pthread_cond_wait(&m_finish, &m_lock);
+        pthread_mutex_unlock(&m_lock);
+        pthread_mutex_unlock(&m_serial);
+    }
+
+private:
+    int                 m_threads;
+    pthread_mutex_t     m_serial;
+    pthread_mutex_t     m_lock;
+    pthread_cond_t      m_start;
+    pthread_cond_t      m_finish;
+    unsigned int        m_generation;
+    int                 m_active;
+
+    Task                m_fn;
+    void               *m_arg;
+    int                 m_tasks;
+    int                 m_next;
+    int                 m_completed;
+
+    static ThreadPool*& instance()
+    {
+        static ThreadPool *pool = NULL;
+        return pool;
+    }
+
+    static void create()
+    {
+        const char *env = getenv("HS_CUDA_HOST_THREADS");
+        long        n   = env != NULL ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+
+        instance() = new ThreadPool(n > 0 ? (int) n : 1);
+    }
+
+    static void* worker(void *arg)
+    {
+        ThreadPool  *pool = static_cast<ThreadPool*>(arg);
+        unsigned int seen = 0;
+        Task         fn;
+        void        *a;
+        int          n;
+
+        pthread_mutex_lock(&pool->m_lock);
+        for (;;)
+        {
+            while (pool->m_generation == seen)
+                pthread_cond_wait(&pool->m_start, &pool->m_lock);
+
+            seen = pool->m_generation;
+            fn   = pool->m_fn;
+            a    = pool->m_arg;
+            n    = pool->m_tasks;
+            ++pool->m_active;
+            pthread_mutex_unlock(&pool->m_lock);
+
+            pool->work(fn, a, n);
+
+            pthread_mutex_lock(&pool->m_lock);
+            if (--pool->m_active == 0)
+                pthread_cond_broadcast(&pool->m_finish);
+        }
+        return NULL;
+    }
+
+    void work(Task fn, void *arg, int n)
+    {
+        int t;
+
+        while ((t = __atomic_fetch_add(&m_next, 1, __ATOMIC_ACQ_REL)) < n)
+        {
+            fn(arg, t);
+
+            if (__atomic_add_fetch(&m_completed, 1, __ATOMIC_ACQ_REL) == n)
+            {
+                pthread_mutex_lock(&m_lock);
+                pthread_cond_broadcast(&m_finish);
+                pthread_mutex_unlock(&m_lock);
+            }
+        }
+    }
+
+    ThreadPool(int n)
+        : m_threads(n), m_generation(0), m_active(0)
+        , m_fn(NULL), m_arg(NULL), m_tasks(0), m_next(0), m_completed(0)
+    {
+        pthread_attr_t attr;
+        pthread_t      thread;
+
+        pthread_mutex_init(&m_serial, NULL);
+        pthread_mutex_init(&m_lock, NULL);
+        pthread_cond_init(&m_start, NULL);
+        pthread_cond_init(&m_finish, NULL);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        for (int i = 1; i < n; ++i)
+        {
+            if (pthread_create(&thread, &attr, worker, this) != 0)
+            {
+                m_threads = i;
+                break;
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+};
+
+
+/*
+ * Apply a function object to each of the tasks [0,n) in parallel
+ */
+template <class F>
+static void
+parallel_task(void *f, int task)
+{
+    (*static_cast<F*>(f))(task);
+}
+
+template <class F>
+static void
+parallel_for(int n, F &f)
+{
+    if (n == 1)
+        f(0);
+    else if (n > 1)
+        ThreadPool::get().run(n, parallel_task<F>, &f);
+}
+
+static inline int
+parallel_threads()
+{
+    return ThreadPool::get().threads();
+}
+
+#endif
@@ -0,0 +1,186 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : SIMD
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Vector types for the host implementations of the examples.
+ *
+ * These are the generic vectors of GCC, so the same code uses the widest
+ * registers enabled by the target flags: AVX-512 with -mavx512f, AVX2 with
+ * -mavx2, and SSE otherwise. The operators of operator.h apply element-wise to
+ * vectors, via 'rebind'.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <string.h>
+
+#if defined(__AVX512F__)
+#define SIMD_BYTES      64
+#elif defined(__AVX__)
+#define SIMD_BYTES      32
+#else
+#define SIMD_BYTES      16
+#endif
+
+
+/*
+ * The signed integer of the same size as an element, for the lane indices of
+ * a shuffle
+ */
+template <int bytes>
+struct simd_lane;
+
+template <> struct simd_lane<4> { typedef int       type; };
+template <> struct simd_lane<8> { typedef long long type; };
+
+
+template <typename T>
+struct simd
+{
+    typedef T                                       type  __attribute__((vector_size(SIMD_BYTES)));
+    typedef typename simd_lane<sizeof(T)>::type     index __attribute__((vector_size(SIMD_BYTES)));
+    enum { width = SIMD_BYTES / sizeof(T) };
+};
+
+
+/*
+ * The operator applied to vectors rather than scalars, so that Plus<float>
+ * becomes Plus<simd<float>::type>
+ */
+template <class op, typename V>
+struct rebind;
+
+template <template <typename, typename, typename> class op, typename T, typename V>
+struct rebind< op<T,T,T>, V >
+{
+    typedef op<V,V,V> type;
+};
+
+
+/*
+ * Unaligned loads and stores, and a vector of copies of a scalar
+ */
+template <typename T>
+static inline typename simd<T>::type
+simd_load(const T *p)
+{
+    typename simd<T>::type v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+template <typename T>
+static inline void
+simd_store(T *p, const typename simd<T>::type &v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+template <typename T>
+static inline typename simd<T>::type
+simd_splat(const T &x)
+{
+    typename simd<T>::type v;
+    for (int i = 0; i < simd<T>::width; ++i)
+        v[i] = x;
+    return v;
+}
+
+
+/*
+ * Move the lanes of a vector k places towards the last lane (up) or the first
+ * lane (down). The lanes left behind are filled from the other end of a second
+ * vector, as if the two were concatenated: shifting up brings in the last k
+ * lanes of 'fill', and shifting down its first k lanes. The vectors may be
+ * either simd<T>::type or its index type. The lane indices are compile-time
+ * constants, so these become single shuffles.
+ */
+template <int k, typename T, typename V>
+static inline V
+simd_shift_up(const V &v, const V &fill)
+{
+    typename simd<T>::index m;
+    for (int i = 0; i < simd<T>::width; ++i)
+        m[i] = simd<T>::width + i - k;
+    return __builtin_shuffle(fill, v, m);
+}
+
+template <int k, typename T, typename V>
+static inline V
+simd_shift_down(const V &v, const V &fill)
+{
+    typename simd<T>::index m;
+    for (int i = 0; i < simd<T>::width; ++i)
+        m[i] = i + k;
+    return __builtin_shuffle(v, fill, m);
+}
+
+/*
+ * A vector of copies of one of the lanes of another
+ */
+template <int k, typename T>
+static inline typename simd<T>::type
+simd_broadcast(const typename simd<T>::type &v)
+{
+    typename simd<T>::index m;
+    for (int i = 0; i < simd<T>::width; ++i)
+        m[i] = k;
+    return __builtin_shuffle(v, m);
+}
+
+
+/*
+ * Reduce a contiguous array with four vector accumulators, so that the loop is
+ * limited by memory bandwidth rather than the latency of the operator. The
+ * elements are combined out of order, so the operator must be commutative.
+ */
+template <class op, typename T>
+static T
+simd_reduce(const T *xs, size_t n)
+{
+    typedef typename simd<T>::type      V;
+    typedef typename rebind<op,V>::type vop;
+
+    const size_t w  = simd<T>::width;
+    const T      id = op::identity();
+
+    V      a0 = simd_splat<T>(id), a1 = a0, a2 = a0, a3 = a0;
+    T      r  = id;
+    size_t i  = 0;
+
+    /*
+     * Arrays shorter than a vector, such as short segments, skip the
+     * accumulators altogether
+     */
+    if (n < w)
+    {
+        for (; i < n; ++i)
+            r = op::apply(r, xs[i]);
+        return r;
+    }
+
+    for (; i + 4*w <= n; i += 4*w)
+    {
+        a0 = vop::apply(a0, simd_load(xs + i));
+        a1 = vop::apply(a1, simd_load(xs + i + w));
+        a2 = vop::apply(a2, simd_load(xs + i + 2*w));
+        a3 = vop::apply(a3, simd_load(xs + i + 3*w));
+    }
+    for (; i + w <= n; i += w)
+        a0 = vop::apply(a0, simd_load(xs + i));
+
+    a0 = vop::apply(vop::apply(a0, a1), vop::apply(a2, a3));
+
+    for (size_t k = 0; k < w; ++k)
+        r = op::apply(r, a0[k]);
+    for (; i < n; ++i)
+        r = op::apply(r, xs[i]);
+
+    return r;
+}
+
+#endif
@@ -0,0 +1,414 @@
+--------------------------------------------------------------------------------
+--
+-- Module    : Benchmark
+-- Copyright : (c) 2009 Trevor L. McDonell
+-- License   : BSD
+--
+-- Benchmarking with warm-up, adaptive iteration counts and outlier
+-- rejection, reporting the median time per iteration together with its
+-- confidence interval.
+--
+-- Each benchmark is first run, with a doubling number of iterations, until
+-- the warm-up period has elapsed. The last of these runs determines how many
+-- iterations make up a sample, such that a sample takes at least the given
+-- sample time, which should be well above the resolution of the timer.
+-- Samples outside the Tukey fences (1.5 times the interquartile range beyond
+-- the quartiles) are discarded as outliers, such as those caused by
+-- interference from other processes or the garbage collector.
+--
+-- Samples are timed by the wall clock, or by CUDA events recorded in the
+-- default stream either side of the sample, which measures the time the
+-- device spent on the work. Either way, the finaliser (typically 'sync') is
+-- run at the end of every sample, so that asynchronous work is included.
+--
+-- The results of every benchmark run within 'withResults' are written, when
+-- it completes, to the file named by the BENCHMARK_OUTPUT environment
+-- variable: as CSV if the name ends in ".csv", otherwise as JSON. Examples
+-- run by the regression driver also take their problem size from
+-- BENCHMARK_SIZE, and run only the benchmarks which execute on the host when
+-- BENCHMARK_HOST_ONLY is set.
+--
+--------------------------------------------------------------------------------
+
+module Benchmark
+  (
+    -- * Timers
+    Timer(..), wallClock, events,
+
+    -- * Benchmarking
+    Config(..), Result(..),
+    defaultConfig, benchmark, benchmarkWith, whnf,
+
+    -- * Environment
+    problemSize, hostOnly,
+
+    -- * Output
+    showResult, withResults, renderJSON, renderCSV, readJSON, readResults
+  )
+  where
+
+import Data.Char
+import Data.IORef
+import Data.List
+import Data.Time.Clock
+import Numeric
+import Control.Monad
+import Control.Exception
+import System.Environment
+import System.IO.Unsafe
+import qualified Foreign.CUDA.Runtime.Event as Event
+
+
+--------------------------------------------------------------------------------
+-- Timers
+--------------------------------------------------------------------------------
+
+-- A means of timing an action, in seconds
+--
+data Timer = Timer
+  { timerName :: String
+  , timed     :: IO () -> IO Double
+  }
+
+wallClock :: Timer
+wallClock = Timer "wall" $ \action -> do
+  t1 <- getCurrentTime
+  action
+  t2 <- getCurrentTime
+  return (realToFrac (diffUTCTime t2 t1))
+
+-- Requires a current device (context)
+--
+events :: Timer
+events = Timer "events" $ \action ->
+  bracket (Event.create []) Event.destroy $ \start ->
+  bracket (Event.create []) Event.destroy $ \stop  -> do
+    Event.record start Nothing
+    action
+    Event.record stop  Nothing
+    Event.block stop
+    ms <- Event.elapsedTime start stop
+    return (realToFrac ms * 1.0E-3)
+
+
+--------------------------------------------------------------------------------
+-- Benchmarking
+--------------------------------------------------------------------------------
+
+data Config = Config
+  { configTimer      :: Timer
+  , configWarmup     :: Double          -- minimum time spent warming up (seconds)
+  , configSampleTime :: Double          -- minimum time of each sample (seconds)
+  , configSamples    :: Int             -- number of samples
+  }
+
+defaultConfig :: Config
+defaultConfig = Config
+  { configTimer      = wallClock
+  , configWarmup     = 0.1
+  , configSampleTime = 0.01
+  , configSamples    = 30
+  }
+
+-- Times are in seconds per iteration
+--
+data Result = Result
+  { resultName       :: String
+  , resultTimer      :: String
+  , resultIterations :: Int             -- iterations per sample
+  , resultSamples    :: [Double]        -- excluding outliers
+  , resultOutliers   :: Int
+  , resultMedian     :: Double
+  , resultLower      :: Double          -- 95% confidence interval of the median
+  , resultUpper      :: Double
+  , resultMean       :: Double
+  , resultStdDev     :: Double
+  }
+  deriving Show
+
+
+-- Benchmark an action by the wall clock with the default configuration,
+-- returning the result of its first execution
+--
+benchmark :: String -> IO a -> IO b -> IO (Result, a)
+benchmark = benchmarkWith defaultConfig
+
+{-# NOINLINE benchmarkWith #-}
+benchmarkWith
+  :: Config
+  -> String             -- Name of the benchmark
+  -> IO a               -- Test to run
+  -> IO b               -- Finaliser to run before measuring elapsed time
+  -> IO (Result, a)
+benchmarkWith config name testee finaliser = do
+  (r, t) <- warmup 1 0
+  let iters = max 1 (ceiling (configSampleTime config / max 1.0E-9 t))
+  ts     <- replicateM (configSamples config) $ do
+              s <- timed timer (replicateM_ iters testee >> finaliser >> return ())
+              return (s / fromIntegral iters)
+  let result = summarise name (timerName timer) iters ts
+  modifyIORef results (result :)
+  return (result, r)
+  where
+    timer = configTimer config
+
+    -- Double the iterations until the warm-up period has elapsed, returning
+    -- the first result and the time per iteration of the last run
+    --
+    warmup n spent = do
+      ref <- newIORef Nothing
+      t   <- timed timer $ do
+               x <- testee
+               writeIORef ref (Just x)
+               replicateM_ (n-1) testee
+               _ <- finaliser
+               return ()
+      Just x <- readIORef ref
+      if spent + t >= configWarmup config
+         then return (x, t / fromIntegral n)
+         else warmup (2*n) (spent + t)
+
+
+-- Apply a function to its argument each time the action is run, rather than
+-- sharing the result of the first, and evaluate that to weak head normal form
+--
+{-# NOINLINE whnf #-}
+whnf :: (a -> b) -> a -> IO b
+whnf f x = evaluate (f x)
+
+
+summarise :: String -> String -> Int -> [Double] -> Result
+summarise name timer iters ts =
+  Result { resultName       = name
+         , resultTimer      = timer
+         , resultIterations = iters
+         , resultSamples    = kept
+         , resultOutliers   = length ts - n
+         , resultMedian     = quantile 0.5 sorted
+         , resultLower      = sorted !! max 0 (lo - 1)
+         , resultUpper      = sorted !! min (n - 1) (hi - 1)
+         , resultMean       = mean
+         , resultStdDev     = if n < 2 then 0 else sqrt (sum [ (x-mean)^(2::Int) | x <- kept ] / fromIntegral (n-1))
+         }
+  where
+    q1     = quantile 0.25 (sort ts)
+    q3     = quantile 0.75 (sort ts)
+    iqr    = q3 - q1
+    kept   = filter (\x -> x >= q1 - 1.5*iqr && x <= q3 + 1.5*iqr) ts
+    sorted = sort kept
+    n      = length kept
+    mean   = sum kept / fromIntegral n
+
+    -- ranks of the distribution-free confidence interval of the median,
+    -- from the normal approximation to the binomial distribution
+    --
+    z      = 1.96 * sqrt (fromIntegral n) / 2 :: Double
+    lo     = floor   (fromIntegral n / 2 - z)
+    hi     = ceiling (fromIntegral n / 2 + z) + 1
+
+-- Linear interpolation between the closest ranks of a sorted list
+--
+quantile :: Double -> [Double] -> Double
+quantile _ []  = 0
+quantile p xs  =
+  let h = p * fromIntegral (length xs - 1)
+      i = floor h
+      x = xs !! i
+      y = xs !! min (length xs - 1) (i+1)
+  in
+  x + (h - fromIntegral i) * (y - x)
+
+
+--------------------------------------------------------------------------------
+-- Environment
+--------------------------------------------------------------------------------
+
+-- The problem size given by BENCHMARK_SIZE, otherwise the default
+--
+problemSize :: Int -> IO Int
+problemSize def = do
+  env <- getEnvironment
+  return $ case fmap reads (lookup "BENCHMARK_SIZE" env) of
+    Just [(n,"")] -> n
+    _             -> def
+
+-- Whether to skip benchmarks which require a device
+--
+hostOnly :: IO Bool
+hostOnly = (maybe False (not . null) . lookup "BENCHMARK_HOST_ONLY") `fmap` getEnvironment
+
+
+--------------------------------------------------------------------------------
+-- Output
+--------------------------------------------------------------------------------
+
+-- The median time per iteration and its confidence interval, in milliseconds
+--
+showResult :: Result -> String
+showResult r = concat
+  [ ms (resultMedian r), " ms (95% CI ", ms (resultLower r), " .. ", ms (resultUpper r), " ms, "
+  , show (length (resultSamples r)), " samples of ", show (resultIterations r), " iterations, "
+  , show (resultOutliers r), " outliers)" ]
+  where
+    ms t = showFFloat (Just 3) (t * 1.0E3) ""
+
+
+{-# NOINLINE results #-}
+results :: IORef [Result]
+results = unsafePerformIO (newIORef [])
+
+-- Run the action, then write the results of the benchmarks it ran to the file
+-- named by BENCHMARK_OUTPUT, if that is set
+--
+withResults :: IO a -> IO a
+withResults action = do
+  r    <- action
+  env  <- getEnvironment
+  case lookup "BENCHMARK_OUTPUT" env of
+    Nothing   -> return ()
+    Just file -> do
+      rs <- reverse `fmap` readIORef results
+      writeFile file $ if ".csv" `isSuffixOf` file then renderCSV rs else renderJSON rs
+  return r
+
+
+renderJSON :: [Result] -> String
+renderJSON rs = "[" ++ intercalate "," (map object rs) ++ "\n]\n"
+  where
+    object r = "\n  { " ++ intercalate "\n  , "
+      [ field "name"       (string (resultName r))
+      , field "timer"      (string (resultTimer r))
+      , field "iterations" (show (resultIterations r))
+      , field "outliers"   (show (resultOutliers r))
+      , field "median"     (number (resultMedian r))
+      , field "lower"      (number (resultLower r))
+      , field "upper"      (number (resultUpper r))
+      , field "mean"       (number (resultMean r))
+      , field "stddev"     (number (resultStdDev r))
+      , field "samples"    ("[" ++ intercalate ", " (map number (resultSamples r)) ++ "]")
+      ] ++ "\n  }"
+
+    field k v  = string k ++ ": " ++ v
+    string s   = "\"" ++ concatMap escape s ++ "\""
+    escape c
+      | c == '"' || c == '\\' = ['\\', c]
+      | c <  ' '              = "\\u" ++ replicate (4 - length (hex c)) '0' ++ hex c
+      | otherwise             = [c]
+    hex c      = showHex (fromEnum c) ""
+
+
+renderCSV :: [Result] -> String
+renderCSV rs = unlines $
+  "name,timer,iterations,samples,outliers,median,lower,upper,mean,stddev" : map row rs
+  where
+    row r = intercalate ","
+      [ "\"" ++ concatMap (\c -> if c == '"' then "\"\"" else [c]) (resultName r) ++ "\""
+      , resultTimer r
+      , show (resultIterations r)
+      , show (length (resultSamples r))
+      , show (resultOutliers r)
+      , number (resultMedian r)
+      , number (resultLower r)
+      , number (resultUpper r)
+      , number (resultMean r)
+      , number (resultStdDev r)
+      ]
+
+number :: Double -> String
+number x
+  | isNaN x || isInfinite x = "0"
+  | otherwise               = showEFloat Nothing x ""
+
+
+-- Read the results written by 'renderJSON'
+--
+readResults :: FilePath -> IO [Result]
+readResults file = do
+  s <- readFile file
+  case readJSON s of
+    Just rs -> length rs `seq` return rs
+    Nothing -> ioError (userError (file ++ ": not a list of benchmark results"))
+
+readJSON :: String -> Maybe [Result]
+readJSON s =
+  case value s of
+    Just (JArray vs, rest) | all isSpace rest -> mapM result vs
+    _                                         -> Nothing
+  where
+    result (JObject fs) = do
+      name    <- lookup "name" fs       >>= str
+      timer   <- lookup "timer" fs      >>= str
+      iters   <- lookup "iterations" fs >>= num
+      out     <- lookup "outliers" fs   >>= num
+      med     <- lookup "median" fs     >>= num
+      lo      <- lookup "lower" fs      >>= num
+      hi      <- lookup "upper" fs      >>= num
+      mean    <- lookup "mean" fs       >>= num
+      sd      <- lookup "stddev" fs     >>= num
+      samples <- lookup "samples" fs    >>= arr >>= mapM num
+      return $ Result name timer (round iters) samples (round out) med lo hi mean sd
+    result _ = Nothing
+
+    str (JString x) = Just x
+    str _           = Nothing
+    num (JNumber x) = Just x
+    num _           = Nothing
+    arr (JArray xs) = Just xs
+    arr _           = Nothing
+
+
+-- Just enough JSON to read back what we write
+--
+data JSON = JString String | JNumber Double | JArray [JSON] | JObject [(String, JSON)]
+
+value :: String -> Maybe (JSON, String)
+value s =
+  case dropWhile isSpace s of
+    '"':cs -> do (x, rest) <- string cs
+                 return (JString x, rest)
+    '[':cs -> do (xs, rest) <- many value ']' cs
+                 return (JArray xs, rest)
+    '{':cs -> do (fs, rest) <- many field '}' cs
+                 return (JObject fs, rest)
+    cs     -> case reads cs of
+                [(x, rest)] -> Just (JNumber x, rest)
+                _           -> Nothing
+  where
+    field cs = do
+      (k, rest)   <- case dropWhile isSpace cs of
+                       '"':ds -> string ds
+                       _      -> Nothing
+      rest'       <- case dropWhile isSpace rest of
+                       ':':ds -> Just ds
+                       _      -> Nothing
+      (v, rest'') <- value rest'
+      return ((k, v), rest'')
+
+    -- elements separated by commas, up to the closing bracket
+    many p close cs =
+      case dropWhile isSpace cs of
+        c:ds | c == close -> Just ([], ds)
+        _                 -> go [] cs
+      where
+        go acc ds = do
+          (x, rest) <- p ds
+          case dropWhile isSpace rest of
+            ',':es            -> go (x:acc) es
+            c:es | c == close -> Just (reverse (x:acc), es)
+            _                 -> Nothing
+
+    string ('"':cs)      = Just ("", cs)
+    string ('\\':'u':cs) =
+      case splitAt 4 cs of
+        (h, rest) | length h == 4 && all isHexDigit h
+          -> prepend (chr (fst (head (readHex h)))) (string rest)
+        _ -> Nothing
+    string ('\\':c:cs)   = prepend (unescape c) (string cs)
+    string (c:cs)        = prepend c (string cs)
+    string []            = Nothing
+
+    prepend c = fmap (\(x, rest) -> (c:x, rest))
+
+    unescape 'n' = '\n'
+    unescape 't' = '\t'
+    unescape c   = c
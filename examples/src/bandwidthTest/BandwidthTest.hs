@@ -1,21 +1,37 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
 --------------------------------------------------------------------------------
 --
--- Module    : Fold
+-- Module    : BandwidthTest
 -- Copyright : (c) 2009 Trevor L. McDonell
 -- License   : BSD
 --
--- Reduce a vector to a single value
+-- Bandwidth of memory transfers between the host and device, and between
+-- devices.
+--
+-- Transfers are made to and from each kind of host memory: Haskell lists,
+-- pageable, page-locked (pinned), registered, write-combined, mapped
+-- (zero-copy) and managed memory. Asynchronous transfers can be split into
+-- chunks issued in turn over several streams, and transfers in both
+-- directions issued together on separate streams, to occupy both copy
+-- engines. With --node, host memory is allocated and touched while bound to
+-- the processors of the given NUMA node.
+--
+-- The bandwidth of the median time is printed as a table, and with --csv the
+-- bandwidth and its confidence interval is written with one row per test and
+-- transfer size.
 --
 --------------------------------------------------------------------------------
 
 module Main where
 
 -- Friends
+import Benchmark
 import PrettyPrint
 
 -- System
 import Numeric
 import Data.List
+import Data.Maybe
 import Control.Monad
 import Control.Exception
 import System.Exit
@@ -24,8 +40,11 @@ import System.Console.GetOpt
 import Text.PrettyPrint
 
 import Foreign
-import qualified Foreign.CUDA               as CUDA
-import qualified Foreign.CUDA.Runtime.Event as CUDA
+import Foreign.C
+import Foreign.CUDA.Driver.Stream               ( Stream )
+import qualified Foreign.CUDA.Driver            as CUDA
+import qualified Foreign.CUDA.Driver.Event      as Event
+import qualified Foreign.CUDA.Driver.Stream     as Stream
 
 
 --------------------------------------------------------------------------------
@@ -35,28 +54,40 @@ import qualified Foreign.CUDA.Runtime.Event as CUDA
 data TestMode = Quick | Range | Shmoo
   deriving (Eq,Show,Read)
 
-data MemoryMode = List | Pageable | Pinned | WriteCombined
+data MemoryMode = List | Pageable | Pinned | Registered | WriteCombined | Mapped | Managed
   deriving (Eq,Show,Read,Ord,Enum)
 
-data CopyMode = HostToDevice | DeviceToHost | DeviceToDevice
+data CopyMode = HostToDevice | DeviceToHost | Bidirectional | DeviceToDevice | PeerToPeer
   deriving (Eq,Show,Read,Ord,Enum)
 
+-- Where a list of modes is empty, the defaults are used
+--
 data Options = Options
   { testMode   :: TestMode
---  , memoryMode :: [MemoryMode]
---  , copyMode   :: [CopyMode]
+  , memoryMode :: [MemoryMode]
+  , copyMode   :: [CopyMode]
+  , streams    :: [Int]
+  , chunks     :: [Int]
+  , nodes      :: [Int]
   , device     :: Int
+  , peer       :: Maybe Int
   , range      :: (Int,Int,Int)
+  , csv        :: Maybe FilePath
   }
   deriving (Show)
 
 defaultOptions :: Options
 defaultOptions = Options
-  { device     = 0
-  , testMode   = Quick
---  , memoryMode = []
---  , copyMode   = []
+  { testMode   = Quick
+  , memoryMode = []
+  , copyMode   = []
+  , streams    = []
+  , chunks     = []
+  , nodes      = []
+  , device     = 0
+  , peer       = Nothing
   , range      = (kilobyte, kilobyte, 10*kilobyte)
+  , csv        = Nothing
   }
 
 kilobyte, megabyte :: Int
@@ -67,92 +98,274 @@ options :: [OptDescr (Options -> Options)]
 options =
   [ Option ['d'] ["device"]    (ReqArg (\d opts -> opts { device = read d }) "ID")                           "numeral of device to test"
   , Option ['t'] ["test"]      (ReqArg (\t opts -> opts { testMode = read t}) "MODE")                        "testing mode: Quick | Range | Shmoo"
---  , Option ['m'] ["memory"]    (ReqArg (\m opts -> opts { memoryMode = read m : memoryMode opts}) "MODE")    "memory copy mode: List | Pageable | Pinned | WriteCombined"
---  , Option ['c'] ["copy"]      (ReqArg (\c opts -> opts { copyMode = read c : copyMode opts}) "DIRECTION")   "memory copy direction: DeviceToHost | HostToDevice | DeviceToDevice"
+  , Option ['m'] ["memory"]    (ReqArg (\m opts -> opts { memoryMode = read m : memoryMode opts}) "MODE")    "host memory: List | Pageable | Pinned | Registered | WriteCombined | Mapped | Managed"
+  , Option ['c'] ["copy"]      (ReqArg (\c opts -> opts { copyMode = read c : copyMode opts}) "DIRECTION")   "copy direction: HostToDevice | DeviceToHost | Bidirectional | DeviceToDevice | PeerToPeer"
+  , Option ['n'] ["streams"]   (ReqArg (\n opts -> opts { streams = read n : streams opts}) "N")             "issue transfers in turn over N streams (in each direction)"
+  , Option ['k'] ["chunk"]     (ReqArg (\k opts -> opts { chunks = read k : chunks opts}) "BYTES")           "split transfers into chunks of BYTES"
+  , Option []    ["node"]      (ReqArg (\n opts -> opts { nodes = read n : nodes opts}) "NODE")              "place host memory on NUMA node NODE"
+  , Option ['p'] ["peer"]      (ReqArg (\p opts -> opts { peer = Just (read p) }) "ID")                      "numeral of device for peer-to-peer copies"
   , Option ['s'] ["start"]     (ReqArg (\s opts -> opts { range = let (_,i,e) = range opts in (read s,i,e)}) "BYTES") "starting transfer size"
   , Option ['i'] ["increment"] (ReqArg (\i opts -> opts { range = let (s,_,e) = range opts in (s,read i,e)}) "BYTES") "transfer test size increment"
   , Option ['e'] ["end"]       (ReqArg (\e opts -> opts { range = let (s,i,_) = range opts in (s,i,read e)}) "BYTES") "ending transfer size"
+  , Option ['o'] ["csv"]       (ReqArg (\f opts -> opts { csv = Just f }) "FILE")                            "write the results to FILE as CSV"
   ]
 
 
 --------------------------------------------------------------------------------
--- Testing
+-- Tests
 --------------------------------------------------------------------------------
 
--- Benchmarking
+-- Each combination of the options is a test, made at every transfer size
 --
-bench :: Int -> IO a -> IO Double
-bench n testee =
-  let iter = 10
-      size = fromIntegral (iter * n) * fromIntegral (sizeOf (undefined::Int))
-  in
-  bracket (CUDA.create []) CUDA.destroy $ \start ->
-  bracket (CUDA.create []) CUDA.destroy $ \stop  -> do
-    CUDA.record start Nothing
-    replicateM_ iter testee
-    CUDA.record stop  Nothing
-    CUDA.sync
-    ms <- realToFrac `fmap` CUDA.elapsedTime start stop
-    return $ 1E3 * size / (fromIntegral megabyte * ms)
+data Test = Test
+  { testCopy    :: CopyMode
+  , testMemory  :: MemoryMode
+  , testStreams :: Int
+  , testChunk   :: Int                  -- bytes per transfer, or zero for all at once
+  , testNode    :: Maybe Int            -- NUMA node of the host memory
+  }
+
+tests :: Options -> [Test]
+tests opts =
+  [ Test c m s k n | c <- cs, m <- ms, s <- ss, k <- ks, n <- ns, valid c m s k n ]
+  where
+    cs = filter (\c -> c /= PeerToPeer || isJust (peer opts))
+       $ orDefault [HostToDevice, DeviceToHost, DeviceToDevice] (copyMode opts)
+    ms = orDefault [List, Pageable, Pinned, WriteCombined] (memoryMode opts)
+    ss = orDefault [1] (streams opts)
+    ks = orDefault [0] (chunks opts)
+    ns = orDefault [Nothing] (map Just (nodes opts))
+
+    orDefault d [] = d
+    orDefault _ xs = reverse xs
+
+    -- Copies between devices do not involve host memory, so are made once.
+    -- Lists and pageable memory can only be copied synchronously.
+    --
+    valid c m s k n
+      | c `elem` [DeviceToDevice, PeerToPeer] = m == head ms && n == head ns
+      | m == List                             = c /= Bidirectional && s == 1 && k == 0
+      | m == Pageable                         = c /= Bidirectional && s == 1
+      | otherwise                             = True
+
+label :: Test -> String
+label (Test c m s k n) = concat
+  [ sc c
+  , if c `elem` [DeviceToDevice, PeerToPeer] then "" else sm m
+  , if s > 1 then " [" ++ show s ++ " streams]" else ""
+  , if k > 0 then " [" ++ show k ++ "B chunks]" else ""
+  , maybe "" (\x -> " [node " ++ show x ++ "]") n
+  ]
+  where
+    sc DeviceToHost   = "D->H"
+    sc HostToDevice   = "H->D"
+    sc Bidirectional  = "H<->D"
+    sc DeviceToDevice = "D->D"
+    sc PeerToPeer     = "P->P"
+    sm List           = " (List)"
+    sm Pinned         = " (Pinned)"
+    sm Registered     = " (Registered)"
+    sm WriteCombined  = " (WC)"
+    sm Mapped         = " (Mapped)"
+    sm Managed        = " (Managed)"
+    sm Pageable       = ""
+
 
+--------------------------------------------------------------------------------
+-- Testing
+--------------------------------------------------------------------------------
 
--- Bandwidth testing for the various copy modes
+-- The bandwidth (MB/s) of the median time, and the bounds of its 95%
+-- confidence interval
 --
-bandwidth :: CopyMode -> MemoryMode -> Int -> IO Double
+data Bandwidth = Bandwidth
+  { median :: Double
+  , lower  :: Double
+  , upper  :: Double
+  }
 
-bandwidth HostToDevice List     n =
-  bench n (CUDA.withListArray [1..n] (\_ -> return ()))
+-- Time by events recorded in the default stream, which wait for the work in
+-- every other stream of the context
+--
+driverEvents :: Timer
+driverEvents = Timer "events" $ \action ->
+  bracket (Event.create []) Event.destroy $ \start ->
+  bracket (Event.create []) Event.destroy $ \stop  -> do
+    Event.record start Nothing
+    action
+    Event.record stop  Nothing
+    Event.block stop
+    ms <- Event.elapsedTime start stop
+    return (realToFrac ms * 1.0E-3)
+
+-- Benchmarking the transfer of the given number of bytes. Fewer samples than
+-- the default keep the Shmoo test to a reasonable length.
+--
+bench :: String -> Int -> IO a -> IO Bandwidth
+bench name bytes testee = do
+  (t,_) <- benchmarkWith config name testee (return ())
+  return $ Bandwidth (rate (resultMedian t)) (rate (resultUpper t)) (rate (resultLower t))
+  where
+    rate s = fromIntegral bytes / (fromIntegral megabyte * s)
+    config = defaultConfig { configTimer      = driverEvents
+                           , configWarmup     = 0.01
+                           , configSampleTime = 0.005
+                           , configSamples    = 10 }
 
-bandwidth HostToDevice Pageable n =
-  CUDA.allocaArray n $ \d_ptr ->
-  withArray [1..n]   $ \h_ptr ->
-  bench n (CUDA.pokeArray n h_ptr d_ptr)
 
-bandwidth HostToDevice x n        =
-  CUDA.allocaArray n $ \d_ptr ->
-  let f = if x == WriteCombined then [CUDA.WriteCombined] else [] in
-  bracket (CUDA.mallocHostArray f n) (CUDA.freeHost) $ \h_ptr -> do
-  pokeArray (CUDA.useHostPtr h_ptr) [1..n]
-  bench n (CUDA.pokeArrayAsync n h_ptr d_ptr Nothing)
+-- Host memory, and how it is copied to and from the device
+--
+data HostArray
+  = Synchronous  (Ptr Int)                      -- pageable
+  | Asynchronous (CUDA.HostPtr Int)             -- page-locked
+  | Addressable  (CUDA.DevicePtr Int)           -- mapped or managed, addressed by the device
+
+withHostArray :: MemoryMode -> Int -> (HostArray -> IO a) -> IO a
+withHostArray mode n action =
+  case mode of
+    Pinned        -> pinned []
+    WriteCombined -> pinned [CUDA.WriteCombined]
+    Registered    -> bracket (mallocArray n) free $ \p ->
+                     bracket (CUDA.registerArray [] n p) CUDA.unregisterArray $ \h -> do
+                       fill p
+                       action (Asynchronous h)
+    Mapped        -> bracket (CUDA.mallocHostArray [CUDA.DeviceMapped] n) CUDA.freeHost $ \h -> do
+                       fill (CUDA.useHostPtr h)
+                       action . Addressable =<< CUDA.getDevicePtr [] h
+    Managed       -> bracket (CUDA.mallocManagedArray [CUDA.CuMemAttachGlobal] n) CUDA.free $ \d -> do
+                       fill (CUDA.useDevicePtr d)
+                       action (Addressable d)
+    _             -> allocaArray n $ \p -> do
+                       fill p
+                       action (Synchronous p)
+  where
+    fill p    = pokeArray p [1..n]
+    pinned fs = bracket (CUDA.mallocHostArray fs n) CUDA.freeHost $ \h -> do
+                  fill (CUDA.useHostPtr h)
+                  action (Asynchronous h)
 
-bandwidth DeviceToHost List     n =
-  CUDA.withListArray [1..n] $ \d_ptr ->
-  bench n (CUDA.peekListArray n d_ptr)
 
-bandwidth DeviceToHost Pageable n =
-  allocaArray n             $ \h_ptr ->
-  CUDA.withListArray [1..n] $ \d_ptr ->
-  bench n (CUDA.peekArray n d_ptr h_ptr)
+-- Copy the section of the array at the given offset and of the given number
+-- of elements
+--
+copyIn :: HostArray -> CUDA.DevicePtr Int -> Maybe Stream -> (Int,Int) -> IO ()
+copyIn (Synchronous p)  d _ (i,n) = CUDA.pokeArray n (p `advancePtr` i) (d `CUDA.advanceDevPtr` i)
+copyIn (Asynchronous h) d s (i,n) = CUDA.pokeArrayAsync n (h `CUDA.advanceHostPtr` i) (d `CUDA.advanceDevPtr` i) s
+copyIn (Addressable a)  d s (i,n) = CUDA.copyArrayAsync n (a `CUDA.advanceDevPtr` i) (d `CUDA.advanceDevPtr` i) s
+
+copyOut :: CUDA.DevicePtr Int -> HostArray -> Maybe Stream -> (Int,Int) -> IO ()
+copyOut d (Synchronous p)  _ (i,n) = CUDA.peekArray n (d `CUDA.advanceDevPtr` i) (p `advancePtr` i)
+copyOut d (Asynchronous h) s (i,n) = CUDA.peekArrayAsync n (d `CUDA.advanceDevPtr` i) (h `CUDA.advanceHostPtr` i) s
+copyOut d (Addressable a)  s (i,n) = CUDA.copyArrayAsync n (d `CUDA.advanceDevPtr` i) (a `CUDA.advanceDevPtr` i) s
+
+-- Split a transfer of n elements into chunks of the given number of bytes,
+-- each paired with the stream to issue it on, in turn
+--
+schedule :: Int -> [Stream] -> Int -> [(Maybe Stream, (Int,Int))]
+schedule k ss n = zip (cycle (map Just ss)) [ (i, min c (n-i)) | i <- [0, c .. n-1] ]
+  where
+    c = if k <= 0 then n else max 1 (k `div` sizeOf (undefined::Int))
 
-bandwidth DeviceToHost x n        =
-  let f = if x == WriteCombined then [CUDA.WriteCombined] else [] in
-  bracket (CUDA.mallocHostArray f n) (CUDA.freeHost) $ \h_ptr ->
-  CUDA.withListArray [1..n]                          $ \d_ptr ->
-  bench n (CUDA.peekArrayAsync n d_ptr h_ptr Nothing)
 
-bandwidth DeviceToDevice _ n      =
-  CUDA.withListArray [1..n] $ \d_src ->
-  CUDA.allocaArray n        $ \d_dst ->
-  (\x->2*x) `fmap` bench n (CUDA.copyArray n d_src d_dst)
+-- Bandwidth testing for the various copy modes. Copies within the device count
+-- the bytes both read and written, and those in both directions the bytes
+-- moved each way.
+--
+bandwidth :: Options -> Test -> Int -> IO Bandwidth
+bandwidth opts t b =
+  withNode (testNode t) $
+  bracket (replicateM nstreams (Stream.create [])) (mapM_ Stream.destroy) $ \ss ->
+  case (testCopy t, testMemory t) of
+    (HostToDevice, List) ->
+      bench l b (CUDA.withListArray [1..n] (\_ -> return ()))
+
+    (DeviceToHost, List) ->
+      CUDA.withListArray [1..n] $ \d ->
+      bench l b (CUDA.peekListArray n d)
+
+    (HostToDevice, m)    ->
+      withHostArray m n $ \h ->
+      CUDA.allocaArray n $ \d ->
+      bench l b (sequence_ [ copyIn h d s c | (s,c) <- schedule k ss n ])
+
+    (DeviceToHost, m)    ->
+      withHostArray m n $ \h ->
+      CUDA.withListArray [1..n] $ \d ->
+      bench l b (sequence_ [ copyOut d h s c | (s,c) <- schedule k ss n ])
+
+    (Bidirectional, m)   ->
+      withHostArray m n $ \h  ->
+      withHostArray m n $ \h' ->
+      CUDA.allocaArray n $ \d ->
+      CUDA.withListArray [1..n] $ \d' ->
+      let (up,down) = splitAt (testStreams t) ss
+          uploads   = [ copyIn h d s c   | (s,c) <- schedule k up n ]
+          downloads = [ copyOut d' h' s c | (s,c) <- schedule k down n ]
+      in
+      bench l (2*b) (sequence_ (concat (transpose [uploads, downloads])))
+
+    (DeviceToDevice, _)  ->
+      CUDA.withListArray [1..n] $ \src ->
+      CUDA.allocaArray n        $ \dst ->
+      bench l (2*b) (sequence_ [ CUDA.copyArrayAsync len (src `CUDA.advanceDevPtr` i) (dst `CUDA.advanceDevPtr` i) s
+                               | (s,(i,len)) <- schedule k ss n ])
+
+    (PeerToPeer, _)      ->
+      withPeer (device opts) (fromJust (peer opts)) n $ \ctx pctx dst ->
+      CUDA.withListArray [1..n] $ \src ->
+      bench l b (sequence_ [ CUDA.copyArrayPeerAsync len (src `CUDA.advanceDevPtr` i) ctx (dst `CUDA.advanceDevPtr` i) pctx s
+                           | (s,(i,len)) <- schedule k ss n ])
+  where
+    n        = b `div` sizeOf (undefined::Int)
+    k        = testChunk t
+    l        = label t ++ "/" ++ show b
+    nstreams = if testCopy t == Bidirectional then 2 * testStreams t else testStreams t
 
 
--- Testing modes
+-- Allocate an array in a new context on the peer device, enabling access
+-- between it and the current context where the devices support it
+--
+withPeer :: Int -> Int -> Int -> (CUDA.Context -> CUDA.Context -> CUDA.DevicePtr Int -> IO a) -> IO a
+withPeer this that n action = do
+  Just ctx <- CUDA.get
+  dev      <- CUDA.device this
+  pdev     <- CUDA.device that
+  bracket (do c <- CUDA.create pdev []; _ <- CUDA.pop; return c) CUDA.destroy $ \pctx ->
+    bracket (CUDA.withContext pctx (CUDA.mallocArray n)) (CUDA.withContext pctx . CUDA.free) $ \dst -> do
+      access <- CUDA.accessible dev pdev
+      when access $ do
+        CUDA.add pctx []
+        CUDA.withContext pctx (CUDA.add ctx [])
+      action ctx pctx dst
+
+
+-- Run the action bound to the processors of the NUMA node, so that the host
+-- memory it allocates and first touches is placed on that node. The program
+-- is not built with the threaded runtime, so the action runs on the thread
+-- which is bound.
 --
-runTests :: [Int] -> IO [(String,[Double])]
-runTests bytes = sequence $
-  [ run m c | m <- [List ..], c <- [HostToDevice,DeviceToHost]] ++ [ run Pageable DeviceToDevice ]
+withNode :: Maybe Int -> IO a -> IO a
+withNode Nothing     action = action
+withNode (Just node) action = bracket_ bind affinity_unbind action
   where
-    run m c =
-      mapM (\b -> bandwidth c m (b `div` sizeOf (undefined::Int))) bytes >>= \t ->
-      return (sc c ++ sm m, t)
+    bind = do
+      r <- affinity_bind (fromIntegral node)
+      when (r /= 0) $ ioError (userError ("unable to bind to NUMA node " ++ show node))
 
-    sc DeviceToHost   = "D->H"
-    sc HostToDevice   = "H->D"
-    sc DeviceToDevice = "D->D"
-    sm List           = " (List)"
-    sm Pinned         = " (Pinned)"
-    sm WriteCombined  = " (WC)"
-    sm Pageable       = ""
+foreign import ccall unsafe "affinity.h affinity_bind"
+  affinity_bind :: CInt -> IO CInt
+
+foreign import ccall unsafe "affinity.h affinity_unbind"
+  affinity_unbind :: IO CInt
+
+
+-- Testing modes
+--
+runTests :: Options -> [Int] -> IO [(Test,[Bandwidth])]
+runTests opts bytes =
+  forM (tests opts) $ \t -> do
+    xs <- mapM (bandwidth opts t) bytes
+    return (t, xs)
 
 
 --------------------------------------------------------------------------------
@@ -168,16 +381,31 @@ printQuick = printDoc . ppAsRows 1 . (++) header . map k
                              ,["----", "----------------"]]
 
 printMany :: [Int] -> [(String,[Double])] -> IO ()
-printMany xs tests =
-  printDoc . ppAsRows 1 . (++) header . zipWith k xs . transpose . snd . unzip $ tests
+printMany xs tests' =
+  printDoc . ppAsRows 1 . (++) header . zipWith k xs . transpose . snd . unzip $ tests'
   where
     k b ys  = int b : map float' ys
     float'  = text . flip (showFFloat (Just 2)) ""
 
-    titles    = "Size (bytes)" : fst (unzip tests)
+    titles    = "Size (bytes)" : fst (unzip tests')
     seperator = map (flip replicate '-' . length) $ titles
     header    = map (map text) [titles,seperator]
 
+-- One row per test and transfer size, giving the bandwidth (MB/s) of the
+-- median time and its confidence interval
+--
+writeCSV :: FilePath -> [Int] -> [(Test,[Bandwidth])] -> IO ()
+writeCSV file bytes results = writeFile file . unlines $
+  "copy,memory,streams,chunk,node,bytes,bandwidth,lower,upper" :
+  [ intercalate "," [ show (testCopy t), memory t, show (testStreams t), show (testChunk t), maybe "" show (testNode t)
+                    , show b, float (median x), float (lower x), float (upper x) ]
+  | (t,xs) <- results, (b,x) <- zip bytes xs ]
+  where
+    float x = showFFloat (Just 2) x ""
+    memory t
+      | testCopy t `elem` [DeviceToDevice, PeerToPeer] = ""
+      | otherwise                                      = show (testMemory t)
+
 
 parseOptions :: [String] -> IO (Options, [String])
 parseOptions argv =
@@ -201,21 +429,41 @@ shmooBytes =
 -- Main
 --
 main :: IO ()
-main = do
+main = withResults $ do
   (opts,_) <- parseOptions =<< getArgs
-  props    <- CUDA.props (device opts)
+  CUDA.initialise []
+  dev      <- CUDA.device (device opts)
+  props    <- CUDA.props dev
+  count    <- CUDA.count
   putStrLn $  "Device " ++ show (device opts) ++ ": " ++ (CUDA.deviceName props)
 
+  ctx      <- CUDA.create dev [CUDA.MapHost]
+  quick    <- problemSize (32*megabyte)
+
+  -- by default, peer-to-peer copies are made to the next device
+  let peers = [ p | p <- maybe [(device opts + 1) `mod` count] return (peer opts)
+                  , p /= device opts, p < count ]
+      opts' = opts { peer = listToMaybe peers }
+
+  when (PeerToPeer `elem` copyMode opts && null peers) $
+    putStrLn "No peer device: skipping peer-to-peer copies"
+
   let (s,i,e) = range opts
-      bytes   = [s,(s+i)..e]
+      bytes   = case testMode opts of
+                  Range -> [s,(s+i)..e]
+                  Shmoo -> shmooBytes
+                  Quick -> [quick]
 
   case testMode opts of
-    Quick -> putStrLn "Quick mode: Bandwidth of 32MB transfer"
+    Quick -> putStrLn $ "Quick mode: Bandwidth of " ++ show quick ++ " byte transfer"
     _     -> putStrLn "Bandwidth measured in MB/s"
 
   putStrLn "Please wait...\n"
+  results <- runTests opts' bytes
+  let table = [ (label t, map median xs) | (t,xs) <- results ]
   case testMode opts of
-    Range -> runTests bytes         >>= printMany bytes
-    Shmoo -> runTests shmooBytes    >>= printMany shmooBytes
-    Quick -> runTests [32*megabyte] >>= printQuick
+    Quick -> printQuick table
+    _     -> printMany bytes table
 
+  maybe (return ()) (\f -> writeCSV f bytes results) (csv opts)
+  CUDA.destroy ctx
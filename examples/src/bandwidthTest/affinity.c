@@ -0,0 +1,89 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : BandwidthTest
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * ---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include "affinity.h"
+
+#include <sched.h>
+#include <stdio.h>
+
+#define NODE_PATH       "/sys/devices/system/node/node%d/cpulist"
+
+static cpu_set_t affinity_saved;
+static int       affinity_bound;
+
+
+int affinity_nodes(void)
+{
+    char  path[64];
+    FILE *f;
+    int   n = 0;
+
+    for (;;) {
+        snprintf(path, sizeof(path), NODE_PATH, n);
+        if ((f = fopen(path, "r")) == NULL)
+            break;
+        fclose(f);
+        ++n;
+    }
+
+    return n > 0 ? n : 1;
+}
+
+/*
+ * The processors of a node are listed as comma separated ranges, for example
+ * "0-7,16-23"
+ */
+int affinity_bind(int node)
+{
+    char      path[64];
+    cpu_set_t set;
+    FILE     *f;
+    int       lo, hi, c, cpu;
+
+    snprintf(path, sizeof(path), NODE_PATH, node);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+
+    CPU_ZERO(&set);
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        c  = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+            c = fgetc(f);
+        }
+        for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &set);
+        if (c != ',')
+            break;
+    }
+    fclose(f);
+
+    if (CPU_COUNT(&set) == 0)
+        return -1;
+
+    if (!affinity_bound) {
+        if (sched_getaffinity(0, sizeof(affinity_saved), &affinity_saved) != 0)
+            return -1;
+        affinity_bound = 1;
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int affinity_unbind(void)
+{
+    if (!affinity_bound)
+        return 0;
+
+    affinity_bound = 0;
+    return sched_setaffinity(0, sizeof(affinity_saved), &affinity_saved);
+}
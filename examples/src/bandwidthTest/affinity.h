@@ -0,0 +1,35 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : BandwidthTest
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Binding the calling thread to the processors of a NUMA node, so that host
+ * memory it allocates and first touches is placed on that node. The node
+ * topology is read from sysfs, so this requires Linux, but not libnuma.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The number of NUMA nodes, which is one where the topology is unknown
+ */
+int affinity_nodes(void);
+
+/*
+ * Restrict the calling thread to the processors of the given node, returning
+ * zero on success. The previous affinity is restored by 'affinity_unbind'.
+ */
+int affinity_bind(int node);
+int affinity_unbind(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
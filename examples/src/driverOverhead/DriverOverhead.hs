@@ -0,0 +1,168 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+--------------------------------------------------------------------------------
+--
+-- Module    : DriverOverhead
+-- Copyright : (c) 2009 Trevor L. McDonell
+-- License   : BSD
+--
+-- The cost of the bindings on top of calling the driver directly from C.
+--
+-- Each operation is timed through the bindings, and by a loop in C making the
+-- same driver calls (see baseline.c). The difference is the cost of the
+-- foreign call, marshalling, and the bookkeeping done by the bindings. Kernels
+-- do nothing on a single thread, and copies are of 'copyBytes' bytes.
+--
+-- To measure the Haskell side alone, without a GPU, build the stub driver
+-- with "make stub" and run with LD_LIBRARY_PATH=stub. Set BENCHMARK_OUTPUT to
+-- keep the results, so that they can be compared across releases.
+--
+--------------------------------------------------------------------------------
+
+module Main where
+
+-- Friends
+import Benchmark
+import PrettyPrint
+
+-- System
+import Numeric
+import Control.Monad
+import Foreign
+import Foreign.C
+import Text.PrettyPrint
+import qualified Data.ByteString.Char8          as B
+
+import qualified Foreign.CUDA.Driver            as CUDA
+import qualified Foreign.CUDA.Driver.Context    as CUDA ( Context(..) )
+import qualified Foreign.CUDA.Driver.Device     as CUDA ( Device(..) )
+import qualified Foreign.CUDA.Driver.Event      as Event
+import qualified Foreign.CUDA.Driver.Stream     as Stream
+
+
+--------------------------------------------------------------------------------
+-- Benchmarks
+--------------------------------------------------------------------------------
+
+-- The number of calls made by each iteration of a C baseline
+--
+inner :: Int
+inner = 100
+
+copyBytes :: Int
+copyBytes = 64
+
+arities :: [Int]
+arities = [0, 1, 2, 4, 8, 16]
+
+
+-- Time an operation through the bindings and in C, returning a row of the
+-- report giving the time per call of each and their difference
+--
+overhead :: String -> IO a -> (CInt -> IO CInt) -> IO [Doc]
+overhead name hs c = do
+  (th,_) <- benchmarkWith config ("driverOverhead/" ++ name ++ "/haskell") hs CUDA.sync
+  (tc,_) <- benchmarkWith config ("driverOverhead/" ++ name ++ "/c") (check =<< c (fromIntegral inner)) CUDA.sync
+  let h = resultMedian th * 1.0E9
+      b = resultMedian tc * 1.0E9 / fromIntegral inner
+  return [text name, ns h, ns b, ns (h - b)]
+  where
+    config  = defaultConfig { configSamples = 20 }
+    check s = CUDA.nothingIfOk (toEnum (fromIntegral s))
+    ns t    = text (showFFloat (Just 1) t "")
+
+
+--------------------------------------------------------------------------------
+-- C baseline
+--------------------------------------------------------------------------------
+
+foreign import ccall unsafe "baseline.h baseline_launch"
+  c_launch :: Ptr () -> CInt -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_launch_packed"
+  c_launch_packed :: Ptr () -> CInt -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_memcpy_htod"
+  c_memcpy_htod :: Ptr () -> Ptr () -> CSize -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_memcpy_dtoh"
+  c_memcpy_dtoh :: Ptr () -> Ptr () -> CSize -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_memcpy_htod_async"
+  c_memcpy_htod_async :: Ptr () -> Ptr () -> CSize -> Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_memcpy_dtoh_async"
+  c_memcpy_dtoh_async :: Ptr () -> Ptr () -> CSize -> Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_event_record"
+  c_event_record :: Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_event_query"
+  c_event_query :: Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_stream_query"
+  c_stream_query :: Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_push_pop"
+  c_push_pop :: Ptr () -> CInt -> IO CInt
+
+foreign import ccall unsafe "baseline.h baseline_props"
+  c_props :: CInt -> CInt -> IO CInt
+
+
+--------------------------------------------------------------------------------
+-- Main
+--------------------------------------------------------------------------------
+
+main :: IO ()
+main = withResults $ do
+  CUDA.initialise []
+  dev   <- CUDA.device 0
+  props <- CUDA.props dev
+  putStrLn $ "Using device 0: " ++ CUDA.deviceName props
+  putStrLn "Please wait...\n"
+
+  ctx   <- CUDA.create dev []
+  mdl   <- CUDA.loadData =<< B.readFile "data/empty.ptx"
+  fns   <- mapM (\n -> CUDA.getFun mdl ("empty" ++ show n)) arities
+
+  dptr  <- CUDA.mallocArray copyBytes         :: IO (CUDA.DevicePtr Word8)
+  hptr  <- mallocBytes copyBytes              :: IO (Ptr Word8)
+  pptr  <- CUDA.mallocHostArray [] copyBytes  :: IO (CUDA.HostPtr Word8)
+  st    <- Stream.create []
+  ev    <- Event.create []
+
+  let d     = castPtr (CUDA.useDevicePtr dptr)
+      h     = castPtr hptr
+      p     = castPtr (CUDA.useHostPtr pptr)
+      bytes = fromIntegral copyBytes
+
+  launches <- forM (zip arities fns) $ \(n,f) -> do
+    let args = replicate n (CUDA.IArg 0)
+    a <- overhead ("launchKernel/"  ++ show n) (CUDA.launchKernel  f (1,1,1) (1,1,1) 0 Nothing args) (c_launch        (CUDA.useFun f) (fromIntegral n))
+    b <- overhead ("launchKernel'/" ++ show n) (CUDA.launchKernel' f (1,1,1) (1,1,1) 0 Nothing args) (c_launch_packed (CUDA.useFun f) (fromIntegral n))
+    return [a,b]
+
+  others <- sequence
+    [ overhead "pokeArray"       (CUDA.pokeArray copyBytes hptr dptr)                (c_memcpy_htod d h bytes)
+    , overhead "peekArray"       (CUDA.peekArray copyBytes dptr hptr)                (c_memcpy_dtoh h d bytes)
+    , overhead "pokeArrayAsync"  (CUDA.pokeArrayAsync copyBytes pptr dptr (Just st)) (c_memcpy_htod_async d p bytes (Stream.useStream st))
+    , overhead "peekArrayAsync"  (CUDA.peekArrayAsync copyBytes dptr pptr (Just st)) (c_memcpy_dtoh_async p d bytes (Stream.useStream st))
+    , overhead "Event.record"    (Event.record ev Nothing)                           (c_event_record (Event.useEvent ev))
+    , overhead "Event.query"     (Event.query ev)                                    (c_event_query  (Event.useEvent ev))
+    , overhead "Stream.finished" (Stream.finished st)                                (c_stream_query (Stream.useStream st))
+    , overhead "push/pop"        (CUDA.push ctx >> CUDA.pop)                         (c_push_pop     (CUDA.useContext ctx))
+    , overhead "props"           (CUDA.props dev)                                    (c_props        (CUDA.useDevice dev))
+    ]
+
+  printDoc . ppAsRows 1 $ header ++ concat launches ++ others
+
+  Event.destroy ev
+  Stream.destroy st
+  CUDA.freeHost pptr
+  free hptr
+  CUDA.free dptr
+  CUDA.unload mdl
+  CUDA.destroy ctx
+  where
+    titles = ["Operation", "Haskell (ns)", "C (ns)", "Overhead (ns)"]
+    header = map (map text) [titles, map (flip replicate '-' . length) titles]
@@ -0,0 +1,233 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : DriverOverhead
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "baseline.h"
+
+#include <stdint.h>
+
+#define MAX_ARGS        16
+
+#define DEVICE_PTR(p)   ((CUdeviceptr) (uintptr_t) (p))
+
+
+CUresult baseline_launch(CUfunction f, int nargs, int iters)
+{
+    int      args[MAX_ARGS]   = { 0 };
+    void    *params[MAX_ARGS];
+    CUresult status           = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < nargs && i < MAX_ARGS; ++i)
+        params[i] = &args[i];
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuLaunchKernel(f, 1, 1, 1, 1, 1, 1, 0, NULL, params, NULL);
+
+    return status;
+}
+
+CUresult baseline_launch_packed(CUfunction f, int nargs, int iters)
+{
+    int      args[MAX_ARGS]   = { 0 };
+    size_t   size             = (nargs < MAX_ARGS ? nargs : MAX_ARGS) * sizeof(int);
+    void    *config[]         = { CU_LAUNCH_PARAM_BUFFER_POINTER, args
+                                , CU_LAUNCH_PARAM_BUFFER_SIZE,    &size
+                                , CU_LAUNCH_PARAM_END };
+    CUresult status           = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuLaunchKernel(f, 1, 1, 1, 1, 1, 1, 0, NULL, NULL, config);
+
+    return status;
+}
+
+
+CUresult baseline_memcpy_htod(void *dst, const void *src, size_t bytes, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuMemcpyHtoD(DEVICE_PTR(dst), src, bytes);
+
+    return status;
+}
+
+CUresult baseline_memcpy_dtoh(void *dst, const void *src, size_t bytes, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuMemcpyDtoH(dst, DEVICE_PTR(src), bytes);
+
+    return status;
+}
+
+CUresult baseline_memcpy_htod_async(void *dst, const void *src, size_t bytes, CUstream stream, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuMemcpyHtoDAsync(DEVICE_PTR(dst), src, bytes, stream);
+
+    return status;
+}
+
+CUresult baseline_memcpy_dtoh_async(void *dst, const void *src, size_t bytes, CUstream stream, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuMemcpyDtoHAsync(dst, DEVICE_PTR(src), bytes, stream);
+
+    return status;
+}
+
+
+CUresult baseline_event_record(CUevent event, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i)
+        status = cuEventRecord(event, NULL);
+
+    return status;
+}
+
+/*
+ * An event or stream which has not yet completed is not an error
+ */
+CUresult baseline_event_query(CUevent event, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i) {
+        status = cuEventQuery(event);
+        if (status == CUDA_ERROR_NOT_READY)
+            status = CUDA_SUCCESS;
+    }
+
+    return status;
+}
+
+CUresult baseline_stream_query(CUstream stream, int iters)
+{
+    CUresult status = CUDA_SUCCESS;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i) {
+        status = cuStreamQuery(stream);
+        if (status == CUDA_ERROR_NOT_READY)
+            status = CUDA_SUCCESS;
+    }
+
+    return status;
+}
+
+CUresult baseline_push_pop(CUcontext ctx, int iters)
+{
+    CUcontext popped;
+    CUresult  status = CUDA_SUCCESS;
+    int       i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i) {
+        status = cuCtxPushCurrent(ctx);
+        if (status == CUDA_SUCCESS)
+            status = cuCtxPopCurrent(&popped);
+    }
+
+    return status;
+}
+
+
+/*
+ * The attributes queried by 'props', other than the compute capability
+ */
+static const CUdevice_attribute props_attributes[] =
+{
+    CU_DEVICE_ATTRIBUTE_TOTAL_CONSTANT_MEMORY,
+    CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_BLOCK,
+    CU_DEVICE_ATTRIBUTE_MAX_PITCH,
+    CU_DEVICE_ATTRIBUTE_TEXTURE_ALIGNMENT,
+    CU_DEVICE_ATTRIBUTE_CLOCK_RATE,
+    CU_DEVICE_ATTRIBUTE_WARP_SIZE,
+    CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_BLOCK,
+    CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK,
+    CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_X,
+    CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Y,
+    CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Z,
+    CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_X,
+    CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Y,
+    CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Z,
+    CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+    CU_DEVICE_ATTRIBUTE_COMPUTE_MODE,
+    CU_DEVICE_ATTRIBUTE_GPU_OVERLAP,
+    CU_DEVICE_ATTRIBUTE_KERNEL_EXEC_TIMEOUT,
+    CU_DEVICE_ATTRIBUTE_INTEGRATED,
+    CU_DEVICE_ATTRIBUTE_CAN_MAP_HOST_MEMORY,
+    CU_DEVICE_ATTRIBUTE_CONCURRENT_KERNELS,
+    CU_DEVICE_ATTRIBUTE_ECC_ENABLED,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE1D_WIDTH,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE2D_WIDTH,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE2D_HEIGHT,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE3D_WIDTH,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE3D_HEIGHT,
+    CU_DEVICE_ATTRIBUTE_MAXIMUM_TEXTURE3D_DEPTH,
+    CU_DEVICE_ATTRIBUTE_ASYNC_ENGINE_COUNT,
+    CU_DEVICE_ATTRIBUTE_L2_CACHE_SIZE,
+    CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR,
+    CU_DEVICE_ATTRIBUTE_GLOBAL_MEMORY_BUS_WIDTH,
+    CU_DEVICE_ATTRIBUTE_MEMORY_CLOCK_RATE,
+    CU_DEVICE_ATTRIBUTE_PCI_BUS_ID,
+    CU_DEVICE_ATTRIBUTE_PCI_DEVICE_ID,
+    CU_DEVICE_ATTRIBUTE_PCI_DOMAIN_ID,
+    CU_DEVICE_ATTRIBUTE_UNIFIED_ADDRESSING,
+    CU_DEVICE_ATTRIBUTE_TCC_DRIVER,
+#if CUDA_VERSION >= 5050
+    CU_DEVICE_ATTRIBUTE_STREAM_PRIORITIES_SUPPORTED,
+#endif
+#if CUDA_VERSION >= 6000
+    CU_DEVICE_ATTRIBUTE_GLOBAL_L1_CACHE_SUPPORTED,
+    CU_DEVICE_ATTRIBUTE_LOCAL_L1_CACHE_SUPPORTED,
+    CU_DEVICE_ATTRIBUTE_MANAGED_MEMORY,
+    CU_DEVICE_ATTRIBUTE_MULTI_GPU_BOARD,
+    CU_DEVICE_ATTRIBUTE_MULTI_GPU_BOARD_GROUP_ID,
+#endif
+};
+
+CUresult baseline_props(CUdevice dev, int iters)
+{
+    char     name[512];
+    size_t   bytes;
+    int      value;
+    CUresult status = CUDA_SUCCESS;
+    size_t   j;
+    int      i;
+
+    for (i = 0; i < iters && status == CUDA_SUCCESS; ++i) {
+        status = cuDeviceGetName(name, sizeof(name), dev);
+
+        if (status == CUDA_SUCCESS)
+            status = cuDeviceGetAttribute(&value, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, dev);
+        if (status == CUDA_SUCCESS)
+            status = cuDeviceGetAttribute(&value, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, dev);
+        if (status == CUDA_SUCCESS)
+            status = cuDeviceTotalMem(&bytes, dev);
+
+        for (j = 0; j < sizeof(props_attributes) / sizeof(props_attributes[0]) && status == CUDA_SUCCESS; ++j)
+            status = cuDeviceGetAttribute(&value, props_attributes[j], dev);
+    }
+
+    return status;
+}
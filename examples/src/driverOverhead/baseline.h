@@ -0,0 +1,55 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : DriverOverhead
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * The same operations as are measured through the bindings, issued directly
+ * from C. Each makes the call the given number of times, stopping at the
+ * first error, which is returned.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef __BASELINE_H__
+#define __BASELINE_H__
+
+#include <cuda.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Launch a kernel taking the given number of int arguments, with a grid and
+ * block of a single thread, passing the arguments as an array of pointers
+ * (as launchKernel) or packed into a single buffer (as launchKernel')
+ */
+CUresult baseline_launch(CUfunction f, int nargs, int iters);
+CUresult baseline_launch_packed(CUfunction f, int nargs, int iters);
+
+/*
+ * Copies between host and device memory
+ */
+CUresult baseline_memcpy_htod(void *dst, const void *src, size_t bytes, int iters);
+CUresult baseline_memcpy_dtoh(void *dst, const void *src, size_t bytes, int iters);
+CUresult baseline_memcpy_htod_async(void *dst, const void *src, size_t bytes, CUstream stream, int iters);
+CUresult baseline_memcpy_dtoh_async(void *dst, const void *src, size_t bytes, CUstream stream, int iters);
+
+/*
+ * Events, streams and contexts
+ */
+CUresult baseline_event_record(CUevent event, int iters);
+CUresult baseline_event_query(CUevent event, int iters);
+CUresult baseline_stream_query(CUstream stream, int iters);
+CUresult baseline_push_pop(CUcontext ctx, int iters);
+
+/*
+ * The device name, capability, memory and attributes queried by 'props'
+ */
+CUresult baseline_props(CUdevice dev, int iters);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Name      : DriverOverhead
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Kernels which do nothing, taking different numbers of arguments
+ */
+
+extern "C" __global__ void empty0(void) { }
+extern "C" __global__ void empty1(int a0) { }
+extern "C" __global__ void empty2(int a0, int a1) { }
+extern "C" __global__ void empty4(int a0, int a1, int a2, int a3) { }
+extern "C" __global__ void empty8(int a0, int a1, int a2, int a3, int a4, int a5, int a6, int a7) { }
+extern "C" __global__ void empty16(int a0, int a1, int a2,  int a3,  int a4,  int a5,  int a6,  int a7,
+                                   int a8, int a9, int a10, int a11, int a12, int a13, int a14, int a15) { }
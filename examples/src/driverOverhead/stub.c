@@ -0,0 +1,330 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : DriverOverhead
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * A stub of the CUDA driver library, which completes every call immediately
+ * without doing any work. Built as libcuda.so.1, it is loaded in place of the
+ * real driver when found first on the library search path, so that the cost
+ * of the bindings can be measured on a machine without a GPU.
+ *
+ * Only the entry points used by the benchmark are provided. The bindings
+ * resolve the driver at runtime, so calling any other function fails with
+ * CUDA_ERROR_NOT_FOUND. Device memory is a range of addresses which are
+ * never dereferenced, so copies move no data.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include <cuda.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CONTEXT_DEPTH       16
+
+/*
+ * Distinct addresses to hand out as handles
+ */
+static char stub_context, stub_module, stub_function, stub_stream, stub_event;
+
+static CUdeviceptr stub_next_address = 0x100000;
+
+static __thread CUcontext stub_contexts[MAX_CONTEXT_DEPTH];
+static __thread int       stub_depth;
+
+
+/* Initialisation and device management */
+
+CUresult CUDAAPI cuInit(unsigned int flags)
+{
+    (void) flags;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDriverGetVersion(int *version)
+{
+    *version = CUDA_VERSION;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGet(CUdevice *device, int ordinal)
+{
+    if (ordinal != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    *device = 0;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetCount(int *count)
+{
+    *count = 1;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetName(char *name, int len, CUdevice dev)
+{
+    (void) dev;
+    strncpy(name, "Stub driver", len);
+    name[len-1] = '\0';
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceTotalMem(size_t *bytes, CUdevice dev)
+{
+    (void) dev;
+    *bytes = (size_t) 1 << 30;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetAttribute(int *value, CUdevice_attribute attrib, CUdevice dev)
+{
+    (void) dev;
+
+    switch (attrib) {
+        case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR:      *value = 3;          break;
+        case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR:      *value = 0;          break;
+        case CU_DEVICE_ATTRIBUTE_WARP_SIZE:                     *value = 32;         break;
+        case CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK:         *value = 1024;       break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_X:               *value = 1024;       break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Y:               *value = 1024;       break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Z:               *value = 64;         break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_X:                *value = 2147483647; break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Y:                *value = 65535;      break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Z:                *value = 65535;      break;
+        case CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT:          *value = 1;          break;
+        case CU_DEVICE_ATTRIBUTE_ASYNC_ENGINE_COUNT:            *value = 2;          break;
+        default:                                                *value = 0;          break;
+    }
+    return CUDA_SUCCESS;
+}
+
+
+/* Context management */
+
+CUresult CUDAAPI cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
+{
+    (void) flags;
+    (void) dev;
+    *pctx = (CUcontext) &stub_context;
+    return cuCtxPushCurrent(*pctx);
+}
+
+CUresult CUDAAPI cuCtxDestroy(CUcontext ctx)
+{
+    if (stub_depth > 0 && stub_contexts[stub_depth-1] == ctx)
+        --stub_depth;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPushCurrent(CUcontext ctx)
+{
+    if (stub_depth == MAX_CONTEXT_DEPTH)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    stub_contexts[stub_depth++] = ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPopCurrent(CUcontext *pctx)
+{
+    if (stub_depth == 0)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    *pctx = stub_contexts[--stub_depth];
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetCurrent(CUcontext *pctx)
+{
+    *pctx = stub_depth > 0 ? stub_contexts[stub_depth-1] : NULL;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSetCurrent(CUcontext ctx)
+{
+    if (stub_depth == 0)
+        return cuCtxPushCurrent(ctx);
+
+    stub_contexts[stub_depth-1] = ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSynchronize(void)
+{
+    return CUDA_SUCCESS;
+}
+
+
+/* Module management and execution */
+
+CUresult CUDAAPI cuModuleLoadData(CUmodule *module, const void *image)
+{
+    (void) image;
+    *module = (CUmodule) &stub_module;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuModuleLoadDataEx(CUmodule *module, const void *image, unsigned int numOptions, CUjit_option *options, void **optionValues)
+{
+    (void) numOptions;
+    (void) options;
+    (void) optionValues;
+    return cuModuleLoadData(module, image);
+}
+
+CUresult CUDAAPI cuModuleUnload(CUmodule module)
+{
+    (void) module;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuModuleGetFunction(CUfunction *fn, CUmodule module, const char *name)
+{
+    (void) module;
+    (void) name;
+    *fn = (CUfunction) &stub_function;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuLaunchKernel(CUfunction f,
+                                unsigned int gridDimX,  unsigned int gridDimY,  unsigned int gridDimZ,
+                                unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+                                unsigned int sharedMemBytes, CUstream hStream,
+                                void **kernelParams, void **extra)
+{
+    (void) f;
+    (void) gridDimX;  (void) gridDimY;  (void) gridDimZ;
+    (void) blockDimX; (void) blockDimY; (void) blockDimZ;
+    (void) sharedMemBytes;
+    (void) hStream;
+    (void) kernelParams;
+    (void) extra;
+    return CUDA_SUCCESS;
+}
+
+
+/* Memory management */
+
+CUresult CUDAAPI cuMemAlloc(CUdeviceptr *dptr, size_t bytes)
+{
+    *dptr = __atomic_fetch_add(&stub_next_address, (bytes + 255) & ~(size_t) 255, __ATOMIC_RELAXED);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemFree(CUdeviceptr dptr)
+{
+    (void) dptr;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemHostAlloc(void **pp, size_t bytes, unsigned int flags)
+{
+    (void) flags;
+    *pp = malloc(bytes);
+    return *pp != NULL ? CUDA_SUCCESS : CUDA_ERROR_OUT_OF_MEMORY;
+}
+
+CUresult CUDAAPI cuMemFreeHost(void *p)
+{
+    free(p);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemcpyHtoD(CUdeviceptr dst, const void *src, size_t bytes)
+{
+    (void) dst;
+    (void) src;
+    (void) bytes;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemcpyDtoH(void *dst, CUdeviceptr src, size_t bytes)
+{
+    (void) dst;
+    (void) src;
+    (void) bytes;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemcpyHtoDAsync(CUdeviceptr dst, const void *src, size_t bytes, CUstream stream)
+{
+    (void) stream;
+    return cuMemcpyHtoD(dst, src, bytes);
+}
+
+CUresult CUDAAPI cuMemcpyDtoHAsync(void *dst, CUdeviceptr src, size_t bytes, CUstream stream)
+{
+    (void) stream;
+    return cuMemcpyDtoH(dst, src, bytes);
+}
+
+
+/* Streams and events */
+
+CUresult CUDAAPI cuStreamCreate(CUstream *stream, unsigned int flags)
+{
+    (void) flags;
+    *stream = (CUstream) &stub_stream;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamDestroy(CUstream stream)
+{
+    (void) stream;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamQuery(CUstream stream)
+{
+    (void) stream;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamSynchronize(CUstream stream)
+{
+    (void) stream;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventCreate(CUevent *event, unsigned int flags)
+{
+    (void) flags;
+    *event = (CUevent) &stub_event;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventDestroy(CUevent event)
+{
+    (void) event;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventRecord(CUevent event, CUstream stream)
+{
+    (void) event;
+    (void) stream;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventQuery(CUevent event)
+{
+    (void) event;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventSynchronize(CUevent event)
+{
+    (void) event;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventElapsedTime(float *ms, CUevent start, CUevent end)
+{
+    (void) start;
+    (void) end;
+    *ms = 0;
+    return CUDA_SUCCESS;
+}
@@ -25,6 +25,13 @@ extern "C" {
  */
 float fold_plusf(float *xs, int N);
 
+float fold_host_plusf(const float *xs, int N);
+float fold_host_timesf(const float *xs, int N);
+float fold_host_minf(const float *xs, int N);
+float fold_host_maxf(const float *xs, int N);
+
+float fold_accumulate_plusf(const float *xs, int N);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,122 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : Fold
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Host implementation of fold, over the same operators as the device version.
+ *
+ * Each thread reduces a contiguous chunk of the input with several vector
+ * accumulators (simd_reduce), so that the loop is limited by memory bandwidth
+ * rather than the latency of the operator. The partial results are then
+ * combined in order. As the accumulators combine elements out of order, the
+ * operator must be commutative as well as associative, as are those of
+ * operator.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "fold.h"
+
+#include "operator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+/*
+ * Inputs smaller than this are reduced by the calling thread alone, and
+ * larger inputs are split into chunks of at least this many bytes
+ */
+#define FOLD_SEQUENTIAL_BYTES   (128 * 1024)
+#define FOLD_CHUNK_BYTES        (64 * 1024)
+
+
+template <class op, typename T>
+struct FoldTask
+{
+    const T     *xs;
+    size_t      n;
+    size_t      chunk;
+    T           *partial;
+
+    void operator() (int t) const
+    {
+        size_t lo = t * chunk;
+        size_t hi = std::min(n, lo + chunk);
+
+        partial[t] = simd_reduce<op,T>(xs + lo, hi - lo);
+    }
+};
+
+
+/*
+ * Apply a binary operator to an array, reducing the array to a single value.
+ * An empty array reduces to the identity of the operator.
+ */
+template <class op, typename T>
+T
+fold_host
+(
+    const T     *xs,
+    int         n
+)
+{
+    if (n <= 0)
+        return op::identity();
+
+    if (n * sizeof(T) <= FOLD_SEQUENTIAL_BYTES)
+        return simd_reduce<op,T>(xs, n);
+
+    /*
+     * Four chunks per thread, so that a thread which is slow to start does not
+     * hold up the others, with each chunk a whole number of unrolled loops
+     */
+    const size_t step    = 4 * simd<T>::width;
+    const size_t threads = parallel_threads();
+    size_t       chunk   = std::max<size_t>(FOLD_CHUNK_BYTES / sizeof(T), (n + 4*threads - 1) / (4*threads));
+
+    chunk = (chunk + step - 1) / step * step;
+
+    std::vector<T>   partial((n + chunk - 1) / chunk);
+    FoldTask<op,T>   task   = { xs, (size_t) n, chunk, &partial[0] };
+
+    parallel_for(partial.size(), task);
+
+    T r = op::identity();
+    for (size_t i = 0; i < partial.size(); ++i)
+        r = op::apply(r, partial[i]);
+
+    return r;
+}
+
+
+// -----------------------------------------------------------------------------
+// Instances
+// -----------------------------------------------------------------------------
+
+float fold_host_plusf(const float *xs, int N)
+{
+    return fold_host< Plus<float> >(xs, N);
+}
+
+float fold_host_timesf(const float *xs, int N)
+{
+    return fold_host< Times<float> >(xs, N);
+}
+
+float fold_host_minf(const float *xs, int N)
+{
+    return fold_host< Min<float> >(xs, N);
+}
+
+float fold_host_maxf(const float *xs, int N)
+{
+    return fold_host< Max<float> >(xs, N);
+}
+
+float fold_accumulate_plusf(const float *xs, int N)
+{
+    return std::accumulate(xs, xs + N, 0.0f);
+}
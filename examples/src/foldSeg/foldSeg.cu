@@ -4,6 +4,20 @@
  * Copyright : (c) 2009 Trevor L. McDonell
  * License   : BSD
  *
+ * Segmented reduction: reduce each segment of an array to a single value.
+ *
+ * The work is split evenly by elements, regardless of the lengths of the
+ * segments. Each thread block takes a tile of consecutive elements, and each
+ * thread a run of ELTS_PER_THREAD elements of that. A segment which starts and
+ * ends within a tile is reduced and written out directly, so long segments
+ * are spread over many threads and blocks while short ones cost little more
+ * than their elements.
+ *
+ * The first and last segments of each tile may continue into the neighbouring
+ * tiles, so their partial values are written out instead, two per tile, as a
+ * new, much shorter, segmented array. This is reduced in the same way until it
+ * fits into a single tile.
+ *
  * ---------------------------------------------------------------------------*/
 
 #include "foldSeg.h"
@@ -11,307 +25,404 @@
 #include "utils.h"
 #include "operator.h"
 
+#include <stdlib.h>
+
+#define TILE_SIZE       (MAX_THREADS * ELTS_PER_THREAD)
+
 
 /* -----------------------------------------------------------------------------
- * Warps
+ * Segment descriptors
  * ---------------------------------------------------------------------------*/
 
-template <class op, typename T, bool inclusive>
-__device__ T scan_warp(volatile T *xs)
+/*
+ * The segment containing each element, given either the offset of the start
+ * of each segment, in ascending order and starting from zero, or the index of
+ * the segment of each element, in ascending order. Segments may be empty.
+ *
+ * Each thread finds the segment of its first element, then steps from one
+ * element to the next.
+ */
+struct SegmentOffset
 {
-    const unsigned int idx  = threadIdx.x;
-    const unsigned int lane = idx & (WARP_SIZE-1);
+    const unsigned int  *offsets;
+    unsigned int        segments;
 
-    if (lane >=  1) xs[idx] = op::apply(xs[idx], xs[idx- 1]);
-    if (lane >=  2) xs[idx] = op::apply(xs[idx], xs[idx- 2]);
-    if (lane >=  4) xs[idx] = op::apply(xs[idx], xs[idx- 4]);
-    if (lane >=  8) xs[idx] = op::apply(xs[idx], xs[idx- 8]);
-    if (lane >= 16) xs[idx] = op::apply(xs[idx], xs[idx-16]);
+    __device__ unsigned int first(unsigned int i) const
+    {
+        unsigned int lo = 0;
+        unsigned int hi = segments;
 
-    if (inclusive) return xs[idx];
-    else           return (lane > 0) ? ptr[idx-1] : op::identity();
-}
+        while (hi - lo > 1)
+        {
+            unsigned int mid = (lo + hi) / 2;
+            if (offsets[mid] <= i) lo = mid;
+            else                   hi = mid;
+        }
+        return lo;
+    }
 
-#if 0
-/*
- * Intra-warp segmented (inclusive) scan. This uses a head flags array to denote
- * the start of each section
- */
-template <class op, typename T>
-__device__ T segscan_warp
-(
-    volatile T            *xs,
-    volatile unsigned int *flags
-)
+    __device__ unsigned int next(unsigned int k, unsigned int i) const
+    {
+        while (k + 1 < segments && offsets[k+1] <= i)
+            ++k;
+        return k;
+    }
+};
+
+struct SegmentIndex
 {
-    const unsigned int idx  = threadIdx.x;
-    const unsigned int lane = idx & (WARP_SIZE-1);
-
-#define DO_SEGSCAN(n)                                                          \
-    if (lane >= n)                                                             \
-    {                                                                          \
-        xs[idx]    = flags[idx] ? xs[idx] : op::apply(xs[idx-n], xs[idx]);     \
-        flags[idx] = flags[idx] | flags[idx-n];                                \
+    const unsigned int  *index;
+
+    __device__ unsigned int first(unsigned int i) const
+    {
+        return index[i];
     }
 
-    DO_SEGSCAN( 1);
-    DO_SEGSCAN( 2);
-    DO_SEGSCAN( 4);
-    DO_SEGSCAN( 8);
-    DO_SEGSCAN(16);
+    __device__ unsigned int next(unsigned int, unsigned int i) const
+    {
+        return index[i];
+    }
+};
 
-    return xs[idx];
-}
-#endif
 
+/* -----------------------------------------------------------------------------
+ * Kernels
+ * ---------------------------------------------------------------------------*/
 
-template <class op, typename T, bool inclusive>
-__device__ T segscan_warp
+/*
+ * Initialise the result for every segment, so that empty segments, which have
+ * no elements to write them, reduce to the identity
+ */
+template <class op, typename T>
+__global__ static void
+foldSeg_fill
 (
-    volatile T            *xs,
-    volatile unsigned int *flags
+    T                   *d_out,
+    unsigned int        segments
 )
 {
-    const unsigned int idx  = threadIdx.x;
-    const unsigned int lane = idx & (WARP_SIZE-1);
-
-    /*
-     * Convert head flags into minimum index form. The multiplication avoids a
-     * branch by relying on the flags being boolean values.
-     */
-    flags[lane]        *= lane;
-    unsigned int mindex = scan_warp<Max, unsigned int, true>(flags);
+    unsigned int i;
+    unsigned int gridSize = blockDim.x * gridDim.x;
 
-    /*
-     * Segmented scan across warp size of 32
-     */
-    if (lane >= mindex +  1) { xs[idx] = op::apply(xs[idx], xs[idx- 1]); }
-    if (lane >= mindex +  2) { xs[idx] = op::apply(xs[idx], xs[idx- 2]); }
-    if (lane >= mindex +  4) { xs[idx] = op::apply(xs[idx], xs[idx- 4]); }
-    if (lane >= mindex +  8) { xs[idx] = op::apply(xs[idx], xs[idx- 8]); }
-    if (lane >= mindex + 16) { xs[idx] = op::apply(xs[idx], xs[idx-16]); }
-
-    if (inclusive) return xs[idx];
-    else           return (lane > 0 && mindex != lane) ? xs[idx-1] : op::identity();
+    for (i = blockIdx.x * blockDim.x + threadIdx.x; i < segments; i += gridSize)
+        d_out[i] = op::identity();
 }
 
 
-/* -----------------------------------------------------------------------------
- * Blocks
- * ---------------------------------------------------------------------------*/
-
-template <unsigned int blockSize, bool lengthIsPow2, class op, typename T>
-__device__ void segfold_recursive
+/*
+ * Reduce the segments of one tile. Interior segments are written to the
+ * output. Unless this is the final level, the first and last segments of the
+ * tile are written as a pair of partial results, the first padded with the
+ * identity if the tile is a single segment.
+ */
+template <unsigned int blockSize, bool final, class op, typename T, class Segment>
+__global__ static void
+foldSeg_tile
 (
     const T             *d_xs,
-    const unsigned int  *d_flags,
+    Segment             seg,
     T                   *d_out,
-    unsigned int        *d_out_flags,
+    T                   *d_part_val,
+    unsigned int        *d_part_idx,
     unsigned int        length
 )
 {
-    __shared__ T            xs[blockSize];
-    __shared__ unsigned int hd[blockSize];
+    __shared__ T            s_xs[blockSize * ELTS_PER_THREAD];
+    __shared__ T            s_val[blockSize];
+    __shared__ unsigned int s_hd[blockSize];
+    __shared__ unsigned int s_fst[blockSize];
+    __shared__ unsigned int s_lst[blockSize];
 
-    const unsigned int idx       = threadIdx.x;
-    const unsigned int lane      = idx & (WARP_SIZE-1);
-    const unsigned int warp_id   = idx / WARP_SIZE;
-    const unsigned int warp_fst  = warp_id * WARP_SIZE;
-    const unsigned int warp_last = warp_fst + WARP_SIZE - 1;
+    const unsigned int tid     = threadIdx.x;
+    const unsigned int base    = blockIdx.x * blockSize * ELTS_PER_THREAD;
+    const unsigned int n       = min(blockSize * ELTS_PER_THREAD, length - base);
+    const unsigned int threads = (n + ELTS_PER_THREAD - 1) / ELTS_PER_THREAD;
+    const unsigned int lo      = tid * ELTS_PER_THREAD;
+    const unsigned int hi      = min(lo + ELTS_PER_THREAD, n);
 
-    xs[idx] = 0;
-    hd[idx] = 0;
+    /*
+     * Stage the tile through shared memory, so that reads are coalesced even
+     * though each thread works on consecutive elements
+     */
+    for (unsigned int i = tid; i < n; i += blockSize)
+        s_xs[i] = d_xs[base + i];
+    __syncthreads();
 
     /*
-     * Reduce multiple elements per thread. The actual number is determined by
-     * the active number of thread blocks. More blocks results in a larger
-     * `gridDim', and fewer elements per thread.
-     *
-     * Warps process chunks of consecutive elements. When the end of a segment
-     * is reached, the (partial) result is written out. When the next chunk of
-     * elements begin with an "open" segment, the last thread of the warp
-     * carries over its reduction value.
+     * Each thread reduces its elements in order. A segment which both starts
+     * and ends among them is complete, and can be written out straight away.
+     * Remember the partial values of the first and last segments.
      */
-    unsigned int i;
-    unsigned int chunk = blockSize * 2 * gridDim.x;
-    unsigned int begin = warp_id * chunk + lane;
+    T            fst_val = op::identity();
+    T            val     = op::identity();
+    unsigned int fst     = 0;
+    unsigned int key     = 0;
+    bool         split   = false;
 
-    for (i = begin; i < begin + chunk; i += WARP_SIZE)
+    if (lo < n)
     {
-        xs[idx] = d_xs[i];
-        hd[idx] = d_flags[i];
+        key = fst = seg.first(base + lo);
+
+        for (unsigned int i = lo; i < hi; ++i)
+        {
+            unsigned int k = seg.next(key, base + i);
+
+            if (k != key)
+            {
+                if (split) d_out[key] = val;
+                else       fst_val    = val;
+
+                split = true;
+                key   = k;
+                val   = op::identity();
+            }
+            val = op::apply(val, s_xs[i]);
+        }
     }
 
+    s_fst[tid] = fst;
+    s_lst[tid] = key;
+    __syncthreads();
+
+    /*
+     * Segmented scan of the values of the last segment of each thread, which
+     * starts afresh at any thread where that segment began
+     */
+    unsigned int hd = tid >= threads || split || tid == 0 || fst != s_lst[tid-1];
+
+    s_val[tid] = val;
+    s_hd[tid]  = hd;
+    __syncthreads();
+
+    for (unsigned int offset = 1; offset < blockSize; offset <<= 1)
+    {
+        if (tid >= offset && !hd)
+        {
+            val = op::apply(s_val[tid - offset], val);
+            hd  = s_hd[tid - offset];
+        }
+        __syncthreads();
+
+        s_val[tid] = val;
+        s_hd[tid]  = hd;
+        __syncthreads();
+    }
 
     /*
-     * Before overwriting the input head flags, record whether this warp begins
-     * with an "open" segment.
+     * Write out the segments which end in this thread: the first, if it ended
+     * before the last element, and the last, if the next thread starts a new
+     * segment. The value carried into the first comes from the thread before.
      */
-    bool warp_is_open = (d_flags[warp_fst] == 0);
+    if (tid < threads)
+    {
+        const unsigned int head = s_fst[0];
+        const unsigned int tail = s_lst[threads-1];
+
+        if (split)
+        {
+            T carry = (tid > 0 && fst == s_lst[tid-1]) ? s_val[tid-1] : op::identity();
+            T x     = op::apply(carry, fst_val);
+
+            if (final || fst != head) d_out[fst] = x;
+            else
+            {
+                d_part_val[2 * blockIdx.x] = x;
+                d_part_idx[2 * blockIdx.x] = fst;
+            }
+        }
+
+        if (tid + 1 < threads && key != s_fst[tid+1])
+        {
+            if (final || key != head) d_out[key] = val;
+            else
+            {
+                d_part_val[2 * blockIdx.x] = val;
+                d_part_idx[2 * blockIdx.x] = key;
+            }
+        }
+
+        if (tid + 1 == threads)
+        {
+            if (final) d_out[tail] = val;
+            else
+            {
+                d_part_val[2 * blockIdx.x + 1] = val;
+                d_part_idx[2 * blockIdx.x + 1] = tail;
+            }
+        }
+
+        if (!final && tid == 0 && head == tail)
+        {
+            d_part_val[2 * blockIdx.x] = op::identity();
+            d_part_idx[2 * blockIdx.x] = head;
+        }
+    }
 }
 
 
+/* -----------------------------------------------------------------------------
+ * Host
+ * ---------------------------------------------------------------------------*/
 
-#if 0
+/*
+ * The partial results of each level of the reduction, and their lengths
+ */
 template <typename T>
 struct foldSeg_plan
 {
-    T            **block_sums;
-    unsigned int **block_idx;
-    size_t       num_levels;
+    T            **part_val;
+    unsigned int **part_idx;
+    unsigned int  *part_len;
+    size_t        num_levels;
 };
 
 
-/*
- * Intra-warp segmented (inclusive) scan that uses an array denoting the segment
- * index each element belongs to
- */
-template <class op, typename T>
-__device__ T segscan_warp
-(
-    volatile T          *xs,
-    const unsigned int  *segment_index,
-)
+static inline unsigned int
+foldSeg_tiles(unsigned int n)
 {
-    const unsigned int idx    = threadIdx.x;
-    const unsigned int lane   = idx & (WARP_SIZE-1);
-    const unsigned int segidx = segment_index[idx];
-
-    if (lane >=  1 && segidx == segment_index[idx- 1]) { xs[idx] = op::apply(xs[idx], xs[idx- 1]); }
-    if (lane >=  2 && segidx == segment_index[idx- 2]) { xs[idx] = op::apply(xs[idx], xs[idx- 2]); }
-    if (lane >=  4 && segidx == segment_index[idx- 4]) { xs[idx] = op::apply(xs[idx], xs[idx- 4]); }
-    if (lane >=  8 && segidx == segment_index[idx- 8]) { xs[idx] = op::apply(xs[idx], xs[idx- 8]); }
-    if (lane >= 16 && segidx == segment_index[idx-16]) { xs[idx] = op::apply(xs[idx], xs[idx-16]); }
-
-    return xs[idx];
+    return multiple(n, TILE_SIZE);
 }
 
 
 /*
- * Segmented reduction in shared memory
+ * Allocate temporary memory for the partial results. Each level has two per
+ * tile of the level before, until they fit into a single tile.
  */
-template <unsigned int blockSize, bool lengthIsPow2, class op, typename T>
-__device__ void
-foldSeg_recursive
-(
-    const T             *d_val,
-    const unsigned int  *d_idx,
-    T                   *d_out_val,
-    unsigned int        *d_out_idx,
-    unsigned int        length
-)
+template <typename T>
+static void
+foldSeg_init(unsigned int N, foldSeg_plan<T> &plan)
 {
-    __shared__ T            s_val[blockSize];
-    __shared__ unsigned int s_idx[blockSize];
+    unsigned int n;
+    size_t       level = 0;
 
-    /*
-     * Reduce multiple elements per thread. The actual number is determined by
-     * the number of active thread blocks. More blocks will result in a larger
-     * `gridDim', and fewer elements per thread.
-     *
-     * Each warp processes `gridDim' number of consecutive elements.
-     */
-    unsigned int i;
-    const unsigned int tid      = blockSize * blockIdx.x + threadIdx.x;
-    const unsigned int lane     = threadIdx.x & (WARP_SIZE - 1);
-    const unsigned int warp_id  = thread_id / WARP_SIZE;
+    for (n = N; foldSeg_tiles(n) > 1; n = 2 * foldSeg_tiles(n))
+        ++level;
 
-    const unsigned int interval = blockSize * 2 * gridDim.x;
-    const unsigned int begin    = warp_id * interval + lane;
-    const unsigned int end      = begin + interval;
+    plan.num_levels = level;
+    plan.part_val   = (T**)            malloc(level * sizeof(T*));
+    plan.part_idx   = (unsigned int**) malloc(level * sizeof(unsigned int*));
+    plan.part_len   = (unsigned int*)  malloc(level * sizeof(unsigned int));
 
-    /*
-     * Initialise values
-     */
-    s_val[threadIdx.x] = op::apply(op::identity(), d_val[begin]);
-    s_idx[threadIdx.x] = d_idx[begin];
+    for (n = N, level = 0; level < plan.num_levels; ++level)
+    {
+        n = 2 * foldSeg_tiles(n);
+
+        plan.part_len[level] = n;
+        cudaMalloc((void**) &plan.part_val[level], n * sizeof(T));
+        cudaMalloc((void**) &plan.part_idx[level], n * sizeof(unsigned int));
+    }
+}
 
-    for (i = begin; i < end; i += WARP_SIZE)
+template <typename T>
+static void
+foldSeg_finalise(foldSeg_plan<T> &plan)
+{
+    for (size_t level = 0; level < plan.num_levels; ++level)
     {
-        /*
-         * With row indices and partial reduction in shared memory, compute a
-         * segmented scan to combine values belonging to the same segment. For
-         * example:
-         *
-         *           0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15   # thread lane
-         *   s_idx [ 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2]  # row indices
-         *   s_val [ 4, 6, 5, 0, 8, 3, 2, 8, 3, 1, 4, 9, 2, 5, 2, 4]  # values
-         *
-         * After the segmented scan:
-         *
-         *   s_val [ 4,10,15,15,23,26, 2,10,13,14, 4,13,15,20,22,26]
-         */
-        foldSeg_warp(s_val, s_idx, lane);
-
-        /*
-         * If this segment ends, store the result. Otherwise ...
-         */
-        if (lane < WARP_SIZE-1 && s_idx[threadIdx.x] != s_idx[threadIdx.x+1])
-        {
-            d_out_val[tid + s_idx[threadIdx.x]] = s_val[threadIdx.x];
-            d_out_idx[tid + s_idx[threadIdx.x]] = s_idx[threadIdx.x];
-        }
+        cudaFree(plan.part_val[level]);
+        cudaFree(plan.part_idx[level]);
     }
+
+    free(plan.part_val);
+    free(plan.part_idx);
+    free(plan.part_len);
 }
 
 
-template <class op, typename T>
+/*
+ * Wrapper function for kernel launch
+ */
+template <bool final, class op, typename T, class Segment>
 static void
 foldSeg_dispatch
 (
-    const T             *d_in,
+    const T             *d_xs,
+    Segment             seg,
     T                   *d_out,
-    scan_plan<T>        *plan,
-    int                 N,
-    int                 level
+    T                   *d_part_val,
+    unsigned int        *d_part_idx,
+    unsigned int        length
 )
 {
+    foldSeg_tile<MAX_THREADS,final,op,T,Segment>
+        <<<foldSeg_tiles(length), MAX_THREADS>>>(d_xs, seg, d_out, d_part_val, d_part_idx, length);
 }
 
 
+/*
+ * Reduce each segment of an array with a binary operator, described by either
+ * a SegmentOffset or a SegmentIndex. The reduction will take place in
+ * parallel, so the operator must be associative, but it need not be
+ * commutative. The plan must have been created for the same length.
+ */
+template <class op, typename T, class Segment>
 static void
-foldSeg_control
+foldSeg
 (
-    int         n,
-    int         &blocks,
-    int         &threads,
-    int         maxThreads = MAX_THREADS,
-    int         maxBlocks  = MAX_BLOCKS
+    const T             *d_xs,
+    Segment             seg,
+    T                   *d_out,
+    int                 length,
+    int                 segments,
+    foldSeg_plan<T>     &plan
 )
 {
-    threads = (n < maxThreads*2) ? ceilPow2((n+1)/2) : maxThreads;
-    blocks  = (n + threads * 2 - 1) / (threads * 2);
-    blocks  = min(blocks, maxBlocks);
+    if (segments <= 0)
+        return;
+
+    foldSeg_fill<op,T><<<min(MAX_BLOCKS, (segments + MAX_THREADS - 1) / MAX_THREADS), MAX_THREADS>>>(d_out, segments);
+
+    if (length <= 0)
+        return;
+
+    if (plan.num_levels == 0)
+    {
+        foldSeg_dispatch<true,op,T>(d_xs, seg, d_out, (T*) NULL, (unsigned int*) NULL, length);
+    }
+    else
+    {
+        foldSeg_dispatch<false,op,T>(d_xs, seg, d_out, plan.part_val[0], plan.part_idx[0], length);
+
+        for (size_t level = 1; level < plan.num_levels; ++level)
+        {
+            SegmentIndex idx = { plan.part_idx[level-1] };
+
+            foldSeg_dispatch<false,op,T>(plan.part_val[level-1], idx, d_out,
+                                         plan.part_val[level], plan.part_idx[level], plan.part_len[level-1]);
+        }
+
+        SegmentIndex idx = { plan.part_idx[plan.num_levels-1] };
+        foldSeg_dispatch<true,op,T>(plan.part_val[plan.num_levels-1], idx, d_out,
+                                    (T*) NULL, (unsigned int*) NULL, plan.part_len[plan.num_levels-1]);
+    }
 }
 
 
-/*
- * Allocate temporary memory used by the scan. At each level we need to store at
- * least (number_blocks + number_segments - 1) partial reductions. The final
- * result is produced when only a single block is launched.
- */
-template <typename T>
-static void
-foldSeg_init(int N, foldSeg_plan<T> &plan)
+// -----------------------------------------------------------------------------
+// Instances
+// -----------------------------------------------------------------------------
+
+void* foldSeg_plan_plusf(int N)
 {
+    foldSeg_plan<float> *plan = new foldSeg_plan<float>;
+    foldSeg_init<float>(N > 0 ? N : 0, *plan);
+    return plan;
 }
 
-template <typename T>
-static void
-foldSeg_finalise(foldSeg_plan<T> &plan)
+void foldSeg_plan_free_plusf(void *plan)
 {
+    foldSeg_finalise<float>(*(foldSeg_plan<float>*) plan);
+    delete (foldSeg_plan<float>*) plan;
 }
 
+void foldSeg_plusf(const float *d_xs, const unsigned int *d_offsets, float *d_out, int N, int segments, void *plan)
+{
+    SegmentOffset seg = { d_offsets, (unsigned int) segments };
+    foldSeg< Plus<float> >(d_xs, seg, d_out, N, segments, *(foldSeg_plan<float>*) plan);
+}
 
-template <class op, typename T>
-void
-foldSeg
-(
-    const T             *d_in,
-    const unsigned int  *d_segment_idx;
-    T                   *d_out,
-    int                 length
-)
+void foldSeg_index_plusf(const float *d_xs, const unsigned int *d_index, float *d_out, int N, int segments, void *plan)
 {
+    SegmentIndex seg = { d_index };
+    foldSeg< Plus<float> >(d_xs, seg, d_out, N, segments, *(foldSeg_plan<float>*) plan);
 }
-#endif
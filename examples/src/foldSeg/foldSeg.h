@@ -6,8 +6,8 @@
  *
  * ---------------------------------------------------------------------------*/
 
-#ifndef __FOLD_H__
-#define __FOLD_H__
+#ifndef __FOLDSEG_H__
+#define __FOLDSEG_H__
 
 /*
  * Optimised for Tesla.
@@ -23,9 +23,24 @@ extern "C" {
 #endif
 
 /*
- * Instances
+ * Device memory for the partial results of reducing N elements. A plan is
+ * created once and passed to every reduction of that length, so that the
+ * reductions themselves do not allocate.
  */
-float foldSeg_plusf(float *xs, int N);
+void* foldSeg_plan_plusf(int N);
+void  foldSeg_plan_free_plusf(void *plan);
+
+/*
+ * Instances. The segments are given either by the offset of the start of each,
+ * or by the segment index of each element.
+ */
+void foldSeg_plusf(const float *d_xs, const unsigned int *d_offsets, float *d_out, int N, int segments, void *plan);
+void foldSeg_index_plusf(const float *d_xs, const unsigned int *d_index, float *d_out, int N, int segments, void *plan);
+
+void foldSeg_host_plusf(const float *xs, const unsigned int *offsets, float *out, int N, int segments);
+void foldSeg_host_index_plusf(const float *xs, const unsigned int *index, float *out, int N, int segments);
+
+void foldSeg_sequential_plusf(const float *xs, const unsigned int *offsets, float *out, int N, int segments);
 
 
 #ifdef __cplusplus
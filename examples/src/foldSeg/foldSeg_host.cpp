@@ -0,0 +1,350 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : FoldSeg
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Host implementation of segmented reduction, over the same segment
+ * descriptors as the device version.
+ *
+ * Given segment offsets, the work is split along the merge path of the segment
+ * ends and the elements: each thread takes an equal share of segments plus
+ * elements, so neither a few very long segments nor very many short ones
+ * leave threads idle. Given segment indices, the elements are split evenly,
+ * and the end of each segment is found by a galloping search, so a long
+ * segment costs little more than reading its elements.
+ *
+ * In either case each segment, or the part of it within a chunk, is reduced
+ * with vector accumulators (simd_reduce), so the operator must be commutative.
+ * The partial results of segments which span chunks are combined afterwards.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "foldSeg.h"
+
+#include "operator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Inputs smaller than this (elements plus segments) are reduced by the calling
+ * thread alone, and larger inputs are split into chunks of at least this size
+ */
+#define FOLDSEG_SEQUENTIAL_WORK (32 * 1024)
+#define FOLDSEG_CHUNK_WORK      (16 * 1024)
+
+
+static size_t
+foldSeg_chunk_size(size_t work)
+{
+    const size_t threads = parallel_threads();
+    return std::max<size_t>(FOLDSEG_CHUNK_WORK, (work + 4*threads - 1) / (4*threads));
+}
+
+
+/* -----------------------------------------------------------------------------
+ * Segment offsets
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * The offsets of the start of each segment, ascending from zero
+ */
+struct Offsets
+{
+    const unsigned int  *offsets;
+    size_t              segments;
+    size_t              n;
+
+    size_t end(size_t k) const
+    {
+        return k + 1 < segments ? offsets[k+1] : n;
+    }
+
+    /*
+     * The point at which a diagonal crosses the merge path of the segment ends
+     * and the element indices: the number of segments completed and elements
+     * consumed, which together add up to the diagonal
+     */
+    void split(size_t d, size_t &x, size_t &y) const
+    {
+        size_t lo = d > n ? d - n : 0;
+        size_t hi = std::min(d, segments);
+
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (end(mid) + mid + 1 <= d) lo = mid + 1;
+            else                         hi = mid;
+        }
+
+        x = lo;
+        y = d - lo;
+    }
+};
+
+
+/*
+ * Reduce the segments completed along one chunk of the merge path, and the
+ * part of the next segment consumed before the end of the chunk. The first
+ * segment may have been started by earlier chunks, whose partial results are
+ * combined with it later.
+ */
+template <class op, typename T>
+struct FoldSegTask
+{
+    const T             *xs;
+    Offsets             seg;
+    size_t              chunk;
+    T                   *out;
+    T                   *carry;
+
+    void operator() (int t) const
+    {
+        const size_t total = seg.n + seg.segments;
+        size_t       x, y, x1, y1;
+
+        seg.split(std::min(total, t * chunk), x, y);
+        seg.split(std::min(total, (t+1) * chunk), x1, y1);
+
+        for (; x < x1; ++x)
+        {
+            size_t e = seg.end(x);
+
+            out[x] = simd_reduce<op,T>(xs + y, e - y);
+            y      = e;
+        }
+
+        carry[t] = simd_reduce<op,T>(xs + y, y1 - y);
+    }
+};
+
+
+/*
+ * Reduce each segment of an array, given the offset of the start of each
+ */
+template <class op, typename T>
+void
+foldSeg_host
+(
+    const T             *xs,
+    const unsigned int  *offsets,
+    T                   *out,
+    int                 length,
+    int                 segments
+)
+{
+    if (segments <= 0)
+        return;
+
+    const Offsets seg   = { offsets, (size_t) segments, (size_t) std::max(length, 0) };
+    const size_t  total = seg.n + seg.segments;
+    const size_t  chunk = total <= FOLDSEG_SEQUENTIAL_WORK ? total : foldSeg_chunk_size(total);
+    const int     nc    = (total + chunk - 1) / chunk;
+
+    std::vector<T>     carry(nc);
+    FoldSegTask<op,T>  task = { xs, seg, chunk, out, &carry[0] };
+
+    parallel_for(nc, task);
+
+    /*
+     * The carry out of a chunk belongs to the first segment of the next, or of
+     * a later chunk if the segment spans several. Combining from the right
+     * keeps the elements in order.
+     */
+    for (int t = nc-1; t >= 0; --t)
+    {
+        size_t x, y;
+        seg.split(std::min(total, (t+1) * chunk), x, y);
+
+        if (x < seg.segments)
+            out[x] = op::apply(carry[t], out[x]);
+    }
+}
+
+
+/* -----------------------------------------------------------------------------
+ * Segment indices
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * The end of the run of elements with the same segment index as element i,
+ * searching forward in steps of increasing size and then bisecting
+ */
+static size_t
+run_end(const unsigned int *index, size_t i, size_t hi)
+{
+    const unsigned int k    = index[i];
+    size_t             lo   = i + 1;
+    size_t             step = 1;
+
+    while (lo + step <= hi && index[lo + step - 1] == k)
+    {
+        lo   += step;
+        step *= 2;
+    }
+
+    return std::upper_bound(index + lo, index + std::min(hi, lo + step), k) - index;
+}
+
+
+/*
+ * Reduce the runs of a chunk of elements. Runs within the chunk are complete
+ * segments, and written out directly. The first and last runs may continue
+ * into the neighbouring chunks, so are recorded as a pair of partial results,
+ * the first padded with the identity if the chunk is a single run.
+ */
+template <class op, typename T>
+struct FoldSegIndexTask
+{
+    const T             *xs;
+    const unsigned int  *index;
+    size_t              n;
+    size_t              chunk;
+    T                   *out;
+    T                   *part_val;
+    unsigned int        *part_idx;
+
+    void operator() (int t) const
+    {
+        const size_t lo = t * chunk;
+        const size_t hi = std::min(n, lo + chunk);
+
+        size_t i = lo;
+        size_t e = run_end(index, i, hi);
+
+        part_idx[2*t]   = index[lo];
+        part_val[2*t]   = op::identity();
+
+        if (e < hi)
+        {
+            part_val[2*t] = simd_reduce<op,T>(xs + i, e - i);
+
+            for (i = e; (e = run_end(index, i, hi)) < hi; i = e)
+                out[index[i]] = simd_reduce<op,T>(xs + i, e - i);
+        }
+
+        part_idx[2*t+1] = index[i];
+        part_val[2*t+1] = simd_reduce<op,T>(xs + i, hi - i);
+    }
+};
+
+template <class op, typename T>
+struct FoldSegFillTask
+{
+    T                   *out;
+    size_t              segments;
+    size_t              chunk;
+
+    void operator() (int t) const
+    {
+        std::fill(out + t * chunk, out + std::min(segments, (t+1) * chunk), op::identity());
+    }
+};
+
+
+/*
+ * Reduce each segment of an array, given the segment index of each element.
+ * The indices must be in ascending order, but need not be consecutive; the
+ * segments which have no elements reduce to the identity.
+ */
+template <class op, typename T>
+void
+foldSeg_host_index
+(
+    const T             *xs,
+    const unsigned int  *index,
+    T                   *out,
+    int                 length,
+    int                 segments
+)
+{
+    if (segments <= 0)
+        return;
+
+    const size_t          s    = segments;
+    FoldSegFillTask<op,T> fill = { out, s, foldSeg_chunk_size(s) };
+
+    parallel_for((s + fill.chunk - 1) / fill.chunk, fill);
+
+    if (length <= 0)
+        return;
+
+    const size_t n     = length;
+    const size_t chunk = n <= FOLDSEG_SEQUENTIAL_WORK ? n : foldSeg_chunk_size(n);
+    const int    nc    = (n + chunk - 1) / chunk;
+
+    std::vector<T>              part_val(2*nc);
+    std::vector<unsigned int>   part_idx(2*nc);
+    FoldSegIndexTask<op,T>      task = { xs, index, n, chunk, out, &part_val[0], &part_idx[0] };
+
+    parallel_for(nc, task);
+
+    /*
+     * The partial results are themselves a short segmented array, in order
+     */
+    unsigned int k = part_idx[0];
+    T            a = part_val[0];
+
+    for (int i = 1; i < 2*nc; ++i)
+    {
+        if (part_idx[i] != k)
+        {
+            out[k] = a;
+            k      = part_idx[i];
+            a      = part_val[i];
+        }
+        else
+            a = op::apply(a, part_val[i]);
+    }
+    out[k] = a;
+}
+
+
+/*
+ * The obvious loop, for comparison
+ */
+template <class op, typename T>
+void
+foldSeg_sequential
+(
+    const T             *xs,
+    const unsigned int  *offsets,
+    T                   *out,
+    int                 length,
+    int                 segments
+)
+{
+    for (int k = 0; k < segments; ++k)
+    {
+        int e = k + 1 < segments ? (int) offsets[k+1] : length;
+        T   a = op::identity();
+
+        for (int i = offsets[k]; i < e; ++i)
+            a = op::apply(a, xs[i]);
+
+        out[k] = a;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Instances
+// -----------------------------------------------------------------------------
+
+void foldSeg_host_plusf(const float *xs, const unsigned int *offsets, float *out, int N, int segments)
+{
+    foldSeg_host< Plus<float> >(xs, offsets, out, N, segments);
+}
+
+void foldSeg_host_index_plusf(const float *xs, const unsigned int *index, float *out, int N, int segments)
+{
+    foldSeg_host_index< Plus<float> >(xs, index, out, N, segments);
+}
+
+void foldSeg_sequential_plusf(const float *xs, const unsigned int *offsets, float *out, int N, int segments)
+{
+    foldSeg_sequential< Plus<float> >(xs, offsets, out, N, segments);
+}
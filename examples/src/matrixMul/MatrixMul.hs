@@ -15,10 +15,11 @@ module Main where
 #include "matrix_mul.h"
 
 -- Friends
-import Time
+import Benchmark
 import RandomVector
 
 -- System
+import Control.Monad
 import Data.Array
 import System.IO
 import Foreign
@@ -92,23 +93,27 @@ matMultCUDA xs' ys' = doMult undefined xs' ys'
 -- Main
 --------------------------------------------------------------------------------
 
+-- The problem size scales each dimension of the matrices
+--
 main :: IO ()
-main = do
-  dev   <- CUDA.get
-  props <- CUDA.props dev
-  putStrLn $ "Using device " ++ show dev ++ ": " ++ CUDA.deviceName props
-
-  xs <- randomArr ((1,1),(8*BLOCK_SIZE, 4*BLOCK_SIZE)) :: IO (Matrix Float)
-  ys <- randomArr ((1,1),(4*BLOCK_SIZE,12*BLOCK_SIZE)) :: IO (Matrix Float)
+main = withResults $ do
+  k    <- problemSize 1
+  host <- hostOnly
+  xs   <- randomArr ((1,1),(8*k*BLOCK_SIZE, 4*k*BLOCK_SIZE)) :: IO (Matrix Float)
+  ys   <- randomArr ((1,1),(4*k*BLOCK_SIZE,12*k*BLOCK_SIZE)) :: IO (Matrix Float)
 
   putStr   "== Reference: " >> hFlush stdout
-  (tr,ref) <- benchmark 100 (matMult xs ys) (return ())
-  putStrLn $  shows (fromInteger (timeIn millisecond tr) / 100::Float) " ms"
+  (tr,ref) <- benchmark "matrixMul/reference" (matMult xs ys) (return ())
+  putStrLn $  showResult tr
 
-  putStr   "== CUDA: " >> hFlush stdout
-  (tc,mat) <- benchmark 100 (matMultCUDA xs ys) (CUDA.sync)
-  putStrLn $  shows (fromInteger (timeIn millisecond tc) / 100::Float) " ms"
+  unless host $ do
+    dev   <- CUDA.get
+    props <- CUDA.props dev
+    putStrLn $ "Using device " ++ show dev ++ ": " ++ CUDA.deviceName props
 
-  putStr "== Validating: "
-  verify ref mat >>= \rv -> putStrLn $ if rv then "Ok!" else "INVALID!"
+    putStr   "== CUDA: " >> hFlush stdout
+    (tc,mat) <- benchmark "matrixMul/cuda" (matMultCUDA xs ys) (CUDA.sync)
+    putStrLn $  showResult tc
 
+    putStr "== Validating: "
+    verify ref mat >>= \rv -> putStrLn $ if rv then "Ok!" else "INVALID!"
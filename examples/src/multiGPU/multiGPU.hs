@@ -11,7 +11,7 @@
 
 module Main where
 
-import Time
+import Benchmark
 
 -- System
 import System.Random.MWC
@@ -50,7 +50,7 @@ data Plan = Plan
 
 
 main :: IO ()
-main = do
+main = withResults $ do
   gpu_n <- CR.count
   putStrLn $ "Number of GPUs found: " ++ show gpu_n
 
@@ -69,7 +69,8 @@ main = do
 executePlans :: [Plan] -> IO ()
 executePlans plans = do
     --Copy data to GPU, launch Kernel, copy data back all asynchronously
-    (t,_) <- flip (benchmark 100) CR.sync $ forM_ plans $ \plan -> do 
+    --The finaliser waits for the streams of every device, not only the current
+    (t,_) <- flip (benchmark name) finished $ forM_ plans $ \plan -> do
       CR.set (device plan)
       --Copy input data from CPU
       CR.pokeArrayAsync (dataN plan) (h_data plan) (d_data plan) (Just $ stream plan)
@@ -86,7 +87,7 @@ executePlans plans = do
       return $ sum hs_sum
     let sumGPU = sum h_sumGPU
 
-    putStrLn $ " GPU processing time: " ++ (show $ timeIn millisecond t) ++ " ms"
+    putStrLn $ " GPU processing time: " ++ showResult t
 
 
     let sumCPU = sum $ map (\p -> U.sum $ v_data p) plans
@@ -100,6 +101,9 @@ executePlans plans = do
       putStrLn $ "Passed!"
       else 
       putStrLn $ "Failed!"
+  where
+    name     = "multiGPU/" ++ show (length plans) ++ "x" ++ show (length (nub (map device plans)))
+    finished = forM_ plans $ \plan -> CR.set (device plan) >> CR.block (stream plan)
 
 -- |Makes n plans spread over ndevices
 withPlans :: Int -> Int -> ([Plan] -> IO ()) ->  IO ()
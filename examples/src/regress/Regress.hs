@@ -0,0 +1,225 @@
+--------------------------------------------------------------------------------
+--
+-- Module    : Regress
+-- Copyright : (c) 2009 Trevor L. McDonell
+-- License   : BSD
+--
+-- Performance regression tracking for the examples.
+--
+-- Each example is run over a sweep of problem sizes, and the results of its
+-- benchmarks are collected into a single JSON baseline. Given the baseline of
+-- a previous run, each benchmark is compared against it, and the program
+-- exits with failure if any has become slower.
+--
+-- A benchmark has regressed only if the lower bound of the confidence
+-- interval of its median is above the upper bound of the baseline's, so that
+-- the two measurements are distinguishable from noise, and the median is
+-- slower by more than the threshold percentage.
+--
+-- The examples must have been built, and are found next to this program. When
+-- there is no device, or with --host, only the benchmarks which run on the
+-- host are run, skipping those examples with none.
+--
+--------------------------------------------------------------------------------
+
+module Main where
+
+-- Friends
+import Benchmark
+import PrettyPrint
+
+-- System
+import Numeric
+import Data.List
+import Control.Monad
+import Control.Exception
+import System.Console.GetOpt
+import System.Directory
+import System.Environment
+import System.Exit
+import System.FilePath
+import System.IO
+import System.Process
+import Text.PrettyPrint
+
+import qualified Foreign.CUDA.Driver            as CUDA
+
+
+--------------------------------------------------------------------------------
+-- Examples
+--------------------------------------------------------------------------------
+
+-- The problem sizes of an example, and whether it has benchmarks which run on
+-- the host. The meaning of the size is up to the example (see its 'main').
+--
+data Example = Example
+  { exampleName  :: String
+  , exampleSizes :: [Int]
+  , exampleHost  :: Bool
+  }
+
+examples :: [Example]
+examples =
+  [ Example "fold"          [10000, 100000, 1000000]                        True
+  , Example "scan"          [10000, 100000, 1000000]                        True
+  , Example "scanSeg"       [10000, 100000, 1000000]                        True
+  , Example "foldSeg"       [10000, 100000, 1000000]                        True
+  , Example "sort"          [1000, 10000, 100000]                           True
+  , Example "matrixMul"     [1, 2]                                          True
+  , Example "smvm"          [512, 2048, 8192]                               False
+  , Example "bandwidthTest" [megabyte, 8*megabyte, 32*megabyte]             False
+  ]
+  where
+    megabyte = 1024 * 1024
+
+
+--------------------------------------------------------------------------------
+-- Options
+--------------------------------------------------------------------------------
+
+data Options = Options
+  { output    :: FilePath
+  , baseline  :: Maybe FilePath
+  , threshold :: Double
+  , host      :: Bool
+  , only      :: [String]
+  }
+
+defaultOptions :: Options
+defaultOptions = Options
+  { output    = "baseline.json"
+  , baseline  = Nothing
+  , threshold = 5
+  , host      = False
+  , only      = []
+  }
+
+options :: [OptDescr (Options -> Options)]
+options =
+  [ Option ['o'] ["output"]    (ReqArg (\f opts -> opts { output = f }) "FILE")                "write the results to FILE (baseline.json)"
+  , Option ['b'] ["baseline"]  (ReqArg (\f opts -> opts { baseline = Just f }) "FILE")         "compare against the results in FILE"
+  , Option ['t'] ["threshold"] (ReqArg (\t opts -> opts { threshold = read t }) "PERCENT")     "slowdown required to report a regression (5)"
+  , Option ['e'] ["example"]   (ReqArg (\e opts -> opts { only = e : only opts }) "NAME")      "run only the named example (may be repeated)"
+  , Option []    ["host"]      (NoArg  (\opts -> opts { host = True }))                        "run only the benchmarks which execute on the host"
+  ]
+
+parseOptions :: [String] -> IO Options
+parseOptions argv =
+  case getOpt Permute options argv of
+    (o,[],[])  -> return (foldl (flip id) defaultOptions o)
+    (_,_,errs) -> do putStrLn $ concat errs ++ usageInfo header options
+                     exitFailure
+  where
+    header = "Usage: regress [OPTION...]"
+
+
+--------------------------------------------------------------------------------
+-- Running
+--------------------------------------------------------------------------------
+
+-- Whether a device is available. The driver is loaded when first used, so
+-- this also fails gracefully when it is not installed.
+--
+hasDevice :: IO Bool
+hasDevice = do
+  r <- try (CUDA.initialise [] >> CUDA.count) :: IO (Either SomeException Int)
+  return $ either (const False) (> 0) r
+
+
+-- Run an example at the given size, returning its results named by the size
+--
+run :: FilePath -> Bool -> Example -> Int -> IO [Result]
+run dir hostonly ex n = do
+  tmp    <- getTemporaryDirectory
+  (f,h)  <- openTempFile tmp "regress.json"
+  hClose h
+  vars   <- getEnvironment
+  let exe  = dir </> exampleName ex
+      env' = [("BENCHMARK_OUTPUT", f), ("BENCHMARK_SIZE", show n)]
+          ++ [("BENCHMARK_HOST_ONLY", "1") | hostonly]
+          ++ filter (\(k,_) -> not ("BENCHMARK_" `isPrefixOf` k)) vars
+
+  putStrLn $ "== " ++ exampleName ex ++ " (" ++ show n ++ ")"
+  (_,_,_,p) <- createProcess (proc exe []) { env = Just env' }
+  status    <- waitForProcess p
+  rs        <- case status of
+                 ExitSuccess   -> readResults f
+                 ExitFailure e -> do hPutStrLn stderr $ exe ++ ": exited with code " ++ show e
+                                     return []
+  removeFile f
+  return [ r { resultName = resultName r ++ "/" ++ show n } | r <- rs ]
+
+
+--------------------------------------------------------------------------------
+-- Comparison
+--------------------------------------------------------------------------------
+
+data Verdict = Faster | Same | Slower
+  deriving (Eq, Show)
+
+-- Compare a result against the baseline, requiring the confidence intervals
+-- of the medians to be disjoint and the change to exceed the threshold
+--
+verdict :: Double -> Result -> Result -> Verdict
+verdict pct old new
+  | resultLower new > resultUpper old && change > pct        = Slower
+  | resultUpper new < resultLower old && change < negate pct = Faster
+  | otherwise                                                = Same
+  where
+    change = percent old new
+
+percent :: Result -> Result -> Double
+percent old new = (resultMedian new / resultMedian old - 1) * 100
+
+
+-- Print the comparison of each benchmark found in both sets of results,
+-- returning the number which regressed
+--
+compareResults :: Double -> [Result] -> [Result] -> IO Int
+compareResults pct olds news = do
+  printDoc . ppAsRows 1 $ header ++ map row matched
+  unless (null missing) $
+    putStrLn $ "Not in the baseline: " ++ intercalate ", " (map resultName missing) ++ "\n"
+  return . length $ filter (\(o,n) -> verdict pct o n == Slower) matched
+  where
+    matched = [ (o,n) | n <- news, o <- take 1 (filter ((== resultName n) . resultName) olds) ]
+    missing = [ n | n <- news, resultName n `notElem` map resultName olds ]
+
+    row (o,n) = [ text (resultName n), ms (resultMedian o), ms (resultMedian n)
+                , text (showFFloat (Just 1) (percent o n) "%"), text (show (verdict pct o n)) ]
+    ms t      = text (showFFloat (Just 3) (t * 1.0E3) "")
+
+    titles    = ["Benchmark", "Baseline (ms)", "Current (ms)", "Change", "Verdict"]
+    header    = map (map text) [titles, map (flip replicate '-' . length) titles]
+
+
+--------------------------------------------------------------------------------
+-- Main
+--------------------------------------------------------------------------------
+
+main :: IO ()
+main = do
+  opts   <- parseOptions =<< getArgs
+  dir    <- takeDirectory `fmap` getExecutablePath
+  device <- if host opts then return False else hasDevice
+
+  unless device $
+    putStrLn "Running only the benchmarks which execute on the host\n"
+
+  let selected = [ ex | ex <- examples
+                      , null (only opts) || exampleName ex `elem` only opts
+                      , device || exampleHost ex ]
+
+  rs <- concat `fmap` sequence [ run dir (not device) ex n | ex <- selected, n <- exampleSizes ex ]
+  writeFile (output opts) (renderJSON rs)
+  putStrLn $ "\nWrote " ++ show (length rs) ++ " results to " ++ output opts ++ "\n"
+
+  case baseline opts of
+    Nothing   -> return ()
+    Just file -> do
+      olds <- readResults file
+      n    <- compareResults (threshold opts) olds rs
+      if n == 0
+         then putStrLn "No regressions"
+         else do putStrLn $ show n ++ " benchmark(s) regressed by more than " ++ show (threshold opts) ++ "%"
+                 exitWith (ExitFailure 1)
@@ -0,0 +1,48 @@
+module Main where
+
+import Control.Monad
+import System.Environment
+import System.Exit
+import Text.Printf
+
+import qualified Foreign.CUDA.Driver                    as CUDA
+import Foreign.CUDA.Driver.Daemon.Backend               ( driverBackend, nullBackend )
+import Foreign.CUDA.Driver.Record                       ( readEntries )
+import Foreign.CUDA.Driver.Replay
+
+
+-- Replay a recording made with 'Foreign.CUDA.Driver.Record.start', on a
+-- device or without executing anything, and compare the time taken by each
+-- kind of call against the recording.
+--
+main :: IO ()
+main = do
+  args <- getArgs
+  (file, opts) <- case args of
+    f:os | all (`elem` ["--null", "--paced"]) os -> return (f, os)
+    _                                           -> do
+      name <- getProgName
+      printf "usage: %s RECORDING [--null] [--paced]\n" name
+      exitFailure
+
+  entries <- readEntries file
+  when (null entries) $ do
+    printf "%s: no calls recorded\n" file
+    exitFailure
+
+  let config = defaultConfig { configPaced = "--paced" `elem` opts }
+  timings <- if "--null" `elem` opts
+               then do
+                 backend <- nullBackend
+                 replay config backend entries
+               else do
+                 CUDA.initialise []
+                 dev <- CUDA.device 0
+                 ctx <- CUDA.create dev []
+                 _   <- CUDA.pop
+                 ts  <- replay config (driverBackend ctx) entries
+                 CUDA.destroy ctx
+                 return ts
+
+  printf "%d calls replayed\n\n" (length timings)
+  putStr (render (summarise timings))
@@ -19,6 +19,13 @@ extern "C" {
 void scanl_plusf(float *in, float *out, int N);
 void scanl1_plusf(float *in, float *out, int N);
 
+void scanl_host_plusf(const float *in, float *out, int N);
+void scanl1_host_plusf(const float *in, float *out, int N);
+void scanr_host_plusf(const float *in, float *out, int N);
+void scanr1_host_plusf(const float *in, float *out, int N);
+
+void scanl1_sequential_plusf(const float *in, float *out, int N);
+
 
 #ifdef __cplusplus
 }
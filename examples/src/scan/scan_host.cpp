@@ -0,0 +1,305 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : Scan
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Host implementation of scan, with the same flags as the device version: the
+ * direction of the scan, and whether each element of the result includes the
+ * corresponding input element.
+ *
+ * Large inputs are scanned in rounds, one block per thread, in three phases:
+ * each thread reduces its block, the block totals are scanned to give the
+ * value carried into each block, and each thread then scans its block again
+ * starting from that value. A block is small enough to remain in cache between
+ * the first and last phases, so the input is read from memory only once.
+ *
+ * Within a block, each vector of elements is scanned in registers with a
+ * logarithmic number of shifts, then combined with the value carried in from
+ * the vectors before it.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "scan.h"
+
+#include "operator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Inputs smaller than this are scanned by the calling thread alone, and larger
+ * inputs are split into blocks of this many bytes
+ */
+#define SCAN_SEQUENTIAL_BYTES   (128 * 1024)
+#define SCAN_BLOCK_BYTES        (128 * 1024)
+
+
+/*
+ * Inclusive scan of the lanes of a vector, towards the last lane or, for a
+ * backward scan, towards the first. Each step combines every lane with the
+ * lane k places behind it, doubling k until it spans the vector.
+ */
+template <class op, typename T, bool backward, int k = 1, bool done = (k >= simd<T>::width)>
+struct ScanVector
+{
+    typedef typename simd<T>::type      V;
+    typedef typename rebind<op,V>::type vop;
+
+    static inline V apply(V v, const V &id)
+    {
+        if (backward) v = vop::apply(v, simd_shift_down<k,T>(v, id));
+        else          v = vop::apply(simd_shift_up<k,T>(v, id), v);
+
+        return ScanVector<op,T,backward,2*k>::apply(v, id);
+    }
+};
+
+template <class op, typename T, bool backward, int k>
+struct ScanVector<op,T,backward,k,true>
+{
+    static inline typename simd<T>::type apply(const typename simd<T>::type &v, const typename simd<T>::type &)
+    {
+        return v;
+    }
+};
+
+
+/*
+ * Scan a contiguous array starting from the given value, returning the value
+ * to carry into the next array in the direction of the scan. The input and
+ * output may be the same array.
+ */
+template <class op, typename T, bool backward, bool exclusive>
+static T
+scan_chunk
+(
+    const T     *in,
+    T           *out,
+    size_t      n,
+    T           carry
+)
+{
+    typedef typename simd<T>::type      V;
+    typedef typename rebind<op,V>::type vop;
+
+    const int w  = simd<T>::width;
+    const V   id = simd_splat<T>(op::identity());
+    V         c  = simd_splat<T>(carry);
+    size_t    i;
+
+    if (!backward)
+    {
+        for (i = 0; i + w <= n; i += w)
+        {
+            V s = ScanVector<op,T,false>::apply(simd_load(in + i), id);
+            V r = exclusive ? simd_shift_up<1,T>(s, id) : s;
+
+            simd_store(out + i, vop::apply(c, r));
+            c = vop::apply(c, simd_broadcast<simd<T>::width - 1, T>(s));
+        }
+
+        carry = c[0];
+        for (; i < n; ++i)
+        {
+            T x = in[i];
+            if (exclusive) out[i] = carry;
+            carry = op::apply(carry, x);
+            if (!exclusive) out[i] = carry;
+        }
+    }
+    else
+    {
+        for (i = n; i >= (size_t) w; i -= w)
+        {
+            V s = ScanVector<op,T,true>::apply(simd_load(in + i - w), id);
+            V r = exclusive ? simd_shift_down<1,T>(s, id) : s;
+
+            simd_store(out + i - w, vop::apply(r, c));
+            c = vop::apply(simd_broadcast<0,T>(s), c);
+        }
+
+        carry = c[0];
+        while (i-- > 0)
+        {
+            T x = in[i];
+            if (exclusive) out[i] = carry;
+            carry = op::apply(x, carry);
+            if (!exclusive) out[i] = carry;
+        }
+    }
+
+    return carry;
+}
+
+
+/*
+ * The phases of a round: reducing each block, and scanning each block from
+ * the value carried into it
+ */
+template <class op, typename T>
+struct ScanReduceTask
+{
+    const T     *in;
+    size_t      n;
+    size_t      block;
+    T           *carry;
+
+    void operator() (int b) const
+    {
+        size_t lo = b * block;
+        size_t hi = std::min(n, lo + block);
+
+        carry[b] = simd_reduce<op,T>(in + lo, hi - lo);
+    }
+};
+
+template <class op, typename T, bool backward, bool exclusive>
+struct ScanTask
+{
+    const T     *in;
+    T           *out;
+    size_t      n;
+    size_t      block;
+    const T     *carry;
+
+    void operator() (int b) const
+    {
+        size_t lo = b * block;
+        size_t hi = std::min(n, lo + block);
+
+        scan_chunk<op,T,backward,exclusive>(in + lo, out + lo, hi - lo, carry[b]);
+    }
+};
+
+
+/*
+ * Scan an array with a binary operator, from the left or (backward) from the
+ * right. An exclusive scan shifts the result by one place, so that the first
+ * element in the direction of the scan is the identity and the total of the
+ * whole array is not included. The input and output may be the same array.
+ *
+ * As the blocks are reduced out of order, the operator must be commutative.
+ */
+template <class op, typename T, bool backward, bool exclusive>
+void
+scan_host
+(
+    const T     *in,
+    T           *out,
+    int         length
+)
+{
+    if (length <= 0)
+        return;
+
+    const size_t threads = parallel_threads();
+    const size_t n       = length;
+
+    if (threads == 1 || n * sizeof(T) <= SCAN_SEQUENTIAL_BYTES)
+    {
+        scan_chunk<op,T,backward,exclusive>(in, out, n, op::identity());
+        return;
+    }
+
+    /*
+     * Each round covers one block per thread. The rounds proceed in the
+     * direction of the scan, carrying the total of each round into the next.
+     */
+    const size_t   block  = SCAN_BLOCK_BYTES / sizeof(T);
+    const size_t   round  = block * threads;
+    const size_t   rounds = (n + round - 1) / round;
+    T              total  = op::identity();
+    std::vector<T> carry(threads);
+
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        size_t lo = (backward ? rounds - 1 - r : r) * round;
+        size_t m  = std::min(n - lo, round);
+        int    nb = (m + block - 1) / block;
+
+        ScanReduceTask<op,T>                    reduce = { in + lo, m, block, &carry[0] };
+        ScanTask<op,T,backward,exclusive>       scan   = { in + lo, out + lo, m, block, &carry[0] };
+
+        parallel_for(nb, reduce);
+
+        if (!backward)
+        {
+            for (int b = 0; b < nb; ++b)
+            {
+                T x      = carry[b];
+                carry[b] = total;
+                total    = op::apply(total, x);
+            }
+        }
+        else
+        {
+            for (int b = nb-1; b >= 0; --b)
+            {
+                T x      = carry[b];
+                carry[b] = total;
+                total    = op::apply(x, total);
+            }
+        }
+
+        parallel_for(nb, scan);
+    }
+}
+
+
+/*
+ * The obvious loop, for comparison
+ */
+template <class op, typename T, bool backward, bool exclusive>
+void
+scan_sequential
+(
+    const T     *in,
+    T           *out,
+    int         length
+)
+{
+    T a = op::identity();
+
+    for (int k = 0; k < length; ++k)
+    {
+        int i = backward ? length - 1 - k : k;
+        T   x = in[i];
+
+        if (exclusive) out[i] = a;
+        a = backward ? op::apply(x, a) : op::apply(a, x);
+        if (!exclusive) out[i] = a;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Instances
+// -----------------------------------------------------------------------------
+
+void scanl_host_plusf(const float *in, float *out, int N)
+{
+    scan_host< Plus<float>, float, false, true >(in, out, N);
+}
+
+void scanl1_host_plusf(const float *in, float *out, int N)
+{
+    scan_host< Plus<float>, float, false, false >(in, out, N);
+}
+
+void scanr_host_plusf(const float *in, float *out, int N)
+{
+    scan_host< Plus<float>, float, true, true >(in, out, N);
+}
+
+void scanr1_host_plusf(const float *in, float *out, int N)
+{
+    scan_host< Plus<float>, float, true, false >(in, out, N);
+}
+
+void scanl1_sequential_plusf(const float *in, float *out, int N)
+{
+    scan_sequential< Plus<float>, float, false, false >(in, out, N);
+}
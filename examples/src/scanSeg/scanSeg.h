@@ -0,0 +1,36 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : ScanSeg
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef __SCANSEG_H__
+#define __SCANSEG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Instances
+ */
+void scanlSeg_host_plusf(const float *in, const unsigned int *flags, float *out, int N);
+void scanl1Seg_host_plusf(const float *in, const unsigned int *flags, float *out, int N);
+void scanrSeg_host_plusf(const float *in, const unsigned int *flags, float *out, int N);
+void scanr1Seg_host_plusf(const float *in, const unsigned int *flags, float *out, int N);
+
+void scanl1Seg_sequential_plusf(const float *in, const unsigned int *flags, float *out, int N);
+
+/*
+ * Segment descriptors
+ */
+int  flags_to_offsets(const unsigned int *flags, unsigned int *offsets, int N);
+void offsets_to_flags(const unsigned int *offsets, int segments, unsigned int *flags, int N);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
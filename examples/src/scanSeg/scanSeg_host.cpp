@@ -0,0 +1,514 @@
+/* -----------------------------------------------------------------------------
+ *
+ * Module    : ScanSeg
+ * Copyright : (c) 2009 Trevor L. McDonell
+ * License   : BSD
+ *
+ * Host implementation of segmented scan, with the semantics of the cudpp
+ * segmented scan kernels: a non-zero head flag marks the first element of a
+ * segment, and each segment is scanned independently, from the left or
+ * (backward) from the right, inclusive or exclusive. The first element of the
+ * array always begins a segment, whatever its flag.
+ *
+ * The input is scanned in rounds of one block per thread, as for scan_host. In
+ * the first phase each thread reduces the part of its block which belongs to
+ * the segment spilling into the next block, and notes whether a segment starts
+ * within it. These are scanned in order to find the value carried into each
+ * block, and each block is then scanned again starting from its carry.
+ *
+ * Within a block, each vector of elements is scanned in registers, the flags
+ * stopping the shifts from crossing into the previous segment.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "scanSeg.h"
+
+#include "operator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+ * Inputs smaller than this are processed by the calling thread alone, and
+ * larger inputs are split into blocks of this many elements
+ */
+#define SCANSEG_SEQUENTIAL_ELTS (32 * 1024)
+#define SCANSEG_BLOCK_ELTS      (32 * 1024)
+
+
+/*
+ * The head flags of a vector of elements, as a mask of all ones for the lanes
+ * whose flag is set
+ */
+template <typename T>
+static inline typename simd<T>::index
+load_flags(const unsigned int *flags)
+{
+    typename simd<T>::index m;
+
+    if (sizeof(T) == sizeof(unsigned int))
+        memcpy(&m, flags, sizeof(m));
+    else
+        for (int i = 0; i < simd<T>::width; ++i)
+            m[i] = flags[i];
+
+    return m != 0;
+}
+
+
+/*
+ * Inclusive segmented scan of the lanes of a vector. On entry 'f' marks the
+ * lanes which may not combine with those before them in the direction of the
+ * scan; on return it marks the lanes at or after such a lane, which therefore
+ * can not combine with the value carried in from the previous vector.
+ */
+template <class op, typename T, bool backward, int k = 1, bool done = (k >= simd<T>::width)>
+struct ScanSegVector
+{
+    typedef typename simd<T>::type      V;
+    typedef typename simd<T>::index     I;
+    typedef typename rebind<op,V>::type vop;
+
+    static inline V apply(V v, I &f, const V &id)
+    {
+        const I none = {};
+
+        if (backward)
+        {
+            v = f ? v : vop::apply(v, simd_shift_down<k,T>(v, id));
+            f = f | simd_shift_down<k,T>(f, none);
+        }
+        else
+        {
+            v = f ? v : vop::apply(simd_shift_up<k,T>(v, id), v);
+            f = f | simd_shift_up<k,T>(f, none);
+        }
+
+        return ScanSegVector<op,T,backward,2*k>::apply(v, f, id);
+    }
+};
+
+template <class op, typename T, bool backward, int k>
+struct ScanSegVector<op,T,backward,k,true>
+{
+    static inline typename simd<T>::type
+    apply(const typename simd<T>::type &v, typename simd<T>::index &, const typename simd<T>::type &)
+    {
+        return v;
+    }
+};
+
+
+/*
+ * Segmented scan of a contiguous array starting from the given value, which
+ * is discarded if the first segment starts within the array. A backward scan
+ * also needs the flag of the element following the array (or one, at the end
+ * of the input). The input and output may be the same array.
+ */
+template <class op, typename T, bool backward, bool exclusive>
+static void
+scanSeg_chunk
+(
+    const T             *in,
+    const unsigned int  *flags,
+    T                   *out,
+    size_t              n,
+    T                   carry,
+    unsigned int        next
+)
+{
+    typedef typename simd<T>::type      V;
+    typedef typename simd<T>::index     I;
+    typedef typename rebind<op,V>::type vop;
+
+    const int w    = simd<T>::width;
+    const T   id   = op::identity();
+    const V   idv  = simd_splat<T>(id);
+    const I   none = {};
+    V         c    = simd_splat<T>(carry);
+    size_t    i;
+
+    if (!backward)
+    {
+        for (i = 0; i + w <= n; i += w)
+        {
+            I f = load_flags<T>(flags + i);
+            I g = f;
+            V s = ScanSegVector<op,T,false>::apply(simd_load(in + i), g, idv);
+            V o = g ? s : vop::apply(c, s);
+
+            simd_store(out + i, exclusive ? (f ? idv : simd_shift_up<1,T>(o, c)) : o);
+            c = simd_broadcast<simd<T>::width - 1, T>(o);
+        }
+
+        carry = c[0];
+        for (; i < n; ++i)
+        {
+            T x = in[i];
+            T y = flags[i] ? x : op::apply(carry, x);
+
+            out[i] = exclusive ? (flags[i] ? id : carry) : y;
+            carry  = y;
+        }
+    }
+    else
+    {
+        /*
+         * Scanning from the right, a segment ends at an element whose successor
+         * has its head flag set
+         */
+        for (i = n; i >= (size_t) w; i -= w)
+        {
+            I e = simd_shift_down<1,T>(load_flags<T>(flags + i - w), none - ((i < n ? flags[i] : next) != 0));
+            I g = e;
+            V s = ScanSegVector<op,T,true>::apply(simd_load(in + i - w), g, idv);
+            V o = g ? s : vop::apply(s, c);
+
+            simd_store(out + i - w, exclusive ? (e ? idv : simd_shift_down<1,T>(o, c)) : o);
+            c = simd_broadcast<0,T>(o);
+        }
+
+        carry = c[0];
+        while (i-- > 0)
+        {
+            bool e = (i + 1 < n ? flags[i+1] : next) != 0;
+            T    x = in[i];
+            T    y = e ? x : op::apply(x, carry);
+
+            out[i] = exclusive ? (e ? id : carry) : y;
+            carry  = y;
+        }
+    }
+}
+
+
+/*
+ * The first phase of a round. Each block records the reduction of the
+ * elements it carries into the next block in the direction of the scan, and
+ * whether that value starts afresh rather than continuing the carry into the
+ * block. Going forward this is the segment starting at the last head flag in
+ * the block; going backward, the elements before the first head flag after
+ * the start of the block.
+ */
+template <class op, typename T, bool backward>
+struct ScanSegReduceTask
+{
+    const T             *in;
+    const unsigned int  *flags;
+    size_t              n;
+    size_t              block;
+    unsigned int        next;
+    T                   *carry;
+    char                *closed;
+
+    void operator() (int b) const
+    {
+        size_t lo = b * block;
+        size_t hi = std::min(n, lo + block);
+        size_t h;
+
+        if (!backward)
+        {
+            for (h = hi; h > lo && !flags[h-1]; --h)
+                ;
+            closed[b] = h > lo;
+            h         = h > lo ? h-1 : lo;
+            carry[b]  = simd_reduce<op,T>(in + h, hi - h);
+        }
+        else
+        {
+            for (h = lo + 1; h < hi && !flags[h]; ++h)
+                ;
+            closed[b] = h < hi || (hi < n ? flags[hi] : next) != 0;
+            carry[b]  = simd_reduce<op,T>(in + lo, h - lo);
+        }
+    }
+};
+
+template <class op, typename T, bool backward, bool exclusive>
+struct ScanSegTask
+{
+    const T             *in;
+    const unsigned int  *flags;
+    T                   *out;
+    size_t              n;
+    size_t              block;
+    unsigned int        next;
+    const T             *carry;
+
+    void operator() (int b) const
+    {
+        size_t lo = b * block;
+        size_t hi = std::min(n, lo + block);
+
+        scanSeg_chunk<op,T,backward,exclusive>(in + lo, flags + lo, out + lo, hi - lo, carry[b], hi < n ? flags[hi] : next);
+    }
+};
+
+
+/*
+ * Segmented scan of an array with a binary operator, with the segments given
+ * by head flags. As the blocks are reduced out of order, the operator must be
+ * commutative.
+ */
+template <class op, typename T, bool backward, bool exclusive>
+void
+scanSeg_host
+(
+    const T             *in,
+    const unsigned int  *flags,
+    T                   *out,
+    int                 length
+)
+{
+    if (length <= 0)
+        return;
+
+    const size_t threads = parallel_threads();
+    const size_t n       = length;
+
+    if (threads == 1 || n <= SCANSEG_SEQUENTIAL_ELTS)
+    {
+        scanSeg_chunk<op,T,backward,exclusive>(in, flags, out, n, op::identity(), 1);
+        return;
+    }
+
+    const size_t      block  = SCANSEG_BLOCK_ELTS;
+    const size_t      round  = block * threads;
+    const size_t      rounds = (n + round - 1) / round;
+    T                 total  = op::identity();
+    std::vector<T>    carry(threads);
+    std::vector<char> closed(threads);
+
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        size_t       lo   = (backward ? rounds - 1 - r : r) * round;
+        size_t       m    = std::min(n - lo, round);
+        int          nb   = (m + block - 1) / block;
+        unsigned int next = lo + m < n ? flags[lo + m] : 1;
+
+        ScanSegReduceTask<op,T,backward>         reduce = { in + lo, flags + lo, m, block, next, &carry[0], &closed[0] };
+        ScanSegTask<op,T,backward,exclusive>     scan   = { in + lo, flags + lo, out + lo, m, block, next, &carry[0] };
+
+        parallel_for(nb, reduce);
+
+        if (!backward)
+        {
+            for (int b = 0; b < nb; ++b)
+            {
+                T x      = carry[b];
+                carry[b] = total;
+                total    = closed[b] ? x : op::apply(total, x);
+            }
+        }
+        else
+        {
+            for (int b = nb-1; b >= 0; --b)
+            {
+                T x      = carry[b];
+                carry[b] = total;
+                total    = closed[b] ? x : op::apply(x, total);
+            }
+        }
+
+        parallel_for(nb, scan);
+    }
+}
+
+
+/*
+ * The obvious loop, for comparison
+ */
+template <class op, typename T>
+void
+scanSeg_sequential
+(
+    const T             *in,
+    const unsigned int  *flags,
+    T                   *out,
+    int                 length
+)
+{
+    T a = op::identity();
+
+    for (int i = 0; i < length; ++i)
+    {
+        a      = flags[i] ? in[i] : op::apply(a, in[i]);
+        out[i] = a;
+    }
+}
+
+
+/* -----------------------------------------------------------------------------
+ * Segment descriptors
+ * ---------------------------------------------------------------------------*/
+
+/*
+ * Count the segments starting in a range of the head flags, and then write
+ * their offsets
+ */
+struct CountHeadsTask
+{
+    const unsigned int  *flags;
+    size_t              n;
+    size_t              chunk;
+    unsigned int        *count;
+
+    void operator() (int t) const
+    {
+        typedef simd<unsigned int>::index I;
+
+        const int    w  = simd<unsigned int>::width;
+        size_t       lo = t * chunk;
+        size_t       hi = std::min(n, lo + chunk);
+        size_t       i  = lo;
+        I            a  = {};
+        unsigned int r  = (lo == 0 && !flags[0]) ? 1 : 0;
+
+        for (; i + w <= hi; i += w)
+            a -= simd_load(flags + i) != 0;
+        for (int k = 0; k < w; ++k)
+            r += a[k];
+        for (; i < hi; ++i)
+            r += flags[i] != 0;
+
+        count[t] = r;
+    }
+};
+
+struct WriteOffsetsTask
+{
+    const unsigned int  *flags;
+    size_t              n;
+    size_t              chunk;
+    const unsigned int  *start;
+    unsigned int        *offsets;
+
+    void operator() (int t) const
+    {
+        size_t        lo = t * chunk;
+        size_t        hi = std::min(n, lo + chunk);
+        unsigned int *p  = offsets + start[t];
+
+        for (size_t i = lo; i < hi; ++i)
+            if (flags[i] || i == 0)
+                *p++ = i;
+    }
+};
+
+struct WriteFlagsTask
+{
+    const unsigned int  *offsets;
+    size_t              segments;
+    size_t              n;
+    size_t              chunk;
+    unsigned int        *flags;
+
+    void operator() (int t) const
+    {
+        size_t              lo = t * chunk;
+        size_t              hi = std::min(n, lo + chunk);
+        const unsigned int *p  = std::lower_bound(offsets, offsets + segments, lo);
+
+        memset(flags + lo, 0, (hi - lo) * sizeof(unsigned int));
+        for (; p < offsets + segments && *p < hi; ++p)
+            flags[*p] = 1;
+    }
+};
+
+
+/*
+ * Convert head flags into the offset of the start of each segment, returning
+ * the number of segments. The offsets array must have room for one per
+ * element.
+ */
+int
+flags_to_offsets
+(
+    const unsigned int  *flags,
+    unsigned int        *offsets,
+    int                 length
+)
+{
+    if (length <= 0)
+        return 0;
+
+    const size_t n      = length;
+    const size_t chunk  = std::max<size_t>(SCANSEG_BLOCK_ELTS, (n + 4*parallel_threads() - 1) / (4*parallel_threads()));
+    const int    chunks = (n + chunk - 1) / chunk;
+
+    std::vector<unsigned int> start(chunks);
+    CountHeadsTask            count = { flags, n, chunk, &start[0] };
+
+    parallel_for(chunks, count);
+
+    unsigned int total = 0;
+    for (int t = 0; t < chunks; ++t)
+    {
+        unsigned int x = start[t];
+        start[t] = total;
+        total   += x;
+    }
+
+    WriteOffsetsTask write = { flags, n, chunk, &start[0], offsets };
+    parallel_for(chunks, write);
+
+    return total;
+}
+
+
+/*
+ * Convert the (ascending) offsets of each segment into head flags. Empty
+ * segments are lost, as they have no element to carry their flag.
+ */
+void
+offsets_to_flags
+(
+    const unsigned int  *offsets,
+    int                 segments,
+    unsigned int        *flags,
+    int                 length
+)
+{
+    if (length <= 0)
+        return;
+
+    const size_t   n      = length;
+    const size_t   chunk  = std::max<size_t>(SCANSEG_BLOCK_ELTS, (n + 4*parallel_threads() - 1) / (4*parallel_threads()));
+    const int      chunks = (n + chunk - 1) / chunk;
+    WriteFlagsTask write  = { offsets, (size_t) std::max(segments, 0), n, chunk, flags };
+
+    parallel_for(chunks, write);
+}
+
+
+// -----------------------------------------------------------------------------
+// Instances
+// -----------------------------------------------------------------------------
+
+void scanlSeg_host_plusf(const float *in, const unsigned int *flags, float *out, int N)
+{
+    scanSeg_host< Plus<float>, float, false, true >(in, flags, out, N);
+}
+
+void scanl1Seg_host_plusf(const float *in, const unsigned int *flags, float *out, int N)
+{
+    scanSeg_host< Plus<float>, float, false, false >(in, flags, out, N);
+}
+
+void scanrSeg_host_plusf(const float *in, const unsigned int *flags, float *out, int N)
+{
+    scanSeg_host< Plus<float>, float, true, true >(in, flags, out, N);
+}
+
+void scanr1Seg_host_plusf(const float *in, const unsigned int *flags, float *out, int N)
+{
+    scanSeg_host< Plus<float>, float, true, false >(in, flags, out, N);
+}
+
+void scanl1Seg_sequential_plusf(const float *in, const unsigned int *flags, float *out, int N)
+{
+    scanSeg_sequential< Plus<float> >(in, flags, out, N);
+}
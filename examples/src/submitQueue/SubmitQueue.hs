@@ -0,0 +1,98 @@
+--------------------------------------------------------------------------------
+--
+-- Module    : SubmitQueue
+-- Copyright : (c) 2009 Trevor L. McDonell
+-- License   : BSD
+--
+-- Throughput of many threads issuing small driver operations, either
+-- directly (making the context current around each call) or through a
+-- single driver thread.
+--
+--------------------------------------------------------------------------------
+
+module Main where
+
+-- Friends
+import Benchmark
+
+-- System
+import Numeric
+import Control.Monad
+import Control.Concurrent
+import Control.Exception
+import Data.Word
+import System.Environment
+
+import qualified Foreign.CUDA.Driver            as CUDA
+import qualified Foreign.CUDA.Driver.Future     as Future
+import qualified Foreign.CUDA.Driver.Submission as Submission
+
+
+--------------------------------------------------------------------------------
+-- Benchmarks
+--------------------------------------------------------------------------------
+
+-- Run the action concurrently on the given number of bound threads, each
+-- performing an equal share of the operations, returning the median time.
+--
+concurrently :: String -> Int -> Int -> (Int -> IO ()) -> IO Double
+concurrently name threads ops action = do
+  (r,_) <- benchmarkWith defaultConfig { configSamples = 10 } name run (return ())
+  return (resultMedian r)
+  where
+    run = do
+      done <- replicateM threads newEmptyMVar
+      forM_ done $ \m -> forkOS (action (ops `div` threads) `finally` putMVar m ())
+      mapM_ takeMVar done
+
+
+-- Each thread makes the context current around every call, as is required
+-- when a Haskell thread may be scheduled on any OS thread.
+--
+direct :: CUDA.Context -> CUDA.DevicePtr Word32 -> Int -> IO ()
+direct ctx dptr n =
+  replicateM_ n $
+    bracket_ (CUDA.push ctx) CUDA.pop (CUDA.memsetAsync dptr 1 0 Nothing)
+
+
+-- Each thread submits its operations to the driver thread, then waits for
+-- the last of them to be issued.
+--
+submitted :: Submission.Submitter -> CUDA.DevicePtr Word32 -> Int -> IO ()
+submitted s dptr n = do
+  fs <- replicateM n (Submission.memsetAsync s dptr 1 0 Nothing)
+  mapM_ Future.await fs
+
+
+--------------------------------------------------------------------------------
+-- Main
+--------------------------------------------------------------------------------
+
+main :: IO ()
+main = withResults $ do
+  args <- getArgs
+  let ops = case args of
+              [n] -> read n
+              _   -> 64 * 1024
+
+  CUDA.initialise []
+  dev  <- CUDA.device 0
+  ctx  <- CUDA.create dev []
+  dptr <- CUDA.mallocArray 1
+  _    <- CUDA.pop
+  sub  <- Submission.new ctx
+
+  putStrLn $ "operations: " ++ show ops
+  putStrLn "threads      direct (ops/s)    submitted (ops/s)"
+  forM_ [1, 8, 64] $ \threads -> do
+    t1 <- concurrently ("submitQueue/direct/"    ++ show threads) threads ops (direct ctx dptr)
+    t2 <- concurrently ("submitQueue/submitted/" ++ show threads) threads ops (submitted sub dptr)
+    let rate t = showFFloat (Just 0) (fromIntegral ops / t) ""
+    putStrLn $ pad 7 (show threads) ++ pad 20 (rate t1) ++ pad 21 (rate t2)
+
+  Submission.destroy sub
+  CUDA.push ctx
+  CUDA.free dptr
+  CUDA.destroy ctx
+  where
+    pad n s = replicate (n - length s) ' ' ++ s
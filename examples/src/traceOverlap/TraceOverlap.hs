@@ -0,0 +1,35 @@
+module Main where
+
+import Control.Monad
+import System.Environment
+import System.Exit
+import Text.Printf
+
+import Foreign.CUDA.Driver.Trace                        ( readRecords )
+import Foreign.CUDA.Driver.Trace.Overlap
+
+
+-- Analyse the overlap of copies and kernels in a trace written with
+-- 'Foreign.CUDA.Driver.Trace.writeRecords'. The number of copy engines is
+-- the 'asyncEngineCount' of the device the trace was recorded on (see
+-- nvidia-device-query).
+--
+main :: IO ()
+main = do
+  args <- getArgs
+  (file, engines, gap) <- case args of
+    [f]       -> return (f, 2, 10)
+    [f, e]    -> return (f, read e, 10)
+    [f, e, g] -> return (f, read e, read g)
+    _         -> do
+      name <- getProgName
+      printf "usage: %s TRACE [COPY_ENGINES=2] [MIN_GAP_US=10]\n" name
+      exitFailure
+
+  records <- readRecords file
+  when (null records) $ do
+    printf "%s: no records\n" file
+    exitFailure
+
+  let analysis = analyse engines (round (gap * 1000 :: Double)) records
+  putStr (render 5 analysis)
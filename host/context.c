@@ -0,0 +1,367 @@
+/*
+ * Host execution backend: context management
+ *
+ * Each thread has its own stack of current contexts. A context owns its
+ * streams, including the NULL stream, which is embedded in it.
+ */
+
+#include "host.h"
+
+#include <stdlib.h>
+
+#define MAX_CONTEXT_DEPTH       16
+
+static __thread hs_host_context *hs_host_contexts[MAX_CONTEXT_DEPTH];
+static __thread int              hs_host_depth;
+
+#if CUDA_VERSION >= 7000
+static hs_host_context          *hs_host_primary;
+static int                       hs_host_primary_refs;
+static unsigned int              hs_host_primary_flags;
+#endif
+
+
+hs_host_context* hs_host_current(void)
+{
+    return hs_host_depth > 0 ? hs_host_contexts[hs_host_depth-1] : NULL;
+}
+
+/*
+ * Block until every stream of the context is idle. A stream with no pending
+ * operations may still be in the ready queue or held by a worker, so it is
+ * idle only once it is no longer active.
+ */
+void hs_host_context_wait(hs_host_context *ctx)
+{
+    hs_host_stream *s;
+
+    pthread_mutex_lock(&hs_host.lock);
+again:
+    for (s = &ctx->null_stream; s != NULL; s = (s == &ctx->null_stream ? ctx->streams : s->next)) {
+        if (s->head != NULL || s->active) {
+            pthread_cond_wait(&hs_host.done, &hs_host.lock);
+            goto again;
+        }
+    }
+    pthread_mutex_unlock(&hs_host.lock);
+}
+
+static hs_host_context* hs_host_context_new(unsigned int flags)
+{
+    hs_host_context *ctx = calloc(1, sizeof(hs_host_context));
+
+    if (ctx != NULL) {
+        ctx->flags                              = flags;
+        ctx->limits[CU_LIMIT_STACK_SIZE]        = 1024;
+        ctx->limits[CU_LIMIT_PRINTF_FIFO_SIZE]  = 1 << 20;
+        ctx->limits[CU_LIMIT_MALLOC_HEAP_SIZE]  = 8 << 20;
+        hs_host_stream_init(&ctx->null_stream, ctx, 0, 0);
+    }
+    return ctx;
+}
+
+static void hs_host_context_free(hs_host_context *ctx)
+{
+    hs_host_stream *s, *next;
+
+    hs_host_context_wait(ctx);
+    for (s = ctx->streams; s != NULL; s = next) {
+        next = s->next;
+        free(s);
+    }
+    free(ctx);
+}
+
+
+CUresult CUDAAPI cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
+{
+    hs_host_context *ctx;
+
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+    if (hs_host_depth == MAX_CONTEXT_DEPTH)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    ctx = hs_host_context_new(flags);
+    if (ctx == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    hs_host_contexts[hs_host_depth++] = ctx;
+    *pctx = (CUcontext) ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxDestroy(CUcontext ctx)
+{
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    if (hs_host_depth > 0 && hs_host_contexts[hs_host_depth-1] == (hs_host_context*) ctx)
+        --hs_host_depth;
+
+    hs_host_context_free((hs_host_context*) ctx);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPushCurrent(CUcontext ctx)
+{
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (hs_host_depth == MAX_CONTEXT_DEPTH)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    hs_host_contexts[hs_host_depth++] = (hs_host_context*) ctx;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxPopCurrent(CUcontext *pctx)
+{
+    HS_HOST_CHECK_INIT();
+    if (hs_host_depth == 0)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    --hs_host_depth;
+    if (pctx != NULL)
+        *pctx = (CUcontext) hs_host_contexts[hs_host_depth];
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetCurrent(CUcontext *pctx)
+{
+    HS_HOST_CHECK_INIT();
+    *pctx = (CUcontext) hs_host_current();
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSetCurrent(CUcontext ctx)
+{
+    HS_HOST_CHECK_INIT();
+    if (hs_host_depth == 0) {
+        if (ctx != NULL)
+            hs_host_contexts[hs_host_depth++] = (hs_host_context*) ctx;
+    }
+    else if (ctx == NULL)
+        --hs_host_depth;
+    else
+        hs_host_contexts[hs_host_depth-1] = (hs_host_context*) ctx;
+
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetDevice(CUdevice *device)
+{
+    HS_HOST_CHECK_INIT();
+    if (hs_host_current() == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    *device = 0;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetFlags(unsigned int *flags)
+{
+    hs_host_context *ctx = hs_host_current();
+
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    *flags = ctx->flags;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSynchronize(void)
+{
+    hs_host_context *ctx = hs_host_current();
+
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    hs_host_context_wait(ctx);
+    return CUDA_SUCCESS;
+}
+
+
+/* Limits and configuration, which are recorded but have no effect */
+
+CUresult CUDAAPI cuCtxSetLimit(CUlimit limit, size_t value)
+{
+    hs_host_context *ctx = hs_host_current();
+
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if ((unsigned int) limit >= sizeof(ctx->limits) / sizeof(ctx->limits[0]))
+        return CUDA_ERROR_UNSUPPORTED_LIMIT;
+
+    ctx->limits[limit] = value;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetLimit(size_t *value, CUlimit limit)
+{
+    hs_host_context *ctx = hs_host_current();
+
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if ((unsigned int) limit >= sizeof(ctx->limits) / sizeof(ctx->limits[0]))
+        return CUDA_ERROR_UNSUPPORTED_LIMIT;
+
+    *value = ctx->limits[limit];
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxGetCacheConfig(CUfunc_cache *config)
+{
+    HS_HOST_CHECK_INIT();
+    *config = CU_FUNC_CACHE_PREFER_NONE;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSetCacheConfig(CUfunc_cache config)
+{
+    (void) config;
+    HS_HOST_CHECK_INIT();
+    return CUDA_SUCCESS;
+}
+
+#if CUDA_VERSION >= 4020
+CUresult CUDAAPI cuCtxGetSharedMemConfig(CUsharedconfig *config)
+{
+    HS_HOST_CHECK_INIT();
+    *config = CU_SHARED_MEM_CONFIG_DEFAULT_BANK_SIZE;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuCtxSetSharedMemConfig(CUsharedconfig config)
+{
+    (void) config;
+    HS_HOST_CHECK_INIT();
+    return CUDA_SUCCESS;
+}
+#endif
+
+#if CUDA_VERSION >= 5050
+CUresult CUDAAPI cuCtxGetStreamPriorityRange(int *least, int *greatest)
+{
+    HS_HOST_CHECK_INIT();
+    if (least != NULL)
+        *least = 0;
+    if (greatest != NULL)
+        *greatest = 0;
+    return CUDA_SUCCESS;
+}
+#endif
+
+
+/* Peer access; there is only one device */
+
+CUresult CUDAAPI cuCtxEnablePeerAccess(CUcontext peer, unsigned int flags)
+{
+    (void) peer;
+    (void) flags;
+    HS_HOST_CHECK_INIT();
+    return CUDA_ERROR_INVALID_DEVICE;
+}
+
+CUresult CUDAAPI cuCtxDisablePeerAccess(CUcontext peer)
+{
+    (void) peer;
+    HS_HOST_CHECK_INIT();
+    return CUDA_ERROR_PEER_ACCESS_NOT_ENABLED;
+}
+
+
+/* The primary context, created on first use and shared by every thread */
+
+#if CUDA_VERSION >= 7000
+CUresult CUDAAPI cuDevicePrimaryCtxRetain(CUcontext *pctx, CUdevice dev)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    if (hs_host_primary == NULL)
+        hs_host_primary = hs_host_context_new(hs_host_primary_flags);
+    if (hs_host_primary != NULL)
+        ++hs_host_primary_refs;
+    *pctx = (CUcontext) hs_host_primary;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    return *pctx != NULL ? CUDA_SUCCESS : CUDA_ERROR_OUT_OF_MEMORY;
+}
+
+CUresult CUDAAPI cuDevicePrimaryCtxRelease(CUdevice dev)
+{
+    hs_host_context *ctx = NULL;
+
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    if (hs_host_primary_refs == 0) {
+        pthread_mutex_unlock(&hs_host.lock);
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    if (--hs_host_primary_refs == 0) {
+        ctx             = hs_host_primary;
+        hs_host_primary = NULL;
+    }
+    pthread_mutex_unlock(&hs_host.lock);
+
+    if (ctx != NULL)
+        hs_host_context_free(ctx);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDevicePrimaryCtxSetFlags(CUdevice dev, unsigned int flags)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    hs_host_primary_flags = flags;
+    pthread_mutex_unlock(&hs_host.lock);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDevicePrimaryCtxGetState(CUdevice dev, unsigned int *flags, int *active)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    *flags  = hs_host_primary_flags;
+    *active = hs_host_primary != NULL;
+    pthread_mutex_unlock(&hs_host.lock);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDevicePrimaryCtxReset(CUdevice dev)
+{
+    hs_host_context *ctx;
+
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    ctx                  = hs_host_primary;
+    hs_host_primary      = NULL;
+    hs_host_primary_refs = 0;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    if (ctx != NULL)
+        hs_host_context_free(ctx);
+    return CUDA_SUCCESS;
+}
+#endif
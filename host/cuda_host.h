@@ -0,0 +1,85 @@
+/*
+ * Kernels for the host execution backend
+ *
+ * The host backend (see host.h) implements the driver API on the CPU, so a
+ * kernel must be compiled for the host, as a function in a shared object,
+ * rather than to PTX. The shared object is loaded as a module, either from
+ * its path with cuModuleLoad or from its contents with cuModuleLoadData, and
+ * kernels are found by name with cuModuleGetFunction as usual.
+ *
+ * A kernel is called once for each thread block of the grid, and runs every
+ * thread of that block itself, typically as a loop over the thread indices:
+ *
+ *   HS_HOST_PARAMS(vector_add, sizeof(float*), sizeof(float*), sizeof(float*), sizeof(int));
+ *
+ *   HS_HOST_KERNEL(vector_add)
+ *   {
+ *       const float *xs = HS_HOST_PARAM(0, const float*);
+ *       const float *ys = HS_HOST_PARAM(1, const float*);
+ *       float       *zs = HS_HOST_PARAM(2, float*);
+ *       int          n  = HS_HOST_PARAM(3, int);
+ *       unsigned int t;
+ *
+ *       for (t = 0; t < block->blockDim.x; ++t) {
+ *           int i = block->blockIdx.x * block->blockDim.x + t;
+ *           if (i < n)
+ *               zs[i] = xs[i] + ys[i];
+ *       }
+ *   }
+ *
+ * A barrier (__syncthreads) is written by splitting the block into one loop
+ * over the threads for each phase, with values which live across the barrier
+ * kept in the block's shared memory or in arrays indexed by thread. Blocks of
+ * the same grid run concurrently on different worker threads, so atomic
+ * updates of global memory must use atomic operations.
+ *
+ * The parameter table HS_HOST_PARAMS gives the size of each parameter of the
+ * kernel. It is optional, but without it the backend can not copy the
+ * parameters of a launch, and so cuLaunchKernel does not return until the
+ * kernel has completed. Launches with the parameters packed into a single
+ * buffer (CU_LAUNCH_PARAM_BUFFER_POINTER, used by launchKernel') are always
+ * asynchronous; the buffer is available as 'args', and with a table it is
+ * also unpacked into 'params', assuming the parameters are packed in order
+ * without padding, as the bindings do.
+ */
+
+#ifndef HS_CUDA_HOST_H
+#define HS_CUDA_HOST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+#define HS_HOST_EXTERN  extern "C"
+#else
+#define HS_HOST_EXTERN
+#endif
+
+typedef struct {
+    unsigned int x, y, z;
+} hs_dim3;
+
+typedef struct {
+    hs_dim3      gridDim;
+    hs_dim3      blockDim;
+    hs_dim3      blockIdx;
+    void        *shared;        /* dynamic shared memory of the launch, at least 64-byte aligned */
+    const void  *args;          /* the packed parameter buffer, or NULL */
+} hs_block;
+
+typedef void (*hs_host_kernel)(const hs_block *block, void **params);
+
+/*
+ * Define a kernel, and the sizes of its parameters
+ */
+#define HS_HOST_KERNEL(name) \
+    HS_HOST_EXTERN void name(const hs_block *block, void **params)
+
+#define HS_HOST_PARAMS(name, ...) \
+    HS_HOST_EXTERN const size_t hs_params_##name[] = { __VA_ARGS__, 0 }
+
+/*
+ * The value of the i-th parameter of the kernel
+ */
+#define HS_HOST_PARAM(i, type)  (*(type*) params[i])
+
+#endif
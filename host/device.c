@@ -0,0 +1,116 @@
+/*
+ * Host execution backend: initialisation and device management
+ *
+ * There is a single device, which is the host. It reports the limits of a
+ * compute capability 3.0 device, so that launch configurations computed for
+ * a GPU remain valid, with one multiprocessor for each worker thread.
+ */
+
+#include "host.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+CUresult CUDAAPI cuInit(unsigned int flags)
+{
+    if (flags != 0)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    return hs_host_start() ? CUDA_SUCCESS : CUDA_ERROR_NO_DEVICE;
+}
+
+CUresult CUDAAPI cuDriverGetVersion(int *version)
+{
+    if (version == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    *version = CUDA_VERSION;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGet(CUdevice *device, int ordinal)
+{
+    HS_HOST_CHECK_INIT();
+    if (ordinal != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    *device = 0;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetCount(int *count)
+{
+    HS_HOST_CHECK_INIT();
+    *count = 1;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetName(char *name, int len, CUdevice dev)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+    if (name == NULL || len <= 0)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    snprintf(name, len, "Host (%d threads)", hs_host.workers);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceTotalMem(size_t *bytes, CUdevice dev)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    *bytes = (size_t) sysconf(_SC_PHYS_PAGES) * (size_t) sysconf(_SC_PAGESIZE);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceGetAttribute(int *value, CUdevice_attribute attrib, CUdevice dev)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    switch (attrib) {
+        case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR:      *value = 3;                 break;
+        case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR:      *value = 0;                 break;
+        case CU_DEVICE_ATTRIBUTE_WARP_SIZE:                     *value = 32;                break;
+        case CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK:         *value = 1024;              break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_X:               *value = 1024;              break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Y:               *value = 1024;              break;
+        case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Z:               *value = 64;                break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_X:                *value = 2147483647;        break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Y:                *value = 65535;             break;
+        case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Z:                *value = 65535;             break;
+        case CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_BLOCK:   *value = 48 * 1024;         break;
+        case CU_DEVICE_ATTRIBUTE_TOTAL_CONSTANT_MEMORY:         *value = 64 * 1024;         break;
+        case CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_BLOCK:       *value = 65536;             break;
+        case CU_DEVICE_ATTRIBUTE_MAX_PITCH:                     *value = 2147483647;        break;
+        case CU_DEVICE_ATTRIBUTE_TEXTURE_ALIGNMENT:             *value = 512;               break;
+        case CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT:          *value = hs_host.workers;   break;
+        case CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR:*value = 2048;              break;
+        case CU_DEVICE_ATTRIBUTE_ASYNC_ENGINE_COUNT:            *value = 2;                 break;
+        case CU_DEVICE_ATTRIBUTE_INTEGRATED:                    *value = 1;                 break;
+        case CU_DEVICE_ATTRIBUTE_CAN_MAP_HOST_MEMORY:           *value = 1;                 break;
+        case CU_DEVICE_ATTRIBUTE_CONCURRENT_KERNELS:            *value = 1;                 break;
+        case CU_DEVICE_ATTRIBUTE_UNIFIED_ADDRESSING:            *value = 1;                 break;
+#if CUDA_VERSION >= 6000
+        case CU_DEVICE_ATTRIBUTE_MANAGED_MEMORY:                *value = 1;                 break;
+#endif
+        default:                                                *value = 0;                 break;
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuDeviceCanAccessPeer(int *canAccessPeer, CUdevice dev, CUdevice peerDev)
+{
+    HS_HOST_CHECK_INIT();
+    if (dev != 0 || peerDev != 0)
+        return CUDA_ERROR_INVALID_DEVICE;
+
+    *canAccessPeer = 0;
+    return CUDA_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/*
+ * Host execution backend for the CUDA driver API
+ *
+ * A replacement for the driver library, libcuda.so.1, which implements the
+ * subset of the driver API used by the bindings on the CPU, so that programs
+ * can run on machines without a GPU. There is a single device, whose memory is
+ * host memory; device pointers are host addresses.
+ *
+ * All work is done by a fixed pool of worker threads. Each stream is an
+ * ordered queue of operations, which is scheduled onto a worker whenever it
+ * has work and is not already running, so operations of different streams
+ * overlap while those of a stream execute in order. A kernel launch publishes
+ * its grid to every worker, which then execute its blocks in parallel (see
+ * launch.c), and the stream continues once the last block has completed.
+ *
+ * The scheduling state is protected by a single lock. It is only held while
+ * queues are changed, never while an operation executes.
+ *
+ * Not provided are texture references and objects, arrays, IPC, the JIT
+ * linker (cuLink*), the profiler controls, cuMemGetAddressRange, the launch
+ * API which preceded cuLaunchKernel (cuParamSet*, cuFuncSetBlockShape,
+ * cuLaunchGridAsync and so on), and the deprecated cuCtxAttach, cuCtxDetach,
+ * cuDeviceComputeCapability and cuDeviceGetProperties. The bindings find no
+ * such entry point in this library, so calling one of them returns
+ * CUDA_ERROR_NOT_FOUND (see cbits/driver.c).
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <cuda.h>
+#include "cuda_host.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct hs_host_context  hs_host_context;
+typedef struct hs_host_stream   hs_host_stream;
+typedef struct hs_host_event    hs_host_event;
+typedef struct hs_host_op       hs_host_op;
+typedef struct hs_host_grid     hs_host_grid;
+
+
+/*
+ * An operation of a stream
+ */
+enum {
+    HS_HOST_COPY,
+    HS_HOST_SET,
+    HS_HOST_RECORD,
+    HS_HOST_WAIT,
+    HS_HOST_LAUNCH
+};
+
+struct hs_host_op {
+    int                 kind;
+    hs_host_op         *next;
+    union {
+        struct { void *dst; const void *src; size_t bytes, rows, dpitch, spitch; } copy;
+        struct { void *dst; unsigned int value; size_t count; int width; }      set;
+        struct { hs_host_event *event; unsigned long long target; }             event;
+        hs_host_grid                                                           *grid;
+    } u;
+};
+
+struct hs_host_stream {
+    hs_host_context    *ctx;
+    unsigned int        flags;
+    int                 priority;
+    hs_host_op         *head, *tail;        /* pending operations; the head is removed once complete */
+    int                 active;             /* queued, running, or waiting on an event or grid */
+    int                 destroyed;          /* free once idle */
+    hs_host_stream     *next;               /* in the context's list of streams */
+    hs_host_stream     *link;               /* in the ready queue, or an event's list of waiters */
+};
+
+struct hs_host_context {
+    unsigned int        flags;
+    hs_host_stream      null_stream;
+    hs_host_stream     *streams;
+    size_t              limits[8];
+};
+
+struct hs_host_event {
+    unsigned int        flags;
+    int                 refs;               /* the handle, and each pending operation */
+    unsigned long long  recorded;           /* generation of the most recently enqueued record */
+    unsigned long long  completed;          /* ... and of the most recently executed */
+    unsigned long long  time;               /* when it was executed, in nanoseconds */
+    hs_host_stream     *waiters;
+};
+
+
+/*
+ * Shared scheduling state
+ */
+struct hs_host_state {
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;               /* a stream or grid is ready */
+    pthread_cond_t      done;               /* an operation has completed */
+    int                 workers;            /* zero until cuInit */
+    hs_host_stream     *ready_head, *ready_tail;
+    hs_host_grid       *grids;              /* grids with blocks yet to be claimed */
+};
+
+extern struct hs_host_state hs_host;
+
+#define HS_HOST_CHECK_INIT()                                    \
+    do {                                                        \
+        if (hs_host.workers == 0)                               \
+            return CUDA_ERROR_NOT_INITIALIZED;                  \
+    } while (0)
+
+
+/* context.c */
+hs_host_context*    hs_host_current(void);
+void                hs_host_context_wait(hs_host_context *ctx);
+
+/* stream.c */
+hs_host_stream*     hs_host_stream_get(CUstream stream);
+hs_host_op*         hs_host_op_new(int kind);
+void                hs_host_enqueue(hs_host_stream *s, hs_host_op *op);
+void                hs_host_stream_wait(hs_host_stream *s);
+void                hs_host_stream_ready(hs_host_stream *s);
+void                hs_host_stream_run(hs_host_stream *s);
+void                hs_host_stream_init(hs_host_stream *s, hs_host_context *ctx, unsigned int flags, int priority);
+void                hs_host_op_complete(hs_host_stream *s);
+
+/* launch.c */
+int                 hs_host_start(void);
+void                hs_host_grid_publish(hs_host_grid *g, hs_host_stream *s);
+
+#endif
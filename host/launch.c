@@ -0,0 +1,658 @@
+/*
+ * Host execution backend: modules, kernel launch, and the worker pool
+ *
+ * A module is a shared object of kernels compiled for the host (see
+ * cuda_host.h). Launching a kernel creates a grid, which is published to every
+ * worker once its stream reaches it. The blocks of the grid are split into
+ * one contiguous range per worker. Each worker executes blocks from the front
+ * of its own range, so consecutive blocks, which typically touch neighbouring
+ * memory, run on the same core. A worker whose range is empty steals the back
+ * half of the range of another, so the load stays balanced when blocks take
+ * different amounts of time or some workers are busy with other streams.
+ */
+
+#define _GNU_SOURCE
+#include "host.h"
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_LINE              64
+#define MAX_SHARED_MEMORY       (48 * 1024)
+
+
+typedef struct hs_host_function hs_host_function;
+
+typedef struct {
+    void               *handle;
+    hs_host_function   *functions;
+} hs_host_module;
+
+struct hs_host_function {
+    hs_host_kernel      kernel;
+    const size_t       *sizes;              /* parameter sizes, zero terminated, or NULL */
+    size_t              count;              /* ... the number of parameters */
+    size_t              bytes;              /* ... and their total size */
+    char               *name;
+    hs_host_function   *next;
+};
+
+/*
+ * The blocks of a grid which a worker has yet to claim
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    size_t              lo, hi;
+} __attribute__((aligned(CACHE_LINE))) hs_host_range;
+
+struct hs_host_grid {
+    hs_host_kernel      kernel;
+    hs_dim3             grid, block;
+    size_t              blocks;
+    unsigned int        shared;
+    void              **params;
+    const void         *args;
+    void               *storage;            /* the copied parameters */
+    hs_host_range      *ranges;             /* one for each worker */
+    size_t              remaining;          /* blocks yet to complete, updated atomically */
+    int                 users;              /* workers executing the grid */
+    int                 listed;             /* in hs_host.grids */
+    int                 finished;
+    int                 waited;             /* freed by the launching thread */
+    hs_host_stream     *stream;
+    hs_host_grid       *next;
+};
+
+
+/*
+ * Grids
+ */
+
+static hs_host_grid* hs_host_grid_new(size_t storage)
+{
+    hs_host_grid *g = calloc(1, sizeof(hs_host_grid));
+    int i;
+
+    if (g == NULL)
+        return NULL;
+
+    if (posix_memalign((void**) &g->ranges, CACHE_LINE, hs_host.workers * sizeof(hs_host_range)) != 0) {
+        free(g);
+        return NULL;
+    }
+    if (storage > 0 && (g->storage = malloc(storage)) == NULL) {
+        free(g->ranges);
+        free(g);
+        return NULL;
+    }
+    for (i = 0; i < hs_host.workers; ++i)
+        pthread_mutex_init(&g->ranges[i].lock, NULL);
+
+    return g;
+}
+
+static void hs_host_grid_free(hs_host_grid *g)
+{
+    int i;
+
+    for (i = 0; i < hs_host.workers; ++i)
+        pthread_mutex_destroy(&g->ranges[i].lock);
+    free(g->ranges);
+    free(g->storage);
+    free(g);
+}
+
+/*
+ * Make the grid available to the workers; called with the lock held
+ */
+void hs_host_grid_publish(hs_host_grid *g, hs_host_stream *s)
+{
+    hs_host_grid **p;
+
+    g->stream = s;
+    g->listed = 1;
+    for (p = &hs_host.grids; *p != NULL; p = &(*p)->next)
+        ;
+    *p = g;
+
+    pthread_cond_broadcast(&hs_host.work);
+}
+
+static void hs_host_grid_complete(hs_host_grid *g)
+{
+    pthread_mutex_lock(&hs_host.lock);
+    g->finished = 1;
+    hs_host_op_complete(g->stream);
+    pthread_cond_broadcast(&hs_host.done);
+    pthread_mutex_unlock(&hs_host.lock);
+}
+
+
+/*
+ * Claim the next block of a worker's own range
+ */
+static int hs_host_take(hs_host_range *r, size_t *block)
+{
+    int ok;
+
+    pthread_mutex_lock(&r->lock);
+    ok = r->lo < r->hi;
+    if (ok)
+        *block = r->lo++;
+    pthread_mutex_unlock(&r->lock);
+    return ok;
+}
+
+/*
+ * Claim the back half of the range of another worker, returning its first
+ * block and keeping the rest as the worker's own range
+ */
+static int hs_host_steal(hs_host_grid *g, int self, size_t *block)
+{
+    hs_host_range *r;
+    size_t lo, hi;
+    int i;
+
+    for (i = 1; i < hs_host.workers; ++i) {
+        r = &g->ranges[(self + i) % hs_host.workers];
+
+        pthread_mutex_lock(&r->lock);
+        hi = r->hi;
+        lo = r->lo + (r->hi - r->lo) / 2;
+        if (lo < hi)
+            r->hi = lo;
+        pthread_mutex_unlock(&r->lock);
+
+        if (lo < hi) {
+            r = &g->ranges[self];
+            pthread_mutex_lock(&r->lock);
+            r->lo = lo + 1;
+            r->hi = hi;
+            pthread_mutex_unlock(&r->lock);
+
+            *block = lo;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Execute blocks of the grid until none remain to be claimed
+ */
+static void hs_host_grid_run(hs_host_grid *g, int self)
+{
+    static __thread void   *shared;
+    static __thread size_t  shared_size;
+    hs_block blk;
+    size_t   b;
+
+    if (g->shared > shared_size) {
+        free(shared);
+        shared_size = 0;
+        if (posix_memalign(&shared, CACHE_LINE, g->shared) != 0)
+            shared = NULL;
+        else
+            shared_size = g->shared;
+    }
+
+    blk.gridDim  = g->grid;
+    blk.blockDim = g->block;
+    blk.shared   = shared;
+    blk.args     = g->args;
+
+    while (hs_host_take(&g->ranges[self], &b) || hs_host_steal(g, self, &b)) {
+        blk.blockIdx.x = b % g->grid.x;
+        blk.blockIdx.y = (b / g->grid.x) % g->grid.y;
+        blk.blockIdx.z = b / ((size_t) g->grid.x * g->grid.y);
+        g->kernel(&blk, g->params);
+
+        if (__atomic_sub_fetch(&g->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+            hs_host_grid_complete(g);
+    }
+}
+
+
+/*
+ * The worker pool
+ */
+
+static void* hs_host_worker(void *arg)
+{
+    int self = (int) (intptr_t) arg;
+    hs_host_grid   *g;
+    hs_host_stream *s;
+
+    pthread_mutex_lock(&hs_host.lock);
+    for (;;) {
+        if ((g = hs_host.grids) != NULL) {
+            ++g->users;
+            pthread_mutex_unlock(&hs_host.lock);
+            hs_host_grid_run(g, self);
+            pthread_mutex_lock(&hs_host.lock);
+
+            /* every block has been claimed, so no other worker should join */
+            if (g->listed) {
+                hs_host_grid **p;
+                for (p = &hs_host.grids; *p != g; p = &(*p)->next)
+                    ;
+                *p        = g->next;
+                g->listed = 0;
+            }
+            if (--g->users == 0 && g->finished) {
+                if (g->waited)
+                    pthread_cond_broadcast(&hs_host.done);
+                else
+                    hs_host_grid_free(g);
+            }
+        }
+        else if ((s = hs_host.ready_head) != NULL) {
+            hs_host.ready_head = s->link;
+            if (hs_host.ready_head == NULL)
+                hs_host.ready_tail = NULL;
+
+            pthread_mutex_unlock(&hs_host.lock);
+            hs_host_stream_run(s);
+            pthread_mutex_lock(&hs_host.lock);
+        }
+        else
+            pthread_cond_wait(&hs_host.work, &hs_host.lock);
+    }
+    return NULL;
+}
+
+static pthread_once_t hs_host_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Start the workers, one for each online processor unless the environment
+ * variable HS_CUDA_HOST_THREADS says otherwise
+ */
+static void hs_host_init(void)
+{
+    const char *env = getenv("HS_CUDA_HOST_THREADS");
+    pthread_attr_t attr;
+    pthread_t thread;
+    long n;
+    int i;
+
+    n = env != NULL ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0)
+        n = 1;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_mutex_lock(&hs_host.lock);
+    for (i = 0; i < n; ++i) {
+        if (pthread_create(&thread, &attr, hs_host_worker, (void*) (intptr_t) i) != 0)
+            break;
+    }
+    hs_host.workers = i;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    pthread_attr_destroy(&attr);
+}
+
+int hs_host_start(void)
+{
+    pthread_once(&hs_host_once, hs_host_init);
+    return hs_host.workers > 0;
+}
+
+
+/*
+ * Modules
+ */
+
+/*
+ * The size of an ELF image, being the end of the furthest of its headers and
+ * the sections and segments they describe
+ */
+static size_t hs_host_elf_size(const unsigned char *image)
+{
+    const ElfW(Ehdr) *eh = (const ElfW(Ehdr)*) image;
+    const ElfW(Shdr) *sh;
+    const ElfW(Phdr) *ph;
+    size_t size = eh->e_ehsize;
+    int i;
+
+#define EXTEND(end)     do { if ((size_t) (end) > size) size = (size_t) (end); } while (0)
+
+    EXTEND(eh->e_shoff + (size_t) eh->e_shnum * eh->e_shentsize);
+    EXTEND(eh->e_phoff + (size_t) eh->e_phnum * eh->e_phentsize);
+
+    for (i = 0; i < eh->e_shnum; ++i) {
+        sh = (const ElfW(Shdr)*) (image + eh->e_shoff + (size_t) i * eh->e_shentsize);
+        if (sh->sh_type != SHT_NOBITS)
+            EXTEND(sh->sh_offset + sh->sh_size);
+    }
+    for (i = 0; i < eh->e_phnum; ++i) {
+        ph = (const ElfW(Phdr)*) (image + eh->e_phoff + (size_t) i * eh->e_phentsize);
+        EXTEND(ph->p_offset + ph->p_filesz);
+    }
+#undef EXTEND
+
+    return size;
+}
+
+static CUresult hs_host_module_open(CUmodule *module, const char *path)
+{
+    hs_host_module *mdl;
+    void *handle;
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+        return access(path, R_OK) == 0 ? CUDA_ERROR_INVALID_IMAGE : CUDA_ERROR_FILE_NOT_FOUND;
+
+    mdl = calloc(1, sizeof(hs_host_module));
+    if (mdl == NULL) {
+        dlclose(handle);
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+
+    mdl->handle = handle;
+    *module     = (CUmodule) mdl;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuModuleLoad(CUmodule *module, const char *fname)
+{
+    HS_HOST_CHECK_INIT();
+    if (hs_host_current() == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (fname == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    return hs_host_module_open(module, fname);
+}
+
+/*
+ * The dynamic linker loads only from files, so the image is written to a
+ * temporary file, which is removed again once it has been opened
+ */
+CUresult CUDAAPI cuModuleLoadData(CUmodule *module, const void *image)
+{
+    const unsigned char *p = image;
+    const char *tmpdir;
+    char path[4096];
+    size_t size, n;
+    ssize_t w;
+    CUresult status;
+    int fd;
+
+    HS_HOST_CHECK_INIT();
+    if (hs_host_current() == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (p == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (memcmp(p, ELFMAG, SELFMAG) != 0 || p[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32))
+        return CUDA_ERROR_INVALID_IMAGE;
+
+    tmpdir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/hs-cuda-XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+    if ((fd = mkstemp(path)) < 0)
+        return CUDA_ERROR_FILE_NOT_FOUND;
+
+    size = hs_host_elf_size(p);
+    for (n = 0; n < size; n += w) {
+        w = write(fd, p + n, size - n);
+        if (w <= 0)
+            break;
+    }
+    close(fd);
+
+    status = n == size ? hs_host_module_open(module, path) : CUDA_ERROR_OUT_OF_MEMORY;
+    unlink(path);
+    return status;
+}
+
+CUresult CUDAAPI cuModuleLoadDataEx(CUmodule *module, const void *image, unsigned int numOptions, CUjit_option *options, void **optionValues)
+{
+    (void) numOptions;
+    (void) options;
+    (void) optionValues;
+    return cuModuleLoadData(module, image);
+}
+
+CUresult CUDAAPI cuModuleUnload(CUmodule hmod)
+{
+    hs_host_module   *mdl = (hs_host_module*) hmod;
+    hs_host_function *fn, *next;
+
+    HS_HOST_CHECK_INIT();
+    if (mdl == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    for (fn = mdl->functions; fn != NULL; fn = next) {
+        next = fn->next;
+        free(fn->name);
+        free(fn);
+    }
+    dlclose(mdl->handle);
+    free(mdl);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuModuleGetFunction(CUfunction *hfunc, CUmodule hmod, const char *name)
+{
+    hs_host_module   *mdl = (hs_host_module*) hmod;
+    hs_host_function *fn;
+    hs_host_kernel    kernel;
+    char              table[512];
+
+    HS_HOST_CHECK_INIT();
+    if (mdl == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+    if (name == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    for (fn = mdl->functions; fn != NULL; fn = fn->next)
+        if (strcmp(fn->name, name) == 0)
+            break;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    if (fn == NULL) {
+        *(void**) &kernel = dlsym(mdl->handle, name);
+        if (kernel == NULL)
+            return CUDA_ERROR_NOT_FOUND;
+
+        fn = calloc(1, sizeof(hs_host_function));
+        if (fn == NULL || (fn->name = strdup(name)) == NULL) {
+            free(fn);
+            return CUDA_ERROR_OUT_OF_MEMORY;
+        }
+
+        fn->kernel = kernel;
+        snprintf(table, sizeof(table), "hs_params_%s", name);
+        fn->sizes  = dlsym(mdl->handle, table);
+        if (fn->sizes != NULL) {
+            for (fn->count = 0; fn->sizes[fn->count] != 0; ++fn->count)
+                fn->bytes += fn->sizes[fn->count];
+        }
+
+        pthread_mutex_lock(&hs_host.lock);
+        fn->next       = mdl->functions;
+        mdl->functions = fn;
+        pthread_mutex_unlock(&hs_host.lock);
+    }
+
+    *hfunc = (CUfunction) fn;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuModuleGetGlobal(CUdeviceptr *dptr, size_t *bytes, CUmodule hmod, const char *name)
+{
+    hs_host_module   *mdl = (hs_host_module*) hmod;
+    const ElfW(Sym)  *sym = NULL;
+    Dl_info           info;
+    void             *addr;
+
+    HS_HOST_CHECK_INIT();
+    if (mdl == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+    if (name == NULL)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    addr = dlsym(mdl->handle, name);
+    if (addr == NULL)
+        return CUDA_ERROR_NOT_FOUND;
+
+    if (dptr != NULL)
+        *dptr = (CUdeviceptr) (uintptr_t) addr;
+    if (bytes != NULL)
+        *bytes = dladdr1(addr, &info, (void**) &sym, RTLD_DL_SYMENT) != 0 && sym != NULL ? sym->st_size : 0;
+    return CUDA_SUCCESS;
+}
+
+
+/*
+ * Functions
+ */
+
+CUresult CUDAAPI cuFuncGetAttribute(int *pi, CUfunction_attribute attrib, CUfunction hfunc)
+{
+    HS_HOST_CHECK_INIT();
+    if (hfunc == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    switch (attrib) {
+        case CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK:   *pi = 1024; break;
+        case CU_FUNC_ATTRIBUTE_PTX_VERSION:             *pi = 30;   break;
+        case CU_FUNC_ATTRIBUTE_BINARY_VERSION:          *pi = 30;   break;
+        default:                                        *pi = 0;    break;
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuFuncSetCacheConfig(CUfunction hfunc, CUfunc_cache config)
+{
+    (void) hfunc;
+    (void) config;
+    HS_HOST_CHECK_INIT();
+    return CUDA_SUCCESS;
+}
+
+#if CUDA_VERSION >= 4020
+CUresult CUDAAPI cuFuncSetSharedMemConfig(CUfunction hfunc, CUsharedconfig config)
+{
+    (void) hfunc;
+    (void) config;
+    HS_HOST_CHECK_INIT();
+    return CUDA_SUCCESS;
+}
+#endif
+
+
+/*
+ * Launch a grid. The parameters are copied when the kernel provides the table
+ * of their sizes, and otherwise the launch waits for the grid to complete, so
+ * that the caller's parameters remain valid while it executes.
+ */
+CUresult CUDAAPI cuLaunchKernel(CUfunction f,
+                                unsigned int gridDimX,  unsigned int gridDimY,  unsigned int gridDimZ,
+                                unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,
+                                unsigned int sharedMemBytes, CUstream hStream,
+                                void **kernelParams, void **extra)
+{
+    hs_host_function *fn     = (hs_host_function*) f;
+    hs_host_stream   *s      = hs_host_stream_get(hStream);
+    const char       *buffer = NULL;
+    size_t            size   = 0;
+    size_t            offset, blocks, i;
+    hs_host_grid     *g;
+    hs_host_op       *op;
+    char             *values;
+    int               copied, waited, w;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (fn == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+    if (gridDimX == 0 || gridDimY == 0 || gridDimZ == 0 || gridDimY > 65535 || gridDimZ > 65535)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (blockDimX == 0 || blockDimY == 0 || blockDimZ == 0 || blockDimZ > 64 || (size_t) blockDimX * blockDimY * blockDimZ > 1024)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (sharedMemBytes > MAX_SHARED_MEMORY)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    while (extra != NULL && *extra != CU_LAUNCH_PARAM_END) {
+        if (extra[0] == CU_LAUNCH_PARAM_BUFFER_POINTER)
+            buffer = extra[1];
+        else if (extra[0] == CU_LAUNCH_PARAM_BUFFER_SIZE)
+            size = *(size_t*) extra[1];
+        else
+            return CUDA_ERROR_INVALID_VALUE;
+        extra += 2;
+    }
+    if ((kernelParams != NULL && buffer != NULL) || (buffer != NULL && fn->sizes != NULL && size < fn->bytes))
+        return CUDA_ERROR_INVALID_VALUE;
+    if (kernelParams == NULL && buffer == NULL && fn->count > 0)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    /* storage for the parameter pointers, the parameter values, and the packed buffer */
+    copied = fn->sizes != NULL;
+    g      = hs_host_grid_new(copied ? fn->count * sizeof(void*) + fn->count * CACHE_LINE + fn->bytes + size : size);
+    op     = hs_host_op_new(HS_HOST_LAUNCH);
+    if (g == NULL || op == NULL) {
+        if (g != NULL)
+            hs_host_grid_free(g);
+        free(op);
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (copied) {
+        g->params = g->storage;
+        values    = (char*) g->storage + fn->count * sizeof(void*);
+        for (i = 0, offset = 0; i < fn->count; ++i) {
+            values       = (char*) (((uintptr_t) values + 15) & ~(uintptr_t) 15);
+            g->params[i] = values;
+            memcpy(values, kernelParams != NULL ? kernelParams[i] : buffer + offset, fn->sizes[i]);
+            values      += fn->sizes[i];
+            offset      += fn->sizes[i];
+        }
+    }
+    else {
+        g->params = kernelParams;
+        values    = g->storage;
+    }
+    if (buffer != NULL) {
+        memcpy(values, buffer, size);
+        g->args = values;
+    }
+
+    blocks       = (size_t) gridDimX * gridDimY * gridDimZ;
+    g->kernel    = fn->kernel;
+    g->grid.x    = gridDimX;  g->grid.y  = gridDimY;  g->grid.z  = gridDimZ;
+    g->block.x   = blockDimX; g->block.y = blockDimY; g->block.z = blockDimZ;
+    g->blocks    = blocks;
+    g->remaining = blocks;
+    g->shared    = sharedMemBytes;
+    g->waited    = waited = kernelParams != NULL && !copied;
+
+    for (w = 0, offset = 0; w < hs_host.workers; ++w) {
+        g->ranges[w].lo = offset;
+        offset         += blocks / hs_host.workers + ((size_t) w < blocks % hs_host.workers);
+        g->ranges[w].hi = offset;
+    }
+
+    /* unless we wait for it, a worker may free the grid as soon as it is enqueued */
+    op->u.grid = g;
+    hs_host_enqueue(s, op);
+
+    if (waited) {
+        pthread_mutex_lock(&hs_host.lock);
+        while (!g->finished || g->users > 0)
+            pthread_cond_wait(&hs_host.done, &hs_host.lock);
+        pthread_mutex_unlock(&hs_host.lock);
+        hs_host_grid_free(g);
+    }
+    return CUDA_SUCCESS;
+}
@@ -0,0 +1,356 @@
+/*
+ * Host execution backend: memory management
+ *
+ * Device memory is allocated from the host heap, and a device pointer is the
+ * host address of the memory. Page-locked, mapped and managed memory are all
+ * the same thing, so registering host memory does nothing and the device
+ * address of host memory is its host address.
+ *
+ * Copies and memsets are operations of a stream like any other. The
+ * synchronous versions are enqueued on the NULL stream, and return once that
+ * stream has drained. A copy is a number of rows at a pitch, which is one row
+ * for linear copies.
+ */
+
+#include "host.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+
+#define DEVICE_ALIGNMENT        256
+#define HOST_ALIGNMENT          4096
+
+
+static CUresult hs_host_copy2d(void *dst, size_t dpitch, const void *src, size_t spitch, size_t bytes, size_t rows, CUstream stream, int async)
+{
+    hs_host_stream *s = hs_host_stream_get(stream);
+    hs_host_op     *op;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (rows > 1 && (dpitch < bytes || spitch < bytes))
+        return CUDA_ERROR_INVALID_VALUE;
+    if (bytes == 0 || rows == 0)
+        return CUDA_SUCCESS;
+
+    op = hs_host_op_new(HS_HOST_COPY);
+    if (op == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    op->u.copy.dst    = dst;
+    op->u.copy.src    = src;
+    op->u.copy.bytes  = bytes;
+    op->u.copy.rows   = rows;
+    op->u.copy.dpitch = dpitch;
+    op->u.copy.spitch = spitch;
+    hs_host_enqueue(s, op);
+
+    if (!async)
+        hs_host_stream_wait(s);
+    return CUDA_SUCCESS;
+}
+
+static CUresult hs_host_copy(void *dst, const void *src, size_t bytes, CUstream stream, int async)
+{
+    return hs_host_copy2d(dst, bytes, src, bytes, bytes, 1, stream, async);
+}
+
+/*
+ * The start of one side of a 2D copy. There are no arrays, since
+ * cuArrayCreate is not provided.
+ */
+static int hs_host_copy2d_address(CUmemorytype type, const void *host, CUdeviceptr device, size_t x, size_t y, size_t pitch, char **start)
+{
+    char *p;
+
+    switch (type) {
+        case CU_MEMORYTYPE_HOST:
+            p = (char*) host;
+            break;
+        case CU_MEMORYTYPE_DEVICE:
+#if CUDA_VERSION >= 4000
+        case CU_MEMORYTYPE_UNIFIED:
+#endif
+            p = (char*) (uintptr_t) device;
+            break;
+        default:
+            return 0;
+    }
+
+    *start = p + y * pitch + x;
+    return 1;
+}
+
+static CUresult hs_host_copy_desc(const CUDA_MEMCPY2D *desc, CUstream stream, int async)
+{
+    char *dst, *src;
+
+    if (desc == NULL
+        || !hs_host_copy2d_address(desc->dstMemoryType, desc->dstHost, desc->dstDevice, desc->dstXInBytes, desc->dstY, desc->dstPitch, &dst)
+        || !hs_host_copy2d_address(desc->srcMemoryType, desc->srcHost, desc->srcDevice, desc->srcXInBytes, desc->srcY, desc->srcPitch, &src))
+        return CUDA_ERROR_INVALID_VALUE;
+
+    return hs_host_copy2d(dst, desc->dstPitch, src, desc->srcPitch, desc->WidthInBytes, desc->Height, stream, async);
+}
+
+static CUresult hs_host_set(CUdeviceptr dst, unsigned int value, size_t count, int width, CUstream stream, int async)
+{
+    hs_host_stream *s = hs_host_stream_get(stream);
+    hs_host_op     *op;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if ((uintptr_t) dst % width != 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (count == 0)
+        return CUDA_SUCCESS;
+
+    op = hs_host_op_new(HS_HOST_SET);
+    if (op == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    op->u.set.dst   = (void*) (uintptr_t) dst;
+    op->u.set.value = value;
+    op->u.set.count = count;
+    op->u.set.width = width;
+    hs_host_enqueue(s, op);
+
+    if (!async)
+        hs_host_stream_wait(s);
+    return CUDA_SUCCESS;
+}
+
+/*
+ * Memory is released only once the current context is idle, as the driver
+ * does, since pending operations may still refer to it
+ */
+static void hs_host_release(void *p)
+{
+    hs_host_context *ctx = hs_host_current();
+
+    if (ctx != NULL)
+        hs_host_context_wait(ctx);
+    free(p);
+}
+
+
+/* Allocation */
+
+CUresult CUDAAPI cuMemGetInfo(size_t *pfree, size_t *ptotal)
+{
+    struct sysinfo info;
+
+    HS_HOST_CHECK_INIT();
+    if (sysinfo(&info) != 0)
+        return CUDA_ERROR_UNKNOWN;
+
+    *pfree  = (size_t) info.freeram  * info.mem_unit;
+    *ptotal = (size_t) info.totalram * info.mem_unit;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemAlloc(CUdeviceptr *dptr, size_t bytes)
+{
+    void *p;
+
+    HS_HOST_CHECK_INIT();
+    if (hs_host_current() == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (bytes == 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (posix_memalign(&p, DEVICE_ALIGNMENT, bytes) != 0)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    *dptr = (CUdeviceptr) (uintptr_t) p;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemFree(CUdeviceptr dptr)
+{
+    HS_HOST_CHECK_INIT();
+    hs_host_release((void*) (uintptr_t) dptr);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemHostAlloc(void **pp, size_t bytes, unsigned int flags)
+{
+    (void) flags;
+
+    HS_HOST_CHECK_INIT();
+    if (hs_host_current() == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (bytes == 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (posix_memalign(pp, HOST_ALIGNMENT, bytes) != 0)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemFreeHost(void *p)
+{
+    HS_HOST_CHECK_INIT();
+    hs_host_release(p);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemHostGetDevicePointer(CUdeviceptr *dptr, void *p, unsigned int flags)
+{
+    HS_HOST_CHECK_INIT();
+    if (flags != 0)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    *dptr = (CUdeviceptr) (uintptr_t) p;
+    return CUDA_SUCCESS;
+}
+
+#if CUDA_VERSION >= 4000
+CUresult CUDAAPI cuMemHostRegister(void *p, size_t bytes, unsigned int flags)
+{
+    (void) flags;
+
+    HS_HOST_CHECK_INIT();
+    if (p == NULL || bytes == 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemHostUnregister(void *p)
+{
+    (void) p;
+    HS_HOST_CHECK_INIT();
+    return CUDA_SUCCESS;
+}
+#endif
+
+#if CUDA_VERSION >= 6000
+CUresult CUDAAPI cuMemAllocManaged(CUdeviceptr *dptr, size_t bytes, unsigned int flags)
+{
+    (void) flags;
+    return cuMemAlloc(dptr, bytes);
+}
+#endif
+
+#if CUDA_VERSION >= 8000
+/*
+ * Managed memory is host memory, so advice and prefetches have nothing to do
+ */
+CUresult CUDAAPI cuMemAdvise(CUdeviceptr dptr, size_t count, CUmem_advise advice, CUdevice device)
+{
+    (void) advice;
+
+    HS_HOST_CHECK_INIT();
+    if (dptr == 0 || count == 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (device != 0 && device != CU_DEVICE_CPU)
+        return CUDA_ERROR_INVALID_DEVICE;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuMemPrefetchAsync(CUdeviceptr dptr, size_t count, CUdevice device, CUstream stream)
+{
+    HS_HOST_CHECK_INIT();
+    if (hs_host_stream_get(stream) == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (dptr == 0 || count == 0)
+        return CUDA_ERROR_INVALID_VALUE;
+    if (device != 0 && device != CU_DEVICE_CPU)
+        return CUDA_ERROR_INVALID_DEVICE;
+    return CUDA_SUCCESS;
+}
+#endif
+
+
+/* Copies */
+
+CUresult CUDAAPI cuMemcpyHtoD(CUdeviceptr dst, const void *src, size_t bytes)
+{
+    return hs_host_copy((void*) (uintptr_t) dst, src, bytes, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemcpyDtoH(void *dst, CUdeviceptr src, size_t bytes)
+{
+    return hs_host_copy(dst, (const void*) (uintptr_t) src, bytes, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemcpyDtoD(CUdeviceptr dst, CUdeviceptr src, size_t bytes)
+{
+    return hs_host_copy((void*) (uintptr_t) dst, (const void*) (uintptr_t) src, bytes, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemcpyHtoDAsync(CUdeviceptr dst, const void *src, size_t bytes, CUstream stream)
+{
+    return hs_host_copy((void*) (uintptr_t) dst, src, bytes, stream, 1);
+}
+
+CUresult CUDAAPI cuMemcpyDtoHAsync(void *dst, CUdeviceptr src, size_t bytes, CUstream stream)
+{
+    return hs_host_copy(dst, (const void*) (uintptr_t) src, bytes, stream, 1);
+}
+
+CUresult CUDAAPI cuMemcpyDtoDAsync(CUdeviceptr dst, CUdeviceptr src, size_t bytes, CUstream stream)
+{
+    return hs_host_copy((void*) (uintptr_t) dst, (const void*) (uintptr_t) src, bytes, stream, 1);
+}
+
+CUresult CUDAAPI cuMemcpy2D(const CUDA_MEMCPY2D *desc)
+{
+    return hs_host_copy_desc(desc, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemcpy2DAsync(const CUDA_MEMCPY2D *desc, CUstream stream)
+{
+    return hs_host_copy_desc(desc, stream, 1);
+}
+
+#if CUDA_VERSION >= 4000
+CUresult CUDAAPI cuMemcpyPeer(CUdeviceptr dst, CUcontext dstContext, CUdeviceptr src, CUcontext srcContext, size_t bytes)
+{
+    (void) dstContext;
+    (void) srcContext;
+    return hs_host_copy((void*) (uintptr_t) dst, (const void*) (uintptr_t) src, bytes, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemcpyPeerAsync(CUdeviceptr dst, CUcontext dstContext, CUdeviceptr src, CUcontext srcContext, size_t bytes, CUstream stream)
+{
+    (void) dstContext;
+    (void) srcContext;
+    return hs_host_copy((void*) (uintptr_t) dst, (const void*) (uintptr_t) src, bytes, stream, 1);
+}
+#endif
+
+
+/* Memset */
+
+CUresult CUDAAPI cuMemsetD8(CUdeviceptr dst, unsigned char value, size_t count)
+{
+    return hs_host_set(dst, value, count, 1, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemsetD16(CUdeviceptr dst, unsigned short value, size_t count)
+{
+    return hs_host_set(dst, value, count, 2, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemsetD32(CUdeviceptr dst, unsigned int value, size_t count)
+{
+    return hs_host_set(dst, value, count, 4, NULL, 0);
+}
+
+CUresult CUDAAPI cuMemsetD8Async(CUdeviceptr dst, unsigned char value, size_t count, CUstream stream)
+{
+    return hs_host_set(dst, value, count, 1, stream, 1);
+}
+
+CUresult CUDAAPI cuMemsetD16Async(CUdeviceptr dst, unsigned short value, size_t count, CUstream stream)
+{
+    return hs_host_set(dst, value, count, 2, stream, 1);
+}
+
+CUresult CUDAAPI cuMemsetD32Async(CUdeviceptr dst, unsigned int value, size_t count, CUstream stream)
+{
+    return hs_host_set(dst, value, count, 4, stream, 1);
+}
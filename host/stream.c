@@ -0,0 +1,528 @@
+/*
+ * Host execution backend: streams and events
+ *
+ * A stream runs on one worker at a time, executing its operations in order
+ * until it is empty, must wait for an event, or has launched a grid. In the
+ * last two cases it is rescheduled once the event has been recorded or the
+ * grid has completed.
+ *
+ * The legacy NULL stream synchronises with the other blocking streams of its
+ * context. Rather than track dependencies between queues, enqueueing work to
+ * the NULL stream waits until the other blocking streams are idle, and
+ * enqueueing work to a blocking stream waits until the NULL stream is idle.
+ * This gives the same ordering, at the cost of blocking the host thread.
+ */
+
+#include "host.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct hs_host_state hs_host = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    0, NULL, NULL, NULL
+};
+
+
+static unsigned long long hs_host_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+/*
+ * The stream denoted by a handle, where NULL (and the legacy and per-thread
+ * default stream handles) are the NULL stream of the current context
+ */
+hs_host_stream* hs_host_stream_get(CUstream stream)
+{
+    hs_host_context *ctx;
+
+#if defined(CU_STREAM_LEGACY)
+    if (stream == CU_STREAM_LEGACY || stream == CU_STREAM_PER_THREAD)
+        stream = NULL;
+#endif
+    if (stream != NULL)
+        return (hs_host_stream*) stream;
+
+    ctx = hs_host_current();
+    return ctx != NULL ? &ctx->null_stream : NULL;
+}
+
+void hs_host_stream_init(hs_host_stream *s, hs_host_context *ctx, unsigned int flags, int priority)
+{
+    memset(s, 0, sizeof(hs_host_stream));
+    s->ctx      = ctx;
+    s->flags    = flags;
+    s->priority = priority;
+}
+
+hs_host_op* hs_host_op_new(int kind)
+{
+    hs_host_op *op = calloc(1, sizeof(hs_host_op));
+
+    if (op != NULL)
+        op->kind = kind;
+    return op;
+}
+
+
+/*
+ * Scheduling; these are called with the lock held
+ */
+
+void hs_host_stream_ready(hs_host_stream *s)
+{
+    s->link = NULL;
+    if (hs_host.ready_tail != NULL)
+        hs_host.ready_tail->link = s;
+    else
+        hs_host.ready_head = s;
+    hs_host.ready_tail = s;
+
+    pthread_cond_signal(&hs_host.work);
+}
+
+static void hs_host_event_release(hs_host_event *e)
+{
+    if (--e->refs == 0)
+        free(e);
+}
+
+/*
+ * Remove the completed operation at the head of the stream
+ */
+static void hs_host_op_pop(hs_host_stream *s)
+{
+    hs_host_op *op = s->head;
+
+    s->head = op->next;
+    if (s->head == NULL)
+        s->tail = NULL;
+
+    if (op->kind == HS_HOST_RECORD || op->kind == HS_HOST_WAIT)
+        hs_host_event_release(op->u.event.event);
+    free(op);
+}
+
+/*
+ * The grid launched by the stream has completed
+ */
+void hs_host_op_complete(hs_host_stream *s)
+{
+    hs_host_op_pop(s);
+    hs_host_stream_ready(s);
+}
+
+static void hs_host_order(hs_host_stream *s)
+{
+    hs_host_context *ctx = s->ctx;
+    hs_host_stream  *t;
+
+    if (s->flags & CU_STREAM_NON_BLOCKING)
+        return;
+
+    if (s != &ctx->null_stream) {
+        while (ctx->null_stream.head != NULL)
+            pthread_cond_wait(&hs_host.done, &hs_host.lock);
+        return;
+    }
+
+again:
+    for (t = ctx->streams; t != NULL; t = t->next) {
+        if (!(t->flags & CU_STREAM_NON_BLOCKING) && t->head != NULL) {
+            pthread_cond_wait(&hs_host.done, &hs_host.lock);
+            goto again;
+        }
+    }
+}
+
+
+/*
+ * Append an operation to a stream, scheduling the stream if it was idle
+ */
+void hs_host_enqueue(hs_host_stream *s, hs_host_op *op)
+{
+    hs_host_event *e;
+
+    pthread_mutex_lock(&hs_host.lock);
+    hs_host_order(s);
+
+    switch (op->kind) {
+        case HS_HOST_RECORD:
+            e                   = op->u.event.event;
+            op->u.event.target  = ++e->recorded;
+            ++e->refs;
+            break;
+
+        case HS_HOST_WAIT:
+            e                   = op->u.event.event;
+            op->u.event.target  = e->recorded;
+            if (e->completed >= e->recorded) {
+                pthread_mutex_unlock(&hs_host.lock);
+                free(op);
+                return;
+            }
+            ++e->refs;
+            break;
+    }
+
+    op->next = NULL;
+    if (s->tail != NULL)
+        s->tail->next = op;
+    else
+        s->head = op;
+    s->tail = op;
+
+    if (!s->active) {
+        s->active = 1;
+        hs_host_stream_ready(s);
+    }
+    pthread_mutex_unlock(&hs_host.lock);
+}
+
+void hs_host_stream_wait(hs_host_stream *s)
+{
+    pthread_mutex_lock(&hs_host.lock);
+    while (s->head != NULL)
+        pthread_cond_wait(&hs_host.done, &hs_host.lock);
+    pthread_mutex_unlock(&hs_host.lock);
+}
+
+
+/*
+ * Copy 'rows' rows of 'bytes' bytes each, at the given pitches
+ */
+static void hs_host_memcpy(void *dst, size_t dpitch, const void *src, size_t spitch, size_t bytes, size_t rows)
+{
+    size_t i;
+
+    for (i = 0; i < rows; ++i)
+        memmove((char*) dst + i * dpitch, (const char*) src + i * spitch, bytes);
+}
+
+static void hs_host_memset(void *dst, unsigned int value, size_t count, int width)
+{
+    size_t i;
+
+    switch (width) {
+        case 1:
+            memset(dst, (int) value, count);
+            break;
+        case 2:
+            for (i = 0; i < count; ++i)
+                ((uint16_t*) dst)[i] = (uint16_t) value;
+            break;
+        case 4:
+            for (i = 0; i < count; ++i)
+                ((uint32_t*) dst)[i] = (uint32_t) value;
+            break;
+    }
+}
+
+/*
+ * Execute the operations of a stream on the calling worker
+ */
+void hs_host_stream_run(hs_host_stream *s)
+{
+    hs_host_op     *op;
+    hs_host_event  *e;
+    hs_host_stream *w;
+
+    pthread_mutex_lock(&hs_host.lock);
+    for (;;) {
+        op = s->head;
+        if (op == NULL) {
+            s->active = 0;
+            if (s->destroyed)
+                free(s);
+            pthread_cond_broadcast(&hs_host.done);
+            break;
+        }
+
+        switch (op->kind) {
+            case HS_HOST_COPY:
+                pthread_mutex_unlock(&hs_host.lock);
+                hs_host_memcpy(op->u.copy.dst, op->u.copy.dpitch, op->u.copy.src, op->u.copy.spitch, op->u.copy.bytes, op->u.copy.rows);
+                pthread_mutex_lock(&hs_host.lock);
+                hs_host_op_pop(s);
+                break;
+
+            case HS_HOST_SET:
+                pthread_mutex_unlock(&hs_host.lock);
+                hs_host_memset(op->u.set.dst, op->u.set.value, op->u.set.count, op->u.set.width);
+                pthread_mutex_lock(&hs_host.lock);
+                hs_host_op_pop(s);
+                break;
+
+            case HS_HOST_RECORD:
+                e = op->u.event.event;
+                if (op->u.event.target > e->completed) {
+                    e->completed = op->u.event.target;
+                    e->time      = hs_host_now();
+                }
+                while ((w = e->waiters) != NULL) {
+                    e->waiters = w->link;
+                    hs_host_stream_ready(w);
+                }
+                hs_host_op_pop(s);
+                pthread_cond_broadcast(&hs_host.done);
+                break;
+
+            case HS_HOST_WAIT:
+                e = op->u.event.event;
+                if (e->completed >= op->u.event.target) {
+                    hs_host_op_pop(s);
+                    break;
+                }
+                s->link    = e->waiters;
+                e->waiters = s;
+                pthread_mutex_unlock(&hs_host.lock);
+                return;
+
+            case HS_HOST_LAUNCH:
+                hs_host_grid_publish(op->u.grid, s);
+                pthread_mutex_unlock(&hs_host.lock);
+                return;
+        }
+    }
+    pthread_mutex_unlock(&hs_host.lock);
+}
+
+
+/* Streams */
+
+#if CUDA_VERSION >= 5050
+CUresult CUDAAPI cuStreamCreateWithPriority(CUstream *phStream, unsigned int flags, int priority)
+#else
+static CUresult cuStreamCreateWithPriority(CUstream *phStream, unsigned int flags, int priority)
+#endif
+{
+    hs_host_context *ctx = hs_host_current();
+    hs_host_stream  *s;
+
+    HS_HOST_CHECK_INIT();
+    if (ctx == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    s = malloc(sizeof(hs_host_stream));
+    if (s == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    hs_host_stream_init(s, ctx, flags, priority);
+
+    pthread_mutex_lock(&hs_host.lock);
+    s->next      = ctx->streams;
+    ctx->streams = s;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    *phStream = (CUstream) s;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamCreate(CUstream *phStream, unsigned int flags)
+{
+    return cuStreamCreateWithPriority(phStream, flags, 0);
+}
+
+#if CUDA_VERSION >= 5050
+CUresult CUDAAPI cuStreamGetPriority(CUstream hStream, int *priority)
+{
+    hs_host_stream *s = hs_host_stream_get(hStream);
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    *priority = s->priority;
+    return CUDA_SUCCESS;
+}
+#endif
+
+/*
+ * The stream is released once its pending work has completed
+ */
+CUresult CUDAAPI cuStreamDestroy(CUstream hStream)
+{
+    hs_host_stream *s = (hs_host_stream*) hStream;
+    hs_host_stream **p;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    for (p = &s->ctx->streams; *p != NULL; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    if (s->active)
+        s->destroyed = 1;
+    else
+        free(s);
+    pthread_mutex_unlock(&hs_host.lock);
+
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamQuery(CUstream hStream)
+{
+    hs_host_stream *s = hs_host_stream_get(hStream);
+    int idle;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    pthread_mutex_lock(&hs_host.lock);
+    idle = s->head == NULL;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    return idle ? CUDA_SUCCESS : CUDA_ERROR_NOT_READY;
+}
+
+CUresult CUDAAPI cuStreamSynchronize(CUstream hStream)
+{
+    hs_host_stream *s = hs_host_stream_get(hStream);
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+
+    hs_host_stream_wait(s);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuStreamWaitEvent(CUstream hStream, CUevent hEvent, unsigned int flags)
+{
+    hs_host_stream *s = hs_host_stream_get(hStream);
+    hs_host_op     *op;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (hEvent == NULL || flags != 0)
+        return CUDA_ERROR_INVALID_VALUE;
+
+    op = hs_host_op_new(HS_HOST_WAIT);
+    if (op == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    op->u.event.event = (hs_host_event*) hEvent;
+    hs_host_enqueue(s, op);
+    return CUDA_SUCCESS;
+}
+
+
+/* Events */
+
+CUresult CUDAAPI cuEventCreate(CUevent *phEvent, unsigned int flags)
+{
+    hs_host_event *e;
+
+    HS_HOST_CHECK_INIT();
+    e = calloc(1, sizeof(hs_host_event));
+    if (e == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    e->flags = flags;
+    e->refs  = 1;
+    *phEvent = (CUevent) e;
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventDestroy(CUevent hEvent)
+{
+    HS_HOST_CHECK_INIT();
+    if (hEvent == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    hs_host_event_release((hs_host_event*) hEvent);
+    pthread_mutex_unlock(&hs_host.lock);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventRecord(CUevent hEvent, CUstream hStream)
+{
+    hs_host_stream *s = hs_host_stream_get(hStream);
+    hs_host_op     *op;
+
+    HS_HOST_CHECK_INIT();
+    if (s == NULL)
+        return CUDA_ERROR_INVALID_CONTEXT;
+    if (hEvent == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    op = hs_host_op_new(HS_HOST_RECORD);
+    if (op == NULL)
+        return CUDA_ERROR_OUT_OF_MEMORY;
+
+    op->u.event.event = (hs_host_event*) hEvent;
+    hs_host_enqueue(s, op);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventQuery(CUevent hEvent)
+{
+    hs_host_event *e = (hs_host_event*) hEvent;
+    int complete;
+
+    HS_HOST_CHECK_INIT();
+    if (e == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    complete = e->completed >= e->recorded;
+    pthread_mutex_unlock(&hs_host.lock);
+
+    return complete ? CUDA_SUCCESS : CUDA_ERROR_NOT_READY;
+}
+
+CUresult CUDAAPI cuEventSynchronize(CUevent hEvent)
+{
+    hs_host_event *e = (hs_host_event*) hEvent;
+    unsigned long long target;
+
+    HS_HOST_CHECK_INIT();
+    if (e == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    target = e->recorded;
+    while (e->completed < target)
+        pthread_cond_wait(&hs_host.done, &hs_host.lock);
+    pthread_mutex_unlock(&hs_host.lock);
+    return CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI cuEventElapsedTime(float *pMilliseconds, CUevent hStart, CUevent hEnd)
+{
+    hs_host_event *start = (hs_host_event*) hStart;
+    hs_host_event *end   = (hs_host_event*) hEnd;
+    CUresult status      = CUDA_SUCCESS;
+
+    HS_HOST_CHECK_INIT();
+    if (start == NULL || end == NULL)
+        return CUDA_ERROR_INVALID_HANDLE;
+    if ((start->flags | end->flags) & CU_EVENT_DISABLE_TIMING)
+        return CUDA_ERROR_INVALID_HANDLE;
+
+    pthread_mutex_lock(&hs_host.lock);
+    if (start->recorded == 0 || end->recorded == 0)
+        status = CUDA_ERROR_INVALID_HANDLE;
+    else if (start->completed < start->recorded || end->completed < end->recorded)
+        status = CUDA_ERROR_NOT_READY;
+    else
+        *pMilliseconds = (float) ((double) (long long) (end->time - start->time) / 1.0E6);
+    pthread_mutex_unlock(&hs_host.lock);
+
+    return status;
+}
@@ -0,0 +1,22 @@
+/*
+ * Kernels for the smoke test of the host execution backend
+ */
+
+#include "cuda_host.h"
+
+HS_HOST_PARAMS(vector_add, sizeof(float*), sizeof(float*), sizeof(float*), sizeof(int));
+
+HS_HOST_KERNEL(vector_add)
+{
+    const float *xs = HS_HOST_PARAM(0, const float*);
+    const float *ys = HS_HOST_PARAM(1, const float*);
+    float       *zs = HS_HOST_PARAM(2, float*);
+    int          n  = HS_HOST_PARAM(3, int);
+    unsigned int t;
+
+    for (t = 0; t < block->blockDim.x; ++t) {
+        int i = block->blockIdx.x * block->blockDim.x + t;
+        if (i < n)
+            zs[i] = xs[i] + ys[i];
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ * Smoke test of the host execution backend
+ *
+ * Adds two vectors copied asynchronously on one stream, while a second stream
+ * waits on an event of the first and copies the result back, then checks a
+ * pitched 2D copy, and destroys contexts with work still queued. The module
+ * of kernels is given as the only argument. Run it with several values of
+ * HS_CUDA_HOST_THREADS (see the Makefile).
+ */
+
+#include <cuda.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(call)                                                             \
+    do {                                                                        \
+        CUresult status = (call);                                               \
+        if (status != CUDA_SUCCESS) {                                           \
+            fprintf(stderr, "%s:%d: %s failed (%d)\n", __FILE__, __LINE__, #call, (int) status); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+#define N           1000003
+#define BLOCK       256
+#define LAUNCHES    16
+#define ROWS        37
+#define WIDTH       100
+#define PITCH       128
+#define CONTEXTS    64
+#define SMALL_N     4096
+
+static void test_vector_add(CUfunction fn)
+{
+    size_t       bytes = N * sizeof(float);
+    float       *xs, *ys, *zs;
+    CUdeviceptr  d_xs, d_ys, d_zs;
+    CUstream     s1, s2;
+    CUevent      start, stop;
+    float        ms;
+    int          n = N, i, bad = 0;
+    void        *args[4];
+
+    CHECK(cuMemHostAlloc((void**) &xs, bytes, 0));
+    CHECK(cuMemHostAlloc((void**) &ys, bytes, 0));
+    CHECK(cuMemHostAlloc((void**) &zs, bytes, 0));
+    for (i = 0; i < N; ++i) {
+        xs[i] = (float) i;
+        ys[i] = (float) (2 * i);
+        zs[i] = -1;
+    }
+
+    CHECK(cuMemAlloc(&d_xs, bytes));
+    CHECK(cuMemAlloc(&d_ys, bytes));
+    CHECK(cuMemAlloc(&d_zs, bytes));
+    CHECK(cuStreamCreate(&s1, CU_STREAM_NON_BLOCKING));
+    CHECK(cuStreamCreate(&s2, CU_STREAM_NON_BLOCKING));
+    CHECK(cuEventCreate(&start, 0));
+    CHECK(cuEventCreate(&stop, 0));
+
+    CHECK(cuMemcpyHtoDAsync(d_xs, xs, bytes, s1));
+    CHECK(cuMemcpyHtoDAsync(d_ys, ys, bytes, s1));
+    CHECK(cuMemsetD32Async(d_zs, 0, N, s1));
+    CHECK(cuEventRecord(start, s1));
+
+    args[0] = &d_xs;
+    args[1] = &d_ys;
+    args[2] = &d_zs;
+    args[3] = &n;
+    for (i = 0; i < LAUNCHES; ++i)
+        CHECK(cuLaunchKernel(fn, (N + BLOCK - 1) / BLOCK, 1, 1, BLOCK, 1, 1, 0, s1, args, NULL));
+    CHECK(cuEventRecord(stop, s1));
+
+    CHECK(cuStreamWaitEvent(s2, stop, 0));
+    CHECK(cuMemcpyDtoHAsync(zs, d_zs, bytes, s2));
+    CHECK(cuStreamSynchronize(s2));
+    CHECK(cuEventElapsedTime(&ms, start, stop));
+
+    for (i = 0; i < N; ++i)
+        if (zs[i] != 3.0f * i)
+            ++bad;
+
+    printf("vector add: %d launches in %.3f ms, %d errors\n", LAUNCHES, ms, bad);
+    if (bad)
+        exit(1);
+
+    CHECK(cuEventDestroy(start));
+    CHECK(cuEventDestroy(stop));
+    CHECK(cuStreamDestroy(s1));
+    CHECK(cuStreamDestroy(s2));
+    CHECK(cuMemFree(d_xs));
+    CHECK(cuMemFree(d_ys));
+    CHECK(cuMemFree(d_zs));
+    CHECK(cuMemFreeHost(xs));
+    CHECK(cuMemFreeHost(ys));
+    CHECK(cuMemFreeHost(zs));
+}
+
+static void test_copy_2d(void)
+{
+    unsigned char  src[ROWS * PITCH], dst[ROWS * WIDTH];
+    CUdeviceptr    d;
+    CUDA_MEMCPY2D  desc = { 0 };
+    int            r, c, bad = 0;
+
+    for (r = 0; r < ROWS * PITCH; ++r)
+        src[r] = (unsigned char) r;
+
+    CHECK(cuMemAlloc(&d, ROWS * PITCH));
+
+    desc.srcMemoryType  = CU_MEMORYTYPE_HOST;
+    desc.srcHost        = src;
+    desc.srcPitch       = PITCH;
+    desc.dstMemoryType  = CU_MEMORYTYPE_DEVICE;
+    desc.dstDevice      = d;
+    desc.dstPitch       = PITCH;
+    desc.WidthInBytes   = WIDTH;
+    desc.Height         = ROWS;
+    CHECK(cuMemcpy2D(&desc));
+
+    desc.srcMemoryType  = CU_MEMORYTYPE_DEVICE;
+    desc.srcDevice      = d;
+    desc.dstMemoryType  = CU_MEMORYTYPE_HOST;
+    desc.dstHost        = dst;
+    desc.dstPitch       = WIDTH;
+    CHECK(cuMemcpy2DAsync(&desc, NULL));
+    CHECK(cuCtxSynchronize());
+
+    for (r = 0; r < ROWS; ++r)
+        for (c = 0; c < WIDTH; ++c)
+            if (dst[r * WIDTH + c] != src[r * PITCH + c])
+                ++bad;
+
+    printf("2D copy: %d errors\n", bad);
+    if (bad)
+        exit(1);
+
+    CHECK(cuMemFree(d));
+}
+
+/*
+ * Destroying a context must wait for the work queued on its streams,
+ * including the NULL stream, which is freed along with the context
+ */
+static void test_context_destroy(CUdevice dev, const char *path)
+{
+    CUcontext    ctx;
+    CUmodule     mdl;
+    CUfunction   fn;
+    CUstream     s;
+    CUdeviceptr  d_xs, d_zs;
+    size_t       bytes = SMALL_N * sizeof(float);
+    int          n = SMALL_N, i;
+    void        *args[4];
+
+    for (i = 0; i < CONTEXTS; ++i) {
+        CHECK(cuCtxCreate(&ctx, 0, dev));
+        CHECK(cuModuleLoad(&mdl, path));
+        CHECK(cuModuleGetFunction(&fn, mdl, "vector_add"));
+        CHECK(cuStreamCreate(&s, CU_STREAM_NON_BLOCKING));
+        CHECK(cuMemAlloc(&d_xs, bytes));
+        CHECK(cuMemAlloc(&d_zs, bytes));
+
+        CHECK(cuMemsetD32Async(d_xs, 0, SMALL_N, s));
+        CHECK(cuStreamSynchronize(s));
+
+        args[0] = &d_xs;
+        args[1] = &d_xs;
+        args[2] = &d_zs;
+        args[3] = &n;
+        CHECK(cuLaunchKernel(fn, (SMALL_N + BLOCK - 1) / BLOCK, 1, 1, BLOCK, 1, 1, 0, NULL, args, NULL));
+        CHECK(cuMemsetD32Async(d_xs, 0, SMALL_N, s));
+        CHECK(cuCtxDestroy(ctx));
+
+        CHECK(cuModuleUnload(mdl));
+        CHECK(cuMemFree(d_xs));
+        CHECK(cuMemFree(d_zs));
+    }
+    printf("context destroy: %d contexts\n", CONTEXTS);
+}
+
+int main(int argc, char **argv)
+{
+    CUdevice   dev;
+    CUcontext  ctx;
+    CUmodule   mdl;
+    CUfunction fn;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s kernels.so\n", argv[0]);
+        return 1;
+    }
+
+    CHECK(cuInit(0));
+    CHECK(cuDeviceGet(&dev, 0));
+    CHECK(cuCtxCreate(&ctx, 0, dev));
+    CHECK(cuModuleLoad(&mdl, argv[1]));
+    CHECK(cuModuleGetFunction(&fn, mdl, "vector_add"));
+
+    test_vector_add(fn);
+    test_copy_2d();
+
+    CHECK(cuModuleUnload(mdl));
+    CHECK(cuCtxDestroy(ctx));
+
+    test_context_destroy(dev, argv[1]);
+    return 0;
+}